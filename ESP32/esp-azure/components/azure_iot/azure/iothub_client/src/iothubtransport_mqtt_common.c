@@ -108,6 +108,23 @@ typedef struct SYSTEM_PROPERTY_INFO_TAG
     size_t propLength;
 } SYSTEM_PROPERTY_INFO;
 
+// encoded property sets kept per transport (see lookupPropertyCache)
+#define PROPERTY_CACHE_SIZE                     4
+
+// The user properties, content type and content encoding of a message as
+// they go into the telemetry topic, keyed by their raw values
+typedef struct PROPERTY_CACHE_ENTRY_TAG
+{
+    char* key;                  // see writePropertyKey; NULL if the entry is unused
+    size_t key_length;
+    uint32_t key_hash;
+    STRING_HANDLE encoded;      // the user properties, then the content type and encoding
+    size_t user_length;         // of the user properties in encoded
+    size_t user_count;
+    size_t system_count;        // 0 to 2
+    uint32_t last_used;
+} PROPERTY_CACHE_ENTRY;
+
 static SYSTEM_PROPERTY_INFO sysPropList[] = {
     { "%24.exp", 7 },
     { "%24.mid", 7 },
@@ -216,6 +233,12 @@ typedef struct MQTTTRANSPORT_HANDLE_DATA_TAG
     // Telemetry specific
     DLIST_ENTRY telemetry_waitingForAck;
     bool auto_url_encode_decode;
+    PROPERTY_CACHE_ENTRY property_cache[PROPERTY_CACHE_SIZE];
+    uint32_t property_cache_clock;
+    char* property_key;         // of the message being sent
+    size_t property_key_size;
+    char* topic_buffer;         // the topic of the message being sent
+    size_t topic_buffer_size;
 
     // Controls frequency of reconnection logic.
     RETRY_CONTROL_HANDLE retry_control_handle;
@@ -309,6 +332,14 @@ static void free_transport_handle_data(MQTTTRANSPORT_HANDLE_DATA* transport_data
 
     free_proxy_data(transport_data);
 
+    for (size_t index = 0; index < PROPERTY_CACHE_SIZE; index++)
+    {
+        free(transport_data->property_cache[index].key);
+        STRING_delete(transport_data->property_cache[index].encoded);
+    }
+    free(transport_data->property_key);
+    free(transport_data->topic_buffer);
+
     STRING_delete(transport_data->devicesAndModulesPath);
     STRING_delete(transport_data->topic_MqttEvent);
     STRING_delete(transport_data->topic_MqttMessage);
@@ -666,53 +697,6 @@ static int addSystemPropertyToTopicString(STRING_HANDLE topic_string, size_t ind
     return result;
 }
 
-static int addSystemPropertiesTouMqttMessage(IOTHUB_MESSAGE_HANDLE iothub_message_handle, STRING_HANDLE topic_string, size_t* index_ptr, bool urlencode)
-{
-    (void)urlencode;
-    int result = 0;
-    size_t index = *index_ptr;
-
-    /* Codes_SRS_IOTHUB_TRANSPORT_MQTT_COMMON_07_052: [ IoTHubTransport_MQTT_Common_DoWork shall check for the CorrelationId property and if found add the value as a system property in the format of $.cid=<id> ] */
-    const char* correlation_id = IoTHubMessage_GetCorrelationId(iothub_message_handle);
-    if (correlation_id != NULL)
-    {
-        result = addSystemPropertyToTopicString(topic_string, index, CORRELATION_ID_PROPERTY, correlation_id, urlencode);
-        index++;
-    }
-    /* Codes_SRS_IOTHUB_TRANSPORT_MQTT_COMMON_07_053: [ IoTHubTransport_MQTT_Common_DoWork shall check for the MessageId property and if found add the value as a system property in the format of $.mid=<id> ] */
-    if (result == 0)
-    {
-        const char* msg_id = IoTHubMessage_GetMessageId(iothub_message_handle);
-        if (msg_id != NULL)
-        {
-            result = addSystemPropertyToTopicString(topic_string, index, MESSAGE_ID_PROPERTY, msg_id, urlencode);
-            index++;
-        }
-    }
-    // Codes_SRS_IOTHUB_TRANSPORT_MQTT_COMMON_09_010: [ `IoTHubTransport_MQTT_Common_DoWork` shall check for the ContentType property and if found add the `value` as a system property in the format of `$.ct=<value>` ]
-    if (result == 0)
-    {
-        const char* content_type = IoTHubMessage_GetContentTypeSystemProperty(iothub_message_handle);
-        if (content_type != NULL)
-        {
-            result = addSystemPropertyToTopicString(topic_string, index, CONTENT_TYPE_PROPERTY, content_type, urlencode);
-            index++;
-        }
-    }
-    // Codes_SRS_IOTHUB_TRANSPORT_MQTT_COMMON_09_011: [ `IoTHubTransport_MQTT_Common_DoWork` shall check for the ContentEncoding property and if found add the `value` as a system property in the format of `$.ce=<value>` ]
-    if (result == 0)
-    {
-        const char* content_encoding = IoTHubMessage_GetContentEncodingSystemProperty(iothub_message_handle);
-        if (content_encoding != NULL)
-        {
-            result = addSystemPropertyToTopicString(topic_string, index, CONTENT_ENCODING_PROPERTY, content_encoding, urlencode);
-            index++;
-        }
-    }
-    *index_ptr = index;
-    return result;
-}
-
 static int addDiagnosticPropertiesTouMqttMessage(IOTHUB_MESSAGE_HANDLE iothub_message_handle, STRING_HANDLE topic_string, size_t* index_ptr)
 {
     int result = 0;
@@ -781,13 +765,117 @@ static int addDiagnosticPropertiesTouMqttMessage(IOTHUB_MESSAGE_HANDLE iothub_me
 }
 
 
-static STRING_HANDLE addPropertiesTouMqttMessage(IOTHUB_MESSAGE_HANDLE iothub_message_handle, const char* eventTopic, bool urlencode)
+static int reserveBuffer(char** buffer, size_t* buffer_size, size_t needed)
+{
+    int result;
+    if (needed <= *buffer_size)
+    {
+        result = 0;
+    }
+    else
+    {
+        char* grown = (char*)realloc(*buffer, needed);
+        if (grown == NULL)
+        {
+            LogError("Failed growing buffer to %zu bytes", needed);
+            result = __FAILURE__;
+        }
+        else
+        {
+            *buffer = grown;
+            *buffer_size = needed;
+            result = 0;
+        }
+    }
+    return result;
+}
+
+static size_t writeKeyString(char* iterator, const char* value)
+{
+    // NULL and "" differ: a marker byte, then the string and its terminator
+    size_t length = 1;
+    if (value != NULL)
+    {
+        length += strlen(value) + 1;
+    }
+    if (iterator != NULL)
+    {
+        *iterator = (value != NULL) ? 1 : 0;
+        if (value != NULL)
+        {
+            (void)memcpy(iterator + 1, value, length - 1);
+        }
+    }
+    return length;
+}
+
+// The raw values the encoded property set depends on, into transport_data->property_key.
+// A first pass with iterator == NULL measures, the second one writes.
+static size_t writePropertyKey(char* iterator, bool urlencode, const char* const* propertyKeys, const char* const* propertyValues, size_t propertyCount, const char* content_type, const char* content_encoding)
+{
+    size_t length = 1 + sizeof(size_t);
+    if (iterator != NULL)
+    {
+        iterator[0] = urlencode ? 1 : 0;
+        (void)memcpy(iterator + 1, &propertyCount, sizeof(size_t));
+    }
+    for (size_t index = 0; index < propertyCount; index++)
+    {
+        length += writeKeyString(iterator == NULL ? NULL : iterator + length, propertyKeys[index]);
+        length += writeKeyString(iterator == NULL ? NULL : iterator + length, propertyValues[index]);
+    }
+    length += writeKeyString(iterator == NULL ? NULL : iterator + length, content_type);
+    length += writeKeyString(iterator == NULL ? NULL : iterator + length, content_encoding);
+    return length;
+}
+
+static int buildPropertyKey(PMQTTTRANSPORT_HANDLE_DATA transport_data, IOTHUB_MESSAGE_HANDLE iothub_message_handle, size_t* key_length, uint32_t* key_hash)
+{
+    int result;
+    const char* const* propertyKeys = NULL;
+    const char* const* propertyValues = NULL;
+    size_t propertyCount = 0;
+    MAP_HANDLE properties_map = IoTHubMessage_Properties(iothub_message_handle);
+    const char* content_type = IoTHubMessage_GetContentTypeSystemProperty(iothub_message_handle);
+    const char* content_encoding = IoTHubMessage_GetContentEncodingSystemProperty(iothub_message_handle);
+
+    if (properties_map != NULL && Map_GetInternals(properties_map, &propertyKeys, &propertyValues, &propertyCount) != MAP_OK)
+    {
+        LogError("Failed to get the internals of the property map.");
+        result = __FAILURE__;
+    }
+    else
+    {
+        size_t length = writePropertyKey(NULL, transport_data->auto_url_encode_decode, propertyKeys, propertyValues, propertyCount, content_type, content_encoding);
+        if (reserveBuffer(&transport_data->property_key, &transport_data->property_key_size, length) != 0)
+        {
+            result = __FAILURE__;
+        }
+        else
+        {
+            (void)writePropertyKey(transport_data->property_key, transport_data->auto_url_encode_decode, propertyKeys, propertyValues, propertyCount, content_type, content_encoding);
+
+            // FNV-1a
+            uint32_t hash = 2166136261u;
+            for (size_t index = 0; index < length; index++)
+            {
+                hash = (hash ^ (uint8_t)transport_data->property_key[index]) * 16777619u;
+            }
+            *key_length = length;
+            *key_hash = hash;
+            result = 0;
+        }
+    }
+    return result;
+}
+
+static STRING_HANDLE encodePropertySet(IOTHUB_MESSAGE_HANDLE iothub_message_handle, bool urlencode, size_t* user_length, size_t* user_count, size_t* system_count)
 {
     size_t index = 0;
-    STRING_HANDLE result = STRING_construct(eventTopic);
+    STRING_HANDLE result = STRING_new();
     if (result == NULL)
     {
-        LogError("Failed to create event topic string handle");
+        LogError("Failed to create property string handle");
     }
     else if (addUserPropertiesTouMqttMessage(iothub_message_handle, result, &index, urlencode) != 0)
     {
@@ -795,42 +883,221 @@ static STRING_HANDLE addPropertiesTouMqttMessage(IOTHUB_MESSAGE_HANDLE iothub_me
         STRING_delete(result);
         result = NULL;
     }
-    else if (addSystemPropertiesTouMqttMessage(iothub_message_handle, result, &index, urlencode) != 0)
+    else
     {
-        LogError("Failed adding System Properties to uMQTT Message");
-        STRING_delete(result);
-        result = NULL;
+        *user_length = STRING_length(result);
+        *user_count = index;
+
+        // the separator in front of these is added with the topic; cid and mid can come in between
+        size_t system_index = 0;
+        const char* content_type = IoTHubMessage_GetContentTypeSystemProperty(iothub_message_handle);
+        const char* content_encoding = IoTHubMessage_GetContentEncodingSystemProperty(iothub_message_handle);
+        // Codes_SRS_IOTHUB_TRANSPORT_MQTT_COMMON_09_010: [ `IoTHubTransport_MQTT_Common_DoWork` shall check for the ContentType property and if found add the `value` as a system property in the format of `$.ct=<value>` ]
+        if (content_type != NULL)
+        {
+            if (addSystemPropertyToTopicString(result, system_index, CONTENT_TYPE_PROPERTY, content_type, urlencode) != 0)
+            {
+                STRING_delete(result);
+                result = NULL;
+            }
+            system_index++;
+        }
+        // Codes_SRS_IOTHUB_TRANSPORT_MQTT_COMMON_09_011: [ `IoTHubTransport_MQTT_Common_DoWork` shall check for the ContentEncoding property and if found add the `value` as a system property in the format of `$.ce=<value>` ]
+        if (result != NULL && content_encoding != NULL)
+        {
+            if (addSystemPropertyToTopicString(result, system_index, CONTENT_ENCODING_PROPERTY, content_encoding, urlencode) != 0)
+            {
+                STRING_delete(result);
+                result = NULL;
+            }
+            system_index++;
+        }
+        *system_count = system_index;
     }
-    else if (addDiagnosticPropertiesTouMqttMessage(iothub_message_handle, result, &index) != 0)
+    return result;
+}
+
+// The encoded property set of the message; encoded once per distinct set and
+// kept in a small LRU, so steady-state telemetry doesn't encode anything
+static PROPERTY_CACHE_ENTRY* lookupPropertyCache(PMQTTTRANSPORT_HANDLE_DATA transport_data, IOTHUB_MESSAGE_HANDLE iothub_message_handle)
+{
+    PROPERTY_CACHE_ENTRY* result = NULL;
+    size_t key_length;
+    uint32_t key_hash;
+
+    if (buildPropertyKey(transport_data, iothub_message_handle, &key_length, &key_hash) == 0)
     {
-        LogError("Failed adding Diagnostic Properties to uMQTT Message");
-        STRING_delete(result);
-        result = NULL;
+        PROPERTY_CACHE_ENTRY* victim = &transport_data->property_cache[0];
+        for (size_t index = 0; index < PROPERTY_CACHE_SIZE; index++)
+        {
+            PROPERTY_CACHE_ENTRY* entry = &transport_data->property_cache[index];
+            if (entry->key != NULL && entry->key_hash == key_hash && entry->key_length == key_length &&
+                memcmp(entry->key, transport_data->property_key, key_length) == 0)
+            {
+                result = entry;
+                break;
+            }
+            if (victim->key != NULL && (entry->key == NULL || entry->last_used < victim->last_used))
+            {
+                victim = entry;
+            }
+        }
+
+        if (result == NULL)
+        {
+            size_t user_length = 0;
+            size_t user_count = 0;
+            size_t system_count = 0;
+            STRING_HANDLE encoded = encodePropertySet(iothub_message_handle, transport_data->auto_url_encode_decode, &user_length, &user_count, &system_count);
+            char* key = (char*)malloc(key_length);
+            if (encoded == NULL || key == NULL)
+            {
+                LogError("Failed caching the message properties");
+                STRING_delete(encoded);
+                free(key);
+            }
+            else
+            {
+                (void)memcpy(key, transport_data->property_key, key_length);
+                free(victim->key);
+                STRING_delete(victim->encoded);
+                victim->key = key;
+                victim->key_length = key_length;
+                victim->key_hash = key_hash;
+                victim->encoded = encoded;
+                victim->user_length = user_length;
+                victim->user_count = user_count;
+                victim->system_count = system_count;
+                result = victim;
+            }
+        }
+
+        if (result != NULL)
+        {
+            result->last_used = ++transport_data->property_cache_clock;
+        }
     }
+    return result;
+}
 
-    // Codes_SRS_IOTHUB_TRANSPORT_MQTT_COMMON_31_060: [ `IoTHubTransport_MQTT_Common_DoWork` shall check for the OutputName property and if found add the alue as a system property in the format of $.on=<value> ]
-    if (result != NULL)
+// The telemetry topic of the message, in transport_data->topic_buffer (valid
+// until the next call). In order: the user properties, $.cid, $.mid, $.ct,
+// $.ce, the diagnostic properties and $.on
+static const char* addPropertiesTouMqttMessage(PMQTTTRANSPORT_HANDLE_DATA transport_data, IOTHUB_MESSAGE_HANDLE iothub_message_handle)
+{
+    const char* result = NULL;
+    bool urlencode = transport_data->auto_url_encode_decode;
+    PROPERTY_CACHE_ENTRY* properties = lookupPropertyCache(transport_data, iothub_message_handle);
+    if (properties == NULL)
+    {
+        LogError("Failed adding Properties to uMQTT Message");
+    }
+    else
     {
+        int failed = 0;
+        size_t index = properties->user_count;
+        // the parts that change from message to message; built only if there are any
+        STRING_HANDLE ids = NULL;
+        STRING_HANDLE tail = NULL;
+
+        /* Codes_SRS_IOTHUB_TRANSPORT_MQTT_COMMON_07_052: [ IoTHubTransport_MQTT_Common_DoWork shall check for the CorrelationId property and if found add the value as a system property in the format of $.cid=<id> ] */
+        const char* correlation_id = IoTHubMessage_GetCorrelationId(iothub_message_handle);
+        /* Codes_SRS_IOTHUB_TRANSPORT_MQTT_COMMON_07_053: [ IoTHubTransport_MQTT_Common_DoWork shall check for the MessageId property and if found add the value as a system property in the format of $.mid=<id> ] */
+        const char* msg_id = IoTHubMessage_GetMessageId(iothub_message_handle);
+        if (correlation_id != NULL || msg_id != NULL)
+        {
+            if ((ids = STRING_new()) == NULL)
+            {
+                failed = __FAILURE__;
+            }
+            else
+            {
+                if (correlation_id != NULL)
+                {
+                    failed = addSystemPropertyToTopicString(ids, index, CORRELATION_ID_PROPERTY, correlation_id, urlencode);
+                    index++;
+                }
+                if (failed == 0 && msg_id != NULL)
+                {
+                    failed = addSystemPropertyToTopicString(ids, index, MESSAGE_ID_PROPERTY, msg_id, urlencode);
+                    index++;
+                }
+            }
+        }
+        if (failed != 0)
+        {
+            LogError("Failed adding System Properties to uMQTT Message");
+        }
+
+        bool system_separator = properties->system_count > 0 && index > 0;
+        index += properties->system_count;
+
+        // Codes_SRS_IOTHUB_TRANSPORT_MQTT_COMMON_31_060: [ `IoTHubTransport_MQTT_Common_DoWork` shall check for the OutputName property and if found add the alue as a system property in the format of $.on=<value> ]
         const char* output_name = IoTHubMessage_GetOutputName(iothub_message_handle);
-        if (output_name != NULL)
+        if (failed == 0 && (IoTHubMessage_GetDiagnosticPropertyData(iothub_message_handle) != NULL || output_name != NULL))
         {
-            if (STRING_sprintf(result, "%s%%24.on=%s/", index == 0 ? "" : PROPERTY_SEPARATOR, output_name) != 0)
+            if ((tail = STRING_new()) == NULL)
+            {
+                failed = __FAILURE__;
+            }
+            else if (addDiagnosticPropertiesTouMqttMessage(iothub_message_handle, tail, &index) != 0)
+            {
+                LogError("Failed adding Diagnostic Properties to uMQTT Message");
+                failed = __FAILURE__;
+            }
+            else if (output_name != NULL && STRING_sprintf(tail, "%s%%24.on=%s/", index == 0 ? "" : PROPERTY_SEPARATOR, output_name) != 0)
             {
                 LogError("Failed setting output name.");
-                STRING_delete(result);
-                result = NULL;
+                failed = __FAILURE__;
             }
-            index++;
         }
-    }
 
+        if (failed == 0)
+        {
+            const char* event_topic = STRING_c_str(transport_data->topic_MqttEvent);
+            const char* encoded = STRING_c_str(properties->encoded);
+            size_t topic_length = strlen(event_topic);
+            size_t ids_length = ids == NULL ? 0 : STRING_length(ids);
+            size_t system_length = STRING_length(properties->encoded) - properties->user_length;
+            size_t separator_length = system_separator ? strlen(PROPERTY_SEPARATOR) : 0;
+            size_t tail_length = tail == NULL ? 0 : STRING_length(tail);
+            size_t length = topic_length + properties->user_length + ids_length + separator_length + system_length + tail_length;
+
+            if (reserveBuffer(&transport_data->topic_buffer, &transport_data->topic_buffer_size, length + 1) == 0)
+            {
+                char* iterator = transport_data->topic_buffer;
+                (void)memcpy(iterator, event_topic, topic_length);
+                iterator += topic_length;
+                (void)memcpy(iterator, encoded, properties->user_length);
+                iterator += properties->user_length;
+                if (ids_length > 0)
+                {
+                    (void)memcpy(iterator, STRING_c_str(ids), ids_length);
+                    iterator += ids_length;
+                }
+                (void)memcpy(iterator, PROPERTY_SEPARATOR, separator_length);
+                iterator += separator_length;
+                (void)memcpy(iterator, encoded + properties->user_length, system_length);
+                iterator += system_length;
+                if (tail_length > 0)
+                {
+                    (void)memcpy(iterator, STRING_c_str(tail), tail_length);
+                    iterator += tail_length;
+                }
+                *iterator = '\0';
+                result = transport_data->topic_buffer;
+            }
+        }
+        STRING_delete(ids);
+        STRING_delete(tail);
+    }
     return result;
 }
 
 static int publish_mqtt_telemetry_msg(PMQTTTRANSPORT_HANDLE_DATA transport_data, MQTT_MESSAGE_DETAILS_LIST* mqttMsgEntry, const unsigned char* payload, size_t len)
 {
     int result;
-    STRING_HANDLE msgTopic = addPropertiesTouMqttMessage(mqttMsgEntry->iotHubMessageEntry->messageHandle, STRING_c_str(transport_data->topic_MqttEvent), transport_data->auto_url_encode_decode);
+    const char* msgTopic = addPropertiesTouMqttMessage(transport_data, mqttMsgEntry->iotHubMessageEntry->messageHandle);
     if (msgTopic == NULL)
     {
         LogError("Failed adding properties to mqtt message");
@@ -838,7 +1105,7 @@ static int publish_mqtt_telemetry_msg(PMQTTTRANSPORT_HANDLE_DATA transport_data,
     }
     else
     {
-        MQTT_MESSAGE_HANDLE mqttMsg = mqttmessage_create_in_place(mqttMsgEntry->packet_id, STRING_c_str(msgTopic), DELIVER_AT_LEAST_ONCE, payload, len);
+        MQTT_MESSAGE_HANDLE mqttMsg = mqttmessage_create_in_place(mqttMsgEntry->packet_id, msgTopic, DELIVER_AT_LEAST_ONCE, payload, len);
         if (mqttMsg == NULL)
         {
             LogError("Failed creating mqtt message");
@@ -866,7 +1133,6 @@ static int publish_mqtt_telemetry_msg(PMQTTTRANSPORT_HANDLE_DATA transport_data,
             }
             mqttmessage_destroy(mqttMsg);
         }
-        STRING_delete(msgTopic);
     }
     return result;
 }
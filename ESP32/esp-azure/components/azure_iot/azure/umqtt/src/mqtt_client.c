@@ -26,6 +26,11 @@
 #define TIME_MAX_BUFFER                 16
 #define DEFAULT_MAX_PING_RESPONSE_TIME  80  // % of time to send pings
 #define MAX_CLOSE_RETRIES               2
+// a publish payload at least this long is sent after its header instead of
+// being copied into the packet
+#ifndef PUBLISH_GATHER_SIZE
+#define PUBLISH_GATHER_SIZE             256
+#endif
 
 static const char* const TRUE_CONST = "true";
 static const char* const FALSE_CONST = "false";
@@ -381,6 +386,50 @@ static int sendPacketItem(MQTT_CLIENT* mqtt_client, const unsigned char* data, s
     return result;
 }
 
+static void sendHeaderComplete(void* context, IO_SEND_RESULT send_result)
+{
+    (void)context;
+    // the payload that follows fails too and reports it (sendComplete)
+    if (send_result == IO_SEND_ERROR)
+    {
+        LogError("MQTT Send Complete Failure of a publish header");
+    }
+}
+
+// The header and the payload of a PUBLISH as two sends; the payload isn't
+// copied into a packet buffer first
+static int sendPublishItems(MQTT_CLIENT* mqtt_client, BUFFER_HANDLE header, const uint8_t* payload, size_t length)
+{
+    int result;
+
+    if (tickcounter_get_current_ms(mqtt_client->packetTickCntr, &mqtt_client->packetSendTimeMs) != 0)
+    {
+        LogError("Failure getting current ms tickcounter");
+        result = __FAILURE__;
+    }
+    else if (xio_send(mqtt_client->xioHandle, (const void*)BUFFER_u_char(header), BUFFER_length(header), sendHeaderComplete, mqtt_client) != 0)
+    {
+        LogError("Failure sending publish header");
+        result = __FAILURE__;
+    }
+    else if (xio_send(mqtt_client->xioHandle, (const void*)payload, length, sendComplete, mqtt_client) != 0)
+    {
+        // the header is out; the stream is broken
+        LogError("Failure sending publish payload");
+        set_error_callback(mqtt_client, MQTT_CLIENT_COMMUNICATION_ERROR);
+        result = __FAILURE__;
+    }
+    else
+    {
+#ifdef ENABLE_RAW_TRACE
+        logOutgoingRawTrace(mqtt_client, (const uint8_t*)BUFFER_u_char(header), BUFFER_length(header));
+        logOutgoingRawTrace(mqtt_client, payload, length);
+#endif
+        result = 0;
+    }
+    return result;
+}
+
 static void onOpenComplete(void* context, IO_OPEN_RESULT open_result)
 {
     MQTT_CLIENT* mqtt_client = (MQTT_CLIENT*)context;
@@ -1040,7 +1089,10 @@ int mqtt_client_publish(MQTT_CLIENT_HANDLE handle, MQTT_MESSAGE_HANDLE msgHandle
             bool isRetained = mqttmessage_getIsRetained(msgHandle);
             uint16_t packetId = mqttmessage_getPacketId(msgHandle);
             const char* topicName = mqttmessage_getTopicName(msgHandle);
-            BUFFER_HANDLE publishPacket = mqtt_codec_publish(qos, isDuplicate, isRetained, packetId, topicName, payload->message, payload->length, trace_log);
+            bool gather = payload->length >= PUBLISH_GATHER_SIZE;
+            BUFFER_HANDLE publishPacket = gather ?
+                mqtt_codec_publish_header(qos, isDuplicate, isRetained, packetId, topicName, payload->length, trace_log) :
+                mqtt_codec_publish(qos, isDuplicate, isRetained, packetId, topicName, payload->message, payload->length, trace_log);
             if (publishPacket == NULL)
             {
                 /*Codes_SRS_MQTT_CLIENT_07_020: [If any failure is encountered then mqtt_client_unsubscribe shall return a non-zero value.]*/
@@ -1053,7 +1105,8 @@ int mqtt_client_publish(MQTT_CLIENT_HANDLE handle, MQTT_MESSAGE_HANDLE msgHandle
 
                 /*Codes_SRS_MQTT_CLIENT_07_022: [On success mqtt_client_publish shall send the MQTT SUBCRIBE packet to the endpoint.]*/
                 size_t size = BUFFER_length(publishPacket);
-                if (sendPacketItem(mqtt_client, BUFFER_u_char(publishPacket), size) != 0)
+                if ((gather ? sendPublishItems(mqtt_client, publishPacket, payload->message, payload->length) :
+                    sendPacketItem(mqtt_client, BUFFER_u_char(publishPacket), size)) != 0)
                 {
                     /*Codes_SRS_MQTT_CLIENT_07_020: [If any failure is encountered then mqtt_client_unsubscribe shall return a non-zero value.]*/
                     LogError("Error: mqtt_client_publish send failed");
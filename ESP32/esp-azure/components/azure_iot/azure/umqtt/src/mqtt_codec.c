@@ -343,7 +343,8 @@ static BUFFER_HANDLE constructPublishReply(CONTROL_PACKET_TYPE type, uint8_t fla
     return result;
 }
 
-static int constructFixedHeader(BUFFER_HANDLE ctrlPacket, CONTROL_PACKET_TYPE packetType, uint8_t flags)
+// payloadLen: bytes that follow ctrlPacket on the wire but aren't in it
+static int constructFixedHeaderWithPayload(BUFFER_HANDLE ctrlPacket, CONTROL_PACKET_TYPE packetType, uint8_t flags, size_t payloadLen)
 {
     int result;
     if (ctrlPacket == NULL)
@@ -352,7 +353,7 @@ static int constructFixedHeader(BUFFER_HANDLE ctrlPacket, CONTROL_PACKET_TYPE pa
     }
     else
     {
-        size_t packetLen = BUFFER_length(ctrlPacket);
+        size_t packetLen = BUFFER_length(ctrlPacket) + payloadLen;
         uint8_t remainSize[4] ={ 0 };
         size_t index = 0;
 
@@ -393,6 +394,11 @@ static int constructFixedHeader(BUFFER_HANDLE ctrlPacket, CONTROL_PACKET_TYPE pa
     return result;
 }
 
+static int constructFixedHeader(BUFFER_HANDLE ctrlPacket, CONTROL_PACKET_TYPE packetType, uint8_t flags)
+{
+    return constructFixedHeaderWithPayload(ctrlPacket, packetType, flags, 0);
+}
+
 static int constructConnPayload(BUFFER_HANDLE ctrlPacket, const MQTT_CLIENT_OPTIONS* mqttOptions, STRING_HANDLE trace_log)
 {
     int result = 0;
@@ -738,7 +744,8 @@ BUFFER_HANDLE mqtt_codec_disconnect()
     return result;
 }
 
-BUFFER_HANDLE mqtt_codec_publish(QOS_VALUE qosValue, bool duplicateMsg, bool serverRetain, uint16_t packetId, const char* topicName, const uint8_t* msgBuffer, size_t buffLen, STRING_HANDLE trace_log)
+// headerOnly: leaves out the payload (buffLen bytes that are sent after the packet)
+static BUFFER_HANDLE constructPublishPacket(QOS_VALUE qosValue, bool duplicateMsg, bool serverRetain, uint16_t packetId, const char* topicName, const uint8_t* msgBuffer, size_t buffLen, bool headerOnly, STRING_HANDLE trace_log)
 {
     BUFFER_HANDLE result;
     /* Codes_SRS_MQTT_CODEC_07_005: [If the parameters topicName is NULL then mqtt_codec_publish shall return NULL.] */
@@ -795,7 +802,14 @@ BUFFER_HANDLE mqtt_codec_publish(QOS_VALUE qosValue, bool duplicateMsg, bool ser
             else
             {
                 size_t payloadOffset = BUFFER_length(result);
-                if (buffLen > 0)
+                if (headerOnly)
+                {
+                    if (trace_log)
+                    {
+                        STRING_sprintf(varible_header_log, " | PAYLOAD_LEN: %zu", buffLen);
+                    }
+                }
+                else if (buffLen > 0)
                 {
                     if (BUFFER_enlarge(result, buffLen) != 0)
                     {
@@ -831,7 +845,7 @@ BUFFER_HANDLE mqtt_codec_publish(QOS_VALUE qosValue, bool duplicateMsg, bool ser
                     {
                         (void)STRING_copy(trace_log, "PUBLISH");
                     }
-                    if (constructFixedHeader(result, PUBLISH_TYPE, headerFlags) != 0)
+                    if (constructFixedHeaderWithPayload(result, PUBLISH_TYPE, headerFlags, headerOnly ? buffLen : 0) != 0)
                     {
                         /* Codes_SRS_MQTT_CODEC_07_006: [If any error is encountered then mqtt_codec_publish shall return NULL.] */
                         BUFFER_delete(result);
@@ -855,6 +869,16 @@ BUFFER_HANDLE mqtt_codec_publish(QOS_VALUE qosValue, bool duplicateMsg, bool ser
     return result;
 }
 
+BUFFER_HANDLE mqtt_codec_publish(QOS_VALUE qosValue, bool duplicateMsg, bool serverRetain, uint16_t packetId, const char* topicName, const uint8_t* msgBuffer, size_t buffLen, STRING_HANDLE trace_log)
+{
+    return constructPublishPacket(qosValue, duplicateMsg, serverRetain, packetId, topicName, msgBuffer, buffLen, false, trace_log);
+}
+
+BUFFER_HANDLE mqtt_codec_publish_header(QOS_VALUE qosValue, bool duplicateMsg, bool serverRetain, uint16_t packetId, const char* topicName, size_t buffLen, STRING_HANDLE trace_log)
+{
+    return constructPublishPacket(qosValue, duplicateMsg, serverRetain, packetId, topicName, NULL, buffLen, true, trace_log);
+}
+
 BUFFER_HANDLE mqtt_codec_publishAck(uint16_t packetId)
 {
     /* Codes_SRS_MQTT_CODEC_07_013: [On success mqtt_codec_publishAck shall return a BUFFER_HANDLE representation of a MQTT PUBACK packet.] */
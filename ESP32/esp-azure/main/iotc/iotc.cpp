@@ -6,6 +6,7 @@
 #include <limits.h>
 #include <stdint.h>
 #include <assert.h>
+#include <time.h>
 #include "iotc.h"
 #include "json.h"
 
@@ -62,11 +63,18 @@ typedef struct CallbackBase_TAG {
   CallbackBase_TAG() { callback = NULL; appContext = NULL; }
 } CallbackBase;
 
+#define TIMESTAMP_SIZE 32
+
 typedef struct IOTContextInternal_TAG {
     IOTHUB_CLIENT_LL_HANDLE clientHandle;
     char *endpoint;
     IOTProtocol protocol;
     CallbackBase callbacks[8];
+    // the `timestamp` property of the telemetry, formatted once a second.
+    // messages sent within the same second carry the same properties, so they
+    // hit the transport's cache of encoded properties (iothubtransport_mqtt_common.c)
+    time_t timestampSecond;
+    char timestamp[TIMESTAMP_SIZE];
 } IOTContextInternal;
 IOTLogLevel gLogLevel = IOTC_LOGGING_DISABLED;
 
@@ -768,11 +776,13 @@ int iotc_send_telemetry(IOTContext ctx, const char* payload, unsigned length, vo
     MAP_HANDLE propMap = IoTHubMessage_Properties(currentMessage->messageHandle);
 
     time_t now_utc = time(NULL); // utc time
-    char timeBuffer[128] = {0};
-    unsigned outputLength = snprintf(timeBuffer, 128, "%s", ctime(&now_utc));
-    assert(outputLength && outputLength < 128 && timeBuffer[outputLength - 1] == '\n');
-    timeBuffer[outputLength - 1] = char(0); // replace `\n` with `\0`
-    if (Map_AddOrUpdate(propMap, "timestamp", timeBuffer) != MAP_OK)
+    if (now_utc != internal->timestampSecond || internal->timestamp[0] == char(0)) {
+        unsigned outputLength = snprintf(internal->timestamp, TIMESTAMP_SIZE, "%s", ctime(&now_utc));
+        assert(outputLength && outputLength < TIMESTAMP_SIZE && internal->timestamp[outputLength - 1] == '\n');
+        internal->timestamp[outputLength - 1] = char(0); // replace `\n` with `\0`
+        internal->timestampSecond = now_utc;
+    }
+    if (Map_AddOrUpdate(propMap, "timestamp", internal->timestamp) != MAP_OK)
     {
         IOTC_LOG("ERROR: (iotc_send_telemetry) Map_AddOrUpdate has failed. ERROR:0x000A");
         freeEventInstance(currentMessage);
@@ -13,6 +13,22 @@ PubSubClient::PubSubClient(const char* domain, uint16_t port, Client* client) {
     setServer(domain, port);
     setClient(client);
     this->stream = NULL;
+    this->ackCallback = NULL;
+    this->chunkCallback = NULL;
+    this->buffer = NULL;
+    this->bufferSize = 0;
+    setBufferSize(MQTT_MAX_PACKET_SIZE);
+    this->_inflightCount = 0;
+    this->_inflightWindow = MQTT_MAX_INFLIGHT;
+    this->_rxStart = this->_rxEnd = 0;
+    this->_topicLength = 0;
+}
+
+PubSubClient::~PubSubClient() {
+    for (uint8_t i = 0; i < _inflightCount; i++) {
+        free(_inflight[i].packet);
+    }
+    free(buffer);
 }
 
 boolean PubSubClient::connect(const char *id, const char *user, const char *pass) {
@@ -30,6 +46,7 @@ boolean PubSubClient::connect(const char *id, const char *user, const char *pass
         }
         if (result == 1) {
             nextMsgId = 1;
+            _rxStart = _rxEnd = 0;
             // Leave room in the buffer for header and variable length field
             uint16_t length = MQTT_MAX_HEADER_SIZE;
             unsigned int j;
@@ -120,8 +137,8 @@ boolean PubSubClient::connect(const char *id, const char *user, const char *pass
     return true;
 }
 
-// reads a byte into result
-boolean PubSubClient::readByte(uint8_t * result) {
+// waits for the network client to have data
+boolean PubSubClient::waitAvailable() {
    uint32_t previousMillis = millis();
    while(!_client->available()) {
      yield();
@@ -130,7 +147,20 @@ boolean PubSubClient::readByte(uint8_t * result) {
        return false;
      }
    }
-   *result = _client->read();
+   return true;
+}
+
+// reads a byte into result
+boolean PubSubClient::readByte(uint8_t * result) {
+   if (_rxStart == _rxEnd) {
+     // take whatever has arrived, one read call for up to MQTT_RX_BUFFER_SIZE
+     if (!waitAvailable()) return false;
+     int n = _client->read(_rx, MQTT_RX_BUFFER_SIZE);
+     if (n <= 0) return false;
+     _rxStart = 0;
+     _rxEnd = n;
+   }
+   *result = _rx[_rxStart++];
    return true;
 }
 
@@ -145,12 +175,39 @@ boolean PubSubClient::readByte(uint8_t * result, uint16_t * index){
   return false;
 }
 
+// reads exactly length bytes into result
+boolean PubSubClient::readBytes(uint8_t * result, uint16_t length) {
+    uint16_t n = _rxEnd - _rxStart;
+    if (n > length) n = length;
+    memcpy(result, _rx + _rxStart, n);
+    _rxStart += n;
+
+    while (n < length) {
+        if (length - n < MQTT_RX_BUFFER_SIZE) {
+            // a short tail; fill _rx, the next packet may come with it
+            if (!readByte(result + n)) return false;
+            uint16_t more = _rxEnd - _rxStart;
+            if (more > length - n - 1) more = length - n - 1;
+            memcpy(result + n + 1, _rx + _rxStart, more);
+            _rxStart += more;
+            n += 1 + more;
+        } else {
+            // never reads past this packet; straight into result
+            if (!waitAvailable()) return false;
+            int r = _client->read(result + n, length - n);
+            if (r <= 0) return false;
+            n += r;
+        }
+    }
+    return true;
+}
+
 uint16_t PubSubClient::readPacket(uint8_t* lengthLength) {
     uint16_t len = 0;
     if(!readByte(buffer, &len)) return 0;
     bool isPublish = (buffer[0]&0xF0) == MQTTPUBLISH;
     uint32_t multiplier = 1;
-    uint16_t length = 0;
+    uint32_t length = 0;
     uint8_t digit = 0;
     uint16_t skip = 0;
     uint8_t start = 0;
@@ -173,34 +230,106 @@ uint16_t PubSubClient::readPacket(uint8_t* lengthLength) {
         // Read in topic length to calculate bytes to skip over for Stream writing
         if(!readByte(buffer, &len)) return 0;
         if(!readByte(buffer, &len)) return 0;
-        skip = (buffer[*lengthLength+1]<<8)+buffer[*lengthLength+2];
+        _topicLength = (buffer[*lengthLength+1]<<8)+buffer[*lengthLength+2];
+        skip = _topicLength;
         start = 2;
         if (buffer[0]&MQTTQOS1) {
             // skip message id
             skip += 2;
         }
+        if (_topicLength + start > length || len + _topicLength > bufferSize) {
+            // the topic doesn't fit the packet (or the buffer)
+            _state = MQTT_DISCONNECTED;
+            _client->stop();
+            return 0;
+        }
+        // the topic goes over the low byte of its length, which leaves room
+        // for the \0 after it; no copy for the callback
+        if(!readBytes(buffer+len-1, _topicLength)) return 0;
+        buffer[len-1+_topicLength] = 0;
+        len += _topicLength;
+        start += _topicLength;
+
+        if (this->chunkCallback && length - start > (uint32_t)(bufferSize - len)) {
+            // doesn't fit; handed over a buffer at a time
+            if (!readChunks(len, *lengthLength, length - start)) return 0;
+            lastInActivity = millis();
+            return 0; // nothing left for loop()
+        }
     }
 
-    for (uint16_t i = start;i<length;i++) {
-        if(!readByte(&digit)) return 0;
-        if (this->stream) {
-            if (isPublish && len-*lengthLength-2>skip) {
-                this->stream->write(digit);
+    // the rest of the body, as far as it fits, goes straight into buffer
+    uint32_t remaining = length - start;
+    boolean overflow = false;
+    while (remaining > 0) {
+        uint8_t chunk[MQTT_RX_BUFFER_SIZE];
+        uint8_t *dst = len < bufferSize ? buffer + len : chunk;
+        uint16_t n = len < bufferSize ? bufferSize - len : MQTT_RX_BUFFER_SIZE;
+        if (n > remaining) n = remaining;
+        if(!readBytes(dst, n)) return 0;
+
+        if (this->stream && isPublish) {
+            // the payload follows the topic and the message id
+            uint32_t first = *lengthLength + 3 + skip;
+            uint16_t from = len < first ? first - len : 0;
+            if (from < n) {
+                this->stream->write(dst + from, n - from);
             }
         }
-        if (len < MQTT_MAX_PACKET_SIZE) {
-            buffer[len] = digit;
+        if (len < bufferSize) {
+            len += n;
+        } else {
+            overflow = true;
         }
-        len++;
+        remaining -= n;
     }
 
-    if (!this->stream && len > MQTT_MAX_PACKET_SIZE) {
+    if (overflow) {
         len = 0; // This will cause the packet to be ignored.
     }
 
     return len;
 }
 
+// Reads the rest of a PUBLISH that doesn't fit the buffer (the topic is in)
+// and hands its payload to the chunk callback, a buffer at a time
+boolean PubSubClient::readChunks(uint16_t len, uint8_t lengthLength, uint32_t remaining) {
+    char *topic = (char*) buffer + lengthLength + 2;
+    uint16_t msgId = 0;
+    boolean qos1 = (buffer[0] & 0x06) == MQTTQOS1;
+    // the message id and at least a byte of the payload go after the topic
+    // (which may fill the buffer); the packet is dropped otherwise
+    if ((uint16_t)(bufferSize - len) < (qos1 ? 3 : 1) || (qos1 && remaining < 2)) {
+        _state = MQTT_DISCONNECTED;
+        _client->stop();
+        return false;
+    }
+    if (qos1) {
+        if (!readBytes(buffer + len, 2)) return false;
+        msgId = (buffer[len] << 8) + buffer[len + 1];
+        len += 2;
+        remaining -= 2;
+    }
+
+    uint16_t room = bufferSize - len;
+    uint32_t total = remaining;
+    uint32_t offset = 0;
+    do {
+        uint16_t n = remaining > room ? room : remaining;
+        if (!readBytes(buffer + len, n)) return false;
+        chunkCallback(topic, buffer + len, n, offset, total);
+        offset += n;
+        remaining -= n;
+    } while (remaining > 0);
+
+    if (qos1) {
+        uint8_t ack[4] = { MQTTPUBACK, 2, (uint8_t)(msgId >> 8), (uint8_t)(msgId & 0xFF) };
+        _client->write(ack, 4);
+        lastOutActivity = millis();
+    }
+    return true;
+}
+
 boolean PubSubClient::loop() {
     if (connected()) {
         unsigned long t = millis();
@@ -218,7 +347,7 @@ boolean PubSubClient::loop() {
                 pingOutstanding = true;
             }
         }
-        if (_client->available()) {
+        if (_rxStart != _rxEnd || _client->available()) {
             uint8_t llen;
             uint16_t len = readPacket(&llen);
             uint16_t msgId = 0;
@@ -228,9 +357,7 @@ boolean PubSubClient::loop() {
                 uint8_t type = buffer[0]&0xF0;
                 if (type == MQTTPUBLISH) {
                     if (callback) {
-                        uint16_t tl = (buffer[llen+1]<<8)+buffer[llen+2]; /* topic length in bytes */
-                        memmove(buffer+llen+2,buffer+llen+3,tl); /* move topic inside buffer 1 byte to front */
-                        buffer[llen+2+tl] = 0; /* end the topic as a 'C' string with \x00 */
+                        uint16_t tl = _topicLength; /* readPacket has ended the topic with \x00 */
                         char *topic = (char*) buffer+llen+2;
                         // msgId only present for QOS>0
                         if ((buffer[0]&0x06) == MQTTQOS1) {
@@ -256,12 +383,15 @@ boolean PubSubClient::loop() {
                     _client->write(buffer,2);
                 } else if (type == MQTTPINGRESP) {
                     pingOutstanding = false;
+                } else if (type == MQTTPUBACK) {
+                    acknowledge((buffer[llen+1]<<8)+buffer[llen+2]);
                 }
             } else if (!connected()) {
                 // readPacket has closed the connection
                 return false;
             }
         }
+        retransmit(t);
         return true;
     }
     return false;
@@ -269,9 +399,11 @@ boolean PubSubClient::loop() {
 
 boolean PubSubClient::publish(const char* topic, const uint8_t* payload, unsigned int plength, boolean retained) {
     if (connected()) {
-        if (MQTT_MAX_PACKET_SIZE < MQTT_MAX_HEADER_SIZE + 2 + strlen(topic) + plength) {
-            // Too long
-            return false;
+        if (plength >= MQTT_GATHER_SIZE ||
+            bufferSize < MQTT_MAX_HEADER_SIZE + 2 + strlen(topic) + plength) {
+            // the payload goes out from where it is, after the header
+            return beginPublish(topic, plength, retained) &&
+                write(payload, plength) == plength && endPublish();
         }
         // Leave room in the buffer for header and variable length field
         uint16_t length = MQTT_MAX_HEADER_SIZE;
@@ -289,7 +421,144 @@ boolean PubSubClient::publish(const char* topic, const uint8_t* payload, unsigne
     return false;
 }
 
+uint16_t PubSubClient::publishQos1(const char* topic, const uint8_t* payload, unsigned int plength, boolean retained) {
+    if (!connected() || !canPublishQos1()) {
+        return 0;
+    }
+    uint32_t length = 2 + strlen(topic) + 2 + plength;
+    if (length + MQTT_MAX_HEADER_SIZE > 0xFFFF) {
+        // Too long
+        return 0;
+    }
+
+    uint8_t header = MQTTPUBLISH | MQTTQOS1;
+    if (retained) {
+        header |= 1;
+    }
+    uint8_t fixed[MQTT_MAX_HEADER_SIZE];
+    uint8_t hlen = buildHeader(header, fixed, length);
+
+    // built in the copy that is kept as sent; a retransmit only sets the
+    // DUP flag
+    Inflight &slot = _inflight[_inflightCount];
+    slot.length = hlen + length;
+    slot.packet = (uint8_t*) malloc(slot.length);
+    if (slot.packet == NULL) {
+        return 0;
+    }
+    uint16_t msgId = nextPacketId();
+    memcpy(slot.packet, fixed + MQTT_MAX_HEADER_SIZE - hlen, hlen);
+    uint16_t pos = writeString(topic, slot.packet, hlen);
+    slot.packet[pos++] = (msgId >> 8);
+    slot.packet[pos++] = (msgId & 0xFF);
+    memcpy(slot.packet + pos, payload, plength);
+    slot.payloadOffset = pos;
+    slot.msgId = msgId;
+
+    if (!writeRaw(slot.packet, slot.length)) {
+        free(slot.packet);
+        return 0;
+    }
+    slot.sentAt = lastOutActivity;
+    _inflightCount++;
+    return msgId;
+}
+
+boolean PubSubClient::canPublishQos1() {
+    return _inflightCount < _inflightWindow;
+}
+
+// the next packet id that isn't waiting for its PUBACK
+uint16_t PubSubClient::nextPacketId() {
+    for (;;) {
+        nextMsgId++;
+        if (nextMsgId == 0) {
+            nextMsgId = 1;
+        }
+        uint8_t i = 0;
+        while (i < _inflightCount && _inflight[i].msgId != nextMsgId) i++;
+        if (i == _inflightCount) {
+            return nextMsgId;
+        }
+    }
+}
+
+void PubSubClient::acknowledge(uint16_t msgId) {
+    uint8_t i = 0;
+    while (i < _inflightCount && _inflight[i].msgId != msgId) i++;
+    if (i == _inflightCount) {
+        return; // not ours (or a late duplicate)
+    }
+
+    // out of the window before the callback; it may publish again
+    Inflight acked = _inflight[i];
+    _inflightCount--;
+    memmove(_inflight + i, _inflight + i + 1, (_inflightCount - i) * sizeof(Inflight));
+
+    if (ackCallback) {
+        ackCallback(msgId, true, acked.packet + acked.payloadOffset, acked.length - acked.payloadOffset);
+    }
+    free(acked.packet);
+}
+
+void PubSubClient::retransmit(unsigned long t) {
+    for (uint8_t i = 0; i < _inflightCount; i++) {
+        Inflight &slot = _inflight[i];
+        if (t - slot.sentAt >= MQTT_PUBACK_TIMEOUT*1000UL) {
+            slot.packet[0] |= 0x08; // DUP
+            if (!writeRaw(slot.packet, slot.length)) {
+                return;
+            }
+            slot.sentAt = t;
+        }
+    }
+}
+
+unsigned long PubSubClient::getWaitMs(unsigned long t) {
+    if (!connected()) {
+        return MQTT_KEEPALIVE*1000UL;
+    }
+    if (_rxStart != _rxEnd || _client->available() > 0) {
+        return 0;
+    }
+
+    // loop() pings once either direction was quiet for MQTT_KEEPALIVE
+    unsigned long periodMs = MQTT_KEEPALIVE*1000UL;
+    unsigned long idleMs = t - lastInActivity;
+    if (t - lastOutActivity > idleMs) {
+        idleMs = t - lastOutActivity;
+    }
+    unsigned long waitMs = idleMs > periodMs ? 0 : periodMs - idleMs;
+
+    unsigned long resendMs = MQTT_PUBACK_TIMEOUT*1000UL;
+    for (uint8_t i = 0; i < _inflightCount && waitMs > 0; i++) {
+        unsigned long sinceMs = t - _inflight[i].sentAt;
+        unsigned long dueMs = sinceMs >= resendMs ? 0 : resendMs - sinceMs;
+        if (dueMs < waitMs) {
+            waitMs = dueMs;
+        }
+    }
+    return waitMs;
+}
+
+void PubSubClient::dropInflight() {
+    while (_inflightCount > 0) {
+        Inflight dropped = _inflight[0];
+        _inflightCount--;
+        memmove(_inflight, _inflight + 1, _inflightCount * sizeof(Inflight));
+
+        if (ackCallback) {
+            ackCallback(dropped.msgId, false, dropped.packet + dropped.payloadOffset, dropped.length - dropped.payloadOffset);
+        }
+        free(dropped.packet);
+    }
+}
+
 boolean PubSubClient::beginPublish(const char* topic, unsigned int plength, boolean retained) {
+    if (bufferSize < MQTT_MAX_HEADER_SIZE + 2 + strlen(topic)) {
+        // the topic goes through the buffer
+        return false;
+    }
     if (connected()) {
         // Send the header and variable length field
         uint16_t length = MQTT_MAX_HEADER_SIZE;
@@ -321,12 +590,12 @@ size_t PubSubClient::write(const uint8_t *buffer, size_t size) {
     return _client->write(buffer,size);
 }
 
-size_t PubSubClient::buildHeader(uint8_t header, uint8_t* buf, uint16_t length) {
+size_t PubSubClient::buildHeader(uint8_t header, uint8_t* buf, uint32_t length) {
     uint8_t lenBuf[4];
     uint8_t llen = 0;
     uint8_t digit;
     uint8_t pos = 0;
-    uint16_t len = length;
+    uint32_t len = length;
     do {
         digit = len % 128;
         len = len / 128;
@@ -345,12 +614,17 @@ size_t PubSubClient::buildHeader(uint8_t header, uint8_t* buf, uint16_t length)
 }
 
 boolean PubSubClient::write(uint8_t header, uint8_t* buf, uint16_t length) {
-    uint16_t rc;
     uint8_t hlen = buildHeader(header, buf, length);
+    return writeRaw(buf+(MQTT_MAX_HEADER_SIZE-hlen),length+hlen);
+}
+
+// writes a complete packet (header included)
+boolean PubSubClient::writeRaw(uint8_t* buf, uint16_t length) {
+    uint16_t rc;
 
 #ifdef MQTT_MAX_TRANSFER_SIZE
-    uint8_t* writeBuf = buf+(MQTT_MAX_HEADER_SIZE-hlen);
-    uint16_t bytesRemaining = length+hlen;  //Match the length type
+    uint8_t* writeBuf = buf;
+    uint16_t bytesRemaining = length;  //Match the length type
     uint8_t bytesToWrite;
     boolean result = true;
     while((bytesRemaining > 0) && result) {
@@ -360,11 +634,12 @@ boolean PubSubClient::write(uint8_t header, uint8_t* buf, uint16_t length) {
         bytesRemaining -= rc;
         writeBuf += rc;
     }
+    lastOutActivity = millis();
     return result;
 #else
-    rc = _client->write(buf+(MQTT_MAX_HEADER_SIZE-hlen),length+hlen);
+    rc = _client->write(buf,length);
     lastOutActivity = millis();
-    return (rc == hlen+length);
+    return (rc == length);
 #endif
 }
 
@@ -376,17 +651,14 @@ boolean PubSubClient::subscribe(const char* topic, uint8_t qos) {
     if (qos > 1) {
         return false;
     }
-    if (MQTT_MAX_PACKET_SIZE < 9 + strlen(topic)) {
+    if (bufferSize < 9 + strlen(topic)) {
         // Too long
         return false;
     }
     if (connected()) {
         // Leave room in the buffer for header and variable length field
         uint16_t length = MQTT_MAX_HEADER_SIZE;
-        nextMsgId++;
-        if (nextMsgId == 0) {
-            nextMsgId = 1;
-        }
+        nextPacketId();
         buffer[length++] = (nextMsgId >> 8);
         buffer[length++] = (nextMsgId & 0xFF);
         length = writeString((char*)topic, buffer,length);
@@ -397,16 +669,13 @@ boolean PubSubClient::subscribe(const char* topic, uint8_t qos) {
 }
 
 boolean PubSubClient::unsubscribe(const char* topic) {
-    if (MQTT_MAX_PACKET_SIZE < 9 + strlen(topic)) {
+    if (bufferSize < 9 + strlen(topic)) {
         // Too long
         return false;
     }
     if (connected()) {
         uint16_t length = MQTT_MAX_HEADER_SIZE;
-        nextMsgId++;
-        if (nextMsgId == 0) {
-            nextMsgId = 1;
-        }
+        nextPacketId();
         buffer[length++] = (nextMsgId >> 8);
         buffer[length++] = (nextMsgId & 0xFF);
         length = writeString(topic, buffer,length);
@@ -478,6 +747,37 @@ PubSubClient& PubSubClient::setCallback(MQTT_CALLBACK_SIGNATURE) {
     return *this;
 }
 
+PubSubClient& PubSubClient::setAckCallback(MQTT_ACK_CALLBACK_SIGNATURE) {
+    this->ackCallback = ackCallback;
+    return *this;
+}
+
+PubSubClient& PubSubClient::setChunkCallback(MQTT_CHUNK_CALLBACK_SIGNATURE) {
+    this->chunkCallback = chunkCallback;
+    return *this;
+}
+
+boolean PubSubClient::setBufferSize(uint16_t size) {
+    if (size < MQTT_MAX_HEADER_SIZE + 2) {
+        return false;
+    }
+    uint8_t* resized = (uint8_t*) realloc(buffer, size);
+    if (resized == NULL) {
+        return false;
+    }
+    buffer = resized;
+    bufferSize = size;
+    return true;
+}
+
+PubSubClient& PubSubClient::setInflightWindow(uint8_t window) {
+    if (window == 0) {
+        window = 1;
+    }
+    this->_inflightWindow = window > MQTT_MAX_INFLIGHT ? MQTT_MAX_INFLIGHT : window;
+    return *this;
+}
+
 PubSubClient& PubSubClient::setClient(Client* client){
     this->_client = client;
     return *this;
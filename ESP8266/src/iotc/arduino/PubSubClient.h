@@ -23,11 +23,27 @@
 #define MQTT_VERSION MQTT_VERSION_3_1_1
 #endif
 
-// MQTT_MAX_PACKET_SIZE : Maximum packet size
+// MQTT_MAX_PACKET_SIZE : Default size of the packet buffer (see setBufferSize).
+//  Larger PUBLISH packets are sent as a stream, and received in chunks when
+//  there is a chunk callback (see setChunkCallback)
 #ifndef MQTT_MAX_PACKET_SIZE
 #define MQTT_MAX_PACKET_SIZE 2048
 #endif
 
+// MQTT_GATHER_SIZE : publish() copies a payload shorter than this into the
+//  packet buffer and sends the packet with one write. A longer one is written
+//  from the caller's memory after the header (two writes, no copy)
+#ifndef MQTT_GATHER_SIZE
+#define MQTT_GATHER_SIZE 256
+#endif
+
+// MQTT_RX_BUFFER_SIZE : bytes taken off the network client per read call.
+//  The body of a packet that is at least this long is read straight into the
+//  packet buffer instead
+#ifndef MQTT_RX_BUFFER_SIZE
+#define MQTT_RX_BUFFER_SIZE 128
+#endif
+
 // MQTT_KEEPALIVE : keepAlive interval in Seconds
 #ifndef MQTT_KEEPALIVE
 #define MQTT_KEEPALIVE 15
@@ -38,6 +54,18 @@
 #define MQTT_SOCKET_TIMEOUT 15
 #endif
 
+// MQTT_MAX_INFLIGHT : Maximum number of QoS1 publishes waiting for their
+//  PUBACK at the same time (see setInflightWindow)
+#ifndef MQTT_MAX_INFLIGHT
+#define MQTT_MAX_INFLIGHT 4
+#endif
+
+// MQTT_PUBACK_TIMEOUT : a QoS1 publish is sent again (DUP) when its PUBACK
+//  didn't arrive within this many seconds
+#ifndef MQTT_PUBACK_TIMEOUT
+#define MQTT_PUBACK_TIMEOUT 10
+#endif
+
 // MQTT_MAX_TRANSFER_SIZE : limit how much data is passed to the network client
 //  in each write call. Needed for the Arduino Wifi Shield. Leave undefined to
 //  pass the entire MQTT packet in each write call.
@@ -82,28 +110,66 @@
 #include <functional>
 #define MQTT_CALLBACK_SIGNATURE \
   std::function<void(char*, uint8_t*, unsigned int)> callback
+#define MQTT_ACK_CALLBACK_SIGNATURE                                  \
+  std::function<void(uint16_t, boolean, const uint8_t*, unsigned int)> \
+      ackCallback
+#define MQTT_CHUNK_CALLBACK_SIGNATURE                                      \
+  std::function<void(char*, uint8_t*, unsigned int, uint32_t, uint32_t)> \
+      chunkCallback
 #else
 #define MQTT_CALLBACK_SIGNATURE void (*callback)(char*, uint8_t*, unsigned int)
+#define MQTT_ACK_CALLBACK_SIGNATURE \
+  void (*ackCallback)(uint16_t, boolean, const uint8_t*, unsigned int)
+#define MQTT_CHUNK_CALLBACK_SIGNATURE \
+  void (*chunkCallback)(char*, uint8_t*, unsigned int, uint32_t, uint32_t)
 #endif
 
-#define CHECK_STRING_LENGTH(l, s)                 \
-  if (l + 2 + strlen(s) > MQTT_MAX_PACKET_SIZE) { \
-    _client->stop();                              \
-    return false;                                 \
+#define CHECK_STRING_LENGTH(l, s)       \
+  if (l + 2 + strlen(s) > bufferSize) { \
+    _client->stop();                    \
+    return false;                       \
   }
 
 class PubSubClient : public Print {
  private:
   Client* _client;
-  uint8_t buffer[MQTT_MAX_PACKET_SIZE];
+  uint8_t* buffer;
+  uint16_t bufferSize;
+  // read from _client, not parsed yet (_rxStart.._rxEnd)
+  uint8_t _rx[MQTT_RX_BUFFER_SIZE];
+  uint16_t _rxStart;
+  uint16_t _rxEnd;
+  uint16_t _topicLength;  // of the last PUBLISH readPacket took in
   uint16_t nextMsgId;
   unsigned long lastOutActivity;
   unsigned long lastInActivity;
   bool pingOutstanding;
   MQTT_CALLBACK_SIGNATURE;
+  // QoS1 publishes waiting for their PUBACK, oldest first
+  struct Inflight {
+    uint8_t* packet;  // the whole PUBLISH, sent again as is (DUP)
+    uint16_t length;
+    uint16_t payloadOffset;
+    uint16_t msgId;
+    unsigned long sentAt;
+  };
+  Inflight _inflight[MQTT_MAX_INFLIGHT];
+  uint8_t _inflightCount;
+  uint8_t _inflightWindow;
+  MQTT_ACK_CALLBACK_SIGNATURE;
+  MQTT_CHUNK_CALLBACK_SIGNATURE;
+  uint16_t nextPacketId();
+  void acknowledge(uint16_t msgId);
+  void retransmit(unsigned long t);
+  boolean writeRaw(uint8_t* buf, uint16_t length);
+  // Reads the next packet into buffer. A PUBLISH topic is moved one byte to
+  // the front and ends with \0 (see _topicLength); the payload stays in place
   uint16_t readPacket(uint8_t*);
+  boolean waitAvailable();
   boolean readByte(uint8_t* result);
   boolean readByte(uint8_t* result, uint16_t* index);
+  boolean readBytes(uint8_t* result, uint16_t length);
+  boolean readChunks(uint16_t len, uint8_t lengthLength, uint32_t remaining);
   boolean write(uint8_t header, uint8_t* buf, uint16_t length);
   uint16_t writeString(const char* string, uint8_t* buf, uint16_t pos);
   // Build up the header ready to send
@@ -111,7 +177,7 @@ class PubSubClient : public Print {
   // Note: the header is built at the end of the first MQTT_MAX_HEADER_SIZE
   // bytes, so will start
   //       (MQTT_MAX_HEADER_SIZE - <returned size>) bytes into the buffer
-  size_t buildHeader(uint8_t header, uint8_t* buf, uint16_t length);
+  size_t buildHeader(uint8_t header, uint8_t* buf, uint32_t length);
   IPAddress ip;
   const char* domain;
   uint16_t port;
@@ -120,6 +186,7 @@ class PubSubClient : public Print {
 
  public:
   PubSubClient(const char*, uint16_t, Client* client);
+  ~PubSubClient();
 
   PubSubClient& setServer(IPAddress ip, uint16_t port);
   PubSubClient& setServer(uint8_t* ip, uint16_t port);
@@ -127,12 +194,32 @@ class PubSubClient : public Print {
   PubSubClient& setCallback(MQTT_CALLBACK_SIGNATURE);
   PubSubClient& setClient(Client* client);
   PubSubClient& setStream(Stream& stream);
+  // Called once per QoS1 publish: acked is true when its PUBACK arrived,
+  // false when it was dropped (see dropInflight). payload points into the
+  // kept copy of the message and is only valid during the call.
+  PubSubClient& setAckCallback(MQTT_ACK_CALLBACK_SIGNATURE);
+  // How many QoS1 publishes may wait for their PUBACK (1 is stop-and-wait),
+  // MQTT_MAX_INFLIGHT at most
+  PubSubClient& setInflightWindow(uint8_t window);
+  // Called for a PUBLISH that doesn't fit the packet buffer, once per piece
+  // of its payload: (topic, chunk, length, offset, total). The pieces come
+  // in order, the last one has offset + length == total. Without a chunk
+  // callback such a message is dropped. The topic and the chunk point into
+  // the packet buffer; don't publish before the last piece.
+  PubSubClient& setChunkCallback(MQTT_CHUNK_CALLBACK_SIGNATURE);
+  // Sizes the packet buffer (MQTT_MAX_PACKET_SIZE by default). It holds a
+  // whole CONNECT and any packet that isn't streamed or chunked.
+  // Returns false, and keeps the old buffer, if there is no memory
+  boolean setBufferSize(uint16_t size);
+  uint16_t getBufferSize() { return bufferSize; }
 
   boolean connect(const char* id, const char* user, const char* pass);
   boolean connect(const char* id, const char* user, const char* pass,
                   const char* willTopic, uint8_t willQos, boolean willRetain,
                   const char* willMessage, boolean cleanSession);
   void disconnect();
+  // A payload of MQTT_GATHER_SIZE or more, or one that doesn't fit the
+  // packet buffer, is streamed (see beginPublish)
   boolean publish(const char* topic, const uint8_t* payload,
                   unsigned int plength, boolean retained);
   // Start to publish a message.
@@ -154,10 +241,27 @@ class PubSubClient : public Print {
   // Write size bytes from buffer into the payload (only to be used with
   // beginPublish/endPublish) Returns the number of bytes written
   virtual size_t write(const uint8_t* buffer, size_t size);
+  // Publishes with QoS1. The packet is built in a copy of the message (not
+  // in the packet buffer) that is kept until its PUBACK arrives; loop()
+  // matches the PUBACKs and sends unacknowledged messages again (DUP) every
+  // MQTT_PUBACK_TIMEOUT seconds.
+  // Returns the packet id, 0 if there was an error or the in-flight window
+  // is full (see canPublishQos1)
+  uint16_t publishQos1(const char* topic, const uint8_t* payload,
+                       unsigned int plength, boolean retained);
+  boolean canPublishQos1();
+  uint8_t inflightCount() { return _inflightCount; }
+  // Forgets the unacknowledged publishes (i.e. before the connection is
+  // dropped); the ack callback gets each with acked == false
+  void dropInflight();
   boolean subscribe(const char* topic);
   boolean subscribe(const char* topic, uint8_t qos);
   boolean unsubscribe(const char* topic);
   boolean loop();
+  // How long (ms) loop() has nothing to do: until the keep-alive ping or the
+  // next resend of an unacknowledged publish is due. 0 if received bytes are
+  // waiting to be read
+  unsigned long getWaitMs(unsigned long t);
   boolean connected();
   int state();
 };
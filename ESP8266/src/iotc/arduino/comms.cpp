@@ -16,3 +16,29 @@ int mqtt_publish(IOTContextInternal* internal, const char* topic,
   }
   return 0;
 }
+
+int mqtt_publish_confirmed(IOTContextInternal* internal, const char* topic,
+                           unsigned long topic_length, const char* msg,
+                           unsigned long msg_length) {
+  if (internal->inflightWindow == 0) {
+    if (mqtt_publish(internal, topic, topic_length, msg, msg_length) != 0) {
+      return 1;
+    }
+    sendConfirmationCallback(msg, msg_length, 0);
+    return 0;
+  }
+
+  // the PUBACKs come in through loop(); take the ones that are already here
+  // and leave the rest to iotc_do_work
+  PubSubClient* client = internal->mqttClient;
+  if (!client->canPublishQos1()) {
+    if (!client->loop()) return 1;
+    if (!client->canPublishQos1()) return IOTC_ERROR_WINDOW_FULL;
+  }
+
+  if (client->publishQos1(topic, (const uint8_t*)msg, msg_length, false) ==
+      0) {
+    return 1;
+  }
+  return 0;
+}
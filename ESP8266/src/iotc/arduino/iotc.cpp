@@ -8,6 +8,9 @@
 #include <stdlib.h>
 #include "../common/iotc_internal.h"
 #include "../common/iotc_json.h"
+#if defined(ESP8266)
+#include <FS.h>
+#endif  // defined(ESP8266)
 
 unsigned long _getNow() {
   int retryCount = 0;
@@ -73,163 +76,72 @@ unsigned long getNow() {
   return g_udpTime + ((ms - g_lastRead) / 1000);
 }
 
-int _getOperationId(IOTContextInternal* internal, const char* dpsEndpoint,
-                    const char* scopeId, const char* deviceId,
-                    const char* authHeader, char* operationId, char* hostName) {
-  ARDUINO_WIFI_SSL_CLIENT client;
-  int exitCode = 0;
+#if !defined(USES_WIFI101) && defined(AXTLS_DEPRECATED)
+// TLS sessions of the last DPS and hub connections. The next connect to the
+// same server (DPS polls, reconnects) resumes them instead of a full handshake
+static BearSSL::Session g_dpsSession, g_hubSession;
+#endif  // !defined(USES_WIFI101) && defined(AXTLS_DEPRECATED)
 
+int connectDPS(ARDUINO_WIFI_SSL_CLIENT* client, const char* endpoint) {
 #ifndef USES_WIFI101
 #ifndef AXTLS_DEPRECATED
-  client.setCACert((const uint8_t*)SSL_CA_PEM_DEF,
-                   strlen((const char*)SSL_CA_PEM_DEF));
+  client->setCACert((const uint8_t*)SSL_CA_PEM_DEF,
+                    strlen((const char*)SSL_CA_PEM_DEF));
 #else   // AXTLS_DEPRECATED
+  // only the handshake uses the trust anchors
   BearSSL::X509List certList(SSL_CA_PEM_DEF);
-  client.setX509Time(g_udpTime);
-  client.setTrustAnchors(&certList);
+  client->setX509Time(g_udpTime);
+  client->setTrustAnchors(&certList);
+  client->setSession(&g_dpsSession);
 #endif  // AXTLS_DEPRECATED
 #endif  // USES_WIFI101
 
-  int retry = 0;
-  while (retry < 5 && !client.connect(dpsEndpoint, AZURE_HTTPS_SERVER_PORT))
-    retry++;
-  if (!client.connected()) {
-    IOTC_LOG(F("ERROR: DPS endpoint %s call has failed."),
-             hostName == NULL ? "PUT" : "GET");
-    return 1;
-  }
-
-  AzureIOT::StringBuffer tmpBuffer(STRING_BUFFER_1024);
-  AzureIOT::StringBuffer deviceIdEncoded(deviceId, strlen(deviceId));
-  deviceIdEncoded.urlEncode();
-
-  size_t size = 0;
-  if (hostName == NULL) {
-    size = strlen("{\"registrationId\":\"%s\"}") + strlen(deviceId) - 2;
-    size += internal->modelData == NULL
-                ? 0
-                : strlen(internal->modelData) + 8;  // ,\"data\":
-    const char* preModalData = internal->modelData == NULL ? "" : ",\"data\":";
-    const char* apiDate =
-        internal->modelData == NULL ? "2018-11-01" : "2019-01-15";
-    size = snprintf(*tmpBuffer, STRING_BUFFER_1024,
-                    "\
-PUT /%s/registrations/%s/register?api-version=%s HTTP/1.1\r\n\
-Host: %s\r\n\
-content-type: application/json; charset=utf-8\r\n\
-%s\r\n\
-accept: */*\r\n\
-content-length: %d\r\n\
-%s\r\n\
-connection: close\r\n\
-\r\n\
-{\"registrationId\":\"%s\"%s%s}\r\n\
-    ",
-                    scopeId, *deviceIdEncoded, apiDate, dpsEndpoint,
-                    AZURE_IOT_CENTRAL_CLIENT_SIGNATURE, size, authHeader,
-                    deviceId, preModalData,
-                    internal->modelData == NULL ? "" : internal->modelData);
-  } else {
-    size = snprintf(*tmpBuffer, STRING_BUFFER_1024,
-                    "\
-GET /%s/registrations/%s/operations/%s?api-version=2018-11-01 HTTP/1.1\r\n\
-Host: %s\r\n\
-content-type: application/json; charset=utf-8\r\n\
-%s\r\n\
-accept: */*\r\n\
-%s\r\n\
-connection: close\r\n\
-\r\n",
-                    scopeId, *deviceIdEncoded, operationId, dpsEndpoint,
-                    AZURE_IOT_CENTRAL_CLIENT_SIGNATURE, authHeader);
-  }
-  assert(size != 0 && size < STRING_BUFFER_1024);
-  tmpBuffer.setLength(size);
-
-  client.println(*tmpBuffer);
-  int index = 0;
-  while (!client.available()) {
-    WAITMS(100);
-    if (index++ > IOTC_SERVER_RESPONSE_TIMEOUT * 10) {
-      // 20 secs..
-      client.stop();
-      IOTC_LOG(F("ERROR: DPS (%s) request has failed. (Server didn't answer "
-                 "within 20 secs.)"),
-               hostName == NULL ? "PUT" : "GET");
-      return 1;
-    }
-  }
+  return client->connect(endpoint, AZURE_HTTPS_SERVER_PORT) ? 0 : 1;
+}
 
-  index = 0;
-  bool enableSaving = false;
-  while (client.available() && index < STRING_BUFFER_1024 - 1) {
-    char ch = (char)client.read();
-    if (ch == '{') {
-      enableSaving = true;  // don't use memory for headers
-    }
+static void messageArrived(char* topic, byte* data, unsigned int length) {
+  handlePayload((char*)data, length, topic, topic ? strlen(topic) : 0);
+}
 
-    if (enableSaving) {
-      (*tmpBuffer)[index++] = ch;
-    }
-  }
-  tmpBuffer.setLength(index);
-
-  const char* lookFor =
-      hostName == NULL ? "{\"operationId\":\"" : "\"assignedHub\":\"";
-  index = tmpBuffer.indexOf(lookFor, strlen(lookFor), 0);
-  if (index == -1) {
-  error_exit:
-    IOTC_LOG(F("ERROR: DPS (%s) request has failed.\r\n%s"),
-             hostName == NULL ? "PUT" : "GET", *tmpBuffer);
-    exitCode = 1;
-    goto exit_operationId;
-  } else {
-    index += strlen(lookFor);
-    int index2 = tmpBuffer.indexOf("\"", 1, index + 1);
-    if (index2 == -1) goto error_exit;
-    tmpBuffer.setLength(index2);
-    strcpy(hostName == NULL ? operationId : hostName, (*tmpBuffer) + index);
+static void dropChunkedMessage(IOTContextInternal* internal) {
+  if (internal->chunkedMessage != NULL) {
+    IOTC_FREE(internal->chunkedMessage);
+    internal->chunkedMessage = NULL;
   }
-
-exit_operationId:
-  client.stop();
-  return exitCode;
 }
 
-int getHubHostName(IOTContextInternal* internal, const char* dpsEndpoint,
-                   const char* scopeId, const char* deviceId, const char* key,
-                   char* hostName) {
-  AzureIOT::StringBuffer authHeader(STRING_BUFFER_256);
-  size_t size = 0;
-
-  IOTC_LOG(F("- iotc.dps : getting auth..."));
-  if (getDPSAuthString(scopeId, deviceId, key, *authHeader, STRING_BUFFER_256,
-                       size)) {
-    IOTC_LOG(F("ERROR: getDPSAuthString has failed"));
-    return 1;
-  }
-  IOTC_LOG(F("- iotc.dps : getting operation id..."));
-  AzureIOT::StringBuffer operationId(STRING_BUFFER_64);
-  int retval = 0;
-  if ((retval = _getOperationId(internal, dpsEndpoint, scopeId, deviceId,
-                                *authHeader, *operationId, NULL)) == 0) {
-    WAITMS(2500);
-    IOTC_LOG(F("- iotc.dps : getting host name..."));
-    WAITMS(2500);
-    for (int i = 0; i < 5; i++) {
-      retval = _getOperationId(internal, dpsEndpoint, scopeId, deviceId,
-                               *authHeader, *operationId, hostName);
-      if (retval == 0) break;
-      WAITMS(3000);
-      IOTC_LOG(F("- iotc.dps : getting host name...")); // re-trigger WD
+// a message larger than the MQTT buffer, one piece at a time. It is put
+// together in a buffer of its own size and handled once the last piece is in
+static void messageChunkArrived(char* topic, byte* data, unsigned int length,
+                                uint32_t offset, uint32_t total) {
+  IOTContextInternal* internal = getSingletonContext();
+  if (internal == NULL) return;
+
+  if (offset == 0) {
+    dropChunkedMessage(internal);
+    if (total > IOTC_MAX_MESSAGE_SIZE) {
+      IOTC_LOG(F("ERROR: %u byte message on %s is larger than "
+                 "IOTC_MAX_MESSAGE_SIZE. dropped"),
+               (unsigned)total, topic);
+      return;
+    }
+    internal->chunkedMessage = (char*)IOTC_MALLOC(total + 1);
+    if (internal->chunkedMessage == NULL) {
+      IOTC_LOG(F("ERROR: no memory for the %u byte message on %s. dropped"),
+               (unsigned)total, topic);
+      return;
     }
   }
-
-  return retval;
-}
-
-static void messageArrived(char* topic, byte* data, unsigned int length) {
-  handlePayload((char*)data, length, topic, topic ? strlen(topic) : 0);
+  if (internal->chunkedMessage == NULL) return;  // dropped
+
+  memcpy(internal->chunkedMessage + offset, data, length);
+  if (offset + length == total) {
+    char* message = internal->chunkedMessage;
+    internal->chunkedMessage = NULL;
+    message[total] = 0;
+    handlePayload(message, total, topic, strlen(topic));
+    IOTC_FREE(message);
+  }
 }
 
 /* extern */
@@ -247,6 +159,13 @@ int iotc_free_context(IOTContext ctx) {
   }
 
   iotc_disconnect(ctx);
+  internal->store.close();
+  internal->dps.clear();
+  clearTopics(internal);
+  clearTopicCallbacks(internal);
+  clearHubCredentials(internal);
+  jstoken_pool_free(&internal->twinTokens);
+  jstoken_pool_free(&internal->echoTokens);
 
   IOTC_FREE(internal);
   setSingletonContext(NULL);
@@ -254,44 +173,42 @@ int iotc_free_context(IOTContext ctx) {
   return 0;
 }
 
-int iotc_connect(IOTContext ctx, const char* scope, const char* keyORcert,
-                 const char* deviceId, IOTConnectType type) {
-  CHECK_NOT_NULL(ctx)
-  GET_LENGTH_NOT_NULL(keyORcert, 512);
-
-  AzureIOT::StringBuffer hostName;
-  AzureIOT::StringBuffer username;
-  AzureIOT::StringBuffer password;
-  IOTContextInternal* internal = (IOTContextInternal*)ctx;
+// MessageSent for a QoS1 publish (see iotc_set_inflight_window)
+static void messageAcked(uint16_t packetId, boolean acked, const uint8_t* data,
+                         unsigned int length) {
+  sendConfirmationCallback((const char*)data, length, acked ? 0 : 1);
+}
 
-  if (type == IOTC_CONNECT_CONNECTION_STRING) {
-    getUsernameAndPasswordFromConnectionString(keyORcert, strlen(keyORcert),
-                                               hostName, internal->deviceId,
-                                               username, password);
-  } else if (type == IOTC_CONNECT_SYMM_KEY) {
-    assert(scope != NULL && deviceId != NULL);
-    AzureIOT::StringBuffer tmpHostname(STRING_BUFFER_128);
-    if (getHubHostName(
-            internal,
-            internal->endpoint == NULL ? DEFAULT_ENDPOINT : internal->endpoint,
-            scope, deviceId, keyORcert, *tmpHostname)) {
-      return 1;
+static void closeHubConnection(IOTContextInternal* internal) {
+  if (internal->mqttClient) {
+    // a new connection starts with a new session; report what wasn't acked
+    internal->mqttClient->dropInflight();
+    if (internal->mqttClient->connected()) {
+      internal->mqttClient->disconnect();
     }
-    AzureIOT::StringBuffer cstr(STRING_BUFFER_256);
-    int rc = snprintf(*cstr, STRING_BUFFER_256,
-                      "HostName=%s;DeviceId=%s;SharedAccessKey=%s",
-                      *tmpHostname, deviceId, keyORcert);
-    assert(rc > 0 && rc < STRING_BUFFER_256);
-    cstr.setLength(rc);
-
-    // TODO: move into iotc_dps and do not re-parse from connection string
-    getUsernameAndPasswordFromConnectionString(
-        *cstr, rc, hostName, internal->deviceId, username, password);
-  } else if (type == IOTC_CONNECT_X509_CERT) {
-    IOTC_LOG(F("ERROR: IOTC_CONNECT_X509_CERT NOT IMPLEMENTED"));
-    connectionStatusCallback(IOTC_CONNECTION_DEVICE_DISABLED,
-                             (IOTContextInternal*)ctx);
-    return 1;
+    delete internal->mqttClient;
+    internal->mqttClient = NULL;
+  }
+  dropChunkedMessage(internal);
+
+  if (internal->tlsClient) {
+    delete internal->tlsClient;
+    internal->tlsClient = NULL;
+  }
+}
+
+// tries of a blocking connect, and the most it waits between two of them
+#define HUB_CONNECT_TRIES 10
+#define HUB_CONNECT_CAP_MS 8000
+
+// connects to internal->hostName with a fresh SAS token and subscribes. The
+// MQTT connect is tried up to `tries` times, with jittered backoff in between
+// returns 0 if there is no error. Otherwise, the IOTConnectionState that tells
+// why
+static int openHubConnection(IOTContextInternal* internal, unsigned tries) {
+  char password[STRING_BUFFER_512];
+  if (getHubPassword(internal, password, STRING_BUFFER_512) != 0) {
+    return IOTC_CONNECTION_BAD_CREDENTIAL;
   }
 
   internal->tlsClient = new ARDUINO_WIFI_SSL_CLIENT();
@@ -304,35 +221,43 @@ int iotc_connect(IOTContext ctx, const char* scope, const char* keyORcert,
   BearSSL::X509List certList(SSL_CA_PEM_DEF);
   internal->tlsClient->setX509Time(g_udpTime);
   internal->tlsClient->setTrustAnchors(&certList);
+  internal->tlsClient->setSession(&g_hubSession);
 #endif  // AXTLS_DEPRECATED
 #endif  // USES_WIFI101
 
-  internal->mqttClient =
-      new PubSubClient(*hostName, AZURE_MQTT_SERVER_PORT, internal->tlsClient);
+  internal->mqttClient = new PubSubClient(
+      *internal->hostName, AZURE_MQTT_SERVER_PORT, internal->tlsClient);
   internal->mqttClient->setCallback(messageArrived);
+  internal->mqttClient->setChunkCallback(messageChunkArrived);
+  internal->mqttClient->setAckCallback(messageAcked);
+  // RAM follows the messages; larger ones are streamed or chunked
+  internal->mqttClient->setBufferSize(IOTC_MQTT_BUFFER_SIZE);
+  if (internal->inflightWindow > 0) {
+    internal->mqttClient->setInflightWindow(internal->inflightWindow);
+  }
 
-  int retry = 0;
-  while (retry < 10 && !internal->mqttClient->connected()) {
-    if (internal->mqttClient->connect(*internal->deviceId, *username,
-                                      *password)) {
-      break;
-    } else {
-      WAITMS(2000);
-      retry++;
-    }
+  // devices that lost the hub at once don't come back in lockstep
+  AzureIOT::ReconnectPolicy backoff = AzureIOT::ReconnectPolicy();
+  backoff.configure(RECONNECT_DEFAULT_BASE_MS, HUB_CONNECT_CAP_MS, 0, 0);
+  backoff.seed(ESP.getChipId() ^ micros());
+
+  for (unsigned attempt = 1; !internal->mqttClient->connect(
+           *internal->deviceId, *internal->username, password);
+       attempt++) {
+    if (attempt >= tries) break;
+    WAITMS(backoff.schedule(millis(), IOTC_CONNECTION_COMMUNICATION_ERROR));
   }
 
   if (!internal->mqttClient->connected()) {
+    int state = internal->mqttClient->state();
     IOTC_LOG(F("ERROR: MQTT client connect attempt failed. Check host, "
                "deviceId, username and password. (state %d)"),
-             internal->mqttClient->state());
-    connectionStatusCallback(IOTC_CONNECTION_BAD_CREDENTIAL,
-                             (IOTContextInternal*)ctx);
-    delete internal->tlsClient;
-    delete internal->mqttClient;
-    internal->tlsClient = NULL;
-    internal->mqttClient = NULL;
-    return 1;
+             state);
+    closeHubConnection(internal);
+    return state == MQTT_CONNECT_BAD_CREDENTIALS ||
+                   state == MQTT_CONNECT_UNAUTHORIZED
+               ? IOTC_CONNECTION_BAD_CREDENTIAL
+               : IOTC_CONNECTION_COMMUNICATION_ERROR;
   }
 
   const unsigned bufferLength = internal->deviceId.getLength() + STRING_BUFFER_64;
@@ -361,35 +286,109 @@ int iotc_connect(IOTContext ctx, const char* scope, const char* keyORcert,
              errorCode);
   }
 
-  connectionStatusCallback(IOTC_CONNECTION_OK, (IOTContextInternal*)ctx);
+  return 0;
+}
+
+// the hub credentials are set; opens the connection
+static int connectHub(IOTContextInternal* internal) {
+  if (cacheTopics(internal) != 0) {
+    return 1;
+  }
+
+  int reason = openHubConnection(internal, HUB_CONNECT_TRIES);
+  if (reason != 0) {
+    connectionStatusCallback((IOTConnectionState)reason, internal);
+    return 1;
+  }
+
+  hubConnected(internal);
 
   iotc_do_work(internal);
-  iotc_get_device_settings(ctx);  // ask for the latest device settings
+  iotc_get_device_settings(internal);  // ask for the latest device settings
   iotc_do_work(internal);
 
   return 0;
 }
 
-/* extern */
-int iotc_disconnect(IOTContext ctx) {
+static int startConnect(IOTContext ctx, const char* scope,
+                        const char* keyORcert, const char* deviceId,
+                        IOTConnectType type, bool async) {
   CHECK_NOT_NULL(ctx)
+  GET_LENGTH_NOT_NULL(keyORcert, 512);
 
   IOTContextInternal* internal = (IOTContextInternal*)ctx;
-  MUST_CALL_AFTER_CONNECT(internal);
+  internal->reconnect.cancel();
 
-  if (internal->mqttClient) {
-    if (internal->mqttClient->connected()) {
-      internal->mqttClient->disconnect();
+  if (type == IOTC_CONNECT_CONNECTION_STRING) {
+    if (setHubCredentialsFromConnectionString(internal, keyORcert,
+                                              keyORcert_len)) {
+      return 1;
     }
-    delete internal->mqttClient;
-    internal->mqttClient = NULL;
+  } else if (type == IOTC_CONNECT_SYMM_KEY) {
+    assert(scope != NULL && deviceId != NULL);
+    if (beginProvisioning(internal, scope, deviceId, keyORcert) != 0) {
+      return 1;
+    }
+    if (async) {
+      return 0;  // iotc_do_work takes it from here
+    }
+    if (finishProvisioning(internal) != 0) {
+      return 1;
+    }
+  } else if (type == IOTC_CONNECT_X509_CERT) {
+    IOTC_LOG(F("ERROR: IOTC_CONNECT_X509_CERT NOT IMPLEMENTED"));
+    connectionStatusCallback(IOTC_CONNECTION_DEVICE_DISABLED,
+                             (IOTContextInternal*)ctx);
+    return 1;
   }
 
-  if (internal->tlsClient) {
-    delete internal->tlsClient;
-    internal->tlsClient = NULL;
+  return connectHub(internal);
+}
+
+int iotc_connect(IOTContext ctx, const char* scope, const char* keyORcert,
+                 const char* deviceId, IOTConnectType type) {
+  return startConnect(ctx, scope, keyORcert, deviceId, type, false);
+}
+
+/* extern */
+int iotc_connect_async(IOTContext ctx, const char* scope,
+                       const char* keyORcert, const char* deviceId,
+                       IOTConnectType type) {
+  return startConnect(ctx, scope, keyORcert, deviceId, type, true);
+}
+
+// the next try of the reconnect policy is due
+static int reconnectHub(IOTContextInternal* internal) {
+  int reason = openHubConnection(internal, 1);
+  if (reason != 0) {
+    scheduleReconnect(internal, (IOTConnectionState)reason);
+    return 1;
   }
 
+  hubConnected(internal);
+  // desired properties may have changed while the device was away
+  iotc_get_device_settings(internal);
+  return 0;
+}
+
+/* extern */
+int iotc_disconnect(IOTContext ctx) {
+  CHECK_NOT_NULL(ctx)
+
+  IOTContextInternal* internal = (IOTContextInternal*)ctx;
+  if (internal->dps.isBusy()) {  // still provisioning
+    internal->dps.clear();
+    return 0;
+  }
+  if (internal->mqttClient == NULL && internal->reconnect.isPending()) {
+    internal->reconnect.cancel();  // DISCONNECTED was reported already
+    return 0;
+  }
+  internal->reconnect.cancel();
+  MUST_CALL_AFTER_CONNECT(internal);
+
+  closeHubConnection(internal);
+
   connectionStatusCallback(IOTC_CONNECTION_DISCONNECTED,
                            (IOTContextInternal*)ctx);
   return 0;
@@ -400,15 +399,75 @@ int iotc_do_work(IOTContext ctx) {
   CHECK_NOT_NULL(ctx)
 
   IOTContextInternal* internal = (IOTContextInternal*)ctx;
+  if (internal->dps.isBusy()) {  // iotc_connect_async
+    int rc = provisionStep(internal, 0);
+    if (rc == 2) return 0;
+    if (rc != 0) {
+      connectionStatusCallback(internal->dps.getStatusCode() == 401
+                                   ? IOTC_CONNECTION_BAD_CREDENTIAL
+                                   : IOTC_CONNECTION_COMMUNICATION_ERROR,
+                               internal);
+      return 1;
+    }
+    return connectHub(internal);
+  }
+  if (internal->mqttClient == NULL && internal->reconnect.isPending()) {
+    return internal->reconnect.isDue(millis()) ? reconnectHub(internal) : 0;
+  }
   MUST_CALL_AFTER_CONNECT(internal);
 
+  if (hubTokenNeedsRenewal(internal)) {
+    // the hub drops the connection once the token expires. reconnect with a
+    // fresh one before that happens. With the reconnect policy on, a failed
+    // try is left to it instead of blocking here
+    IOTC_LOG(F("- iotc : renewing the SAS token"));
+    closeHubConnection(internal);
+    int reason = openHubConnection(
+        internal, internal->reconnect.isEnabled() ? 1 : HUB_CONNECT_TRIES);
+    if (reason != 0) {
+      connectionStatusCallback(IOTC_CONNECTION_DISCONNECTED,
+                               (IOTContextInternal*)ctx);
+      scheduleReconnect(internal, (IOTConnectionState)reason);
+      return 1;
+    }
+  }
+
   if (!internal->mqttClient->loop()) {
     if (!internal->mqttClient->connected()) {
+      if (internal->reconnect.isEnabled()) closeHubConnection(internal);
       connectionStatusCallback(IOTC_CONNECTION_DISCONNECTED,
                                (IOTContextInternal*)ctx);
+      scheduleReconnect(internal, IOTC_CONNECTION_DISCONNECTED);
     }
     return 1;
   }
+
+  drainStore(internal);
+  return 0;
+}
+
+/* extern */
+int iotc_get_wait_ms(IOTContext ctx, unsigned long* waitMs) {
+  CHECK_NOT_NULL(ctx)
+  CHECK_NOT_NULL(waitMs)
+
+  IOTContextInternal* internal = (IOTContextInternal*)ctx;
+  unsigned long now = millis();
+  unsigned long wait = IOTC_MAX_WAIT_MS;
+  if (internal->dps.isBusy()) {
+    // a response is read as it comes in (0 until then)
+    wait = internal->dps.getWaitMs(now);
+  } else if (internal->mqttClient == NULL) {
+    if (internal->reconnect.isPending()) {
+      wait = internal->reconnect.getWaitMs(now);
+    }
+  } else if (hubTokenNeedsRenewal(internal)) {
+    wait = 0;
+  } else {
+    wait = iotc_min(internal->mqttClient->getWaitMs(now),
+                    getStoreWaitMs(internal, now));
+  }
+  *waitMs = iotc_min(wait, (unsigned long)IOTC_MAX_WAIT_MS);
   return 0;
 }
 
@@ -416,4 +475,76 @@ int iotc_do_work(IOTContext ctx) {
 int iotc_set_network_interface(void* networkInterface) {
   // NO-OP
   return 0;
-}
\ No newline at end of file
+}
+
+#if defined(ESP8266)
+static bool g_spiffsMounted = false;
+
+void* iotc_store_open(const char* path, unsigned long size) {
+  if (!g_spiffsMounted && !SPIFFS.begin()) {
+    IOTC_LOG(F("ERROR: (iotc_store_open) SPIFFS couldn't be mounted."));
+    return NULL;
+  }
+  g_spiffsMounted = true;
+
+  File file = SPIFFS.open(path, "r+");
+  if (!file) file = SPIFFS.open(path, "w+");
+  if (!file) return NULL;
+
+  // SPIFFS doesn't seek past the end. Zeros are empty slots
+  uint8_t zeros[64] = {0};
+  file.seek(0, SeekEnd);
+  while (file.size() < size) {
+    size_t chunk = iotc_min((unsigned long)sizeof(zeros), size - file.size());
+    if (file.write(zeros, chunk) != chunk) {
+      file.close();
+      return NULL;
+    }
+  }
+  file.flush();
+  return new File(file);
+}
+
+void iotc_store_close(void* medium) {
+  File* file = (File*)medium;
+  file->close();
+  delete file;
+}
+
+int iotc_store_read(void* medium, unsigned long offset, void* data,
+                    unsigned length) {
+  File* file = (File*)medium;
+  return file->seek(offset, SeekSet) &&
+                 file->read((uint8_t*)data, length) == length
+             ? 0
+             : 1;
+}
+
+int iotc_store_write(void* medium, unsigned long offset, const void* data,
+                     unsigned length) {
+  File* file = (File*)medium;
+  if (!file->seek(offset, SeekSet) ||
+      file->write((const uint8_t*)data, length) != length) {
+    return 1;
+  }
+  file->flush();
+  return 0;
+}
+#else   // defined(ESP8266)
+void* iotc_store_open(const char* path, unsigned long size) {
+  IOTC_LOG(F("ERROR: (iotc_store_open) no file system on this board."));
+  return NULL;
+}
+
+void iotc_store_close(void* medium) {}
+
+int iotc_store_read(void* medium, unsigned long offset, void* data,
+                    unsigned length) {
+  return 1;
+}
+
+int iotc_store_write(void* medium, unsigned long offset, const void* data,
+                     unsigned length) {
+  return 1;
+}
+#endif  // defined(ESP8266)
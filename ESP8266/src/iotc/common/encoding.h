@@ -0,0 +1,44 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license.
+
+#ifndef AZURE_IOTC_LITE_ENCODING_H
+#define AZURE_IOTC_LITE_ENCODING_H
+
+// Table driven url and base64 kernels.
+//
+// Every *To function writes into a caller supplied buffer and returns the
+// number of bytes written. None of them \0 terminates. Size the target with
+// the matching *Length function first; it returns the exact output length.
+//
+//   unsigned size = urlEncodedLength(deviceId, deviceIdLength);
+//   ...
+//   urlEncodeTo(target, deviceId, deviceIdLength);
+
+namespace AzureIOT {
+
+// Same rules with the former StringBuffer::urlEncode; [A-Za-z0-9_.~-] are
+// kept, space becomes '+' and the rest is %XX escaped.
+unsigned urlEncodedLength(const char* source, unsigned length);
+// target must not overlap source
+unsigned urlEncodeTo(char* target, const char* source, unsigned length);
+
+// '+' becomes space and %XX is unescaped. A '%' that isn't followed by two
+// hex digits is kept as is. target needs `length` bytes and may be source
+unsigned urlDecodeTo(char* target, const char* source, unsigned length);
+
+// padded with '='
+unsigned base64EncodedLength(unsigned length);
+// target must not overlap source
+unsigned base64EncodeTo(char* target, const unsigned char* source,
+                        unsigned length);
+
+// returns the length of the decoded data. Trailing '=' are optional
+unsigned base64DecodedLength(const char* source, unsigned length);
+// target needs base64DecodedLength bytes and may be source.
+// returns false if source isn't valid base64
+bool base64DecodeTo(unsigned char* target, const char* source, unsigned length,
+                    unsigned& outLength);
+
+}  // namespace AzureIOT
+
+#endif  // AZURE_IOTC_LITE_ENCODING_H
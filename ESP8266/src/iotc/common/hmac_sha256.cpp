@@ -0,0 +1,23 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license.
+
+#include "iotc_internal.h"
+
+namespace AzureIOT {
+
+bool HmacSha256::init(const char* key, unsigned keyLength) {
+  sha256.initHmac((const uint8_t*)key, (size_t)keyLength);
+  return true;
+}
+
+bool HmacSha256::update(const char* data, unsigned length) {
+  sha256.update((const uint8_t*)data, (size_t)length);
+  return true;
+}
+
+bool HmacSha256::final(unsigned char* digest) {
+  memcpy(digest, sha256.resultHmac(), HMAC_SHA256_LENGTH);
+  return true;
+}
+
+}  // namespace AzureIOT
@@ -134,4 +134,85 @@ int iotc_set_model_data(IOTContext ctx, const char* modelData) {
 int iotc_set_token_expiration(IOTContext ctx, unsigned timeout) {
   setEXPIRES(timeout);
   return 0;
-}
\ No newline at end of file
+}
+
+/* extern */
+int iotc_set_reconnect(IOTContext ctx, unsigned baseMs, unsigned capMs,
+                       unsigned stableMs, unsigned maxAttempts) {
+  CHECK_NOT_NULL(ctx)
+
+  IOTContextInternal* internal = (IOTContextInternal*)ctx;
+  internal->reconnect.configure(baseMs, capMs, stableMs, maxAttempts);
+  return 0;
+}
+
+void hubConnected(IOTContextInternal* internal) {
+  AzureIOT::ReconnectPolicy& policy = internal->reconnect;
+  if (!policy.isEnabled()) {
+    connectionStatusCallback(IOTC_CONNECTION_OK, internal);
+    return;
+  }
+
+  // devices that boot together still draw different delays
+  unsigned long hash = 2166136261UL;  // FNV-1a
+  for (unsigned i = 0; i < internal->deviceId.getLength(); i++) {
+    hash = ((hash ^ (unsigned char)(*internal->deviceId)[i]) * 16777619UL) &
+           0xFFFFFFFFUL;
+  }
+  policy.seed(hash ^ ESP.getChipId() ^ micros());
+  policy.onConnected(millis());
+  connectionStatusCallback(IOTC_CONNECTION_OK, internal);
+}
+
+int scheduleReconnect(IOTContextInternal* internal, IOTConnectionState reason) {
+  AzureIOT::ReconnectPolicy& policy = internal->reconnect;
+  if (!policy.isEnabled()) return 1;
+
+  long waitMs = policy.schedule(millis(), reason);
+  if (waitMs < 0) {
+    IOTC_LOG(F("ERROR: giving up on the hub connection (%d)"), reason);
+    connectionStatusCallback(IOTC_CONNECTION_RETRY_EXPIRED, internal);
+    return 1;
+  }
+
+  IOTC_LOG(F("- iotc : reconnecting in %ld ms (try %d)"), waitMs,
+           policy.getAttempts());
+  return 0;
+}
+
+// how long a blocking registration waits on each read
+#define DPS_BLOCKING_READ_MS 100
+
+int beginProvisioning(IOTContextInternal* internal, const char* scopeId,
+                      const char* deviceId, const char* key) {
+  return internal->dps.begin(
+      internal->endpoint == NULL ? DEFAULT_ENDPOINT : internal->endpoint,
+      scopeId, deviceId, key, internal->modelData);
+}
+
+int provisionStep(IOTContextInternal* internal, unsigned readTimeoutMs) {
+  AzureIOT::DPSClient& dps = internal->dps;
+  AzureIOT::DPSState state = dps.step(millis(), readTimeoutMs);
+  if (state != AzureIOT::DPS_DONE && state != AzureIOT::DPS_FAILED) {
+    return dps.isBusy() ? 2 : 1;
+  }
+
+  int rc = 1;
+  if (state == AzureIOT::DPS_DONE) {
+    rc = setHubCredentials(internal, *dps.getHostName(),
+                           dps.getHostName().getLength(), *dps.getDeviceId(),
+                           dps.getDeviceId().getLength(), *dps.getKey(),
+                           dps.getKey().getLength());
+  }
+  dps.clear();
+  return rc;
+}
+
+int finishProvisioning(IOTContextInternal* internal) {
+  int rc = 0;
+  while ((rc = provisionStep(internal, DPS_BLOCKING_READ_MS)) == 2) {
+    unsigned long waitMs = internal->dps.getWaitMs(millis());
+    if (waitMs > 0) WAITMS(waitMs);
+  }
+  return rc;
+}
@@ -1,8 +1,10 @@
 // Copyright (c) Microsoft. All rights reserved.
 // Licensed under the MIT license.
 
+#include <time.h>
 #include "iotc_internal.h"
 #include "../common/iotc_json.h"
+#include "string_pool.h"
 
 IOTLogLevel gLogLevel = IOTC_LOGGING_DISABLED;
 
@@ -30,16 +32,17 @@ static IOTContextInternal *singletonContext = NULL;
 IOTContextInternal *getSingletonContext() { return singletonContext; }
 void setSingletonContext(IOTContextInternal *ctx) { singletonContext = ctx; }
 
-int getUsernameAndPasswordFromConnectionString(
-    const char *connectionString, size_t connectionStringLength,
-    AzureIOT::StringBuffer &hostName, AzureIOT::StringBuffer &deviceId,
-    AzureIOT::StringBuffer &username, AzureIOT::StringBuffer &password) {
+// HostName=<host>;DeviceId=<id>;SharedAccessKey=<key>
+// returns 0 if there is no error
+static int parseConnectionString(const char *connectionString,
+                                 size_t connectionStringLength,
+                                 int32_t &deviceIndex, int32_t &keyIndex) {
   // TODO: improve this so we don't depend on a particular order in connection
   // string
-  AzureIOT::StringBuffer connStr(connectionString, connectionStringLength);
+  AzureIOT::StringBuffer connStr(connectionString, connectionStringLength,
+                                 false);
 
   int32_t hostIndex = connStr.indexOf(HOSTNAME_STRING, HOSTNAME_LENGTH);
-  size_t length = connStr.getLength();
   if (hostIndex != 0) {
     IOTC_LOG(
         F("ERROR: connectionString doesn't start with HostName=  RESULT:%d"),
@@ -47,123 +50,196 @@ int getUsernameAndPasswordFromConnectionString(
     return 1;
   }
 
-  int32_t deviceIndex = connStr.indexOf(DEVICEID_STRING, DEVICEID_LENGTH);
+  deviceIndex = connStr.indexOf(DEVICEID_STRING, DEVICEID_LENGTH);
   if (deviceIndex == -1) {
     IOTC_LOG(F("ERROR: ;DeviceId= not found in the connectionString"));
     return 1;
   }
 
-  int32_t keyIndex = connStr.indexOf(KEY_STRING, KEY_LENGTH);
+  keyIndex = connStr.indexOf(KEY_STRING, KEY_LENGTH);
   if (keyIndex == -1) {
     IOTC_LOG(F("ERROR: ;SharedAccessKey= not found in the connectionString"));
     return 1;
   }
 
+  return 0;
+}
+
+static int formatUsername(AzureIOT::StringBuffer &username,
+                          AzureIOT::StringBuffer &hostName,
+                          AzureIOT::StringBuffer &deviceId) {
+  const char *usernameTemplate = "%s/%s/api-version=2016-11-14";
+  unsigned length = (strlen(usernameTemplate) - 4 /* %s twice */) +
+                    hostName.getLength() + deviceId.getLength();
+
+  username.clear();
+  username.alloc(length + 1);
+  if (*username == NULL) return 1;
+
+  username.setLength(snprintf(*username, length + 1, usernameTemplate,
+                              *hostName, *deviceId));
+  return 0;
+}
+
+int getUsernameAndPasswordFromConnectionString(
+    const char *connectionString, size_t connectionStringLength,
+    AzureIOT::StringBuffer &hostName, AzureIOT::StringBuffer &deviceId,
+    AzureIOT::StringBuffer &username, AzureIOT::StringBuffer &password) {
+  int32_t deviceIndex = 0, keyIndex = 0;
+  if (parseConnectionString(connectionString, connectionStringLength,
+                            deviceIndex, keyIndex)) {
+    return 1;
+  }
+
+  // the results outlive the call; only the token's buffers are temporaries
+  AzureIOT::StringHeapScope heapScope;
   hostName.initialize(connectionString + HOSTNAME_LENGTH,
                       deviceIndex - HOSTNAME_LENGTH);
   deviceId.initialize(connectionString + (deviceIndex + DEVICEID_LENGTH),
                       keyIndex - (deviceIndex + DEVICEID_LENGTH));
+  password.alloc(STRING_BUFFER_512);
+
+  unsigned passLength = 0;
+  {
+    AzureIOT::StringPoolScope poolScope;
+    AzureIOT::SASToken sasToken;
+    if (sasToken.initialize(connectionString + (keyIndex + KEY_LENGTH),
+                            connectionStringLength - (keyIndex + KEY_LENGTH),
+                            *hostName, hostName.getLength(),
+                            SAS_DEVICES_SECTION, *deviceId,
+                            deviceId.getLength())) {
+      return 1;
+    }
+    passLength =
+        sasToken.write(*password, STRING_BUFFER_512, getNow() + EXPIRES);
+  }
+  if (passLength == 0 || formatUsername(username, hostName, deviceId)) {
+    return 1;
+  }
+  password.setLength(passLength);
 
-  AzureIOT::StringBuffer keyBuffer(length - (keyIndex + KEY_LENGTH));
-  memcpy(*keyBuffer, connectionString + (keyIndex + KEY_LENGTH),
-         keyBuffer.getLength());
-
-  AzureIOT::StringBuffer hostURLEncoded(hostName);
-  hostURLEncoded.urlEncode();
-
-  size_t expires = getNow() + EXPIRES;
+  IOTC_LOG(F("\r\n"
+             "hostname: %s\r\n"
+             "deviceId: %s\r\n"
+             "username: %s\r\n"
+             "password: %s\r\n"),
+           *hostName, *deviceId, *username, *password);
 
-  AzureIOT::StringBuffer stringToSign(hostURLEncoded.getLength() +
-                                      STRING_BUFFER_128);
-  AzureIOT::StringBuffer deviceIdEncoded(deviceId);
-  deviceIdEncoded.urlEncode();
-  size_t keyLength =
-      snprintf(*stringToSign, stringToSign.getLength(), "%s%s%s\n%lu000",
-               *hostURLEncoded, "%2Fdevices%2F", *deviceIdEncoded, expires);
-  stringToSign.setLength(keyLength);
+  return 0;
+}
 
-  keyBuffer.base64Decode();
-  stringToSign.hash(*keyBuffer, keyBuffer.getLength());
-  if (!stringToSign.base64Encode() || !stringToSign.urlEncode()) {
-    IOTC_LOG(F("ERROR: stringToSign base64Encode / urlEncode has failed."));
+int setHubCredentials(IOTContextInternal *internal, const char *hostName,
+                      unsigned hostNameLength, const char *deviceId,
+                      unsigned deviceIdLength, const char *key,
+                      unsigned keyLength) {
+  clearHubCredentials(internal);
+
+  AzureIOT::StringHeapScope heapScope;  // kept until the context goes away
+  internal->hostName.initialize(hostName, hostNameLength);
+  internal->deviceId.initialize(deviceId, deviceIdLength);
+  if (internal->sasToken.initialize(key, keyLength, hostName, hostNameLength,
+                                    SAS_DEVICES_SECTION, deviceId,
+                                    deviceIdLength) ||
+      formatUsername(internal->username, internal->hostName,
+                     internal->deviceId)) {
+    clearHubCredentials(internal);
     return 1;
   }
+  assert(!AzureIOT::StringPool::owns(*internal->hostName) &&
+         !AzureIOT::StringPool::owns(*internal->deviceId) &&
+         !AzureIOT::StringPool::owns(*internal->username));
 
-  AzureIOT::StringBuffer passwordBuffer(STRING_BUFFER_512);
-  size_t passLength = snprintf(
-      *passwordBuffer, STRING_BUFFER_512,
-      "SharedAccessSignature sr=%s%s%s&sig=%s&se=%lu000", *hostURLEncoded,
-      "%2Fdevices%2F", *deviceIdEncoded, *stringToSign, expires);
+  IOTC_LOG(F("\r\n"
+             "hostname: %s\r\n"
+             "deviceId: %s\r\n"
+             "username: %s\r\n"),
+           *internal->hostName, *internal->deviceId, *internal->username);
 
-  assert(passLength && passLength < STRING_BUFFER_512);
-  passwordBuffer.setLength(passLength);
+  return 0;
+}
 
-  password.initialize(*passwordBuffer, passwordBuffer.getLength());
+int setHubCredentialsFromConnectionString(IOTContextInternal *internal,
+                                          const char *connectionString,
+                                          size_t connectionStringLength) {
+  int32_t deviceIndex = 0, keyIndex = 0;
+  if (parseConnectionString(connectionString, connectionStringLength,
+                            deviceIndex, keyIndex)) {
+    return 1;
+  }
 
-  const char *usernameTemplate = "%s/%s/api-version=2016-11-14";
-  AzureIOT::StringBuffer usernameBuffer(
-      (strlen(usernameTemplate) - 3 /* %s twice */) + hostName.getLength() +
-      deviceId.getLength());
+  return setHubCredentials(
+      internal, connectionString + HOSTNAME_LENGTH,
+      deviceIndex - HOSTNAME_LENGTH,
+      connectionString + (deviceIndex + DEVICEID_LENGTH),
+      keyIndex - (deviceIndex + DEVICEID_LENGTH),
+      connectionString + (keyIndex + KEY_LENGTH),
+      connectionStringLength - (keyIndex + KEY_LENGTH));
+}
 
-  size_t expLength = snprintf(*usernameBuffer, usernameBuffer.getLength(),
-                              usernameTemplate, *hostName, *deviceId);
-  assert(expLength <= usernameBuffer.getLength());
+void clearHubCredentials(IOTContextInternal *internal) {
+  internal->hostName.clear();
+  internal->deviceId.clear();
+  internal->username.clear();
+  internal->sasToken.clear();
+}
 
-  username.initialize(*usernameBuffer, usernameBuffer.getLength());
+int getHubPassword(IOTContextInternal *internal, char *buffer,
+                   unsigned bufferSize) {
+  if (!internal->sasToken.isInitialized()) {
+    IOTC_LOG(F("ERROR: (getHubPassword) hub credentials are not set"));
+    return 1;
+  }
 
-  IOTC_LOG(F("\r\n"
-             "hostname: %s\r\n"
-             "deviceId: %s\r\n"
-             "username: %s\r\n"
-             "password: %s\r\n"),
-           *hostName, *deviceId, *username, *password);
+  return internal->sasToken.write(buffer, bufferSize, getNow() + EXPIRES) == 0
+             ? 1
+             : 0;
+}
 
-  return 0;
+bool hubTokenNeedsRenewal(IOTContextInternal *internal) {
+  unsigned long expiresAt = internal->sasToken.getExpiresAt();
+  if (expiresAt == 0) return false;
+
+  unsigned long margin = iotc_min(TOKEN_RENEWAL_MARGIN, EXPIRES / 10);
+  return getNow() + margin >= expiresAt;
 }
 
 int getDPSAuthString(const char *scopeId, const char *deviceId, const char *key,
                      char *buffer, int bufferSize, size_t &outLength) {
-  size_t expires = getNow() + EXPIRES;
-
-  AzureIOT::StringBuffer deviceIdEncoded(deviceId, strlen(deviceId));
-  deviceIdEncoded.urlEncode();
-
-  AzureIOT::StringBuffer stringToSign(STRING_BUFFER_256);
-  size_t size =
-      snprintf(*stringToSign, STRING_BUFFER_256, "%s%%2Fregistrations%%2F%s",
-               scopeId, *deviceIdEncoded);
-  assert(size < STRING_BUFFER_256);
-  stringToSign.setLength(size);
-
-  AzureIOT::StringBuffer sr(stringToSign);
-  size = snprintf(*stringToSign, STRING_BUFFER_256, "%s\n%lu000", *sr, expires);
-  assert(size < STRING_BUFFER_256);
-  stringToSign.setLength(size);
-
-  size = 0;
-  AzureIOT::StringBuffer keyDecoded(key, strlen(key));
-  keyDecoded.base64Decode();
-  stringToSign.hash(*keyDecoded, keyDecoded.getLength());
-  if (!stringToSign.base64Encode() || !stringToSign.urlEncode()) {
-    IOTC_LOG(F("ERROR: stringToSign base64Encode / urlEncode has failed."));
+  AzureIOT::StringPoolScope poolScope;
+  const char *header = "authorization: ";
+  const char *keyName = "&skn=registration";
+  const unsigned headerLength = strlen(header),
+                 keyNameLength = strlen(keyName);
+
+  AzureIOT::SASToken sasToken;
+  if (sasToken.initialize(key, strlen(key), scopeId, strlen(scopeId),
+                          SAS_REGISTRATIONS_SECTION, deviceId,
+                          strlen(deviceId))) {
     return 1;
   }
 
-  outLength = snprintf(buffer, bufferSize,
-                       "authorization: SharedAccessSignature "
-                       "sr=%s&sig=%s&se=%lu000&skn=registration",
-                       *sr, *stringToSign, expires);
-  assert(outLength > 0 && outLength < bufferSize);
-  buffer[outLength] = 0;
+  if ((unsigned)bufferSize <= headerLength + keyNameLength) return 1;
+  memcpy(buffer, header, headerLength);
+  unsigned length =
+      sasToken.write(buffer + headerLength,
+                     bufferSize - (headerLength + keyNameLength),
+                     getNow() + EXPIRES);
+  if (length == 0) {
+    IOTC_LOG(F("ERROR: (getDPSAuthString) SAS token doesn't fit into the "
+               "buffer"));
+    return 1;
+  }
 
+  memcpy(buffer + headerLength + length, keyName, keyNameLength + 1);
+  outLength = headerLength + length + keyNameLength;
   return 0;
 }
 
 // send telemetry etc. confirmation callback
 /* MessageSent */
-void sendConfirmationCallback(const char *buffer, size_t size) {
+void sendConfirmationCallback(const char *buffer, size_t size,
+                              int statusCode) {
   IOTContextInternal *internal = (IOTContextInternal *)singletonContext;
-  int result = 0;
 
   if (internal->callbacks[/*IOTCallbacks::*/ MessageSent].callback) {
     IOTCallbackInfo info;
@@ -173,7 +249,7 @@ void sendConfirmationCallback(const char *buffer, size_t size) {
     info.payloadLength = (unsigned)size;
     info.appContext =
         internal->callbacks[/*IOTCallbacks::*/ ::MessageSent].appContext;
-    info.statusCode = (int)result;
+    info.statusCode = statusCode;
     info.callbackResponse = NULL;
     internal->callbacks[/*IOTCallbacks::*/ ::MessageSent].callback(internal,
                                                                    &info);
@@ -245,11 +321,50 @@ void sendOnError(IOTContextInternal *internal, const char *message) {
   }
 }
 
+int cacheTopics(IOTContextInternal *internal) {
+  clearTopics(internal);
+
+  AzureIOT::StringHeapScope heapScope;
+  unsigned length = internal->deviceId.getLength() +
+                    strlen(EVENTS_TOPIC_TEMPLATE) - 2 /* %s */;
+  internal->eventsTopic.alloc(length + 1);
+  // + 11 for the request id (%d), + 1 for \0
+  internal->reportedTopic.alloc(REPORTED_TOPIC_PREFIX_LENGTH + 12);
+  if (*internal->eventsTopic == NULL || *internal->reportedTopic == NULL) {
+    IOTC_LOG(F("ERROR: (cacheTopics) out of memory"));
+    clearTopics(internal);
+    return 1;
+  }
+
+  internal->eventsTopic.setLength(snprintf(*internal->eventsTopic, length + 1,
+                                           EVENTS_TOPIC_TEMPLATE,
+                                           *internal->deviceId));
+  memcpy(*internal->reportedTopic, REPORTED_TOPIC_PREFIX,
+         REPORTED_TOPIC_PREFIX_LENGTH);
+  internal->reportedTopic.setLength(REPORTED_TOPIC_PREFIX_LENGTH);
+  return 0;
+}
+
+void clearTopics(IOTContextInternal *internal) {
+  internal->eventsTopic.clear();
+  internal->reportedTopic.clear();
+}
+
+// appends the next request id to the cached reported properties topic
+// returns the length of the topic
+static unsigned nextReportedTopic(IOTContextInternal *internal) {
+  int size = snprintf(*internal->reportedTopic + REPORTED_TOPIC_PREFIX_LENGTH,
+                      12, "%d", internal->messageId++);
+  internal->reportedTopic.setLength(REPORTED_TOPIC_PREFIX_LENGTH + size);
+  return internal->reportedTopic.getLength();
+}
+
 void echoDesired(IOTContextInternal *internal, const char *propertyName,
                  AzureIOT::StringBuffer &message, const char *status,
                  int statusCode) {
   jsobject_t rootObject;
-  jsobject_initialize(&rootObject, *message, message.getLength());
+  jsobject_initialize_pooled(&rootObject, *message, message.getLength(),
+                             &internal->echoTokens);
   jsobject_t propertyNameObject;
 
   if (jsobject_get_object_by_name(&rootObject, propertyName,
@@ -262,32 +377,32 @@ void echoDesired(IOTContextInternal *internal, const char *propertyName,
     return;
   }
 
-  char *value = jsobject_get_data_by_name(&propertyNameObject, "value");
+  const char *value = NULL;
+  int valueLength =
+      jsobject_get_data_span_by_name(&propertyNameObject, "value", &value);
+  if (valueLength == -1) {
+    value = "null";
+    valueLength = 4;
+  }
   double desiredVersion = jsobject_get_number_by_name(&rootObject, "$version");
 
   const char *echoTemplate =
-      "{\"%s\":{\"value\":%s,\"statusCode\":%d,\
+      "{\"%s\":{\"value\":%.*s,\"statusCode\":%d,\
 \"status\":\"%s\",\"desiredVersion\":%d}}";
-  uint32_t buffer_size = strlen(echoTemplate) + strlen(value) +
+  uint32_t buffer_size = strlen(echoTemplate) + valueLength +
                          3 /* statusCode */
                          + 32 /* status */ + 23 /* version max */;
   buffer_size = iotc_min(buffer_size, 512);
   AzureIOT::StringBuffer buffer(buffer_size);
 
-  size_t size = snprintf(*buffer, buffer_size, echoTemplate, propertyName,
-                         value, statusCode, status, (int)desiredVersion);
+  size_t size =
+      snprintf(*buffer, buffer_size, echoTemplate, propertyName, valueLength,
+               value, statusCode, status, (int)desiredVersion);
   buffer.setLength(size);
 
-  IOTC_FREE(value);
-
-  const char *topicName = "$iothub/twin/PATCH/properties/reported/?$rid=%d";
-  AzureIOT::StringBuffer topic(
-      strlen(topicName) +
-      21);  // + 2 for %d == +23 in case requestId++ overflows
-  topic.setLength(
-      snprintf(*topic, topic.getLength(), topicName, internal->messageId++));
-
-  if (mqtt_publish(internal, *topic, topic.getLength(), *buffer, size) != 0) {
+  unsigned topicLength = nextReportedTopic(internal);
+  if (mqtt_publish(internal, *internal->reportedTopic, topicLength, *buffer,
+                   size) != 0) {
     IOTC_LOG("ERROR: (echoDesired) MQTTClient publish has failed => %s",
              *buffer);
   }
@@ -295,8 +410,7 @@ void echoDesired(IOTContextInternal *internal, const char *propertyName,
   jsobject_free(&rootObject);
 }
 
-void callDesiredCallback(IOTContextInternal *internal,
-                         AzureIOT::StringBuffer &topicName,
+void callDesiredCallback(IOTContextInternal *internal, bool echo,
                          const char *propertyName,
                          AzureIOT::StringBuffer &payload) {
   const char *response = "completed";
@@ -313,9 +427,7 @@ void callDesiredCallback(IOTContextInternal *internal,
     internal->callbacks[/*IOTCallbacks::*/ ::SettingsUpdated].callback(internal,
                                                                        &info);
 
-    if (topicName.startsWith(
-            "$iothub/twin/PATCH/properties/desired/",
-            strlen("$iothub/twin/PATCH/properties/desired/"))) {
+    if (echo) {
       if (info.callbackResponse) {
         response = (const char *)info.callbackResponse;
       }
@@ -324,7 +436,7 @@ void callDesiredCallback(IOTContextInternal *internal,
   }
 }
 
-static void deviceTwinGetStateCallback(AzureIOT::StringBuffer &topicName,
+static void deviceTwinGetStateCallback(bool echo,
                                        AzureIOT::StringBuffer &payload,
                                        void *userContextCallback) {
   IOTContextInternal *internal = (IOTContextInternal *)userContextCallback;
@@ -335,19 +447,22 @@ static void deviceTwinGetStateCallback(AzureIOT::StringBuffer &topicName,
   }
 
   jsobject_t desired, outDesired, outReported;
-  jsobject_initialize(&desired, *payload, payload.getLength());
+  jsobject_initialize_pooled(&desired, *payload, payload.getLength(),
+                             &internal->twinTokens);
 
   if (jsobject_get_object_by_name(&desired, "desired", &outDesired) != -1 &&
       jsobject_get_object_by_name(&desired, "reported", &outReported) != -1) {
-    callDesiredCallback(internal, topicName, "twin", payload);
+    callDesiredCallback(internal, echo, "twin", payload);
   } else {
     for (unsigned i = 0, count = jsobject_get_count(&desired); i < count;
         i += 2) {
-      char *itemName = jsobject_get_name_at(&desired, i);
-      if (itemName != NULL && itemName[0] != '$') {
-        callDesiredCallback(internal, topicName, itemName, payload);
+      const char *itemName = NULL;
+      int itemNameLength = jsobject_get_name_span_at(&desired, i, &itemName);
+      if (itemNameLength > 0 && itemName[0] != '$') {
+        // the callback wants a \0 terminated name
+        AzureIOT::StringBuffer name(itemName, itemNameLength);
+        callDesiredCallback(internal, echo, *name, payload);
       }
-      if (itemName) IOTC_FREE(itemName);
     }
   }
   jsobject_free(&outReported);
@@ -355,70 +470,257 @@ static void deviceTwinGetStateCallback(AzureIOT::StringBuffer &topicName,
   jsobject_free(&outDesired);
 }
 
+#define METHODS_TOPIC_PREFIX "$iothub/methods/POST/"
+#define DESIRED_TOPIC_PREFIX "$iothub/twin/PATCH/properties/desired/"
+#define TWIN_TOPIC_PREFIX "$iothub/twin/"
+
+/* Command: $iothub/methods/POST/<method name>/?$rid=<request id> */
+static void onMethodTopic(const char *topic, unsigned topicLength,
+                          const AzureIOT::TopicFields &fields, char *payload,
+                          unsigned long payloadLength, void *handlerContext) {
+  IOTContextInternal *internal = (IOTContextInternal *)handlerContext;
+
+  if (fields.requestId == NULL || fields.segmentLength == 0 ||
+      fields.segmentLength >= STRING_BUFFER_128 ||
+      fields.requestIdLength >= STRING_BUFFER_64) {
+    IOTC_LOG(F("ERROR: corrupt C2D message topic => %.*s"), (int)topicLength,
+             topic);
+    return;
+  }
+
+  // PubSubClient reuses the buffer of the topic when the callback
+  // publishes; keep what we need on the stack
+  char methodName[STRING_BUFFER_128];
+  memcpy(methodName, fields.segment, fields.segmentLength);
+  methodName[fields.segmentLength] = 0;
+  char requestId[STRING_BUFFER_64];
+  memcpy(requestId, fields.requestId, fields.requestIdLength);
+  requestId[fields.requestIdLength] = 0;
+
+  const char *constResponse = "{}";
+  char *response = NULL;
+  size_t respSize = 0;
+  int rc = onCommand(methodName, payload, payloadLength, &response, &respSize,
+                     internal);
+  if (respSize == 0) {
+    respSize = 2;
+  } else {
+    constResponse = response;
+  }
+
+  char respTopic[STRING_BUFFER_128];
+  int respTopicLength = snprintf(respTopic, STRING_BUFFER_128,
+                                 "$iothub/methods/res/%d/?$rid=%s", rc,
+                                 requestId);
+
+  if (mqtt_publish(internal, respTopic, respTopicLength, constResponse,
+                   respSize) != 0) {
+    IOTC_LOG(
+        "ERROR: mqtt_publish has failed during C2D with response "
+        "topic '%s' and response '%s'",
+        respTopic, constResponse);
+  }
+  if (response != constResponse) {
+    IOTC_FREE(response);
+  }
+}
+
+// SettingsUpdated. jsobject wants a \0 terminated copy and echoDesired
+// publishes (over the buffer of the payload) while it walks the properties
+static void onTwinPayload(bool echo, char *payload,
+                          unsigned long payloadLength, void *handlerContext) {
+  AzureIOT::StringBuffer twin;
+  if (payloadLength) {
+    twin.initialize(payload, payloadLength);
+  }
+  deviceTwinGetStateCallback(echo, twin, handlerContext);
+}
+
+/* $iothub/twin/PATCH/properties/desired/?$version=<version> */
+static void onDesiredTopic(const char *topic, unsigned topicLength,
+                           const AzureIOT::TopicFields &fields, char *payload,
+                           unsigned long payloadLength, void *handlerContext) {
+  onTwinPayload(true, payload, payloadLength, handlerContext);
+}
+
+/* $iothub/twin/res/<status>/?$rid=<request id> (i.e. the full twin) */
+static void onTwinTopic(const char *topic, unsigned topicLength,
+                        const AzureIOT::TopicFields &fields, char *payload,
+                        unsigned long payloadLength, void *handlerContext) {
+  onTwinPayload(false, payload, payloadLength, handlerContext);
+}
+
+/* iotc_on_topic */
+static void onUserTopic(const char *topic, unsigned topicLength,
+                        const AzureIOT::TopicFields &fields, char *payload,
+                        unsigned long payloadLength, void *handlerContext) {
+  TopicCallback *entry = (TopicCallback *)handlerContext;
+
+  // a copy; the callback may publish over the buffer of the topic
+  AzureIOT::StringBuffer topicName(topic, topicLength);
+  IOTCallbackInfo info;
+  info.eventName = "Topic";
+  info.tag = *topicName;
+  info.payload = payload;
+  info.payloadLength = (unsigned)payloadLength;
+  info.appContext = entry->callback.appContext;
+  info.statusCode = 0;
+  info.callbackResponse = NULL;
+  entry->callback.callback(getSingletonContext(), &info);
+}
+
 void handlePayload(char *msg, unsigned long msg_length, char *topic,
                    unsigned long topic_length) {
+  AzureIOT::StringPoolScope poolScope;
   if (topic_length) {
     assert(topic != NULL);
-    AzureIOT::StringBuffer topicName(topic, topic_length);
-    AzureIOT::StringBuffer payload;
-    if (msg_length) {
-      payload.initialize(msg, msg_length);
+    if (!singletonContext->topicRouter.dispatch(topic, topic_length, msg,
+                                                msg_length)) {
+      IOTC_LOG(F("ERROR: unknown twin topic: %.*s, msg: %.*s"),
+               (int)topic_length, topic, msg_length ? (int)msg_length : 4,
+               msg_length ? msg : "NULL");
     }
+  }
+}
 
-    if (topicName.startsWith("$iothub/twin", strlen("$iothub/twin"))) {
-      deviceTwinGetStateCallback(topicName, payload, singletonContext);
-    } else if (topicName.startsWith("$iothub/methods",
-                                    strlen("$iothub/methods"))) {
-      int index = topicName.indexOf("$rid=", 5, 0);
-      if (index == -1) {
-        IOTC_LOG(F("ERROR: corrupt C2D message topic => %s"), *topicName);
-        return;
-      }
+void clearTopicCallbacks(IOTContextInternal *internal) {
+  for (unsigned i = 0; i < IOTC_MAX_TOPIC_CALLBACKS; i++) {
+    TopicCallback &entry = internal->topicCallbacks[i];
+    if (*entry.prefix != NULL) {
+      internal->topicRouter.remove(*entry.prefix);
+      entry.prefix.clear();
+    }
+    entry.callback.callback = NULL;
+    entry.callback.appContext = NULL;
+  }
+}
 
-      const char *topicId = (*topicName + index + 5);
-      const char *topicTemplate = "$iothub/methods/POST/";
-      const int topicTemplateLength = strlen(topicTemplate);
-      index = topicName.indexOf("/", 1, topicTemplateLength + 1);
-      if (index == -1) {
-        IOTC_LOG(F("ERROR: corrupt C2D message topic (methodName) => %s"),
-                 *topicName);
-        return;
-      }
+/* extern */
+int iotc_on_topic(IOTContext ctx, const char *topicPrefix,
+                  IOTCallback callback, void *appContext) {
+  CHECK_NOT_NULL(ctx)
+  GET_LENGTH_NOT_NULL_NOT_EMPTY(topicPrefix, STRING_BUFFER_256);
 
-      AzureIOT::StringBuffer methodName(topic + topicTemplateLength,
-                                        index - topicTemplateLength);
-
-      const char *constResponse = "{}";
-      char *response = NULL;
-      size_t respSize = 0;
-      int rc = onCommand(*methodName, msg, msg_length, &response, &respSize,
-                         getSingletonContext());
-      if (respSize == 0) {
-        respSize = 2;
-      } else {
-        constResponse = response;
-      }
+  IOTContextInternal *internal = (IOTContextInternal *)ctx;
+  MUST_CALL_AFTER_INIT(internal);
+
+  if (strcmp(topicPrefix, METHODS_TOPIC_PREFIX) == 0 ||
+      strcmp(topicPrefix, DESIRED_TOPIC_PREFIX) == 0 ||
+      strcmp(topicPrefix, TWIN_TOPIC_PREFIX) == 0) {
+    IOTC_LOG(F("ERROR: (iotc_on_topic) %s is handled by the SDK. Use iotc_on "
+               "instead."),
+             topicPrefix);
+    return 1;
+  }
 
-      AzureIOT::StringBuffer respTopic(STRING_BUFFER_128);
-      respTopic.setLength(snprintf(*respTopic, STRING_BUFFER_128,
-                                   "$iothub/methods/res/%d/?$rid=%s", rc,
-                                   topicId));
-
-      if (mqtt_publish(getSingletonContext(), *respTopic, respTopic.getLength(),
-                       constResponse, respSize) != 0) {
-        IOTC_LOG(
-            "ERROR: mqtt_publish has failed during C2D with response "
-            "topic '%s' and response '%s'",
-            *respTopic, constResponse);
-      }
-      if (response != constResponse) {
-        IOTC_FREE(response);
-      }
-    } else {
-      IOTC_LOG(F("ERROR: unknown twin topic: %s, msg: %s"), topic,
-               msg_length ? msg : "NULL");
+  TopicCallback *entry = NULL, *empty = NULL;
+  for (unsigned i = 0; i < IOTC_MAX_TOPIC_CALLBACKS; i++) {
+    TopicCallback &slot = internal->topicCallbacks[i];
+    if (*slot.prefix == NULL) {
+      if (empty == NULL) empty = &slot;
+    } else if (strcmp(*slot.prefix, topicPrefix) == 0) {
+      entry = &slot;
+      break;
+    }
+  }
+
+  if (callback == NULL) {  // unregister
+    if (entry != NULL) {
+      internal->topicRouter.remove(*entry->prefix);
+      entry->prefix.clear();
+      entry->callback.callback = NULL;
+      entry->callback.appContext = NULL;
     }
+    return 0;
   }
+
+  if (entry == NULL) {
+    if (empty == NULL) {
+      IOTC_LOG(F("ERROR: (iotc_on_topic) no room for another topic callback. "
+                 "(max %d)"),
+               IOTC_MAX_TOPIC_CALLBACKS);
+      return 1;
+    }
+    entry = empty;
+    AzureIOT::StringHeapScope heapScope;
+    entry->prefix.initialize(topicPrefix, topicPrefix_len);
+    if (*entry->prefix == NULL) {
+      IOTC_LOG(F("ERROR: (iotc_on_topic) out of memory"));
+      return 1;
+    }
+    if (internal->topicRouter.add(*entry->prefix, onUserTopic, entry) != 0) {
+      IOTC_LOG(F("ERROR: (iotc_on_topic) topic router is full"));
+      entry->prefix.clear();
+      return 1;
+    }
+  }
+
+  entry->callback.callback = callback;
+  entry->callback.appContext = appContext;
+  return 0;
+}
+
+// keeps telemetry that couldn't be sent for drainStore
+// returns 0 if it was stored
+static int storeMessage(IOTContextInternal *internal, const char *payload,
+                        unsigned length) {
+  if (!internal->store.isOpen()) return 1;
+
+  if (internal->store.append(payload, length, getNow()) != 0) {
+    IOTC_LOG(F("ERROR: (storeMessage) the message couldn't be stored."));
+    return 1;
+  }
+  return 0;
+}
+
+void drainStore(IOTContextInternal *internal) {
+  AzureIOT::MessageStore &store = internal->store;
+  // the handlers that run while it publishes may call iotc_do_work
+  if (internal->draining || internal->mqttClient == NULL ||
+      !store.isOpen() || store.isEmpty()) {
+    return;
+  }
+
+  unsigned long now = millis();
+  if (now - internal->lastDrainMs < internal->storeDrainMs) return;
+  internal->lastDrainMs = now;
+
+  AzureIOT::StringBuffer message;
+  unsigned long timestamp = 0;
+  if (store.peek(message, timestamp) != 0) return;
+
+  // sent with the time it was created
+  unsigned eventsTopicLength = internal->eventsTopic.getLength();
+  AzureIOT::StringBuffer topic(eventsTopicLength + STRING_BUFFER_64);
+  memcpy(*topic, *internal->eventsTopic, eventsTopicLength);
+  unsigned topicLength = eventsTopicLength;
+  time_t created = (time_t)timestamp;
+  struct tm *utc = timestamp != 0 ? gmtime(&created) : NULL;
+  if (utc != NULL) {
+    topicLength += strftime(*topic + topicLength, STRING_BUFFER_64,
+                            "iothub-creation-time-utc=%Y-%m-%dT%H%%3A%M%%3A%SZ",
+                            utc);
+  }
+  topic.setLength(topicLength);
+
+  // MessageSent fires as for any other telemetry
+  internal->draining = true;
+  int rc = mqtt_publish_confirmed(internal, *topic, topicLength, *message,
+                                  message.getLength());
+  internal->draining = false;
+  if (rc != 0) return;  // tried again on the next turn
+
+  store.pop();
+}
+
+unsigned long getStoreWaitMs(IOTContextInternal *internal,
+                             unsigned long nowMs) {
+  AzureIOT::MessageStore &store = internal->store;
+  if (!store.isOpen() || store.isEmpty()) return IOTC_MAX_WAIT_MS;
+
+  unsigned long sinceMs = nowMs - internal->lastDrainMs;
+  return sinceMs >= internal->storeDrainMs ? 0
+                                           : internal->storeDrainMs - sinceMs;
 }
 
 /* extern */
@@ -436,6 +738,11 @@ int iotc_send_telemetry_with_system_properties(IOTContext ctx,
   CHECK_NOT_NULL(payload)
 
   IOTContextInternal *internal = (IOTContextInternal *)ctx;
+  if (internal->mqttClient == NULL && internal->store.isOpen() &&
+      sysPropPayloadLength == 0) {
+    // offline; iotc_do_work sends it once connected again
+    return storeMessage(internal, payload, length);
+  }
   MUST_CALL_AFTER_CONNECT(internal);
 
   if ((sysPropPayload == NULL && sysPropPayloadLength != 0) ||
@@ -446,27 +753,28 @@ int iotc_send_telemetry_with_system_properties(IOTContext ctx,
     return 1;
   }
 
-  AzureIOT::StringBuffer topic(internal->deviceId.getLength() +
-                               strlen("devices/ /messages/events/") +
-                               sysPropPayloadLength);
+  const char *topic = *internal->eventsTopic;
+  unsigned topicLength = internal->eventsTopic.getLength();
+  AzureIOT::StringBuffer sysPropTopic;
   if (sysPropPayloadLength > 0) {
-    topic.setLength(
-        snprintf(*topic, topic.getLength(), "devices/%s/messages/events/%.*s",
-                 *internal->deviceId, sysPropPayloadLength, sysPropPayload));
-  } else {
-    topic.setLength(snprintf(*topic, topic.getLength(),
-                             "devices/%s/messages/events/",
-                             *internal->deviceId));
+    // system properties change per message. only this case allocates
+    sysPropTopic.alloc(topicLength + sysPropPayloadLength + 1);
+    memcpy(*sysPropTopic, topic, topicLength);
+    memcpy(*sysPropTopic + topicLength, sysPropPayload, sysPropPayloadLength);
+    sysPropTopic.setLength(topicLength + sysPropPayloadLength);
+    topic = *sysPropTopic;
+    topicLength = sysPropTopic.getLength();
   }
 
-  if (mqtt_publish(internal, *topic, topic.getLength(), payload, length) != 0) {
+  int rc = mqtt_publish_confirmed(internal, topic, topicLength, payload, length);
+  if (rc == 1) {
+    if (sysPropPayloadLength == 0 && storeMessage(internal, payload, length) == 0) {
+      return 0;
+    }
     IOTC_LOG("ERROR: (iotc_send_telemetry) MQTTClient publish has failed => %s",
              payload);
-    return 1;
   }
-
-  sendConfirmationCallback(payload, length);
-  return 0;
+  return rc;
 }
 
 /* extern */
@@ -498,20 +806,47 @@ int iotc_send_property(IOTContext ctx, const char *payload, unsigned length) {
   IOTContextInternal *internal = (IOTContextInternal *)ctx;
   MUST_CALL_AFTER_CONNECT(internal);
 
-  const char *topicName = "$iothub/twin/PATCH/properties/reported/?$rid=%d";
-  AzureIOT::StringBuffer topic(
-      strlen(topicName) +
-      21);  // + 2 for %d == +23 in case requestId++ overflows
-  topic.setLength(
-      snprintf(*topic, topic.getLength(), topicName, internal->messageId++));
-
-  if (mqtt_publish(internal, *topic, topic.getLength(), payload, length) != 0) {
+  unsigned topicLength = nextReportedTopic(internal);
+  int rc = mqtt_publish_confirmed(internal, *internal->reportedTopic,
+                                  topicLength, payload, length);
+  if (rc == 1) {
     IOTC_LOG("ERROR: (iotc_send_property) MQTTClient publish has failed => %s",
              payload);
-    return 1;
   }
+  return rc;
+}
+
+/* extern */
+int iotc_set_inflight_window(IOTContext ctx, unsigned window) {
+  CHECK_NOT_NULL(ctx)
+
+  IOTContextInternal *internal = (IOTContextInternal *)ctx;
+  MUST_CALL_AFTER_INIT(internal);
+
+  if (window > MQTT_MAX_INFLIGHT) window = MQTT_MAX_INFLIGHT;
+  internal->inflightWindow = window;
+  if (internal->mqttClient != NULL && window > 0) {
+    internal->mqttClient->setInflightWindow(window);
+  }
+  return 0;
+}
+
+/* extern */
+int iotc_set_offline_store(IOTContext ctx, const char *path, unsigned slotCount,
+                           unsigned slotSize, unsigned drainIntervalMs) {
+  CHECK_NOT_NULL(ctx)
+
+  IOTContextInternal *internal = (IOTContextInternal *)ctx;
+  MUST_CALL_AFTER_INIT(internal);
+
+  internal->store.close();
+  internal->storeDrainMs = drainIntervalMs;
+  if (path == NULL) return 0;
 
-  sendConfirmationCallback(payload, length);
+  if (internal->store.open(path, slotCount, slotSize) != 0) {
+    IOTC_LOG(F("ERROR: (iotc_set_offline_store) couldn't open %s"), path);
+    return 1;
+  }
   return 0;
 }
 
@@ -528,9 +863,15 @@ int iotc_init_context(IOTContext *ctx) {
   IOTContextInternal *internal =
       (IOTContextInternal *)IOTC_MALLOC(sizeof(IOTContextInternal));
   CHECK_NOT_NULL(internal);
+  // no constructors run: every member (StringBuffer, TopicRouter, DPSClient,
+  // ...) is in its initial, empty state when all of its bytes are zero
   memset(internal, 0, sizeof(IOTContextInternal));
   *ctx = (void *)internal;
 
+  internal->topicRouter.add(METHODS_TOPIC_PREFIX, onMethodTopic, internal);
+  internal->topicRouter.add(DESIRED_TOPIC_PREFIX, onDesiredTopic, internal);
+  internal->topicRouter.add(TWIN_TOPIC_PREFIX, onTwinTopic, internal);
+
   setSingletonContext(internal);
 
   return 0;
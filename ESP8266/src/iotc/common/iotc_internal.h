@@ -10,11 +10,28 @@
 #include <assert.h>
 #include <limits.h>
 #include <stddef.h>  // size_t etc.
+#include "encoding.h"
+#include "hmac_sha256.h"
+#include "iotc_json.h"
+#include "message_store.h"
+#include "sas_token.h"
+#include "dps_client.h"
+#include "reconnect_policy.h"
+#include "topic_router.h"
 #include "string_buffer.h"
 
 #include "../iotc.h"
 
 #define AZ_IOT_HUB_MAX_LEN 1024
+// the MQTT packet buffer. Larger messages are streamed out, and come in as
+// chunks that are put back together on the heap (see IOTC_MAX_MESSAGE_SIZE)
+#ifndef IOTC_MQTT_BUFFER_SIZE
+#define IOTC_MQTT_BUFFER_SIZE 1024
+#endif
+// the largest inbound message (i.e. a twin document) that is put together
+#ifndef IOTC_MAX_MESSAGE_SIZE
+#define IOTC_MAX_MESSAGE_SIZE 16384
+#endif
 #define DEFAULT_ENDPOINT "global.azure-devices-provisioning.net"
 #define TO_STR_(s) #s
 #define TO_STR(s) TO_STR_(s)
@@ -36,6 +53,14 @@ typedef struct CallbackBase_TAG {
   }
 } CallbackBase;
 
+// routes left for iotc_on_topic once the built-in ones are in
+#define IOTC_MAX_TOPIC_CALLBACKS (TOPIC_ROUTER_MAX_ROUTES - 3)
+
+typedef struct TopicCallback_TAG {
+  AzureIOT::StringBuffer prefix;  // the router keeps a pointer to it
+  CallbackBase callback;
+} TopicCallback;
+
 typedef struct IOTContextInternal_TAG {
   char *endpoint;
   char *modelData;
@@ -44,8 +69,38 @@ typedef struct IOTContextInternal_TAG {
 
   int messageId;
   AzureIOT::StringBuffer deviceId;
+  // formatted once per connect (see cacheTopics)
+  AzureIOT::StringBuffer eventsTopic;    // devices/<deviceId>/messages/events/
+  AzureIOT::StringBuffer reportedTopic;  // REPORTED_TOPIC_PREFIX + room for the request id
+  // hub credentials. kept for the lifetime of the context so the SAS token
+  // can be renewed without parsing the key and host again
+  AzureIOT::StringBuffer hostName;
+  AzureIOT::StringBuffer username;
+  AzureIOT::SASToken sasToken;
+  // inbound topics (see handlePayload and iotc_on_topic)
+  AzureIOT::TopicRouter topicRouter;
+  TopicCallback topicCallbacks[IOTC_MAX_TOPIC_CALLBACKS];
+  // json tokens, kept between messages. echoDesired parses the document
+  // again while the twin callback still holds twinTokens
+  jstoken_pool_t twinTokens;
+  jstoken_pool_t echoTokens;
+  // QoS1 publishes waiting for their PUBACK; 0 publishes with QoS0
+  // (see iotc_set_inflight_window)
+  unsigned inflightWindow;
+  // device registration in progress (see iotc_connect_async)
+  AzureIOT::DPSClient dps;
+  // when to open the hub connection again (see iotc_set_reconnect)
+  AzureIOT::ReconnectPolicy reconnect;
+  // telemetry that couldn't be sent (see iotc_set_offline_store)
+  AzureIOT::MessageStore store;
+  unsigned storeDrainMs;
+  unsigned long lastDrainMs;
+  bool draining;  // drainStore is publishing
   ARDUINO_WIFI_SSL_CLIENT *tlsClient;
   PubSubClient *mqttClient;
+  // an inbound message larger than IOTC_MQTT_BUFFER_SIZE, as its chunks come
+  // in (NULL when there is none or it was dropped)
+  char *chunkedMessage;
 } IOTContextInternal;
 
 #define CHECK_NOT_NULL(x)             \
@@ -102,6 +157,14 @@ typedef struct IOTContextInternal_TAG {
   }
 #endif  // USE_LIGHT_CLIENT
 
+// the hub token is renewed this early (seconds) or, for short lived
+// tokens, once 90% of its lifetime has passed
+#define TOKEN_RENEWAL_MARGIN 300
+
+#define EVENTS_TOPIC_TEMPLATE "devices/%s/messages/events/"
+#define REPORTED_TOPIC_PREFIX "$iothub/twin/PATCH/properties/reported/?$rid="
+#define REPORTED_TOPIC_PREFIX_LENGTH (sizeof(REPORTED_TOPIC_PREFIX) - 1)
+
 #define HOSTNAME_STRING "HostName="
 #define DEVICEID_STRING ";DeviceId="
 #define KEY_STRING ";SharedAccessKey="
@@ -122,22 +185,99 @@ int getUsernameAndPasswordFromConnectionString(
 int getDPSAuthString(const char *scopeId, const char *deviceId, const char *key,
                      char *buffer, int bufferSize, size_t &outLength);
 
+// Sets hostName, deviceId, username and sasToken of the context up.
+// returns 0 if there is no error
+int setHubCredentials(IOTContextInternal *internal, const char *hostName,
+                      unsigned hostNameLength, const char *deviceId,
+                      unsigned deviceIdLength, const char *key,
+                      unsigned keyLength);
+int setHubCredentialsFromConnectionString(IOTContextInternal *internal,
+                                          const char *connectionString,
+                                          size_t connectionStringLength);
+void clearHubCredentials(IOTContextInternal *internal);
+
+// Writes a fresh SAS token for the hub connection into buffer.
+// returns 0 if there is no error
+int getHubPassword(IOTContextInternal *internal, char *buffer,
+                   unsigned bufferSize);
+// true when the token of the current connection is about to expire
+bool hubTokenNeedsRenewal(IOTContextInternal *internal);
+
 void setLogLevel(IOTLogLevel l);
 IOTLogLevel getLogLevel();
 
 void handlePayload(char *msg, unsigned long msg_length, char *topic,
                    unsigned long topic_length);
-int getHubHostName(IOTContextInternal* internal, const char *dpsEndpoint, const char *scopeId,
-                   const char *deviceId, const char *key, char *hostName);
+// Opens the TLS session of a registration (see DPSClient), with the trust
+// anchors and session cache of the platform
+// returns 0 if there is no error
+int connectDPS(ARDUINO_WIFI_SSL_CLIENT *client, const char *endpoint);
+// Starts the registration of deviceId with DPS (internal->dps)
+// returns 0 if there is no error
+int beginProvisioning(IOTContextInternal *internal, const char *scopeId,
+                      const char *deviceId, const char *key);
+// Moves the registration one step further (see DPSClient::step) and sets the
+// hub credentials up once DPS has assigned the device.
+// returns 0 when the credentials are set, 2 while it is in progress, 1 if it
+// has failed
+int provisionStep(IOTContextInternal *internal, unsigned readTimeoutMs);
+// Runs the registration to the end
+// returns 0 when the credentials are set
+int finishProvisioning(IOTContextInternal *internal);
 void connectionStatusCallback(IOTConnectionState status,
                               IOTContextInternal *internal);
 IOTContextInternal *getSingletonContext();
 void setSingletonContext(IOTContextInternal *ctx);
-void sendConfirmationCallback(const char *buffer, size_t size);
+// statusCode is 0 once the message was delivered
+void sendConfirmationCallback(const char *buffer, size_t size, int statusCode);
 
 int mqtt_publish(IOTContextInternal *internal, const char *topic,
                  unsigned long topic_length, const char *msg,
                  unsigned long msg_length);
+// Publishes telemetry and reported properties. MessageSent fires once the
+// hub acknowledged the message when the in-flight window is on, right away
+// otherwise. Never waits for a full window.
+// returns 0 if there is no error, IOTC_ERROR_WINDOW_FULL if the window is
+// full
+int mqtt_publish_confirmed(IOTContextInternal *internal, const char *topic,
+                           unsigned long topic_length, const char *msg,
+                           unsigned long msg_length);
+
+// The medium of the offline store (see MessageStore): a SPIFFS file, created
+// with `size` bytes of zeros.
+// returns NULL if it can't be opened
+void *iotc_store_open(const char *path, unsigned long size);
+void iotc_store_close(void *medium);
+// returns 0 if all `length` bytes were read
+int iotc_store_read(void *medium, unsigned long offset, void *data,
+                    unsigned length);
+// returns 0 once all `length` bytes are written and flushed
+int iotc_store_write(void *medium, unsigned long offset, const void *data,
+                     unsigned length);
+
+// Sends the next stored message when it's time. Call it from iotc_do_work
+void drainStore(IOTContextInternal *internal);
+// how long until drainStore has a message to send (IOTC_MAX_WAIT_MS if there
+// is none)
+unsigned long getStoreWaitMs(IOTContextInternal *internal, unsigned long nowMs);
+
+// Formats the telemetry and reported property topics for internal->deviceId.
+// Call it from iotc_connect, once deviceId is known.
+// returns 0 if there is no error
+int cacheTopics(IOTContextInternal *internal);
+void clearTopics(IOTContextInternal *internal);
+// Drops the iotc_on_topic registrations. Call it from iotc_free_context
+void clearTopicCallbacks(IOTContextInternal *internal);
+
+// The hub connection is open: fires ConnectionStatus (IOTC_CONNECTION_OK)
+// and lets the reconnect policy know
+void hubConnected(IOTContextInternal *internal);
+// The hub connection was lost, or a try to open it again has failed, for
+// `reason`. Schedules the next try (see iotc_set_reconnect) and fires
+// ConnectionStatus with IOTC_CONNECTION_RETRY_EXPIRED when the policy gives
+// up.
+// returns 0 if a try is scheduled
+int scheduleReconnect(IOTContextInternal *internal, IOTConnectionState reason);
 
 #ifdef __cplusplus
 }
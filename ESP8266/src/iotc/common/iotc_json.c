@@ -1,20 +1,95 @@
 #include <stdlib.h>
+#include <string.h>
 #include "iotc_json.h"
 
-int jsobject_initialize(jsobject_t *object, const char *js, unsigned len) {
+#define JSOBJECT_MIN_TOKENS 16
+
+// doubles the token array, keeping the first `used` tokens
+static int jsobject_grow_tokens(jsmntok_t **tokens, unsigned *capacity,
+                                unsigned used) {
+  unsigned newCapacity =
+      *capacity < JSOBJECT_MIN_TOKENS ? JSOBJECT_MIN_TOKENS : *capacity * 2;
+  jsmntok_t *newTokens =
+      (jsmntok_t *)IOTC_MALLOC(newCapacity * sizeof(jsmntok_t));
+  if (newTokens == NULL) return 1;
+
+  // the parser resumes with the tokens it has filled so far
+  if (used) memcpy(newTokens, *tokens, used * sizeof(jsmntok_t));
+  if (*tokens != NULL) IOTC_FREE(*tokens);
+  *tokens = newTokens;
+  *capacity = newCapacity;
+  return 0;
+}
+
+// Single pass; jsmn picks up where it stopped when it ran out of tokens
+static int jsobject_parse(jsobject_t *object, jsmntok_t **tokens,
+                          unsigned *capacity) {
+  // jsmn only counts when there is no token array at all
+  if (*tokens == NULL && jsobject_grow_tokens(tokens, capacity, 0) != 0) {
+    return JSMN_ERROR_NOMEM;
+  }
+
+  jsmn_init(&object->parser);
+  for (;;) {
+    int count = jsmn_parse(&object->parser, object->json, object->length,
+                           *tokens, *capacity);
+    if (count != JSMN_ERROR_NOMEM) return count;
+    if (jsobject_grow_tokens(tokens, capacity, object->parser.toknext) != 0) {
+      return JSMN_ERROR_NOMEM;
+    }
+  }
+}
+
+void jstoken_pool_free(jstoken_pool_t *pool) {
+  if (pool->tokens != NULL) {
+    IOTC_FREE(pool->tokens);
+  }
+  pool->tokens = NULL;
+  pool->capacity = 0;
+  pool->busy = 0;
+}
+
+int jsobject_initialize_pooled(jsobject_t *object, const char *js,
+                               unsigned len, jstoken_pool_t *pool) {
+  if (pool == NULL || pool->busy) {
+    return jsobject_initialize(object, js, len);
+  }
+
   object->json = js;
   object->length = len;
+  object->ownsTokens = 0;
   object->tokens = NULL;
-  jsmn_init(&object->parser);
+  object->pool = NULL;
 
-  object->tokenCount = jsmn_parse(&object->parser, object->json, object->length, NULL, 0);
-  if (object->tokenCount < 0) {
-    return object->tokenCount;
+  int count = jsobject_parse(object, &pool->tokens, &pool->capacity);
+  if (count < 0) {
+    object->tokenCount = 0;
+    return count;
   }
 
-  jsmn_init(&object->parser);
-  object->tokens = (jsmntok_t *)IOTC_MALLOC(object->tokenCount * sizeof(jsmntok_t));
-  jsmn_parse(&object->parser, object->json, object->length, object->tokens, object->tokenCount);
+  pool->busy = 1;
+  object->pool = pool;
+  object->tokens = pool->tokens;
+  object->tokenCount = count;
+  return 0;
+}
+
+int jsobject_initialize(jsobject_t *object, const char *js, unsigned len) {
+  object->json = js;
+  object->length = len;
+  object->pool = NULL;
+  object->ownsTokens = 1;
+  object->tokens = NULL;
+
+  unsigned capacity = 0;
+  int count = jsobject_parse(object, &object->tokens, &capacity);
+  if (count < 0) {
+    // an empty object, so the accessors stay safe to call
+    jsobject_free(object);
+    object->tokenCount = 0;
+    return count;
+  }
+  object->tokenCount = count;
   return 0;
 }
 
@@ -31,24 +106,70 @@ int jsobject_compare(jsobject_t *object, int index, const char *s) {
   return -1;
 }
 
-// caller responsible from free'ing the memory
-char *jsobject_get_name_at(jsobject_t *object, int index) {
+int jsobject_get_name_span_at(jsobject_t *object, int index,
+                              const char **out) {
   index *= 2;  // even indexes are names, odd indexes are values
-  return jsobject_get_string_at(object, index);
+  return jsobject_get_string_span_at(object, index, out);
 }
 
-// caller responsible from free'ing the memory
-char *jsobject_get_string_at(jsobject_t *object, int index) {
+int jsobject_get_string_span_at(jsobject_t *object, int index,
+                                const char **out) {
   if (index + 1 >= object->tokenCount) {
-    return NULL;
+    return -1;
   }
 
-  jsmntok_t token = object->tokens[index + 1];
-  unsigned n = token.end - token.start;
-  char *name = (char *)IOTC_MALLOC(1 + n);
-  memcpy(name, object->json + token.start, n);
-  name[n] = 0;
-  return name;
+  jsmntok_t *token = &object->tokens[index + 1];
+  *out = object->json + token->start;
+  return token->end - token->start;
+}
+
+int jsobject_get_string_span_by_name(jsobject_t *object, const char *name,
+                                     const char **out) {
+  int index = jsobject_get_index_by_name(object, name);
+  if (index == -1) {
+    return -1;  // let consumer file the log
+  }
+
+  return jsobject_get_string_span_at(object, index, out);
+}
+
+int jsobject_get_data_span_by_name(jsobject_t *object, const char *name,
+                                   const char **out) {
+  int index = jsobject_get_index_by_name(object, name);
+  if (index == -1) {
+    return -1;  // let consumer file the log
+  }
+
+  int length = jsobject_get_string_span_at(object, index, out);
+  if (length != -1 && object->tokens[index + 1].type == JSMN_STRING) {
+    *out -= 1;  // put the quotes back
+    length += 2;
+  }
+  return length;
+}
+
+static char *jsobject_copy_span(const char *data, int length) {
+  if (length < 0) return NULL;
+
+  char *copy = (char *)IOTC_MALLOC(1 + length);
+  if (copy == NULL) return NULL;
+  memcpy(copy, data, length);
+  copy[length] = 0;
+  return copy;
+}
+
+// caller responsible from free'ing the memory
+char *jsobject_get_name_at(jsobject_t *object, int index) {
+  const char *name = NULL;
+  int length = jsobject_get_name_span_at(object, index, &name);
+  return jsobject_copy_span(name, length);
+}
+
+// caller responsible from free'ing the memory
+char *jsobject_get_string_at(jsobject_t *object, int index) {
+  const char *value = NULL;
+  int length = jsobject_get_string_span_at(object, index, &value);
+  return jsobject_copy_span(value, length);
 }
 
 unsigned jsobject_get_count(jsobject_t *object) { return object->tokenCount; }
@@ -62,59 +183,67 @@ int jsobject_get_index_by_name(jsobject_t *object, const char *name) {
 
 void jsobject_free(jsobject_t *object) {
   if (object->tokens != NULL) {
-    IOTC_FREE(object->tokens);
+    if (object->pool != NULL) {
+      object->pool->busy = 0;
+    } else if (object->ownsTokens) {
+      IOTC_FREE(object->tokens);
+    }
     object->tokens = NULL;
   }
+  object->pool = NULL;
 }
 
 int jsobject_get_object_by_name(jsobject_t *object, const char *name,
                                 jsobject_t *out) {
+  out->tokens = NULL;
+  out->tokenCount = 0;
+  out->pool = NULL;
+  out->ownsTokens = 0;
+
   int index = jsobject_get_index_by_name(object, name);
-  if (index == -1) {
+  if (index == -1 || index + 1 >= object->tokenCount) {
     return 1;  // let consumer file the log
   }
 
-  jsmntok_t token = object->tokens[index + 1];
-  unsigned n = token.end - token.start;
-  jsobject_initialize(out, object->json + token.start, n);
+  // the tokens of a value are the ones that start before it ends. Offsets
+  // stay relative to object->json
+  jsmntok_t *tokens = &object->tokens[index + 1];
+  int count = 1;
+  while (index + 1 + count < object->tokenCount &&
+         tokens[count].start < tokens->end) {
+    count++;
+  }
+
+  out->json = object->json;
+  out->length = object->length;
+  out->parser = object->parser;
+  out->tokens = tokens;
+  out->tokenCount = count;
   return 0;
 }
 
 char *jsobject_get_string_by_name(jsobject_t *object, const char *name) {
-  int index = jsobject_get_index_by_name(object, name);
-  if (index == -1) {
-    return NULL;  // let consumer file the log
-  }
-
-  jsmntok_t token = object->tokens[index + 1];
-  unsigned n = token.end - token.start;
-  char *value = (char *)IOTC_MALLOC(1 + n);
-  memcpy(value, object->json + token.start, n);
-  value[n] = 0;
-  return value;
+  const char *value = NULL;
+  int length = jsobject_get_string_span_by_name(object, name, &value);
+  return jsobject_copy_span(value, length);
 }
 
 double jsobject_get_number_by_name(jsobject_t *object, const char *name) {
-  char *str = jsobject_get_string_by_name(object, name);
-  if (str == NULL) return 0;
-
-  double n = atof(str);
-  IOTC_FREE(str);
-  return n;
+  const char *value = NULL;
+  int length = jsobject_get_string_span_by_name(object, name, &value);
+  if (length <= 0) return 0;
+
+  // a number doesn't need more than this
+  char number[32];
+  if (length >= (int)sizeof(number)) length = sizeof(number) - 1;
+  memcpy(number, value, length);
+  number[length] = 0;
+  return atof(number);
 }
 
 // caller responsible from free'ing the memory
-char *jsobject_get_data_by_name(jsobject_t *object, const char*name) {
-  int index = jsobject_get_index_by_name(object, name);
-  if (index == -1) {
-    return NULL;  // let consumer file the log
-  }
-
-  jsmntok_t token = object->tokens[index + 1];
-  unsigned n = (token.end - token.start) + (token.type == JSMN_STRING ? 2 : 0);
-  unsigned start = token.type == JSMN_STRING ? (object->json + token.start - 1) : (object->json + token.start);
-  char *value = (char *)IOTC_MALLOC(1 + n);
-  memcpy(value, start, n);
-  value[n] = 0;
-  return value;
-}
\ No newline at end of file
+char *jsobject_get_data_by_name(jsobject_t *object, const char *name) {
+  const char *value = NULL;
+  int length = jsobject_get_data_span_by_name(object, name, &value);
+  return jsobject_copy_span(value, length);
+}
@@ -0,0 +1,190 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license.
+
+#include <string.h>
+#include "iotc_internal.h"
+
+#define SEQ_MASK 0xFFFFFFFFUL
+
+namespace AzureIOT {
+
+// little endian, so a store moves between hosts
+static void putNumber(unsigned char* p, unsigned long value, unsigned bytes) {
+  for (unsigned i = 0; i < bytes; i++) {
+    p[i] = (unsigned char)(value >> (8 * i));
+  }
+}
+
+static unsigned long getNumber(const unsigned char* p, unsigned bytes) {
+  unsigned long value = 0;
+  for (unsigned i = bytes; i > 0; i--) {
+    value = (value << 8) | p[i - 1];
+  }
+  return value;
+}
+
+// Fletcher-16 over the header (but the checksum) and the message
+static unsigned checksum(const unsigned char* header, const char* data,
+                         unsigned length) {
+  unsigned a = 0, b = 0;
+  for (unsigned i = 0; i < MESSAGE_STORE_HEADER_SIZE - 2; i++) {
+    a = (a + header[i]) % 255;
+    b = (b + a) % 255;
+  }
+  for (unsigned i = 0; i < length; i++) {
+    a = (a + (unsigned char)data[i]) % 255;
+    b = (b + a) % 255;
+  }
+  return (b << 8) | a;
+}
+
+int MessageStore::open(const char* path, unsigned count, unsigned size) {
+  close();
+  if (count == 0) return 1;
+
+  if (size < MESSAGE_STORE_MIN_SLOT_SIZE) size = MESSAGE_STORE_MIN_SLOT_SIZE;
+  if (size > MESSAGE_STORE_HEADER_SIZE + 0xFFFF) {
+    size = MESSAGE_STORE_HEADER_SIZE + 0xFFFF;
+  }
+
+  medium = iotc_store_open(path, (unsigned long)count * size);
+  if (medium == NULL) return 1;
+
+  slotCount = count;
+  slotSize = size;
+
+  // the oldest and the newest message that are still pending
+  unsigned long first = 0, last = 0;
+  StringBuffer data;
+  for (unsigned slot = 0; slot < slotCount; slot++) {
+    unsigned char header[MESSAGE_STORE_HEADER_SIZE];
+    if (iotc_store_read(medium, (unsigned long)slot * slotSize, header,
+                        MESSAGE_STORE_HEADER_SIZE) != 0) {
+      break;
+    }
+
+    unsigned long seq = getNumber(header, 4);
+    if (seq == 0 || seq % slotCount != slot) continue;
+
+    tail = seq;
+    head = seq + 1;
+    data.clear();
+    unsigned long timestamp = 0;
+    if (peek(data, timestamp) != 0) continue;
+
+    if (first == 0 || seq < first) first = seq;
+    if (seq > last) last = seq;
+  }
+
+  if (first == 0) {
+    head = tail = 1;
+  } else {
+    tail = first;
+    head = last + 1;
+  }
+  return 0;
+}
+
+void MessageStore::close() {
+  if (medium != NULL) {
+    iotc_store_close(medium);
+  }
+  medium = NULL;
+  slotCount = 0;
+  slotSize = 0;
+  head = tail = 0;
+}
+
+int MessageStore::readHeader(unsigned long seq, unsigned long& timestamp,
+                             unsigned& length) {
+  unsigned char header[MESSAGE_STORE_HEADER_SIZE];
+  if (iotc_store_read(medium, (unsigned long)(seq % slotCount) * slotSize,
+                      header, MESSAGE_STORE_HEADER_SIZE) != 0) {
+    return 1;
+  }
+
+  // sent (zeroed) or overwritten
+  if (getNumber(header, 4) != (seq & SEQ_MASK)) return 1;
+
+  timestamp = getNumber(header + 4, 4);
+  length = (unsigned)getNumber(header + 8, 2);
+  return length > getMaxMessageLength() ? 1 : 0;
+}
+
+int MessageStore::append(const char* data, unsigned length,
+                         unsigned long timestamp) {
+  if (medium == NULL || length > getMaxMessageLength()) return 1;
+
+  // header and message in one write
+  StringBuffer slot(MESSAGE_STORE_HEADER_SIZE + length);
+  unsigned char* header = (unsigned char*)*slot;
+  if (header == NULL) return 1;
+
+  // full; the oldest message goes
+  if (head - tail >= slotCount) {
+    tail = head - slotCount + 1;
+  }
+
+  putNumber(header, head & SEQ_MASK, 4);
+  putNumber(header + 4, timestamp & SEQ_MASK, 4);
+  putNumber(header + 8, length, 2);
+  putNumber(header + 10, checksum(header, data, length), 2);
+  memcpy(header + MESSAGE_STORE_HEADER_SIZE, data, length);
+
+  // a torn write fails the checksum; open() and peek() skip it
+  if (iotc_store_write(medium, (unsigned long)(head % slotCount) * slotSize,
+                       header, MESSAGE_STORE_HEADER_SIZE + length) != 0) {
+    return 1;
+  }
+
+  head++;
+  return 0;
+}
+
+int MessageStore::peek(StringBuffer& out, unsigned long& timestamp) {
+  if (medium == NULL) return 1;
+
+  for (; tail != head; tail++) {
+    unsigned length = 0;
+    if (readHeader(tail, timestamp, length) != 0) continue;
+
+    unsigned char header[MESSAGE_STORE_HEADER_SIZE];
+    putNumber(header, tail & SEQ_MASK, 4);
+    putNumber(header + 4, timestamp, 4);
+    putNumber(header + 8, length, 2);
+
+    unsigned long offset = (unsigned long)(tail % slotCount) * slotSize;
+    unsigned char stored[2];
+    out.clear();
+    out.alloc(length + 1);
+    if (*out == NULL ||
+        iotc_store_read(medium, offset + MESSAGE_STORE_HEADER_SIZE - 2, stored,
+                        2) != 0 ||
+        iotc_store_read(medium, offset + MESSAGE_STORE_HEADER_SIZE, *out,
+                        length) != 0 ||
+        getNumber(stored, 2) != checksum(header, *out, length)) {
+      out.clear();
+      continue;
+    }
+
+    out.setLength(length);
+    return 0;
+  }
+  return 1;
+}
+
+int MessageStore::pop() {
+  if (medium == NULL || tail == head) return 1;
+
+  // only the sequence number; the message itself stays until overwritten
+  const unsigned char zero[4] = {0, 0, 0, 0};
+  if (iotc_store_write(medium, (unsigned long)(tail % slotCount) * slotSize,
+                       zero, sizeof(zero)) != 0) {
+    return 1;
+  }
+
+  tail++;
+  return 0;
+}
+
+}  // namespace AzureIOT
@@ -0,0 +1,66 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license.
+
+#ifndef AZURE_IOTC_LITE_MESSAGE_STORE_H
+#define AZURE_IOTC_LITE_MESSAGE_STORE_H
+
+#include <stddef.h>
+#include "string_buffer.h"
+
+// seq (4), timestamp (4), length (2), checksum (2)
+#define MESSAGE_STORE_HEADER_SIZE 12
+#define MESSAGE_STORE_MIN_SLOT_SIZE 64
+
+namespace AzureIOT {
+
+// Messages that couldn't be sent, kept on the store medium (a SPIFFS file,
+// see iotc_store_open) until they can.
+//
+// The medium is a ring of slotCount fixed size slots; message n goes to slot
+// n % slotCount. Appends walk over all slots in turn and nothing is
+// rewritten in place (no index, no head pointer), so the writes spread over
+// the whole medium. Once the ring is full the oldest message is overwritten.
+// A sent message is marked by zeroing its sequence number.
+//
+// open() finds the pending messages again by their sequence numbers; a
+// slot whose checksum doesn't match (i.e. a torn write) is skipped.
+//
+// A zeroed store is closed; open() attaches the medium.
+class MessageStore {
+  void* medium;
+  unsigned slotCount;
+  unsigned slotSize;
+  unsigned long head;  // sequence number of the next message
+  unsigned long tail;  // sequence number of the oldest pending message
+
+  int readHeader(unsigned long seq, unsigned long& timestamp,
+                 unsigned& length);
+
+ public:
+  // Opens (or creates) the store at path.
+  // returns 0 if there is no error
+  int open(const char* path, unsigned slotCount, unsigned slotSize);
+  void close();
+
+  bool isOpen() { return medium != NULL; }
+  bool isEmpty() { return head == tail; }
+  unsigned getMaxMessageLength() {
+    return slotSize - MESSAGE_STORE_HEADER_SIZE;
+  }
+
+  // Drops the oldest message when the store is full.
+  // returns 0 if there is no error
+  int append(const char* data, unsigned length, unsigned long timestamp);
+
+  // Reads the oldest pending message into out.
+  // returns 0 if there is one
+  int peek(StringBuffer& out, unsigned long& timestamp);
+
+  // Marks the oldest pending message as sent.
+  // returns 0 if there is no error
+  int pop();
+};
+
+}  // namespace AzureIOT
+
+#endif  // AZURE_IOTC_LITE_MESSAGE_STORE_H
@@ -0,0 +1,126 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license.
+
+#include <stdio.h>
+#include "iotc_internal.h"
+
+#define SAS_SIGNATURE_LENGTH 44  // base64 of HMAC_SHA256_LENGTH bytes
+
+namespace AzureIOT {
+
+// signs "<uri>\n<expiry>" without putting the parts together
+static bool signTo(char* signature, const char* key, unsigned keyLength,
+                   const char* uri, unsigned uriLength, const char* expiry,
+                   unsigned expiryLength) {
+  unsigned char digest[HMAC_SHA256_LENGTH];
+  HmacSha256 hmac;
+  if (!hmac.init(key, keyLength) || !hmac.update(uri, uriLength) ||
+      !hmac.update("\n", 1) || !hmac.update(expiry, expiryLength) ||
+      !hmac.final(digest)) {
+    return false;
+  }
+
+  return base64EncodeTo(signature, digest, HMAC_SHA256_LENGTH) ==
+         SAS_SIGNATURE_LENGTH;
+}
+
+int SASToken::initialize(const char* base64Key, unsigned base64KeyLength,
+                         const char* root, unsigned rootLength,
+                         const char* section, const char* id,
+                         unsigned idLength) {
+  assert(base64Key != NULL && root != NULL && section != NULL && id != NULL);
+  clear();
+
+  if (base64KeyLength == 0) {
+    IOTC_LOG(F("ERROR: (SASToken) key is empty"));
+    return 1;
+  }
+
+  unsigned keyLength = base64DecodedLength(base64Key, base64KeyLength);
+  if (keyLength == 0) {
+    IOTC_LOG(F("ERROR: (SASToken) couldn't decode the key"));
+    return 1;
+  }
+
+  key.alloc(keyLength + 1);
+  if (*key == NULL || !base64DecodeTo((unsigned char*)*key, base64Key,
+                                      base64KeyLength, keyLength)) {
+    IOTC_LOG(F("ERROR: (SASToken) couldn't decode the key"));
+    clear();
+    return 1;
+  }
+  key.setLength(keyLength);
+
+  unsigned sectionLength = strlen(section);
+  resourceURI.alloc(urlEncodedLength(root, rootLength) + sectionLength +
+                    urlEncodedLength(id, idLength) + 1);
+  if (*resourceURI == NULL) {
+    IOTC_LOG(F("ERROR: (SASToken) out of memory"));
+    clear();
+    return 1;
+  }
+
+  char* uri = *resourceURI;
+  unsigned length = urlEncodeTo(uri, root, rootLength);
+  memcpy(uri + length, section, sectionLength);
+  length += sectionLength;
+  length += urlEncodeTo(uri + length, id, idLength);
+  resourceURI.setLength(length);
+
+  return 0;
+}
+
+void SASToken::clear() {
+  if (*key != NULL) {
+    memset(*key, 0, key.getLength());
+  }
+  key.clear();
+  resourceURI.clear();
+  expiresAt = 0;
+}
+
+unsigned SASToken::write(char* buffer, unsigned bufferSize,
+                         unsigned long expires) {
+  assert(buffer != NULL && isInitialized());
+
+  char expiry[STRING_BUFFER_32];
+  unsigned expiryLength =
+      snprintf(expiry, STRING_BUFFER_32, "%lu000", expires);
+  unsigned uriLength = resourceURI.getLength();
+
+  char signature[SAS_SIGNATURE_LENGTH + 1];
+  if (!signTo(signature, *key, key.getLength(), *resourceURI, uriLength,
+              expiry, expiryLength)) {
+    IOTC_LOG(F("ERROR: (SASToken) signing has failed"));
+    return 0;
+  }
+
+  char encoded[3 * SAS_SIGNATURE_LENGTH];  // '+', '/' and '=' are escaped
+  unsigned encodedLength =
+      urlEncodeTo(encoded, signature, SAS_SIGNATURE_LENGTH);
+  if (SAS_TOKEN_PREFIX_LENGTH + uriLength + 5 /* &sig= */ + encodedLength +
+          4 /* &se= */ + expiryLength + 1 >
+      bufferSize) {
+    IOTC_LOG(F("ERROR: (SASToken) buffer is too small (%u)"), bufferSize);
+    return 0;
+  }
+
+  memcpy(buffer, SAS_TOKEN_PREFIX, SAS_TOKEN_PREFIX_LENGTH);
+  unsigned pos = SAS_TOKEN_PREFIX_LENGTH;
+  memcpy(buffer + pos, *resourceURI, uriLength);
+  pos += uriLength;
+  memcpy(buffer + pos, "&sig=", 5);
+  pos += 5;
+  memcpy(buffer + pos, encoded, encodedLength);
+  pos += encodedLength;
+  memcpy(buffer + pos, "&se=", 4);
+  pos += 4;
+  memcpy(buffer + pos, expiry, expiryLength);
+  pos += expiryLength;
+  buffer[pos] = 0;
+
+  expiresAt = expires;
+  return pos;
+}
+
+}  // namespace AzureIOT
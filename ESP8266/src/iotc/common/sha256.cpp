@@ -48,31 +48,38 @@ void Sha256::hashBlock() {
   g = state.w[6];
   h = state.w[7];
 
-  for (i = 0; i < 64; i++) {
-    if (i >= 16) {
-      t1 = buffer.w[i & 15] + buffer.w[(i - 7) & 15];
-      t2 = buffer.w[(i - 2) & 15];
-      t1 += ror32(t2, 17) ^ ror32(t2, 19) ^ (t2 >> 10);
-      t2 = buffer.w[(i - 15) & 15];
-      t1 += ror32(t2, 7) ^ ror32(t2, 18) ^ (t2 >> 3);
-      buffer.w[i & 15] = t1;
-    }
-    t1 = h;
-    t1 += ror32(e, 6) ^ ror32(e, 11) ^ ror32(e, 25);  // ∑1(e)
-    t1 += g ^ (e & (g ^ f));                          // Ch(e,f,g)
-    t1 += pgm_read_dword(SHA256_K + i);               // Ki
-    t1 += buffer.w[i & 15];                           // Wi
-    t2 = ror32(a, 2) ^ ror32(a, 13) ^ ror32(a, 22);   // ∑0(a)
-    t2 += ((b & c) | (a & (b | c)));                  // Maj(a,b,c)
-    h = g;
-    g = f;
-    f = e;
-    e = d + t1;
-    d = c;
-    c = b;
-    b = a;
-    a = t1 + t2;
+  // rounds 0..15 use the block as is, the rest extend the message schedule
+  // in place. two loops keep the schedule branch out of the round function
+#define SHA256_ROUND(i)                                        \
+  t1 = h;                                                      \
+  t1 += ror32(e, 6) ^ ror32(e, 11) ^ ror32(e, 25); /* ∑1(e) */ \
+  t1 += g ^ (e & (g ^ f));                 /* Ch(e,f,g) */     \
+  t1 += pgm_read_dword(SHA256_K + i);      /* Ki */            \
+  t1 += buffer.w[i & 15];                  /* Wi */            \
+  t2 = ror32(a, 2) ^ ror32(a, 13) ^ ror32(a, 22); /* ∑0(a) */  \
+  t2 += ((b & c) | (a & (b | c)));         /* Maj(a,b,c) */    \
+  h = g;                                                       \
+  g = f;                                                       \
+  f = e;                                                       \
+  e = d + t1;                                                  \
+  d = c;                                                       \
+  c = b;                                                       \
+  b = a;                                                       \
+  a = t1 + t2;
+
+  for (i = 0; i < 16; i++) {
+    SHA256_ROUND(i)
+  }
+  for (; i < 64; i++) {
+    t1 = buffer.w[i & 15] + buffer.w[(i - 7) & 15];
+    t2 = buffer.w[(i - 2) & 15];
+    t1 += ror32(t2, 17) ^ ror32(t2, 19) ^ (t2 >> 10);
+    t2 = buffer.w[(i - 15) & 15];
+    t1 += ror32(t2, 7) ^ ror32(t2, 18) ^ (t2 >> 3);
+    buffer.w[i & 15] = t1;
+    SHA256_ROUND(i)
   }
+#undef SHA256_ROUND
   state.w[0] += a;
   state.w[1] += b;
   state.w[2] += c;
@@ -104,6 +111,28 @@ void Sha256::write(uint8_t data) {
 #endif
 }
 
+void Sha256::update(const uint8_t* data, size_t length) {
+  byteCount += length;
+
+  // complete a partially filled block first
+  while (length > 0 && bufferOffset != 0) {
+    push(*data++);
+    length--;
+  }
+
+  // whole blocks are loaded as big endian words and hashed right away
+  while (length >= BLOCK_LENGTH) {
+    for (uint8_t i = 0; i < BLOCK_LENGTH / 4; i++, data += 4) {
+      buffer.w[i] = ((uint32_t)data[0] << 24) | ((uint32_t)data[1] << 16) |
+                    ((uint32_t)data[2] << 8) | (uint32_t)data[3];
+    }
+    hashBlock();
+    length -= BLOCK_LENGTH;
+  }
+
+  while (length--) push(*data++);
+}
+
 void Sha256::padBlock() {
   // Implement SHA-256 padding (fips180-2 §5.1.1)
 
@@ -150,7 +179,7 @@ void Sha256::initHmac(const uint8_t* key, size_t keyLength) {
   if (keyLength > BLOCK_LENGTH) {
     // Hash long keys
     init();
-    for (; keyLength--;) write(*key++);
+    update(key, keyLength);
     memcpy(keyBuffer, result(), HASH_LENGTH);
   } else {
     // Block length keys are used as is
@@ -164,16 +193,20 @@ uint8_t* Sha256::resultHmac(void) {
   // Complete inner hash
   memcpy(innerHash, result(), HASH_LENGTH);
   // Calculate outer hash
+  uint8_t pad[BLOCK_LENGTH];
+  for (i = 0; i < BLOCK_LENGTH; i++) pad[i] = keyBuffer[i] ^ HMAC_OPAD;
   init();
-  for (i = 0; i < BLOCK_LENGTH; i++) write(keyBuffer[i] ^ HMAC_OPAD);
-  for (i = 0; i < HASH_LENGTH; i++) write(innerHash[i]);
+  update(pad, BLOCK_LENGTH);
+  update(innerHash, HASH_LENGTH);
   return result();
 }
 
 void Sha256::reset(void) {
   // Start inner hash
-  init();
+  uint8_t pad[BLOCK_LENGTH];
   for (uint8_t i = 0; i < BLOCK_LENGTH; i++) {
-    write(keyBuffer[i] ^ HMAC_IPAD);
+    pad[i] = keyBuffer[i] ^ HMAC_IPAD;
   }
+  init();
+  update(pad, BLOCK_LENGTH);
 }
\ No newline at end of file
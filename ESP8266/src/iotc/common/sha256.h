@@ -25,6 +25,9 @@ class Sha256 : public Print {
   // Reset to initial state, but preserve key material.
   void reset(void);
 
+  // Hash `length` bytes. Whole 64 byte blocks skip the per byte path.
+  void update(const uint8_t* data, size_t length);
+
   uint8_t* result(void);
   uint8_t* resultHmac(void);
 #if defined(ARDUINO) && ARDUINO >= 100
@@ -1,33 +1,13 @@
 // Copyright (c) Microsoft. All rights reserved.
 // Licensed under the MIT license.
 
-#include <ctype.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include "iotc_internal.h"
+#include "string_pool.h"
 
 namespace AzureIOT {
 
-static char convertToHex(char ch) {
-  static const char *lst = "0123456789ABCDEF";
-  return *(lst + (ch & 15));
-}
-
-static char convertFromHex(char ch) {
-  assert(isdigit(ch) || isalpha(ch));  // isalnum ?
-  if (ch <= '9') {
-    return ch - '0';
-  } else {
-    if (ch <= 'Z') {
-      ch = ch - 'A';
-    } else {
-      ch = ch - 'a';
-    }
-
-    return ch + 10;
-  }
-}
-
 bool StringBuffer::startsWith(const char *str, size_t len) {
   if (len > length) return false;
 
@@ -71,105 +51,74 @@ int32_t StringBuffer::indexOf(const char *look_for, size_t look_for_length,
 
 bool StringBuffer::urlEncode() {
   assert(data != NULL);
-  size_t buffer_length = (length * 3) + 1;
-  char *buffer = (char *)IOTC_MALLOC(buffer_length);
-  if (buffer == NULL) {
-    return false;
+  unsigned encodedLength = urlEncodedLength(data, length);
+  if (encodedLength == length) {
+    return true;  // nothing to escape
   }
 
-  char *tmp = buffer;
-  assert(buffer != NULL);
-
-  for (size_t i = 0; i < length; i++) {
-    char ch = data[i];
-    if (isalnum(ch) || ch == '_' || ch == '-' || ch == '~' || ch == '.') {
-      *tmp = ch;
-    } else if (ch == ' ') {
-      *tmp = '+';
-    } else {
-      *tmp++ = '%';
-      *tmp++ = convertToHex(ch >> 4);
-      *tmp = convertToHex(ch & 15);
-    }
-    tmp++;
+  char *buffer = (char *)StringPool::allocate(encodedLength + 1);
+  if (buffer == NULL) {
+    return false;
   }
-  *tmp = 0;
+  urlEncodeTo(buffer, data, length);
 
   clear();  // free prev memory
 
   data = buffer;
-  length = (size_t)tmp - (size_t)buffer;
+  setLength(encodedLength);
   return true;
 }
 
 bool StringBuffer::urlDecode() {  // in-memory
   assert(data != NULL);
-  char *tmp = data;  // fast
-
-  for (size_t i = 0; i < length; i++) {
-    char ch = data[i];
-    if (ch == '%') {
-      if (i + 2 < length) {
-        *tmp = convertFromHex(data[i + 1]) << 4 | convertFromHex(data[i + 2]);
-        i += 2;
-      }
-    } else if (ch == '+') {
-      *tmp = ' ';
-    } else {
-      *tmp = ch;
-    }
-    tmp++;
-  }
-  *tmp = 0;
-  length = (size_t)tmp - (size_t)data;
-
+  setLength(urlDecodeTo(data, data, length));
   return true;
 }
 
 bool StringBuffer::hash(const char *key, unsigned key_length) {
   assert(data != NULL);
 
-  Sha256 *sha256 = new Sha256();
-  sha256->initHmac((const uint8_t *)key, (size_t)key_length);
-  sha256->print(data);
-  char *sign = (char *)sha256->resultHmac();
-  if (length < HASH_LENGTH) {
-    IOTC_FREE(data);
-    data = (char *)IOTC_MALLOC(HASH_LENGTH + 1);
+  unsigned char digest[HMAC_SHA256_LENGTH];
+  HmacSha256 hmac;
+  if (!hmac.init(key, key_length) || !hmac.update(data, length) ||
+      !hmac.final(digest)) {
+    return false;
+  }
+
+  if (length < HMAC_SHA256_LENGTH) {
+    StringPool::release(data);
+    data = (char *)StringPool::allocate(HMAC_SHA256_LENGTH + 1);
+    if (data == NULL) {
+      length = 0;
+      return false;
+    }
   }
-  memcpy(data, sign, HASH_LENGTH);
-  setLength(HASH_LENGTH);
-  delete sha256;
+  memcpy(data, digest, HMAC_SHA256_LENGTH);
+  setLength(HMAC_SHA256_LENGTH);
   return true;
 }
 
-bool StringBuffer::base64Decode() {
+bool StringBuffer::base64Decode() {  // in-memory
   assert(data != NULL && length > 0);
-  char *decoded = (char *)IOTC_MALLOC(length + 1);
-  assert(decoded != NULL);
-  size_t size = base64_decode(decoded, data, length);
-  assert(size <= length + 1);
-  IOTC_FREE(data);
-  data = (char *)IOTC_MALLOC(size + 1);
-  assert(data != NULL);
-  memcpy(data, decoded, size);
+  unsigned size = 0;
+  if (!base64DecodeTo((unsigned char *)data, data, length, size)) {
+    return false;
+  }
   setLength(size);
-  IOTC_FREE(decoded);
   return true;
 }
 
 bool StringBuffer::base64Encode() {
   assert(data != NULL && length > 0);
-  char *decoded = (char *)IOTC_MALLOC(length * 3);
-  assert(decoded != NULL);
-  size_t size = base64_encode(decoded, data, length);
-  assert(size < length * 3);
-  IOTC_FREE(data);
-  data = (char *)IOTC_MALLOC(size + 1);
-  assert(data != NULL);
-  memcpy(data, decoded, size);
+  unsigned size = base64EncodedLength(length);
+  char *encoded = (char *)StringPool::allocate(size + 1);
+  if (encoded == NULL) {
+    return false;
+  }
+  base64EncodeTo(encoded, (const unsigned char *)data, length);
+  StringPool::release(data);
+  data = encoded;
   setLength(size);
-  IOTC_FREE(decoded);
   return true;
 }
 
@@ -216,7 +165,7 @@ void StringBuffer::initialize(const char *str, unsigned lengthStr) {
 void StringBuffer::alloc(unsigned lengthStr) {
   ASSERT_OR_FAIL_FAST(lengthStr != 0 && data == NULL && immutable == NULL);
 
-  data = (char *)IOTC_MALLOC(lengthStr);
+  data = (char *)StringPool::allocate(lengthStr);
 
   ASSERT_OR_FAIL_FAST(data != NULL);
   memset(data, 0, lengthStr);
@@ -229,7 +178,7 @@ void StringBuffer::set(unsigned index, char c) {
 
 void StringBuffer::clear() {
   if (data != NULL) {
-    IOTC_FREE(data);
+    StringPool::release(data);
     data = NULL;
   }
 }
@@ -0,0 +1,56 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license.
+
+#ifndef AZURE_IOTC_LITE_STRING_POOL_H
+#define AZURE_IOTC_LITE_STRING_POOL_H
+
+#include <stddef.h>
+
+// Size classes of the StringBuffer pool. The memory given to
+// iotc_set_string_pool is split evenly between them.
+#define STRING_POOL_CLASS_COUNT 5
+#define STRING_POOL_MIN_CLASS 32  // 32, 64, 128, 256, 512
+
+namespace AzureIOT {
+
+// StringBuffer storage. Draws fixed size blocks from the pool while a
+// StringPoolScope is alive, IOTC_MALLOC/IOTC_FREE otherwise (or when the pool
+// has no block of the right size left). Blocks go back to their free list in
+// O(1).
+//
+// The pool is for temporaries of one operation. Buffers that live as long as
+// the context (hub credentials and token, cached topics, topic prefixes,
+// registration state) are allocated under a StringHeapScope so they don't pin
+// pool blocks; setHubCredentials asserts it.
+//
+// Not thread safe. The light client runs the SDK from a single thread.
+class StringPool {
+ public:
+  static void* allocate(size_t size);
+  static void release(void* ptr);
+  // ptr is a pool block
+  static bool owns(const void* ptr);
+};
+
+// Marks an operation (i.e. compute a SAS token, handle an inbound message)
+// whose StringBuffer temporaries should come from the pool.
+class StringPoolScope {
+ public:
+  StringPoolScope();
+  ~StringPoolScope();
+};
+
+// Turns the pool off (IOTC_MALLOC/IOTC_FREE) for buffers that outlive the
+// operation, even inside a StringPoolScope (i.e. a callback that changes
+// settings).
+class StringHeapScope {
+  unsigned savedDepth;
+
+ public:
+  StringHeapScope();
+  ~StringHeapScope();
+};
+
+}  // namespace AzureIOT
+
+#endif  // AZURE_IOTC_LITE_STRING_POOL_H
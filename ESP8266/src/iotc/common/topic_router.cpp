@@ -0,0 +1,123 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license.
+
+#include "topic_router.h"
+#include <string.h>
+
+namespace AzureIOT {
+
+int TopicRouter::add(const char *prefix, TopicHandler handler,
+                     void *handlerContext) {
+  unsigned prefixLength = strlen(prefix);
+  unsigned index = 0;
+  for (; index < count; index++) {
+    if (routes[index].prefixLength == prefixLength &&
+        memcmp(routes[index].prefix, prefix, prefixLength) == 0)
+      break;
+  }
+
+  if (index == count) {
+    if (count == TOPIC_ROUTER_MAX_ROUTES) return 1;
+    count++;
+  }
+
+  Route &route = routes[index];
+  route.prefix = prefix;
+  route.prefixLength = prefixLength;
+  route.handler = handler;
+  route.handlerContext = handlerContext;
+  return 0;
+}
+
+int TopicRouter::remove(const char *prefix) {
+  unsigned prefixLength = strlen(prefix);
+  for (unsigned i = 0; i < count; i++) {
+    if (routes[i].prefixLength == prefixLength &&
+        memcmp(routes[i].prefix, prefix, prefixLength) == 0) {
+      routes[i] = routes[--count];
+      return 0;
+    }
+  }
+  return 1;
+}
+
+// parses a decimal number, -1 if [data, data + length) isn't one
+static long parseNumber(const char *data, unsigned length) {
+  if (length == 0 || length > 9) return -1;
+  long number = 0;
+  for (unsigned i = 0; i < length; i++) {
+    unsigned digit = (unsigned char)data[i] - '0';
+    if (digit > 9) return -1;
+    number = number * 10 + digit;
+  }
+  return number;
+}
+
+void TopicRouter::parseFields(const char *rest, unsigned length,
+                              TopicFields &fields) {
+  fields.segment = rest;
+  fields.requestId = NULL;
+  fields.requestIdLength = 0;
+  fields.version = -1;
+
+  unsigned i = 0;
+  while (i < length && rest[i] != '/' && rest[i] != '?') i++;
+  fields.segmentLength = i;
+  fields.status = (int)parseNumber(rest, i);
+
+  while (i < length && rest[i] != '?') i++;
+
+  // ?name=value&name=value
+  while (i < length) {
+    const char *name = rest + ++i;
+    while (i < length && rest[i] != '=' && rest[i] != '&') i++;
+    unsigned nameLength = (unsigned)(rest + i - name);
+    if (i == length || rest[i] == '&') continue;
+
+    const char *value = rest + ++i;
+    while (i < length && rest[i] != '&') i++;
+    unsigned valueLength = (unsigned)(rest + i - value);
+
+    if (nameLength == 4 && memcmp(name, "$rid", 4) == 0) {
+      fields.requestId = value;
+      fields.requestIdLength = valueLength;
+    } else if (nameLength == 8 && memcmp(name, "$version", 8) == 0) {
+      fields.version = parseNumber(value, valueLength);
+    }
+  }
+}
+
+bool TopicRouter::dispatch(const char *topic, unsigned topicLength,
+                           char *payload, unsigned long payloadLength) {
+  // bit n is set while routes[n] still matches
+  unsigned live = (1U << count) - 1;
+  int match = -1;
+
+  for (unsigned i = 0; live != 0; i++) {
+    for (unsigned n = 0; n < count; n++) {
+      unsigned bit = 1U << n;
+      if ((live & bit) == 0) continue;
+
+      const Route &route = routes[n];
+      if (route.prefixLength == i) {
+        // ends here; any route still live is longer
+        match = (int)n;
+        live &= ~bit;
+      } else if (i == topicLength || route.prefix[i] != topic[i]) {
+        live &= ~bit;
+      }
+    }
+  }
+
+  if (match == -1) return false;
+
+  const Route &route = routes[match];
+  TopicFields fields;
+  parseFields(topic + route.prefixLength, topicLength - route.prefixLength,
+              fields);
+  route.handler(topic, topicLength, fields, payload, payloadLength,
+                route.handlerContext);
+  return true;
+}
+
+}  // namespace AzureIOT
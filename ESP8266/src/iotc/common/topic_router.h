@@ -0,0 +1,69 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license.
+
+#ifndef AZURE_IOTC_LITE_TOPIC_ROUTER_H
+#define AZURE_IOTC_LITE_TOPIC_ROUTER_H
+
+// built-in routes (methods, twin PATCH, twin) included
+#define TOPIC_ROUTER_MAX_ROUTES 8
+
+namespace AzureIOT {
+
+// Picked out of the topic while it is routed. Views into the topic; nothing
+// is copied and none of them is \0 terminated.
+//
+//   $iothub/methods/POST/<segment>/?$rid=<requestId>
+//   $iothub/twin/res/<status>/?$rid=<requestId>&$version=<version>
+//   $iothub/twin/PATCH/properties/desired/?$version=<version>
+struct TopicFields {
+  const char *segment;  // first path segment after the matched prefix
+  unsigned segmentLength;
+  const char *requestId;  // value of $rid
+  unsigned requestIdLength;
+  int status;    // segment as a number, -1 if it isn't one
+  long version;  // value of $version, -1 if missing
+};
+
+typedef void (*TopicHandler)(const char *topic, unsigned topicLength,
+                             const TopicFields &fields, char *payload,
+                             unsigned long payloadLength,
+                             void *handlerContext);
+
+// Routes inbound topics to the handler with the longest matching prefix.
+//
+// A single pass over the topic runs all prefixes side by side (one bit per
+// route that still matches) and then reads the fields behind the prefix.
+// No allocation, no copy.
+//
+// A zeroed router has no routes.
+class TopicRouter {
+  struct Route {
+    const char *prefix;  // must outlive the route
+    unsigned prefixLength;
+    TopicHandler handler;
+    void *handlerContext;
+  };
+
+  Route routes[TOPIC_ROUTER_MAX_ROUTES];
+  unsigned count;
+
+ public:
+  // Replaces the handler of a prefix that is already there.
+  // returns 0 if there is no error, 1 when the router is full
+  int add(const char *prefix, TopicHandler handler, void *handlerContext);
+  // returns 0 if the prefix was found
+  int remove(const char *prefix);
+  void clear() { count = 0; }
+
+  // returns false if no route matches the topic
+  bool dispatch(const char *topic, unsigned topicLength, char *payload,
+                unsigned long payloadLength);
+
+  // exposed for the handlers and benchmarks
+  static void parseFields(const char *rest, unsigned length,
+                          TopicFields &fields);
+};
+
+}  // namespace AzureIOT
+
+#endif  // AZURE_IOTC_LITE_TOPIC_ROUTER_H
@@ -33,6 +33,15 @@ typedef struct IOTCallbackInfo_TAG {
 
 typedef void* IOTContext;
 
+typedef struct IOTMemoryStats_TAG {
+  unsigned poolSize;           // bytes of the string pool (0 when not set)
+  unsigned inUse;              // pool bytes currently held
+  unsigned highWaterMark;      // peak of inUse
+  unsigned allocations;        // requests served from the pool
+  unsigned poolMisses;         // requests the pool couldn't serve (went to heap)
+  unsigned failedAllocations;  // requests that couldn't be served at all
+} IOTMemoryStats;
+
 // ***** Macro definitions *****
 #define IOTC_PROTOCOL_MQTT 0x01
 #define IOTC_PROTOCOL_AMQP 0x02
@@ -59,6 +68,13 @@ typedef short IOTConnectType;
 #define IOTC_CONNECTION_DISCONNECTED 0x80
 typedef short IOTConnectionState;
 
+// returned by the send functions while the in-flight window is full (see
+// iotc_set_inflight_window)
+#define IOTC_ERROR_WINDOW_FULL 0x08
+
+// the longest wait iotc_get_wait_ms reports (ms)
+#define IOTC_MAX_WAIT_MS 60000
+
 #define IOTC_MESSAGE_ACCEPTED 0x01
 #define IOTC_MESSAGE_REJECTED 0x02
 #define IOTC_MESSAGE_ABANDONED 0x04
@@ -69,6 +85,18 @@ typedef short IOTMessageStatus;
 // returns 0 if there is no error. Otherwise, error code will be returned.
 int iotc_set_logging(IOTLogLevel level);
 
+// Back the SDK's string buffers with a size-class pool carved from `memory`
+// (blocks of 32 to 512 bytes). SAS token and inbound message handling draw
+// from it instead of the heap. Pass NULL to go back to malloc / free.
+// Call this before `init_context`
+// returns 0 if there is no error. Otherwise, error code will be returned.
+int iotc_set_string_pool(void* memory, unsigned size);
+
+// Read / reset (high water mark = in use, counters = 0) the string pool stats
+// returns 0 if there is no error. Otherwise, error code will be returned.
+int iotc_get_memory_stats(IOTMemoryStats* stats);
+int iotc_reset_memory_stats();
+
 // Initialize the device context. The context variable will be used by rest of
 // the API returns 0 if there is no error. Otherwise, error code will be
 // returned.
@@ -90,6 +118,17 @@ int iotc_get_device_settings(IOTContext ctx);
 int iotc_connect(IOTContext ctx, const char* scope, const char* keyORcert,
                  const char* deviceId, IOTConnectType type);
 
+// Connect to Azure IoT Central without blocking on device provisioning
+// Registration with DPS runs a step at a time in `do_work`, and the hub
+// connection is opened once DPS assigns the device. `ConnectionStatus`
+// reports the outcome (IOTC_CONNECTION_OK or an error). Connection strings
+// need no provisioning; those connect right away like `connect`.
+// Call this after `init_context`
+// returns 0 if there is no error. Otherwise, error code will be returned.
+int iotc_connect_async(IOTContext ctx, const char* scope,
+                       const char* keyORcert, const char* deviceId,
+                       IOTConnectType type);
+
 // Disconnect
 // returns 0 if there is no error. Otherwise, error code will be returned.
 int iotc_disconnect(IOTContext ctx);
@@ -143,6 +182,19 @@ int iotc_send_event(IOTContext ctx, const char* payload, unsigned length);
 // returns 0 if there is no error. Otherwise, error code will be returned.
 int iotc_send_property(IOTContext ctx, const char* payload, unsigned length);
 
+// Publishes telemetry and properties with QoS1, up to `window` of them
+// waiting for the hub's acknowledgement at once (4 at most). `MessageSent`
+// fires once a message was acknowledged (statusCode 0) or dropped with the
+// connection (statusCode 1). Messages that aren't acknowledged in time are
+// sent again. While the window is full a send doesn't wait; it returns
+// IOTC_ERROR_WINDOW_FULL and the message isn't sent. Call `do_work` to take
+// the acknowledgements in, then send again.
+// window == 0 (default) publishes with QoS0; `MessageSent` fires right away.
+// Only this platform keeps publishes in flight; the others take window 0.
+// Call this after `init_context`
+// returns 0 if there is no error. Otherwise, error code will be returned.
+int iotc_set_inflight_window(IOTContext ctx, unsigned window);
+
 // Sets the device model data (if any)
 // i.e. => iotc_set_model_data(ctx, "{\"iotcModelId\":\"PUT_MODEL_ID_HERE\"}",
 // lengthModelData);
@@ -156,6 +208,34 @@ int iotc_set_model_data(IOTContext ctx, const char* modelData);
 // returns 0 if there is no error. Otherwise, error code will be returned.
 int iotc_set_token_expiration(IOTContext ctx, unsigned timeout);
 
+// Opens the hub connection again from `do_work` once it was lost. Tries are
+// spread with jittered exponential backoff: every delay is picked at random
+// between baseMs and three times the previous one, up to capMs. The backoff
+// starts over once a connection stayed up for stableMs. An expired token is
+// renewed right away, a disabled device isn't retried and refused
+// credentials are retried a few times. After maxAttempts (0: no limit) tries
+// without a stable connection `ConnectionStatus` reports
+// IOTC_CONNECTION_RETRY_EXPIRED and the SDK stops trying.
+// `connect` spreads its own tries the same way.
+// baseMs == 0 (default) turns it off; reconnecting is up to the application.
+// Call this after `init_context`
+// returns 0 if there is no error. Otherwise, error code will be returned.
+int iotc_set_reconnect(IOTContext ctx, unsigned baseMs, unsigned capMs,
+                       unsigned stableMs, unsigned maxAttempts);
+
+// Keeps telemetry that can't be sent (i.e. while offline) in the SPIFFS file
+// at path and sends it once the connection is back: one message every
+// drainIntervalMs, with the time it was created (iothub-creation-time-utc).
+// The file holds slotCount messages of up to slotSize - 12 bytes each; once
+// it is full the oldest message is dropped. Messages left over from an
+// earlier run are sent too. `MessageSent` fires when a stored message is sent.
+// Telemetry with system properties isn't stored.
+// path == NULL closes the store. SPIFFS.begin() is called when needed.
+// Call this after `init_context`
+// returns 0 if there is no error. Otherwise, error code will be returned.
+int iotc_set_offline_store(IOTContext ctx, const char* path, unsigned slotCount,
+                           unsigned slotSize, unsigned drainIntervalMs);
+
 /*
 eventName:
   ConnectionStatus
@@ -172,11 +252,32 @@ typedef void (*IOTCallback)(IOTContext, IOTCallbackInfo*);
 int iotc_on(IOTContext ctx, const char* eventName, IOTCallback callback,
             void* appContext);
 
+// Register to the inbound messages whose topic starts with topicPrefix
+// (i.e. "devices/<deviceId>/messages/devicebound/"). The longest matching
+// prefix wins. The callback gets eventName "Topic" and the topic as tag.
+// Pass a NULL callback to unregister. Method calls and twin updates stay
+// with `Command` and `SettingsUpdated`.
+// Call this after `init_context`
+// returns 0 if there is no error. Otherwise, error code will be returned.
+int iotc_on_topic(IOTContext ctx, const char* topicPrefix, IOTCallback callback,
+                  void* appContext);
+
 // Lets SDK to do background work
 // Call this after `connect`
 // returns 0 if there is no error. Otherwise, error code will be returned.
 int iotc_do_work(IOTContext ctx);
 
+// How long (ms) `do_work` has nothing to do: the time until the next
+// keep-alive ping, resend of an unacknowledged message, reconnect try or DPS
+// poll, IOTC_MAX_WAIT_MS at most. 0 means call `do_work` now (i.e. bytes
+// arrived, or the SAS token is due for renewal). Inbound packets aren't a
+// deadline; the WiFi stack can't signal them, so don't sleep longer than the
+// latency you can take on commands.
+// Ask again after every `do_work` and every send.
+// Call this after `init_context`
+// returns 0 if there is no error. Otherwise, error code will be returned.
+int iotc_get_wait_ms(IOTContext ctx, unsigned long* waitMs);
+
 // Provide platform dependent NetworkInterface
 int iotc_set_network_interface(void* networkInterface);
 
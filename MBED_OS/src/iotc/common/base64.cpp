@@ -5,9 +5,13 @@ The above copyright notice and this permission notice shall be included in all c
 THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 */
 
+#if defined(ARDUINO) || defined(IOTC_POSIX)
+#include "base64.h"
 #ifdef ARDUINO
-#include "Base64.h"
 #include <avr/pgmspace.h>
+#else
+#include "../posix/pgmspace.h"
+#endif // ARDUINO
 
 const char PROGMEM b64_alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
     "abcdefghijklmnopqrstuvwxyz"
@@ -139,4 +143,4 @@ inline unsigned char b64_lookup(char c) {
     return -1;
 }
 
-#endif // ARDUINO
\ No newline at end of file
+#endif // defined(ARDUINO) || defined(IOTC_POSIX)
\ No newline at end of file
@@ -2,7 +2,7 @@
  * Copyright (c) 2013 Adam Rudd.
  * See LICENSE for more information
  */
-#ifdef ARDUINO
+#if defined(ARDUINO) || defined(IOTC_POSIX)
 #ifndef _BASE64_H
 #define _BASE64_H
 
@@ -0,0 +1,340 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license.
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+#include "iotc_internal.h"
+#include "string_pool.h"
+
+#if defined(USE_LIGHT_CLIENT) && (defined(__MBED__) || defined(IOTC_POSIX))
+
+namespace AzureIOT {
+
+// returns the number of bytes read, 0 if nothing arrived, -1 when the session is gone
+static int readSome(TLSClient* client, char* buffer, unsigned length, unsigned timeoutMs) {
+    int rc = client->read((unsigned char*)buffer, (int) length, (int) timeoutMs);
+#if defined(__MBED__)
+    // recv: 0 is a closed socket, NSAPI_ERROR_WOULD_BLOCK a timeout
+    if (rc == NSAPI_ERROR_WOULD_BLOCK) return 0;
+    if (rc == 0) return -1;
+#endif // __MBED__
+    return rc < 0 ? -1 : rc;
+}
+
+static bool startsWithNoCase(const char* text, const char* prefix) {
+    for (; *prefix != 0; text++, prefix++) {
+        if (tolower((unsigned char)*text) != *prefix) return false;
+    }
+    return true;
+}
+
+// value of the `name` (lower case) header line, NULL if there is none
+static const char* findHeader(const char* headers, unsigned length, const char* name) {
+    unsigned nameLength = strlen(name);
+    for (unsigned pos = 0; pos + nameLength < length; ) {
+        if (startsWithNoCase(headers + pos, name) && headers[pos + nameLength] == ':') {
+            const char* value = headers + pos + nameLength + 1;
+            while (*value == ' ') value++;
+            return value;
+        }
+
+        const char* lineEnd = (const char*) memchr(headers + pos, '\n', length - pos);
+        if (lineEnd == NULL) break;
+        pos = (unsigned)(lineEnd - headers) + 1;
+    }
+    return NULL;
+}
+
+static int findJSONString(StringBuffer &buffer, const char* lookFor, StringBuffer &target) {
+    int index = buffer.indexOf(lookFor, strlen(lookFor), 0);
+    if (index == -1) return 1;
+
+    index += strlen(lookFor);
+    int index2 = buffer.indexOf("\"", 1, index);
+    if (index2 == -1 || index2 == index) return 1;
+
+    target.clear();
+    StringHeapScope heapScope; // the results are kept until clear()
+    target.initialize(*buffer + index, index2 - index);
+    return 0;
+}
+
+int DPSClient::begin(const char* dpsEndpoint, const char* scope, const char* id, const char* deviceKey) {
+    clear();
+    statusCode = 0;
+
+    StringHeapScope heapScope; // a registration may outlive the caller's scope
+    IOTC_LOG(F("- iotc.dps : getting auth..."));
+    size_t size = 0;
+    authHeader.alloc(STRING_BUFFER_256);
+    if (getDPSAuthString(scope, id, deviceKey, *authHeader, STRING_BUFFER_256, size)) {
+        IOTC_LOG(F("ERROR: getDPSAuthString has failed"));
+        clear();
+        return 1;
+    }
+    authHeader.setLength(size);
+
+    endpoint.initialize(dpsEndpoint, strlen(dpsEndpoint));
+    scopeId.initialize(scope, strlen(scope));
+    deviceId.initialize(id, strlen(id));
+    key.initialize(deviceKey, strlen(deviceKey));
+    response.alloc(DPS_RESPONSE_SIZE + 1);
+
+    retryMs = DPS_DEFAULT_RETRY_MS;
+    state = DPS_CONNECT;
+    return 0;
+}
+
+void DPSClient::clear() {
+    closeSession();
+    endpoint.clear();
+    scopeId.clear();
+    deviceId.clear();
+    key.clear();
+    authHeader.clear();
+    operationId.clear();
+    hostName.clear();
+    response.clear();
+    state = DPS_IDLE;
+    polls = 0;
+    hasTiming = false;
+}
+
+void DPSClient::closeSession() {
+    if (client != NULL) {
+        client->disconnect();
+        delete client;
+        client = NULL;
+    }
+    sessionRequests = 0;
+}
+
+DPSState DPSClient::step(unsigned long nowMs, unsigned readTimeoutMs) {
+    switch (state) {
+    case DPS_CONNECT:
+        state = connect();
+        break;
+    case DPS_SEND:
+        state = send(nowMs);
+        break;
+    case DPS_READ:
+        state = read(nowMs, readTimeoutMs);
+        break;
+    case DPS_WAIT:
+        if ((long)(nowMs - deadlineMs) >= 0) {
+            state = client != NULL ? DPS_SEND : DPS_CONNECT;
+        }
+        break;
+    default:
+        break;
+    }
+
+    if (state == DPS_DONE || state == DPS_FAILED) {
+        closeSession();
+    }
+    return state;
+}
+
+DPSState DPSClient::connect() {
+    closeSession();
+    client = new TLSClient();
+    if (client->connect(*endpoint, AZURE_HTTPS_SERVER_PORT) != 0) {
+        IOTC_LOG(F("ERROR: DPS endpoint %s couldn't be reached."), *endpoint);
+        return DPS_FAILED;
+    }
+    timing = client->getTiming();
+    hasTiming = true;
+    return DPS_SEND;
+}
+
+DPSState DPSClient::send(unsigned long nowMs) {
+    StringBuffer deviceIdEncoded(*deviceId, deviceId.getLength());
+    deviceIdEncoded.urlEncode();
+
+    char* data = *response;
+    int size = 0;
+    if (*operationId == NULL) {
+        IOTC_LOG(F("- iotc.dps : getting operation id..."));
+        int bodySize = snprintf(NULL, 0, "{\"registrationId\":\"%s\"}", *deviceId);
+        size = snprintf(data, DPS_RESPONSE_SIZE, F("\
+PUT /%s/registrations/%s/register?api-version=" DPS_API_VERSION " HTTP/1.1\r\n\
+Host: %s\r\n\
+content-type: application/json; charset=utf-8\r\n\
+%s\r\n\
+accept: */*\r\n\
+content-length: %d\r\n\
+%s\r\n\
+connection: keep-alive\r\n\
+\r\n\
+{\"registrationId\":\"%s\"}"),
+        *scopeId, *deviceIdEncoded, *endpoint,
+        AZURE_IOT_CENTRAL_CLIENT_SIGNATURE, bodySize, *authHeader, *deviceId);
+    } else {
+        IOTC_LOG(F("- iotc.dps : getting host name..."));
+        size = snprintf(data, DPS_RESPONSE_SIZE, F("\
+GET /%s/registrations/%s/operations/%s?api-version=" DPS_API_VERSION " HTTP/1.1\r\n\
+Host: %s\r\n\
+content-type: application/json; charset=utf-8\r\n\
+%s\r\n\
+accept: */*\r\n\
+%s\r\n\
+connection: keep-alive\r\n\
+\r\n"),
+        *scopeId, *deviceIdEncoded, *operationId, *endpoint,
+        AZURE_IOT_CENTRAL_CLIENT_SIGNATURE, *authHeader);
+    }
+
+    if (size <= 0 || size >= DPS_RESPONSE_SIZE) {
+        IOTC_LOG(F("ERROR: DPS request doesn't fit into %d bytes"), DPS_RESPONSE_SIZE);
+        return DPS_FAILED;
+    }
+
+    int total = 0;
+    while (total < size) {
+        int rc = client->write((const unsigned char*)data + total, size - total,
+            IOTC_SERVER_RESPONSE_TIMEOUT * 1000);
+        if (rc <= 0) break;
+        total += rc;
+    }
+
+    if (total < size) {
+        // the service drops idle sessions; go again on a new one
+        bool reused = sessionRequests > 0;
+        closeSession();
+        if (reused) return DPS_CONNECT;
+
+        IOTC_LOG(F("ERROR: DPS request couldn't be sent."));
+        return retry(nowMs);
+    }
+
+    sessionRequests++;
+    received = 0;
+    headerLength = 0;
+    contentLength = 0;
+    hasContentLength = false;
+    keepAlive = true;
+    statusCode = 0;
+    retryMs = DPS_DEFAULT_RETRY_MS;
+    response.setLength(0);
+    deadlineMs = nowMs + IOTC_SERVER_RESPONSE_TIMEOUT * 1000UL;
+    return DPS_READ;
+}
+
+DPSState DPSClient::read(unsigned long nowMs, unsigned timeoutMs) {
+    char* data = *response;
+    int rc = readSome(client, data + received, DPS_RESPONSE_SIZE - received, timeoutMs);
+
+    if (rc < 0) {
+        bool reused = sessionRequests > 1;
+        closeSession();
+        if (received == 0 && reused) {
+            return DPS_CONNECT; // the session was closed under the request
+        }
+        if (headerLength == 0) {
+            IOTC_LOG(F("ERROR: DPS closed the connection before it answered."));
+            return retry(nowMs);
+        }
+        // no content-length; the body ends with the connection
+        return onResponse(nowMs);
+    }
+
+    if (rc == 0) {
+        if ((long)(nowMs - deadlineMs) >= 0) {
+            IOTC_LOG(F("ERROR: DPS didn't answer within %d secs."), IOTC_SERVER_RESPONSE_TIMEOUT);
+            closeSession();
+            return retry(nowMs);
+        }
+        return DPS_READ;
+    }
+
+    unsigned from = received > 3 ? received - 3 : 0;
+    received += rc;
+    response.setLength(received);
+
+    if (headerLength == 0) {
+        int index = response.indexOf("\r\n\r\n", 4, from);
+        if (index == -1) {
+            if (received < DPS_RESPONSE_SIZE) return DPS_READ;
+            IOTC_LOG(F("ERROR: DPS response header doesn't fit into %d bytes"), DPS_RESPONSE_SIZE);
+            closeSession();
+            return retry(nowMs);
+        }
+        headerLength = index + 4;
+        parseHeader();
+    }
+
+    if (hasContentLength && received >= headerLength + contentLength) {
+        return onResponse(nowMs);
+    }
+
+    if (received == DPS_RESPONSE_SIZE) {
+        // the rest of the body is dropped; the session can't take another request
+        closeSession();
+        return onResponse(nowMs);
+    }
+    return DPS_READ;
+}
+
+void DPSClient::parseHeader() {
+    const char* data = *response;
+    statusCode = strncmp(data, "HTTP/1.", 7) == 0 ? atoi(data + 9) : 0;
+
+    const char* value = findHeader(data, headerLength, "content-length");
+    if (value != NULL) {
+        hasContentLength = true;
+        contentLength = (unsigned) strtoul(value, NULL, 10);
+    }
+
+    // HTTP/1.1 sessions are kept alive unless the service says otherwise
+    value = findHeader(data, headerLength, "connection");
+    keepAlive = value == NULL || !startsWithNoCase(value, "close");
+
+    value = findHeader(data, headerLength, "retry-after");
+    if (value != NULL && isdigit((unsigned char)*value)) {
+        unsigned long seconds = strtoul(value, NULL, 10);
+        retryMs = seconds > DPS_MAX_RETRY_MS / 1000 ? DPS_MAX_RETRY_MS : (unsigned) seconds * 1000;
+    }
+}
+
+DPSState DPSClient::onResponse(unsigned long nowMs) {
+    if (!keepAlive) {
+        closeSession();
+    }
+
+    // DPS may assign the device with the PUT response already
+    if (findJSONString(response, "\"assignedHub\":\"", hostName) == 0) {
+        return DPS_DONE;
+    }
+
+    bool registering = *operationId == NULL;
+    if (registering) {
+        findJSONString(response, "\"operationId\":\"", operationId);
+    }
+
+    bool throttled = statusCode == 429 || statusCode >= 500;
+    bool assigning = *operationId != NULL && statusCode >= 200 && statusCode < 300 &&
+        response.indexOf("\"status\":\"failed\"", 17, headerLength) == -1 &&
+        response.indexOf("\"status\":\"disabled\"", 19, headerLength) == -1;
+    if (throttled || assigning) {
+        return retry(nowMs);
+    }
+
+    IOTC_LOG(F("ERROR: DPS (%s) request has failed.\r\n%s"),
+        registering ? "PUT" : "GET", *response);
+    return DPS_FAILED;
+}
+
+DPSState DPSClient::retry(unsigned long nowMs) {
+    if (++polls > DPS_MAX_POLLS) {
+        IOTC_LOG(F("ERROR: DPS didn't assign a hub after %d attempts."), DPS_MAX_POLLS);
+        return DPS_FAILED;
+    }
+
+    deadlineMs = nowMs + retryMs;
+    return DPS_WAIT;
+}
+
+} // namespace AzureIOT
+
+#endif // defined(USE_LIGHT_CLIENT) && (defined(__MBED__) || defined(IOTC_POSIX))
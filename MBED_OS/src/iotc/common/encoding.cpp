@@ -0,0 +1,281 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license.
+
+#include <stdint.h>
+#include <string.h>
+#include "encoding.h"
+
+namespace AzureIOT {
+
+static const char HEX_DIGITS[] = "0123456789ABCDEF";
+
+static const char BASE64_ALPHABET[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+    "abcdefghijklmnopqrstuvwxyz0123456789+/";
+
+// url encoded form of the characters that aren't escaped, 0 for the rest
+static const unsigned char URL_SAFE[256] = {
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x2B, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x2D, 0x2E, 0x00,
+    0x30, 0x31, 0x32, 0x33, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x41, 0x42, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49, 0x4A, 0x4B, 0x4C, 0x4D, 0x4E, 0x4F,
+    0x50, 0x51, 0x52, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5A, 0x00, 0x00, 0x00, 0x00, 0x5F,
+    0x00, 0x61, 0x62, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69, 0x6A, 0x6B, 0x6C, 0x6D, 0x6E, 0x6F,
+    0x70, 0x71, 0x72, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7A, 0x00, 0x00, 0x00, 0x7E, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+};
+
+// value of a hex digit, 0xFF for the rest
+static const unsigned char HEX_VALUE[256] = {
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF
+};
+
+// value of a base64 digit, 0xFF for the rest ('=' included)
+static const unsigned char BASE64_VALUE[256] = {
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x3E, 0xFF, 0xFF, 0xFF, 0x3F,
+    0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3A, 0x3B, 0x3C, 0x3D, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E,
+    0x0F, 0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0x1A, 0x1B, 0x1C, 0x1D, 0x1E, 0x1F, 0x20, 0x21, 0x22, 0x23, 0x24, 0x25, 0x26, 0x27, 0x28,
+    0x29, 0x2A, 0x2B, 0x2C, 0x2D, 0x2E, 0x2F, 0x30, 0x31, 0x32, 0x33, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF
+};
+
+#define INVALID_DIGIT 0x80 // set on every 0xFF entry, never on a valid one
+
+#if IOTC_ENCODING_SWAR
+#define SWAR_ONES 0x0101010101010101ULL
+#define SWAR_HIGHS 0x8080808080808080ULL
+// non zero if any byte of `word` is `ch`
+#define SWAR_HAS_BYTE(word, ch) \
+    ((((word) ^ (SWAR_ONES * (ch))) - SWAR_ONES) & ~((word) ^ (SWAR_ONES * (ch))) & SWAR_HIGHS)
+#endif // IOTC_ENCODING_SWAR
+
+unsigned urlEncodedLength(const char* source, unsigned length) {
+    const unsigned char *in = (const unsigned char*) source;
+    unsigned escaped = 0;
+    for (unsigned i = 0; i < length; i++) {
+        escaped += URL_SAFE[in[i]] == 0;
+    }
+    return length + 2 * escaped;
+}
+
+unsigned urlEncodeTo(char* target, const char* source, unsigned length) {
+    const unsigned char *in = (const unsigned char*) source;
+    char *out = target;
+    unsigned i = 0;
+
+    // target has room for at least one byte per input byte left. while three
+    // or more are left, an escape sequence can be written for every byte and
+    // the cursor moved by 1 or 3; no branch on the character class
+    for (; i + 2 < length; i++) {
+        unsigned char ch = in[i];
+        char safe = (char) URL_SAFE[ch];
+        out[0] = safe ? safe : '%';
+        out[1] = HEX_DIGITS[ch >> 4];
+        out[2] = HEX_DIGITS[ch & 15];
+        out += safe ? 1 : 3;
+    }
+
+    for (; i < length; i++) {
+        unsigned char ch = in[i];
+        if (URL_SAFE[ch]) {
+            *out++ = (char) URL_SAFE[ch];
+        } else {
+            *out++ = '%';
+            *out++ = HEX_DIGITS[ch >> 4];
+            *out++ = HEX_DIGITS[ch & 15];
+        }
+    }
+
+    return (unsigned)(out - target);
+}
+
+unsigned urlDecodeTo(char* target, const char* source, unsigned length) {
+    const unsigned char *in = (const unsigned char*) source;
+    char *out = target;
+    unsigned i = 0;
+#if IOTC_ENCODING_SWAR
+    unsigned scalarEnd = 0;
+#endif // IOTC_ENCODING_SWAR
+
+    while (i < length) {
+#if IOTC_ENCODING_SWAR
+        // move the bytes in front of the first '%' or '+' of the next 8 at
+        // once (the lowest marker bit of SWAR_HAS_BYTE is exact). the rest of
+        // a window with a marker goes byte by byte; dense escapes would
+        // otherwise pay for a word load per byte
+        if (i >= scalarEnd && i + 8 <= length) {
+            uint64_t word;
+            memcpy(&word, in + i, 8);
+            uint64_t marks = SWAR_HAS_BYTE(word, '%') | SWAR_HAS_BYTE(word, '+');
+            unsigned run = marks ? (unsigned) __builtin_ctzll(marks) / 8 : 8;
+            memcpy(out, &word, run);
+            out += run;
+            scalarEnd = i + 8;
+            i += run;
+            if (run == 8) continue;
+        }
+#endif // IOTC_ENCODING_SWAR
+        unsigned char ch = in[i];
+        if (ch == '%' && i + 2 < length &&
+            ((HEX_VALUE[in[i + 1]] | HEX_VALUE[in[i + 2]]) & INVALID_DIGIT) == 0) {
+            *out++ = (char)(HEX_VALUE[in[i + 1]] << 4 | HEX_VALUE[in[i + 2]]);
+            i += 3;
+        } else {
+            *out++ = ch == '+' ? ' ' : (char) ch;
+            i++;
+        }
+    }
+
+    return (unsigned)(out - target);
+}
+
+unsigned base64EncodedLength(unsigned length) {
+    return ((length + 2) / 3) * 4;
+}
+
+unsigned base64EncodeTo(char* target, const unsigned char* source, unsigned length) {
+    char *out = target;
+    unsigned i = 0;
+
+#if IOTC_ENCODING_SWAR
+    // 6 bytes in, 8 characters out. the load reads 8 bytes; keep 2 in reserve
+    for (; i + 8 <= length; i += 6) {
+        uint64_t word;
+        memcpy(&word, source + i, 8);
+        word = __builtin_bswap64(word);
+        out[0] = BASE64_ALPHABET[word >> 58];
+        out[1] = BASE64_ALPHABET[(word >> 52) & 63];
+        out[2] = BASE64_ALPHABET[(word >> 46) & 63];
+        out[3] = BASE64_ALPHABET[(word >> 40) & 63];
+        out[4] = BASE64_ALPHABET[(word >> 34) & 63];
+        out[5] = BASE64_ALPHABET[(word >> 28) & 63];
+        out[6] = BASE64_ALPHABET[(word >> 22) & 63];
+        out[7] = BASE64_ALPHABET[(word >> 16) & 63];
+        out += 8;
+    }
+#endif // IOTC_ENCODING_SWAR
+
+    for (; i + 3 <= length; i += 3) {
+        uint32_t group = (uint32_t) source[i] << 16 | (uint32_t) source[i + 1] << 8 |
+            source[i + 2];
+        out[0] = BASE64_ALPHABET[group >> 18];
+        out[1] = BASE64_ALPHABET[(group >> 12) & 63];
+        out[2] = BASE64_ALPHABET[(group >> 6) & 63];
+        out[3] = BASE64_ALPHABET[group & 63];
+        out += 4;
+    }
+
+    if (i < length) {
+        uint32_t group = (uint32_t) source[i] << 16;
+        if (i + 1 < length) group |= (uint32_t) source[i + 1] << 8;
+        out[0] = BASE64_ALPHABET[group >> 18];
+        out[1] = BASE64_ALPHABET[(group >> 12) & 63];
+        out[2] = i + 1 < length ? BASE64_ALPHABET[(group >> 6) & 63] : '=';
+        out[3] = '=';
+        out += 4;
+    }
+
+    return (unsigned)(out - target);
+}
+
+static unsigned base64Unpadded(const char* source, unsigned length) {
+    if (length > 0 && source[length - 1] == '=') length--;
+    if (length > 0 && source[length - 1] == '=') length--;
+    return length;
+}
+
+unsigned base64DecodedLength(const char* source, unsigned length) {
+    length = base64Unpadded(source, length);
+    unsigned tail = length & 3;
+    return (length / 4) * 3 + (tail ? tail - 1 : 0);
+}
+
+bool base64DecodeTo(unsigned char* target, const char* source, unsigned length,
+    unsigned &outLength) {
+    const unsigned char *in = (const unsigned char*) source;
+    unsigned char *out = target;
+    unsigned char invalid = 0;
+    unsigned i = 0;
+
+    length = base64Unpadded(source, length);
+    if ((length & 3) == 1) return false;
+
+    // output never passes the input; in place decoding reads a group before
+    // overwriting it
+#if IOTC_ENCODING_SWAR
+    // 8 characters in, 6 bytes out through one 8 byte store. the store runs
+    // 2 bytes past the group; keep a group in reserve so it stays in target
+    for (; i + 12 <= length; i += 8) {
+        unsigned char a = BASE64_VALUE[in[i]], b = BASE64_VALUE[in[i + 1]],
+            c = BASE64_VALUE[in[i + 2]], d = BASE64_VALUE[in[i + 3]],
+            e = BASE64_VALUE[in[i + 4]], f = BASE64_VALUE[in[i + 5]],
+            g = BASE64_VALUE[in[i + 6]], h = BASE64_VALUE[in[i + 7]];
+        invalid |= a | b | c | d | e | f | g | h;
+        uint64_t word = ((uint64_t) a << 18 | (uint64_t) b << 12 | (uint64_t) c << 6 | d) << 40 |
+            ((uint64_t) e << 18 | (uint64_t) f << 12 | (uint64_t) g << 6 | h) << 16;
+        word = __builtin_bswap64(word);
+        memcpy(out, &word, 8);
+        out += 6;
+    }
+#endif // IOTC_ENCODING_SWAR
+
+    for (; i + 4 <= length; i += 4) {
+        unsigned char a = BASE64_VALUE[in[i]], b = BASE64_VALUE[in[i + 1]],
+            c = BASE64_VALUE[in[i + 2]], d = BASE64_VALUE[in[i + 3]];
+        invalid |= a | b | c | d;
+        uint32_t group = (uint32_t) a << 18 | (uint32_t) b << 12 | (uint32_t) c << 6 | d;
+        out[0] = (unsigned char)(group >> 16);
+        out[1] = (unsigned char)(group >> 8);
+        out[2] = (unsigned char) group;
+        out += 3;
+    }
+
+    unsigned tail = length - i; // 0, 2 or 3
+    if (tail) {
+        unsigned char a = BASE64_VALUE[in[i]], b = BASE64_VALUE[in[i + 1]];
+        unsigned char c = tail == 3 ? BASE64_VALUE[in[i + 2]] : 0;
+        invalid |= a | b | c;
+        uint32_t group = (uint32_t) a << 18 | (uint32_t) b << 12 | (uint32_t) c << 6;
+        *out++ = (unsigned char)(group >> 16);
+        if (tail == 3) *out++ = (unsigned char)(group >> 8);
+    }
+
+    if (invalid & INVALID_DIGIT) return false;
+    outLength = (unsigned)(out - target);
+    return true;
+}
+
+} // namespace AzureIOT
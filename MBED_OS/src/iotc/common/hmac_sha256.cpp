@@ -0,0 +1,56 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license.
+
+#include "iotc_internal.h"
+
+#if (defined(__MBED__) || defined(ARDUINO) || defined(IOTC_POSIX)) && !defined(TARGET_MXCHIP)
+
+namespace AzureIOT {
+
+#if defined(__MBED__)
+HmacSha256::HmacSha256() {
+    mbedtls_md_init(&context);
+}
+
+HmacSha256::~HmacSha256() {
+    mbedtls_md_free(&context);
+}
+
+bool HmacSha256::init(const char* key, unsigned keyLength) {
+    mbedtls_md_free(&context);
+    mbedtls_md_init(&context);
+    return mbedtls_md_setup(&context, mbedtls_md_info_from_type(MBEDTLS_MD_SHA256), 1) == 0 &&
+        mbedtls_md_hmac_starts(&context, (const unsigned char*) key, keyLength) == 0;
+}
+
+bool HmacSha256::update(const char* data, unsigned length) {
+    return mbedtls_md_hmac_update(&context, (const unsigned char*) data, length) == 0;
+}
+
+bool HmacSha256::final(unsigned char* digest) {
+    return mbedtls_md_hmac_finish(&context, digest) == 0;
+}
+#else // ARDUINO || IOTC_POSIX
+HmacSha256::HmacSha256() { }
+
+HmacSha256::~HmacSha256() { }
+
+bool HmacSha256::init(const char* key, unsigned keyLength) {
+    sha256.initHmac((const uint8_t*) key, (size_t) keyLength);
+    return true;
+}
+
+bool HmacSha256::update(const char* data, unsigned length) {
+    sha256.update((const uint8_t*) data, (size_t) length);
+    return true;
+}
+
+bool HmacSha256::final(unsigned char* digest) {
+    memcpy(digest, sha256.resultHmac(), HMAC_SHA256_LENGTH);
+    return true;
+}
+#endif // __MBED__
+
+} // namespace AzureIOT
+
+#endif // (__MBED__ || ARDUINO || IOTC_POSIX) && !TARGET_MXCHIP
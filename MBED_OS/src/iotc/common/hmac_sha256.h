@@ -0,0 +1,38 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license.
+
+#ifndef AZURE_IOTC_LITE_HMAC_SHA256_H
+#define AZURE_IOTC_LITE_HMAC_SHA256_H
+
+#define HMAC_SHA256_LENGTH 32
+
+namespace AzureIOT {
+
+// Streaming HMAC-SHA256. Feed the message in as many parts as it takes;
+// nothing is copied or concatenated on the way.
+//
+//   HmacSha256 hmac;
+//   hmac.init(key, keyLength);
+//   hmac.update(resourceURI, resourceURILength);
+//   hmac.update("\n", 1);
+//   hmac.final(digest);
+class HmacSha256 {
+#if defined(__MBED__)
+    mbedtls_md_context_t context;
+#else
+    Sha256 sha256;
+#endif // __MBED__
+
+public:
+    HmacSha256();
+    ~HmacSha256();
+
+    bool init(const char* key, unsigned keyLength);
+    bool update(const char* data, unsigned length);
+    // writes HMAC_SHA256_LENGTH bytes into digest
+    bool final(unsigned char* digest);
+};
+
+} // namespace AzureIOT
+
+#endif // AZURE_IOTC_LITE_HMAC_SHA256_H
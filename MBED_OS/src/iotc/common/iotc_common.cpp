@@ -22,6 +22,8 @@ int iotc_on(IOTContext ctx, const char* eventName, IOTCallback callback, void* a
         SETCB_(internal->callbacks[/*IOTCallbacks::*/::SettingsUpdated], callback, appContext);
     } else if (strcmp(eventName, "Command") == 0) {
         SETCB_(internal->callbacks[/*IOTCallbacks::*/::Command], callback, appContext);
+    } else if (strcmp(eventName, "ConnectionTiming") == 0) {
+        SETCB_(internal->callbacks[/*IOTCallbacks::*/::ConnectionTiming], callback, appContext);
     } else {
         IOTC_LOG(F("ERROR: (iotc_on) Unknown event definition. (%s)"), eventName);
         return 1;
@@ -104,4 +106,72 @@ int iotc_set_logging(IOTLogLevel level) {
     }
     setLogLevel(level);
     return 0;
-}
\ No newline at end of file
+}
+
+/* extern */
+int iotc_set_inflight_window(IOTContext ctx, unsigned window) {
+    CHECK_NOT_NULL(ctx)
+
+    IOTContextInternal *internal = (IOTContextInternal*)ctx;
+    MUST_CALL_AFTER_INIT(internal);
+
+    if (window != 0) {
+        IOTC_LOG(F("ERROR: (iotc_set_inflight_window) Not implemented."));
+        return 1;
+    }
+    return 0;
+}
+
+#if defined(USE_LIGHT_CLIENT)
+/* extern */
+int iotc_set_token_expiration(IOTContext ctx, unsigned timeout) {
+    if (timeout == 0) {
+        IOTC_LOG(F("ERROR: (iotc_set_token_expiration) invalid argument. ERROR:0x0001"));
+        return 1;
+    }
+    setEXPIRES(timeout);
+    return 0;
+}
+
+/* extern */
+int iotc_set_reconnect(IOTContext ctx, unsigned baseMs, unsigned capMs, unsigned stableMs,
+    unsigned maxAttempts) {
+    CHECK_NOT_NULL(ctx)
+
+    IOTContextInternal *internal = (IOTContextInternal*)ctx;
+    internal->reconnect.configure(baseMs, capMs, stableMs, maxAttempts);
+    return 0;
+}
+
+void hubConnected(IOTContextInternal *internal) {
+    AzureIOT::ReconnectPolicy &policy = internal->reconnect;
+    if (!policy.isEnabled()) {
+        connectionStatusCallback(IOTC_CONNECTION_OK, internal);
+        return;
+    }
+
+    // devices that boot together still draw different delays
+    unsigned long hash = 2166136261UL; // FNV-1a
+    for (unsigned i = 0; i < internal->deviceId.getLength(); i++) {
+        hash = ((hash ^ (unsigned char)(*internal->deviceId)[i]) * 16777619UL) & 0xFFFFFFFFUL;
+    }
+    policy.seed(hash ^ getTickMs());
+    policy.onConnected(getTickMs());
+    connectionStatusCallback(IOTC_CONNECTION_OK, internal);
+}
+
+int scheduleReconnect(IOTContextInternal *internal, IOTConnectionState reason) {
+    AzureIOT::ReconnectPolicy &policy = internal->reconnect;
+    if (!policy.isEnabled()) return 1;
+
+    long waitMs = policy.schedule(getTickMs(), reason);
+    if (waitMs < 0) {
+        IOTC_LOG(F("ERROR: giving up on the hub connection (%d)"), reason);
+        connectionStatusCallback(IOTC_CONNECTION_RETRY_EXPIRED, internal);
+        return 1;
+    }
+
+    IOTC_LOG(F("- iotc : reconnecting in %ld ms (try %d)"), waitMs, policy.getAttempts());
+    return 0;
+}
+#endif // USE_LIGHT_CLIENT
@@ -67,6 +67,32 @@ AZIOTC_API_MINOR_VERSION AZIOTC_API_PATCH_VERSION) "-msiotc"
 #define ASSERT_OR_FAIL_FAST(x) if (!(x)) { LOG_ERROR(TO_STRING(x) "condition has failed"); }
 #endif // defined(_DEBUG) || defined(DEBUG)
 
+#ifdef __cplusplus
+namespace AzureIOT {
+
+// how long the phases of the last TLSClient::connect took (ms). A phase the
+// platform can't tell apart from the next one is 0 and counted there.
+typedef struct ConnectTiming_TAG {
+    unsigned long dnsMs;
+    unsigned long tcpMs;
+    unsigned long handshakeMs;
+    bool resumed; // the TLS session was resumed (abbreviated handshake)
+    // false when the platform resolves, connects and shakes hands in one
+    // call: handshakeMs is all of it, the rest isn't known
+    bool phased;
+} ConnectTiming;
+
+// a piece of an outgoing packet. TLSClient::writev sends the pieces in order
+// without putting them together first (i.e. the header of a PUBLISH, then its
+// payload from where the caller keeps it)
+typedef struct WriteSegment_TAG {
+    const unsigned char* data;
+    unsigned length;
+} WriteSegment;
+
+} // namespace AzureIOT
+#endif // __cplusplus
+
 #ifdef MBED_STATIC_ASSERT
 #define ASSERT_STATIC MBED_STATIC_ASSERT
 #else
@@ -1,8 +1,10 @@
 // Copyright (c) Oguz Bastemur. All rights reserved.
 // Licensed under the MIT license. See LICENSE file in the project root for full license information.
 
+#include <time.h>
 #include "iotc_internal.h"
 #include "../common/json.h"
+#include "string_pool.h"
 
 IOTLogLevel gLogLevel = IOTC_LOGGING_DISABLED;
 
@@ -22,81 +24,88 @@ unsigned strlen_s_(const char* str, int max_expected) {
 #if defined(USE_LIGHT_CLIENT)
 unsigned long getNow();
 
+static unsigned EXPIRES = DEFAULT_EXPIRES;
+void setEXPIRES(unsigned e) { EXPIRES = e; }
+
 // Self MQTT option supports singletonContext only.
 static IOTContextInternal *singletonContext = NULL;
 
 IOTContextInternal* getSingletonContext() { return singletonContext; }
 void setSingletonContext(IOTContextInternal* ctx) { singletonContext = ctx; }
 
-int getUsernameAndPasswordFromConnectionString(const char* connectionString, size_t connectionStringLength,
-    AzureIOT::StringBuffer &hostName, AzureIOT::StringBuffer &deviceId,
-    AzureIOT::StringBuffer &username, AzureIOT::StringBuffer &password) {
+// HostName=<host>;DeviceId=<id>;SharedAccessKey=<key>
+// returns 0 if there is no error
+static int parseConnectionString(const char* connectionString, size_t connectionStringLength,
+    int32_t &deviceIndex, int32_t &keyIndex) {
     // TODO: improve this so we don't depend on a particular order in connection string
-    AzureIOT::StringBuffer connStr(connectionString, connectionStringLength);
+    AzureIOT::StringBuffer connStr(connectionString, connectionStringLength, false);
 
     int32_t hostIndex = connStr.indexOf(HOSTNAME_STRING, HOSTNAME_LENGTH);
-    size_t length = connStr.getLength();
     if (hostIndex != 0) {
         IOTC_LOG(F("ERROR: connectionString doesn't start with HostName=  RESULT:%d"), hostIndex);
         return 1;
     }
 
-    int32_t deviceIndex = connStr.indexOf(DEVICEID_STRING, DEVICEID_LENGTH);
+    deviceIndex = connStr.indexOf(DEVICEID_STRING, DEVICEID_LENGTH);
     if (deviceIndex == -1) {
         IOTC_LOG(F("ERROR: ;DeviceId= not found in the connectionString"));
         return 1;
     }
 
-    int32_t keyIndex = connStr.indexOf(KEY_STRING, KEY_LENGTH);
+    keyIndex = connStr.indexOf(KEY_STRING, KEY_LENGTH);
     if (keyIndex == -1) {
         IOTC_LOG(F("ERROR: ;SharedAccessKey= not found in the connectionString"));
         return 1;
     }
 
-    hostName.initialize(connectionString + HOSTNAME_LENGTH, deviceIndex - HOSTNAME_LENGTH);
-    deviceId.initialize(connectionString + (deviceIndex + DEVICEID_LENGTH), keyIndex - (deviceIndex + DEVICEID_LENGTH));
-
-    AzureIOT::StringBuffer keyBuffer(length - (keyIndex + KEY_LENGTH));
-    memcpy(*keyBuffer, connectionString + (keyIndex + KEY_LENGTH), keyBuffer.getLength());
+    return 0;
+}
 
-    AzureIOT::StringBuffer hostURLEncoded(hostName);
-    hostURLEncoded.urlEncode();
+static int formatUsername(AzureIOT::StringBuffer &username,
+    AzureIOT::StringBuffer &hostName, AzureIOT::StringBuffer &deviceId) {
+    const char * usernameTemplate = "%s/%s/api-version=2016-11-14";
+    unsigned length = (strlen(usernameTemplate) - 4 /* %s twice */)
+        + hostName.getLength() + deviceId.getLength();
 
-    size_t expires = getNow() + EXPIRES;
+    username.clear();
+    username.alloc(length + 1);
+    if (*username == NULL) return 1;
 
-    AzureIOT::StringBuffer stringToSign(hostURLEncoded.getLength() + STRING_BUFFER_128);
-    AzureIOT::StringBuffer deviceIdEncoded(deviceId);
-    deviceIdEncoded.urlEncode();
-    size_t keyLength = snprintf(*stringToSign, stringToSign.getLength(), "%s%s%s\n%lu000",
-        *hostURLEncoded, "%2Fdevices%2F", *deviceIdEncoded, expires);
-    stringToSign.setLength(keyLength);
+    username.setLength(snprintf(*username, length + 1, usernameTemplate,
+        *hostName, *deviceId));
+    return 0;
+}
 
-    keyBuffer.base64Decode();
-    stringToSign.hash(*keyBuffer, keyBuffer.getLength());
-    if (!stringToSign.base64Encode() || !stringToSign.urlEncode()) {
-        IOTC_LOG(F("ERROR: stringToSign base64Encode / urlEncode has failed."));
+int getUsernameAndPasswordFromConnectionString(const char* connectionString, size_t connectionStringLength,
+    AzureIOT::StringBuffer &hostName, AzureIOT::StringBuffer &deviceId,
+    AzureIOT::StringBuffer &username, AzureIOT::StringBuffer &password) {
+    int32_t deviceIndex = 0, keyIndex = 0;
+    if (parseConnectionString(connectionString, connectionStringLength, deviceIndex, keyIndex)) {
         return 1;
     }
 
-    AzureIOT::StringBuffer passwordBuffer(STRING_BUFFER_512);
-    size_t passLength = snprintf(*passwordBuffer, STRING_BUFFER_512,
-            "SharedAccessSignature sr=%s%s%s&sig=%s&se=%lu000",
-            *hostURLEncoded, "%2Fdevices%2F", *deviceIdEncoded, *stringToSign, expires);
-
-    assert(passLength && passLength < STRING_BUFFER_512);
-    passwordBuffer.setLength(passLength);
-
-    password.initialize(*passwordBuffer, passwordBuffer.getLength());
-
-    const char * usernameTemplate = "%s/%s/api-version=2016-11-14";
-    AzureIOT::StringBuffer usernameBuffer((strlen(usernameTemplate) - 3 /* %s twice */)
-        + hostName.getLength() + deviceId.getLength());
-
-    size_t expLength = snprintf(*usernameBuffer, usernameBuffer.getLength(),
-        usernameTemplate, *hostName, *deviceId);
-    assert(expLength <= usernameBuffer.getLength());
-
-    username.initialize(*usernameBuffer, usernameBuffer.getLength());
+    // the results outlive the call; only the token's buffers are temporaries
+    AzureIOT::StringHeapScope heapScope;
+    hostName.initialize(connectionString + HOSTNAME_LENGTH, deviceIndex - HOSTNAME_LENGTH);
+    deviceId.initialize(connectionString + (deviceIndex + DEVICEID_LENGTH), keyIndex - (deviceIndex + DEVICEID_LENGTH));
+    password.alloc(STRING_BUFFER_512);
+
+    unsigned passLength = 0;
+    {
+        AzureIOT::StringPoolScope poolScope;
+        AzureIOT::SASToken sasToken;
+        if (sasToken.initialize(connectionString + (keyIndex + KEY_LENGTH),
+                connectionStringLength - (keyIndex + KEY_LENGTH),
+                *hostName, hostName.getLength(), SAS_DEVICES_SECTION,
+                *deviceId, deviceId.getLength())) {
+            return 1;
+        }
+        passLength = sasToken.write(*password, STRING_BUFFER_512, getNow() + EXPIRES);
+    }
+    if (passLength == 0 || formatUsername(username, hostName, deviceId)) {
+        return 1;
+    }
+    password.setLength(passLength);
 
     IOTC_LOG(F(
     "\r\n"\
@@ -109,37 +118,99 @@ int getUsernameAndPasswordFromConnectionString(const char* connectionString, siz
     return 0;
 }
 
+int setHubCredentials(IOTContextInternal *internal, const char* hostName,
+    unsigned hostNameLength, const char* deviceId, unsigned deviceIdLength,
+    const char* key, unsigned keyLength) {
+    clearHubCredentials(internal);
+
+    AzureIOT::StringHeapScope heapScope; // kept until the context goes away
+    internal->hostName.initialize(hostName, hostNameLength);
+    internal->deviceId.initialize(deviceId, deviceIdLength);
+    if (internal->sasToken.initialize(key, keyLength, hostName, hostNameLength,
+            SAS_DEVICES_SECTION, deviceId, deviceIdLength) ||
+        formatUsername(internal->username, internal->hostName, internal->deviceId)) {
+        clearHubCredentials(internal);
+        return 1;
+    }
+    assert(!AzureIOT::StringPool::owns(*internal->hostName) &&
+        !AzureIOT::StringPool::owns(*internal->deviceId) &&
+        !AzureIOT::StringPool::owns(*internal->username));
+
+    IOTC_LOG(F(
+    "\r\n"\
+    "hostname: %s\r\n"\
+    "deviceId: %s\r\n"\
+    "username: %s\r\n"),
+    *internal->hostName, *internal->deviceId, *internal->username);
+
+    return 0;
+}
+
+int setHubCredentialsFromConnectionString(IOTContextInternal *internal,
+    const char* connectionString, size_t connectionStringLength) {
+    int32_t deviceIndex = 0, keyIndex = 0;
+    if (parseConnectionString(connectionString, connectionStringLength, deviceIndex, keyIndex)) {
+        return 1;
+    }
+
+    return setHubCredentials(internal,
+        connectionString + HOSTNAME_LENGTH, deviceIndex - HOSTNAME_LENGTH,
+        connectionString + (deviceIndex + DEVICEID_LENGTH), keyIndex - (deviceIndex + DEVICEID_LENGTH),
+        connectionString + (keyIndex + KEY_LENGTH), connectionStringLength - (keyIndex + KEY_LENGTH));
+}
+
+void clearHubCredentials(IOTContextInternal *internal) {
+    internal->hostName.clear();
+    internal->deviceId.clear();
+    internal->username.clear();
+    internal->sasToken.clear();
+}
+
+int getHubPassword(IOTContextInternal *internal, char* buffer, unsigned bufferSize) {
+    if (!internal->sasToken.isInitialized()) {
+        IOTC_LOG(F("ERROR: (getHubPassword) hub credentials are not set"));
+        return 1;
+    }
+
+    return internal->sasToken.write(buffer, bufferSize, getNow() + EXPIRES) == 0 ? 1 : 0;
+}
+
+// seconds before the token expires that it is renewed
+static unsigned long tokenRenewalMargin() {
+    return iotc_min(TOKEN_RENEWAL_MARGIN, EXPIRES / 10);
+}
+
+bool hubTokenNeedsRenewal(IOTContextInternal *internal) {
+    unsigned long expiresAt = internal->sasToken.getExpiresAt();
+    if (expiresAt == 0) return false;
+
+    return getNow() + tokenRenewalMargin() >= expiresAt;
+}
+
 int getDPSAuthString(const char* scopeId, const char* deviceId, const char* key,
   char *buffer, int bufferSize, size_t &outLength) {
-    size_t expires = getNow() + EXPIRES;
-
-    AzureIOT::StringBuffer deviceIdEncoded(deviceId, strlen(deviceId));
-    deviceIdEncoded.urlEncode();
-
-    AzureIOT::StringBuffer stringToSign(STRING_BUFFER_256);
-    size_t size = snprintf(*stringToSign, STRING_BUFFER_256, "%s%%2Fregistrations%%2F%s", scopeId, *deviceIdEncoded);
-    assert(size < STRING_BUFFER_256);
-    stringToSign.setLength(size);
-
-    AzureIOT::StringBuffer sr(stringToSign);
-    size = snprintf(*stringToSign, STRING_BUFFER_256, "%s\n%lu000", *sr, expires);
-    assert(size < STRING_BUFFER_256);
-    stringToSign.setLength(size);
-
-    size = 0;
-    AzureIOT::StringBuffer keyDecoded(key, strlen(key));
-    keyDecoded.base64Decode();
-    stringToSign.hash(*keyDecoded, keyDecoded.getLength());
-    if (!stringToSign.base64Encode() || !stringToSign.urlEncode()) {
-        IOTC_LOG(F("ERROR: stringToSign base64Encode / urlEncode has failed."));
+    AzureIOT::StringPoolScope poolScope;
+    const char* header = "authorization: ";
+    const char* keyName = "&skn=registration";
+    const unsigned headerLength = strlen(header), keyNameLength = strlen(keyName);
+
+    AzureIOT::SASToken sasToken;
+    if (sasToken.initialize(key, strlen(key), scopeId, strlen(scopeId),
+            SAS_REGISTRATIONS_SECTION, deviceId, strlen(deviceId))) {
         return 1;
     }
 
-    outLength = snprintf(buffer, bufferSize, "authorization: SharedAccessSignature sr=%s&sig=%s&se=%lu000&skn=registration",
-        *sr, *stringToSign, expires);
-    assert(outLength > 0 && outLength < bufferSize);
-    buffer[outLength] = 0;
+    if ((unsigned) bufferSize <= headerLength + keyNameLength) return 1;
+    memcpy(buffer, header, headerLength);
+    unsigned length = sasToken.write(buffer + headerLength,
+        bufferSize - (headerLength + keyNameLength), getNow() + EXPIRES);
+    if (length == 0) {
+        IOTC_LOG(F("ERROR: (getDPSAuthString) SAS token doesn't fit into the buffer"));
+        return 1;
+    }
 
+    memcpy(buffer + headerLength + length, keyName, keyNameLength + 1);
+    outLength = headerLength + length + keyNameLength;
     return 0;
 }
 
@@ -208,6 +279,43 @@ void connectionStatusCallback(IOTConnectionState status, IOTContextInternal *int
     }
 }
 
+/* ConnectionTiming */
+void connectionTimingCallback(IOTContextInternal *internal, const char* tag,
+    const AzureIOT::ConnectTiming &timing, long connackMs) {
+    if (internal->callbacks[/*IOTCallbacks::*/::ConnectionTiming].callback == NULL) {
+        return;
+    }
+
+    unsigned long total = timing.dnsMs + timing.tcpMs + timing.handshakeMs;
+    char connack[STRING_BUFFER_32] = {0};
+    if (connackMs >= 0) {
+        snprintf(connack, STRING_BUFFER_32, ",\"connack\":%ld", connackMs);
+        total += (unsigned long) connackMs;
+    }
+
+    char payload[STRING_BUFFER_128];
+    int length = 0;
+    if (timing.phased) {
+        length = snprintf(payload, STRING_BUFFER_128,
+            "{\"dns\":%lu,\"tcp\":%lu,\"tls\":%lu%s,\"resumed\":%s}",
+            timing.dnsMs, timing.tcpMs, timing.handshakeMs, connack,
+            timing.resumed ? "true" : "false");
+    } else {
+        length = snprintf(payload, STRING_BUFFER_128, "{\"connect\":%lu%s}",
+            timing.handshakeMs, connack);
+    }
+
+    IOTCallbackInfo info;
+    info.eventName = "ConnectionTiming";
+    info.tag = tag;
+    info.payload = payload;
+    info.payloadLength = (unsigned) length;
+    info.appContext = internal->callbacks[/*IOTCallbacks::*/::ConnectionTiming].appContext;
+    info.statusCode = (int) total;
+    info.callbackResponse = NULL;
+    internal->callbacks[/*IOTCallbacks::*/::ConnectionTiming].callback(internal, &info);
+}
+
 void sendOnError(IOTContextInternal *internal, const char* message) {
     if (internal->callbacks[/*IOTCallbacks::*/::Error].callback) {
         IOTCallbackInfo info;
@@ -222,16 +330,257 @@ void sendOnError(IOTContextInternal *internal, const char* message) {
     }
 }
 
+int cacheTopics(IOTContextInternal *internal) {
+    clearTopics(internal);
+
+    AzureIOT::StringHeapScope heapScope;
+    unsigned length = internal->deviceId.getLength() + strlen(EVENTS_TOPIC_TEMPLATE) - 2 /* %s */;
+    internal->eventsTopic.alloc(length + 1);
+    // + 11 for the request id (%d), + 1 for \0
+    internal->reportedTopic.alloc(REPORTED_TOPIC_PREFIX_LENGTH + 12);
+    if (*internal->eventsTopic == NULL || *internal->reportedTopic == NULL) {
+        IOTC_LOG(F("ERROR: (cacheTopics) out of memory"));
+        clearTopics(internal);
+        return 1;
+    }
+
+    internal->eventsTopic.setLength(snprintf(*internal->eventsTopic, length + 1,
+        EVENTS_TOPIC_TEMPLATE, *internal->deviceId));
+    memcpy(*internal->reportedTopic, REPORTED_TOPIC_PREFIX, REPORTED_TOPIC_PREFIX_LENGTH);
+    internal->reportedTopic.setLength(REPORTED_TOPIC_PREFIX_LENGTH);
+    return 0;
+}
+
+void clearTopics(IOTContextInternal *internal) {
+    internal->eventsTopic.clear();
+    internal->reportedTopic.clear();
+}
+
+// appends the next request id to the cached reported properties topic
+// returns the length of the topic
+static unsigned nextReportedTopic(IOTContextInternal *internal) {
+    int size = snprintf(*internal->reportedTopic + REPORTED_TOPIC_PREFIX_LENGTH, 12,
+        "%d", internal->messageId++);
+    internal->reportedTopic.setLength(REPORTED_TOPIC_PREFIX_LENGTH + size);
+    return internal->reportedTopic.getLength();
+}
+
+int flushProperties(IOTContextInternal *internal) {
+    AzureIOT::PropertyBatch &batch = internal->properties;
+    if (batch.isEmpty() || batch.isSending()) return 0;
+
+    // kept on failure; the next flush tries again
+    batch.beginSend();
+    unsigned topicLength = nextReportedTopic(internal);
+    int rc = mqtt_publish(internal, *internal->reportedTopic, topicLength,
+        batch.getData(), batch.getLength());
+    if (rc == 0) {
+        sendConfirmationCallback(batch.getData(), batch.getLength());
+    }
+    batch.endSend(rc == 0);
+
+    if (rc != 0) {
+        IOTC_LOG(F("ERROR: (flushProperties) MQTTClient publish has failed."));
+        return 1;
+    }
+    return 0;
+}
+
+// keeps telemetry that couldn't be sent for drainStore
+// returns 0 if it was stored
+static int storeMessage(IOTContextInternal *internal, const char* payload, unsigned length) {
+    if (!internal->store.isOpen()) return 1;
+
+    if (internal->store.append(payload, length, getNow()) != 0) {
+        IOTC_LOG(F("ERROR: (storeMessage) the message couldn't be stored."));
+        return 1;
+    }
+    return 0;
+}
+
+int flushTelemetry(IOTContextInternal *internal) {
+    AzureIOT::TelemetryBatch &batch = internal->telemetry;
+    if (batch.isEmpty() || batch.isSending()) return 0;
+
+    // kept on failure; the next flush tries again
+    batch.beginSend();
+    int rc = mqtt_publish(internal, *internal->eventsTopic, internal->eventsTopic.getLength(),
+        batch.getData(), batch.getLength());
+    if (rc == 0) {
+        // MessageSent per sample, as if they were sent one by one
+        for (unsigned i = 0; i < batch.getCount(); i++) {
+            unsigned sampleLength = 0;
+            const char* sample = batch.getSample(i, sampleLength);
+            sendConfirmationCallback(sample, sampleLength);
+        }
+    }
+    // a stored batch goes out as one message later on
+    bool stored = rc != 0 && storeMessage(internal, batch.getData(), batch.getLength()) == 0;
+    batch.endSend(rc == 0 || stored);
+
+    if (rc != 0 && !stored) {
+        IOTC_LOG(F("ERROR: (flushTelemetry) MQTTClient publish has failed."));
+        return 1;
+    }
+    return 0;
+}
+
+void drainStore(IOTContextInternal *internal) {
+    AzureIOT::MessageStore &store = internal->store;
+    // the handlers that run while it publishes may call iotc_do_work
+    if (internal->draining || internal->mqttClient == NULL ||
+        !store.isOpen() || store.isEmpty()) return;
+
+    unsigned long now = getTickMs();
+    if (now - internal->lastDrainMs < internal->storeDrainMs) return;
+    internal->lastDrainMs = now;
+
+    AzureIOT::StringBuffer message;
+    unsigned long timestamp = 0;
+    if (store.peek(message, timestamp) != 0) return;
+
+    // sent with the time it was created
+    unsigned eventsTopicLength = internal->eventsTopic.getLength();
+    AzureIOT::StringBuffer topic(eventsTopicLength + STRING_BUFFER_64);
+    memcpy(*topic, *internal->eventsTopic, eventsTopicLength);
+    unsigned topicLength = eventsTopicLength;
+    time_t created = (time_t) timestamp;
+    struct tm* utc = timestamp != 0 ? gmtime(&created) : NULL;
+    if (utc != NULL) {
+        topicLength += strftime(*topic + topicLength, STRING_BUFFER_64,
+            "iothub-creation-time-utc=%Y-%m-%dT%H%%3A%M%%3A%SZ", utc);
+    }
+    topic.setLength(topicLength);
+
+    internal->draining = true;
+    int rc = mqtt_publish(internal, *topic, topicLength, *message, message.getLength());
+    internal->draining = false;
+    if (rc != 0) return; // tried again on the next turn
+
+    store.pop();
+    sendConfirmationCallback(*message, message.getLength());
+}
+
+void flushDueBatches(IOTContextInternal *internal) {
+    unsigned long now = getTickMs();
+    if (internal->telemetry.isDue(now)) {
+        flushTelemetry(internal);
+    }
+    // a callback of the flush may have disconnected
+    if (internal->mqttClient != NULL && internal->properties.isDue(now)) {
+        flushProperties(internal);
+    }
+}
+
+unsigned long getWorkWaitMs(IOTContextInternal *internal, unsigned long nowMs) {
+    if (internal->dps.isBusy()) {
+        // a response is read as it comes in (0 until then)
+        return iotc_min(internal->dps.getWaitMs(nowMs), (unsigned long) IOTC_MAX_WAIT_MS);
+    }
+    if (internal->mqttClient == NULL) {
+        if (!internal->reconnect.isPending()) return IOTC_MAX_WAIT_MS;
+        return iotc_min(internal->reconnect.getWaitMs(nowMs), (unsigned long) IOTC_MAX_WAIT_MS);
+    }
+
+    unsigned long waitMs = IOTC_MAX_WAIT_MS;
+    unsigned long expiresAt = internal->sasToken.getExpiresAt();
+    if (expiresAt != 0) {
+        unsigned long renewAt = expiresAt - tokenRenewalMargin();
+        unsigned long now = getNow();
+        if (now >= renewAt) {
+            waitMs = 0;
+        } else if (renewAt - now < IOTC_MAX_WAIT_MS / 1000) {
+            waitMs = (renewAt - now) * 1000UL;
+        }
+    }
+    waitMs = iotc_min(waitMs, internal->telemetry.getWaitMs(nowMs));
+    waitMs = iotc_min(waitMs, internal->properties.getWaitMs(nowMs));
+
+    AzureIOT::MessageStore &store = internal->store;
+    if (store.isOpen() && !store.isEmpty()) {
+        unsigned long sinceMs = nowMs - internal->lastDrainMs;
+        waitMs = sinceMs >= internal->storeDrainMs ? 0 :
+            iotc_min(waitMs, internal->storeDrainMs - sinceMs);
+    }
+    return waitMs;
+}
+
+// how long a blocking registration waits on each read
+#define DPS_BLOCKING_READ_MS 100
+
+int beginProvisioning(IOTContextInternal *internal, const char* scopeId,
+    const char* deviceId, const char* key) {
+    return internal->dps.begin(internal->endpoint == NULL ? DEFAULT_ENDPOINT : internal->endpoint,
+        scopeId, deviceId, key);
+}
+
+int provisionStep(IOTContextInternal *internal, unsigned readTimeoutMs) {
+    AzureIOT::DPSClient &dps = internal->dps;
+    AzureIOT::DPSState state = dps.step(getTickMs(), readTimeoutMs);
+    AzureIOT::ConnectTiming timing;
+    if (dps.takeTiming(timing)) {
+        connectionTimingCallback(internal, "dps", timing, -1);
+    }
+    if (state != AzureIOT::DPS_DONE && state != AzureIOT::DPS_FAILED) {
+        return dps.isBusy() ? 2 : 1;
+    }
+
+    int rc = 1;
+    if (state == AzureIOT::DPS_DONE) {
+        rc = setHubCredentials(internal,
+            *dps.getHostName(), dps.getHostName().getLength(),
+            *dps.getDeviceId(), dps.getDeviceId().getLength(),
+            *dps.getKey(), dps.getKey().getLength());
+    }
+    dps.clear();
+    return rc;
+}
+
+int finishProvisioning(IOTContextInternal *internal) {
+    int rc = 0;
+    while ((rc = provisionStep(internal, DPS_BLOCKING_READ_MS)) == 2) {
+        unsigned long waitMs = internal->dps.getWaitMs(getTickMs());
+        if (waitMs > 0) WAITMS(waitMs);
+    }
+    return rc;
+}
+
+// Merges a reported property patch into the pending batch when batching is
+// on. Anything the batch can't take goes out on its own, after the pending
+// properties so a newer value is never overwritten by an older one (and
+// right away while a flush is publishing).
+// MessageSent fires for every published batch, and for a patch that goes
+// out on its own when `confirm` is set.
+// returns 0 if there is no error
+static int sendProperty(IOTContextInternal *internal, const char* payload, unsigned length,
+    bool confirm) {
+    AzureIOT::PropertyBatch &batch = internal->properties;
+    if (batch.isEnabled() && !batch.isSending()) {
+        if (!batch.fits(length) && flushProperties(internal) != 0) return 1;
+        if (batch.merge(payload, length, getTickMs()) == 0) return 0;
+        if (flushProperties(internal) != 0) return 1;
+    }
+
+    unsigned topicLength = nextReportedTopic(internal);
+    if (mqtt_publish(internal, *internal->reportedTopic, topicLength, payload, length) != 0) {
+        return 1;
+    }
+
+    if (confirm) {
+        sendConfirmationCallback(payload, length);
+    }
+    return 0;
+}
+
 void echoDesired(IOTContextInternal *internal, const char *propertyName,
   AzureIOT::StringBuffer &message, const char *status, int statusCode) {
-    AzureIOT::JSObject rootObject(*message);
-    AzureIOT::JSObject propertyNameObject;
+    // only `value` and `$version` are needed; no DOM
+    AzureIOT::JSCursor rootObject(*message, message.getLength());
+    AzureIOT::JSCursor propertyNameObject;
 
     rootObject.getObjectByName(propertyName, &propertyNameObject);
 
     double value = 0, desiredVersion = 0;
-    propertyName = rootObject.getNameAt(0);
-
     value = propertyNameObject.getNumberByName("value");
     desiredVersion = rootObject.getNumberByName("$version");
 
@@ -246,11 +595,7 @@ void echoDesired(IOTContextInternal *internal, const char *propertyName,
              (int) value, statusCode, status, (int) desiredVersion);
     buffer.setLength(size);
 
-    const char* topicName = "$iothub/twin/PATCH/properties/reported/?$rid=%d";
-    AzureIOT::StringBuffer topic(strlen(topicName) + 21); // + 2 for %d == +23 in case requestId++ overflows
-    topic.setLength(snprintf(*topic, topic.getLength(), topicName, internal->messageId++));
-
-    if (mqtt_publish(internal, *topic, topic.getLength(), *buffer, size) != 0) {
+    if (sendProperty(internal, *buffer, size, false) != 0) {
         IOTC_LOG(F("ERROR: (echoDesired) MQTTClient publish has failed."));
     }
 }
@@ -280,70 +625,186 @@ static void deviceTwinGetStateCallback(DEVICE_TWIN_UPDATE_STATE update_state,
     IOTContextInternal *internal = (IOTContextInternal*)userContextCallback;
     assert(internal != NULL);
 
-    AzureIOT::JSObject desired(*payload);
+    AzureIOT::JSCursor desired(*payload, payload.getLength());
+    AzureIOT::JSCursor name;
 
-    for (unsigned i = 0, count = desired.getCount(); i < count; i++) {
-        const char * itemName = desired.getNameAt(i);
-        if (itemName != NULL && itemName[0] != '$') {
-            callDesiredCallback(internal, itemName, payload);
+    for (unsigned offset = 0; desired.getNextMember(offset, &name, NULL); ) {
+        // name.getLength() includes the quotes
+        if (name.getLength() > 2 && name.getData()[1] != '$') {
+            AzureIOT::StringBuffer itemName(name.getLength() - 1);
+            itemName.setLength(name.copyString(*itemName, name.getLength() - 1));
+            callDesiredCallback(internal, *itemName, payload);
         }
     }
 }
 
+#define METHODS_TOPIC_PREFIX "$iothub/methods/POST/"
+#define DESIRED_TOPIC_PREFIX "$iothub/twin/PATCH/properties/desired/"
+#define TWIN_RESPONSE_TOPIC_PREFIX "$iothub/twin/res/"
+
+/* Command: $iothub/methods/POST/<method name>/?$rid=<request id> */
+static void onMethodTopic(const char* topic, unsigned topicLength,
+    const AzureIOT::TopicFields &fields, char* payload, unsigned long payloadLength,
+    void* handlerContext) {
+    IOTContextInternal *internal = (IOTContextInternal*)handlerContext;
+
+    if (fields.requestId == NULL || fields.segmentLength == 0 ||
+        fields.segmentLength >= STRING_BUFFER_128 ||
+        fields.requestIdLength >= STRING_BUFFER_64) {
+        IOTC_LOG(F("ERROR: corrupt C2D message topic => %.*s"), (int) topicLength, topic);
+        return;
+    }
+
+    // the transport may reuse the buffer of the topic when the callback
+    // publishes; keep what we need on the stack
+    char methodName[STRING_BUFFER_128];
+    memcpy(methodName, fields.segment, fields.segmentLength);
+    methodName[fields.segmentLength] = 0;
+    char requestId[STRING_BUFFER_64];
+    memcpy(requestId, fields.requestId, fields.requestIdLength);
+    requestId[fields.requestIdLength] = 0;
+
+    const char* constResponse = "{}";
+    char* response = NULL;
+    size_t respSize = 0;
+    int rc = onCommand(methodName, payload, payloadLength, &response, &respSize, internal);
+    if (respSize == 0) {
+        respSize = 2;
+    } else {
+        constResponse = response;
+    }
+
+    char respTopic[STRING_BUFFER_128];
+    int respTopicLength = snprintf(respTopic, STRING_BUFFER_128,
+        "$iothub/methods/res/%d/?$rid=%s", rc, requestId);
+
+    if (mqtt_publish(internal, respTopic, respTopicLength, constResponse, respSize) != 0) {
+        IOTC_LOG(F("ERROR: mqtt_publish has failed during C2D with response topic '%s' and response '%s'"), respTopic, constResponse);
+    }
+    if (response != constResponse) {
+        free(response);
+    }
+}
+
+/* SettingsUpdated: $iothub/twin/PATCH/properties/desired/?$version=<version> */
+static void onDesiredTopic(const char* topic, unsigned topicLength,
+    const AzureIOT::TopicFields &fields, char* payload, unsigned long payloadLength,
+    void* handlerContext) {
+    // a copy; echoDesired publishes (and the transport may reuse its buffer)
+    // while the properties are walked
+    AzureIOT::StringBuffer desired;
+    if (payloadLength) {
+        desired.initialize(payload, payloadLength);
+    }
+    deviceTwinGetStateCallback(DEVICE_TWIN_UPDATE_ALL, desired, handlerContext);
+}
+
+/* responses to the reported property updates; nothing to do */
+static void onTwinResponseTopic(const char* topic, unsigned topicLength,
+    const AzureIOT::TopicFields &fields, char* payload, unsigned long payloadLength,
+    void* handlerContext) { }
+
+/* iotc_on_topic */
+static void onUserTopic(const char* topic, unsigned topicLength,
+    const AzureIOT::TopicFields &fields, char* payload, unsigned long payloadLength,
+    void* handlerContext) {
+    TopicCallback *entry = (TopicCallback*)handlerContext;
+
+    // not every transport \0 terminates the topic
+    AzureIOT::StringBuffer topicName(topic, topicLength);
+    IOTCallbackInfo info;
+    info.eventName = "Topic";
+    info.tag = *topicName;
+    info.payload = payload;
+    info.payloadLength = (unsigned) payloadLength;
+    info.appContext = entry->callback.appContext;
+    info.statusCode = 0;
+    info.callbackResponse = NULL;
+    entry->callback.callback(getSingletonContext(), &info);
+}
+
 void handlePayload(char *msg, unsigned long msg_length, char *topic, unsigned long topic_length) {
+    AzureIOT::StringPoolScope poolScope;
     if (topic_length) {
         assert(topic != NULL);
-        AzureIOT::StringBuffer topicName(topic, topic_length);
-        if (topicName.startsWith("$iothub/twin/res", strlen("$iothub/twin/res"))) return;
+        if (!singletonContext->topicRouter.dispatch(topic, topic_length, msg, msg_length)) {
+            IOTC_LOG(F("ERROR: unknown twin topic: %.*s, msg: %.*s"), (int) topic_length, topic,
+                msg_length ? (int) msg_length : 4, msg_length ? msg : "NULL");
+        }
+    }
+}
 
-        AzureIOT::StringBuffer payload;
-        if (msg_length) {
-            payload.initialize(msg, msg_length);
+void clearTopicCallbacks(IOTContextInternal *internal) {
+    for (unsigned i = 0; i < IOTC_MAX_TOPIC_CALLBACKS; i++) {
+        TopicCallback &entry = internal->topicCallbacks[i];
+        if (*entry.prefix != NULL) {
+            internal->topicRouter.remove(*entry.prefix);
+            entry.prefix.clear();
         }
+        entry.callback.callback = NULL;
+        entry.callback.appContext = NULL;
+    }
+}
+
+/* extern */
+int iotc_on_topic(IOTContext ctx, const char* topicPrefix, IOTCallback callback, void* appContext) {
+    CHECK_NOT_NULL(ctx)
+    GET_LENGTH_NOT_NULL_NOT_EMPTY(topicPrefix, STRING_BUFFER_256);
 
-        if (topicName.startsWith("$iothub/twin/PATCH/properties/desired/", strlen("$iothub/twin/PATCH/properties/desired/"))) {
-            deviceTwinGetStateCallback(DEVICE_TWIN_UPDATE_ALL, payload, singletonContext);
-        } else if (topicName.startsWith("$iothub/methods", strlen("$iothub/methods"))) {
-            int index = topicName.indexOf("$rid=", 5, 0);
-            if (index == -1) {
-                IOTC_LOG(F("ERROR: corrupt C2D message topic => %s"), *topicName);
-                return;
-            }
-
-            const char* topicId = (*topicName + index + 5);
-            const char* topicTemplate = "$iothub/methods/POST/";
-            const int topicTemplateLength = strlen(topicTemplate);
-            index = topicName.indexOf("/", 1, topicTemplateLength + 1);
-            if (index == -1) {
-                IOTC_LOG(F("ERROR: corrupt C2D message topic (methodName) => %s"), *topicName);
-                return;
-            }
-
-            AzureIOT::StringBuffer methodName(topic + topicTemplateLength, index - topicTemplateLength);
-
-            const char* constResponse = "{}";
-            char* response = NULL;
-            size_t respSize = 0;
-            int rc = onCommand(*methodName, msg, msg_length, &response, &respSize, getSingletonContext());
-            if (respSize == 0) {
-                respSize = 2;
-            } else {
-                constResponse = response;
-            }
-
-            AzureIOT::StringBuffer respTopic(STRING_BUFFER_128);
-            respTopic.setLength(snprintf(*respTopic, STRING_BUFFER_128, "$iothub/methods/res/%d/?$rid=%s", rc, topicId));
-
-            if (mqtt_publish(getSingletonContext(), *respTopic, respTopic.getLength(), constResponse, respSize) != 0) {
-                IOTC_LOG(F("ERROR: mqtt_publish has failed during C2D with response topic '%s' and response '%s'"), *respTopic, constResponse);
-            }
-            if (response != constResponse) {
-                free(response);
-            }
-        } else {
-            IOTC_LOG(F("ERROR: unknown twin topic: %s, msg: %s"), topic, msg_length ? msg : "NULL");
+    IOTContextInternal *internal = (IOTContextInternal*)ctx;
+    MUST_CALL_AFTER_INIT(internal);
+
+    if (strcmp(topicPrefix, METHODS_TOPIC_PREFIX) == 0 ||
+        strcmp(topicPrefix, DESIRED_TOPIC_PREFIX) == 0 ||
+        strcmp(topicPrefix, TWIN_RESPONSE_TOPIC_PREFIX) == 0) {
+        IOTC_LOG(F("ERROR: (iotc_on_topic) %s is handled by the SDK. Use iotc_on instead."), topicPrefix);
+        return 1;
+    }
+
+    TopicCallback *entry = NULL, *empty = NULL;
+    for (unsigned i = 0; i < IOTC_MAX_TOPIC_CALLBACKS; i++) {
+        TopicCallback &slot = internal->topicCallbacks[i];
+        if (*slot.prefix == NULL) {
+            if (empty == NULL) empty = &slot;
+        } else if (strcmp(*slot.prefix, topicPrefix) == 0) {
+            entry = &slot;
+            break;
+        }
+    }
+
+    if (callback == NULL) { // unregister
+        if (entry != NULL) {
+            internal->topicRouter.remove(*entry->prefix);
+            entry->prefix.clear();
+            entry->callback.callback = NULL;
+            entry->callback.appContext = NULL;
+        }
+        return 0;
+    }
+
+    if (entry == NULL) {
+        if (empty == NULL) {
+            IOTC_LOG(F("ERROR: (iotc_on_topic) no room for another topic callback. (max %d)"),
+                IOTC_MAX_TOPIC_CALLBACKS);
+            return 1;
+        }
+        entry = empty;
+        AzureIOT::StringHeapScope heapScope;
+        entry->prefix.initialize(topicPrefix, topicPrefix_len);
+        if (*entry->prefix == NULL) {
+            IOTC_LOG(F("ERROR: (iotc_on_topic) out of memory"));
+            return 1;
+        }
+        if (internal->topicRouter.add(*entry->prefix, onUserTopic, entry) != 0) {
+            IOTC_LOG(F("ERROR: (iotc_on_topic) topic router is full"));
+            entry->prefix.clear();
+            return 1;
         }
     }
+
+    entry->callback.callback = callback;
+    entry->callback.appContext = appContext;
+    return 0;
 }
 
 /* extern */
@@ -352,11 +813,28 @@ int iotc_send_telemetry(IOTContext ctx, const char* payload, unsigned length) {
     CHECK_NOT_NULL(payload)
 
     IOTContextInternal *internal = (IOTContextInternal*)ctx;
+    if (internal->mqttClient == NULL && internal->store.isOpen()) {
+        // offline; iotc_do_work sends it once connected again
+        return storeMessage(internal, payload, length);
+    }
     MUST_CALL_AFTER_CONNECT(internal);
 
-    AzureIOT::StringBuffer topic(internal->deviceId.getLength() + strlen("devices/ /messages/events/"));
-    topic.setLength(snprintf(*topic, topic.getLength(), "devices/%s/messages/events/", *internal->deviceId));
-    if (mqtt_publish(internal, *topic, topic.getLength(), payload, length) != 0) {
+    AzureIOT::TelemetryBatch &batch = internal->telemetry;
+    if (batch.isEnabled() && !batch.isSending()) {
+        if (!batch.fits(length) && flushTelemetry(internal) != 0) {
+            IOTC_LOG(F("ERROR: (iotc_send_telemetry) the batch is full and can't be sent."));
+            return 1;
+        }
+        if (batch.add(payload, length, getTickMs()) == 0) {
+            // a failed flush is retried by iotc_do_work
+            if (batch.isFull()) flushTelemetry(internal);
+            return 0;
+        }
+        // bigger than the whole batch; goes out on its own
+    }
+
+    if (mqtt_publish(internal, *internal->eventsTopic, internal->eventsTopic.getLength(), payload, length) != 0) {
+        if (storeMessage(internal, payload, length) == 0) return 0;
         IOTC_LOG(F("ERROR: (iotc_send_telemetry) MQTTClient publish has failed."));
         return 1;
     }
@@ -373,19 +851,88 @@ int iotc_send_property (IOTContext ctx, const char* payload, unsigned length) {
     IOTContextInternal *internal = (IOTContextInternal*)ctx;
     MUST_CALL_AFTER_CONNECT(internal);
 
-    const char* topicName = "$iothub/twin/PATCH/properties/reported/?$rid=%d";
-    AzureIOT::StringBuffer topic(strlen(topicName) + 21); // + 2 for %d == +23 in case requestId++ overflows
-    topic.setLength(snprintf(*topic, topic.getLength(), topicName, internal->messageId++));
-
-    if (mqtt_publish(internal, *topic, topic.getLength(), payload, length) != 0) {
+    if (sendProperty(internal, payload, length, true) != 0) {
         IOTC_LOG(F("ERROR: (iotc_send_property) MQTTClient publish has failed."));
         return 1;
     }
+    return 0;
+}
 
-    sendConfirmationCallback(payload, length);
+/* extern */
+int iotc_set_property_batching(IOTContext ctx, unsigned intervalMs, unsigned maxBytes) {
+    CHECK_NOT_NULL(ctx)
+
+    IOTContextInternal *internal = (IOTContextInternal*)ctx;
+    MUST_CALL_AFTER_INIT(internal);
+
+    if (internal->mqttClient != NULL && flushProperties(internal) != 0) {
+        return 1;
+    }
+
+    if (internal->properties.configure(intervalMs, maxBytes) != 0) {
+        IOTC_LOG(F("ERROR: (iotc_set_property_batching) out of memory"));
+        return 1;
+    }
+    return 0;
+}
+
+/* extern */
+int iotc_set_telemetry_batching(IOTContext ctx, unsigned maxCount, unsigned maxBytes, unsigned maxAgeMs) {
+    CHECK_NOT_NULL(ctx)
+
+    IOTContextInternal *internal = (IOTContextInternal*)ctx;
+    MUST_CALL_AFTER_INIT(internal);
+
+    if (internal->mqttClient != NULL && flushTelemetry(internal) != 0) {
+        return 1;
+    }
+
+    if (internal->telemetry.configure(maxCount, maxBytes, maxAgeMs) != 0) {
+        IOTC_LOG(F("ERROR: (iotc_set_telemetry_batching) out of memory"));
+        return 1;
+    }
     return 0;
 }
 
+/* extern */
+int iotc_set_offline_store(IOTContext ctx, const char* path, unsigned slotCount,
+    unsigned slotSize, unsigned drainIntervalMs) {
+    CHECK_NOT_NULL(ctx)
+
+    IOTContextInternal *internal = (IOTContextInternal*)ctx;
+    MUST_CALL_AFTER_INIT(internal);
+
+    internal->store.close();
+    internal->storeDrainMs = drainIntervalMs;
+    if (path == NULL) return 0;
+
+    if (internal->store.open(path, slotCount, slotSize) != 0) {
+        IOTC_LOG(F("ERROR: (iotc_set_offline_store) couldn't open %s"), path);
+        return 1;
+    }
+    return 0;
+}
+
+/* extern */
+int iotc_flush_telemetry(IOTContext ctx) {
+    CHECK_NOT_NULL(ctx)
+
+    IOTContextInternal *internal = (IOTContextInternal*)ctx;
+    MUST_CALL_AFTER_CONNECT(internal);
+
+    return flushTelemetry(internal);
+}
+
+/* extern */
+int iotc_flush_properties(IOTContext ctx) {
+    CHECK_NOT_NULL(ctx)
+
+    IOTContextInternal *internal = (IOTContextInternal*)ctx;
+    MUST_CALL_AFTER_CONNECT(internal);
+
+    return flushProperties(internal);
+}
+
 /* extern */
 int iotc_init_context(IOTContext *ctx) {
     CHECK_NOT_NULL(ctx)
@@ -398,9 +945,15 @@ int iotc_init_context(IOTContext *ctx) {
     MUST_CALL_BEFORE_INIT((*ctx));
     IOTContextInternal *internal = (IOTContextInternal*)malloc(sizeof(IOTContextInternal));
     CHECK_NOT_NULL(internal);
+    // no constructors run: every member (StringBuffer, TopicRouter, DPSClient,
+    // ...) is in its initial, empty state when all of its bytes are zero
     memset(internal, 0, sizeof(IOTContextInternal));
     *ctx = (void*)internal;
 
+    internal->topicRouter.add(METHODS_TOPIC_PREFIX, onMethodTopic, internal);
+    internal->topicRouter.add(DESIRED_TOPIC_PREFIX, onDesiredTopic, internal);
+    internal->topicRouter.add(TWIN_RESPONSE_TOPIC_PREFIX, onTwinResponseTopic, internal);
+
     setSingletonContext(internal);
 
     return 0;
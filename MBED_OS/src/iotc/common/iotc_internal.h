@@ -12,6 +12,15 @@
 #include <limits.h>
 #include "../iotc.h"
 #include "string_buffer.h"
+#include "encoding.h"
+#include "hmac_sha256.h"
+#include "sas_token.h"
+#include "topic_router.h"
+#include "property_batch.h"
+#include "telemetry_batch.h"
+#include "message_store.h"
+#include "dps_client.h"
+#include "reconnect_policy.h"
 
 #define AZ_IOT_HUB_MAX_LEN 1024
 #define DEFAULT_ENDPOINT "global.azure-devices-provisioning.net"
@@ -23,7 +32,8 @@ typedef enum IOTCallbacks_TAG {
     MessageSent,
     Command,
     Error,
-    SettingsUpdated
+    SettingsUpdated,
+    ConnectionTiming
 } IOTCallbacks;
 
 typedef struct CallbackBase_TAG {
@@ -32,6 +42,14 @@ typedef struct CallbackBase_TAG {
   CallbackBase_TAG() { callback = NULL; appContext = NULL; }
 } CallbackBase;
 
+// routes left for iotc_on_topic once the built-in ones are in
+#define IOTC_MAX_TOPIC_CALLBACKS (TOPIC_ROUTER_MAX_ROUTES - 3)
+
+typedef struct TopicCallback_TAG {
+  AzureIOT::StringBuffer prefix; // the router keeps a pointer to it
+  CallbackBase callback;
+} TopicCallback;
+
 typedef struct IOTContextInternal_TAG {
     char *endpoint;
     IOTProtocol protocol;
@@ -39,6 +57,30 @@ typedef struct IOTContextInternal_TAG {
 #if defined(USE_LIGHT_CLIENT)
     int messageId;
     AzureIOT::StringBuffer deviceId;
+    // formatted once per connect (see cacheTopics)
+    AzureIOT::StringBuffer eventsTopic;   // devices/<deviceId>/messages/events/
+    AzureIOT::StringBuffer reportedTopic; // REPORTED_TOPIC_PREFIX + room for the request id
+    // hub credentials. kept for the lifetime of the context so the SAS token
+    // can be renewed without parsing the key and host again
+    AzureIOT::StringBuffer hostName;
+    AzureIOT::StringBuffer username;
+    AzureIOT::SASToken sasToken;
+    // inbound topics (see handlePayload and iotc_on_topic)
+    AzureIOT::TopicRouter topicRouter;
+    TopicCallback topicCallbacks[IOTC_MAX_TOPIC_CALLBACKS];
+    // reported properties waiting to go out (see iotc_set_property_batching)
+    AzureIOT::PropertyBatch properties;
+    // telemetry waiting to go out (see iotc_set_telemetry_batching)
+    AzureIOT::TelemetryBatch telemetry;
+    // telemetry that couldn't be sent (see iotc_set_offline_store)
+    AzureIOT::MessageStore store;
+    unsigned storeDrainMs;
+    unsigned long lastDrainMs;
+    bool draining;
+    // device registration in progress (see iotc_connect_async)
+    AzureIOT::DPSClient dps;
+    // when to open the hub connection again (see iotc_set_reconnect)
+    AzureIOT::ReconnectPolicy reconnect;
 #else // use azure iot client
     IOTHUB_CLIENT_LL_HANDLE clientHandle;
 #endif // USE_LIGHT_CLIENT
@@ -47,6 +89,12 @@ typedef struct IOTContextInternal_TAG {
 #if defined(__MBED__)
     AzureIOT::TLSClient *tlsClient;
     MQTT::Client<AzureIOT::TLSClient, Countdown, STRING_BUFFER_1024, 5>* mqttClient;
+    // see iotc_set_wake_callback
+    IOTWakeCallback wakeCallback;
+    void* wakeContext;
+#elif defined(IOTC_POSIX)
+    AzureIOT::TLSClient *tlsClient;
+    AzureIOT::MQTTClient *mqttClient;
 #elif defined(ARDUINO)
     ARDUINO_WIFI_SSL_CLIENT *tlsClient;
     PubSubClient *mqttClient;
@@ -102,8 +150,11 @@ do { \
     }
 #endif // USE_LIGHT_CLIENT
 
-// when the auth token expires
-#define EXPIRES 21600 // 6 hours
+// when the auth token expires (see iotc_set_token_expiration)
+#define DEFAULT_EXPIRES 21600 // 6 hours
+// the hub token is renewed this early (seconds) or, for short lived
+// tokens, once 90% of its lifetime has passed
+#define TOKEN_RENEWAL_MARGIN 300
 
 typedef enum IOTHUBMESSAGE_DISPOSITION_RESULT_TAG {
     IOTHUBMESSAGE_ACCEPTED = 0x01,
@@ -115,6 +166,10 @@ typedef enum DEVICE_TWIN_UPDATE_STATE_TAG {
     DEVICE_TWIN_UPDATE_ALL = 1
 } DEVICE_TWIN_UPDATE_STATE;
 
+#define EVENTS_TOPIC_TEMPLATE "devices/%s/messages/events/"
+#define REPORTED_TOPIC_PREFIX "$iothub/twin/PATCH/properties/reported/?$rid="
+#define REPORTED_TOPIC_PREFIX_LENGTH (sizeof(REPORTED_TOPIC_PREFIX) - 1)
+
 #define HOSTNAME_STRING "HostName="
 #define DEVICEID_STRING ";DeviceId="
 #define KEY_STRING      ";SharedAccessKey="
@@ -134,12 +189,32 @@ int getUsernameAndPasswordFromConnectionString(const char* connectionString, siz
 int getDPSAuthString(const char* scopeId, const char* deviceId, const char* key,
   char *buffer, int bufferSize, size_t &outLength);
 
+// Sets hostName, deviceId, username and sasToken of the context up.
+// returns 0 if there is no error
+int setHubCredentials(IOTContextInternal *internal, const char* hostName,
+    unsigned hostNameLength, const char* deviceId, unsigned deviceIdLength,
+    const char* key, unsigned keyLength);
+int setHubCredentialsFromConnectionString(IOTContextInternal *internal,
+    const char* connectionString, size_t connectionStringLength);
+void clearHubCredentials(IOTContextInternal *internal);
+
+// Writes a fresh SAS token for the hub connection into buffer.
+// returns 0 if there is no error
+int getHubPassword(IOTContextInternal *internal, char* buffer, unsigned bufferSize);
+// true when the token of the current connection is about to expire
+bool hubTokenNeedsRenewal(IOTContextInternal *internal);
+
+void setEXPIRES(unsigned e);
+
 void setLogLevel(IOTLogLevel l);
 IOTLogLevel getLogLevel();
 
 void handlePayload(char *msg, unsigned long msg_length, char *topic, unsigned long topic_length);
-int getHubHostName(const char* dpsEndpoint, const char *scopeId, const char* deviceId, const char* key, char *hostName);
 void connectionStatusCallback(IOTConnectionState status, IOTContextInternal *internal);
+// Reports how long a connection took to open. tag is "dps" or "hub";
+// connackMs < 0 leaves the MQTT phase out.
+void connectionTimingCallback(IOTContextInternal *internal, const char* tag,
+    const AzureIOT::ConnectTiming &timing, long connackMs);
 IOTContextInternal* getSingletonContext();
 void setSingletonContext(IOTContextInternal* ctx);
 void sendConfirmationCallback(const char* buffer, size_t size);
@@ -147,6 +222,52 @@ void sendConfirmationCallback(const char* buffer, size_t size);
 int mqtt_publish(IOTContextInternal *internal, const char* topic, unsigned long topic_length,
     const char* msg, unsigned long msg_length);
 
+// Formats the telemetry and reported property topics for internal->deviceId.
+// Call it from iotc_connect, once deviceId is known.
+// returns 0 if there is no error
+int cacheTopics(IOTContextInternal *internal);
+void clearTopics(IOTContextInternal *internal);
+// Drops the iotc_on_topic registrations. Call it from iotc_free_context
+void clearTopicCallbacks(IOTContextInternal *internal);
+
+// monotonic milliseconds (platform)
+unsigned long getTickMs();
+// Publishes the pending reported properties as a single patch.
+// returns 0 if there is no error (or nothing was pending)
+int flushProperties(IOTContextInternal *internal);
+// Publishes the pending telemetry samples as a single message.
+// returns 0 if there is no error (or nothing was pending)
+int flushTelemetry(IOTContextInternal *internal);
+// Flushes the batches that are due. Call it from iotc_do_work
+void flushDueBatches(IOTContextInternal *internal);
+// Sends the next stored message when it's time. Call it from iotc_do_work
+void drainStore(IOTContextInternal *internal);
+// How long iotc_do_work has nothing to do as far as the common parts go:
+// provisioning, reconnect, token renewal, batches and the offline store.
+// The platform adds the MQTT keep-alive (see iotc_get_wait_ms)
+unsigned long getWorkWaitMs(IOTContextInternal *internal, unsigned long nowMs);
+
+// Starts the registration of deviceId with DPS (internal->dps)
+// returns 0 if there is no error
+int beginProvisioning(IOTContextInternal *internal, const char* scopeId,
+    const char* deviceId, const char* key);
+// Moves the registration one step further (see DPSClient::step) and sets the
+// hub credentials up once DPS has assigned the device.
+// returns 0 when the credentials are set, 2 while it is in progress, 1 if it has failed
+int provisionStep(IOTContextInternal *internal, unsigned readTimeoutMs);
+// Runs the registration to the end
+// returns 0 when the credentials are set
+int finishProvisioning(IOTContextInternal *internal);
+
+// The hub connection is open: fires ConnectionStatus (IOTC_CONNECTION_OK)
+// and lets the reconnect policy know
+void hubConnected(IOTContextInternal *internal);
+// The hub connection was lost, or a try to open it again has failed, for
+// `reason`. Schedules the next try (see iotc_set_reconnect) and fires
+// ConnectionStatus with IOTC_CONNECTION_RETRY_EXPIRED when the policy gives up.
+// returns 0 if a try is scheduled
+int scheduleReconnect(IOTContextInternal *internal, IOTConnectionState reason);
+
 #ifdef ARDUINO
 void IOTC_LOG(const __FlashStringHelper *format, ...);
 #else
@@ -49,6 +49,27 @@
 
 #define F(x) x
 
+#elif defined(IOTC_POSIX)
+
+#if defined(ARDUINO)
+#error "Both IOTC_POSIX and ARDUINO were defined"
+#endif // defined(ARDUINO)
+
+#define USE_LIGHT_CLIENT 1
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "base64.h"
+#include "sha256.h"
+#include "../posix/posix_tls_client.h"
+#include "../posix/posix_mqtt_client.h"
+#define WAITMS AzureIOT::TLSClient::waitMs
+#define SERIAL_PRINT printf
+
+#define F(x) x
+
 #elif defined (ARDUINO)
 #include <arduino.h>
 #include <avr/pgmspace.h>
@@ -20,7 +20,7 @@
  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
  THE SOFTWARE.
 */
-#if defined(ESP_PLATFORM) || defined(__MBED__) || defined(ARDUINO)
+#if defined(ESP_PLATFORM) || defined(__MBED__) || defined(ARDUINO) || defined(IOTC_POSIX)
 #ifdef _MSC_VER
 #ifndef _CRT_SECURE_NO_WARNINGS
 #define _CRT_SECURE_NO_WARNINGS
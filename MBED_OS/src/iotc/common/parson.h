@@ -24,7 +24,7 @@
 #ifndef parson_parson_h
 #define parson_parson_h
 
-#if defined(__MBED__) || defined(ESP_PLATFORM) || defined(ARDUINO)
+#if defined(__MBED__) || defined(ESP_PLATFORM) || defined(ARDUINO) || defined(IOTC_POSIX)
 
 #ifdef __cplusplus
 extern "C"
@@ -0,0 +1,102 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license.
+
+#include <string.h>
+#include "iotc_internal.h"
+#include "json.h"
+#include "string_pool.h"
+
+namespace AzureIOT {
+
+int PropertyBatch::configure(unsigned interval, unsigned maxBytes) {
+    clear();
+    if (interval == 0) return 0;
+
+    if (maxBytes < PROPERTY_BATCH_MIN_BYTES) maxBytes = PROPERTY_BATCH_MIN_BYTES;
+    StringHeapScope heapScope; // kept while batching is on
+    buffer.alloc(maxBytes + 1);
+    if (*buffer == NULL) return 1;
+
+    capacity = maxBytes;
+    intervalMs = interval;
+    reset();
+    return 0;
+}
+
+void PropertyBatch::clear() {
+    buffer.clear();
+    capacity = 0;
+    length = 0;
+    intervalMs = 0;
+    sending = false;
+}
+
+void PropertyBatch::reset() {
+    if (*buffer == NULL) return;
+
+    char* data = *buffer;
+    data[0] = '{';
+    data[1] = '}';
+    data[2] = 0;
+    length = 2;
+}
+
+// removes a pending "name":value and the comma that separates it
+void PropertyBatch::remove(const char* member, unsigned memberLength) {
+    char* data = *buffer;
+    unsigned start = (unsigned)(member - data), end = start + memberLength;
+    if (data[end] == ',') {
+        end++;
+    } else if (data[start - 1] == ',') {
+        start--;
+    }
+
+    memmove(data + start, data + end, length + 1 - end); // and the \0
+    length -= end - start;
+}
+
+unsigned long PropertyBatch::getWaitMs(unsigned long nowMs) {
+    if (sending || isEmpty()) return IOTC_MAX_WAIT_MS;
+    if (isDue(nowMs)) return 0;
+    return iotc_min(firstMergeMs + intervalMs - nowMs, (unsigned long) IOTC_MAX_WAIT_MS);
+}
+
+int PropertyBatch::merge(const char* patch, unsigned patchLength, unsigned long nowMs) {
+    JSCursor object(patch, patchLength);
+    // the members of a patch (and their commas) never take more room than
+    // the patch itself
+    if (!object.isObject() || !fits(patchLength)) return 1;
+
+    bool wasEmpty = isEmpty();
+    char* data = *buffer;
+    JSCursor name, value;
+    for (unsigned offset = 0; object.getNextMember(offset, &name, &value); ) {
+        JSCursor pending(data, length), pendingName, pendingValue;
+        for (unsigned pendingOffset = 0;
+             pending.getNextMember(pendingOffset, &pendingName, &pendingValue); ) {
+            if (pendingName.getLength() == name.getLength() &&
+                memcmp(pendingName.getData(), name.getData(), name.getLength()) == 0) {
+                remove(pendingName.getData(), (unsigned)(pendingValue.getData() +
+                    pendingValue.getLength() - pendingName.getData()));
+                break;
+            }
+        }
+
+        // "...}" -> "...,"name":value}"
+        char* p = data + length - 1;
+        if (!isEmpty()) *p++ = ',';
+        memcpy(p, name.getData(), name.getLength());
+        p += name.getLength();
+        *p++ = ':';
+        memcpy(p, value.getData(), value.getLength());
+        p += value.getLength();
+        *p++ = '}';
+        *p = 0;
+        length = (unsigned)(p - data);
+    }
+
+    if (wasEmpty && !isEmpty()) firstMergeMs = nowMs;
+    return 0;
+}
+
+} // namespace AzureIOT
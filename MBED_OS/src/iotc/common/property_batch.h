@@ -0,0 +1,76 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license.
+
+#ifndef AZURE_IOTC_LITE_PROPERTY_BATCH_H
+#define AZURE_IOTC_LITE_PROPERTY_BATCH_H
+
+#include "string_buffer.h"
+
+#define PROPERTY_BATCH_MIN_BYTES 64
+
+namespace AzureIOT {
+
+// Reported property patches waiting to go out as a single message.
+//
+// The top level members of every patch are merged into one JSON object; a
+// member that is already pending is replaced (last writer wins). The
+// object is kept complete ("{...}") so flushing it doesn't copy anything.
+//
+// Off while zeroed; configure() turns it on.
+class PropertyBatch {
+    StringBuffer buffer; // capacity bytes + \0
+    unsigned capacity;
+    unsigned length;
+    unsigned intervalMs;
+    unsigned long firstMergeMs; // when the oldest pending member came in
+    bool sending;
+
+    void remove(const char* member, unsigned memberLength);
+
+public:
+    // intervalMs == 0 disables the batch (and frees the buffer)
+    // returns 0 if there is no error
+    int configure(unsigned intervalMs, unsigned maxBytes);
+    void clear();
+
+    bool isEnabled() { return intervalMs != 0; }
+    bool isEmpty() { return length <= 2; }
+
+    // true if a patch of this size can be merged without a flush first
+    bool fits(unsigned patchLength) { return length + patchLength <= capacity; }
+
+    // true once the oldest pending member waited for intervalMs
+    bool isDue(unsigned long nowMs) {
+        return !sending && !isEmpty() && nowMs - firstMergeMs >= intervalMs;
+    }
+
+    // how long until isDue() (0 once it is); IOTC_MAX_WAIT_MS when nothing
+    // is pending
+    unsigned long getWaitMs(unsigned long nowMs);
+
+    // returns 0 if the patch was merged, 1 if it doesn't fit (see fits) or
+    // isn't a JSON object
+    int merge(const char* patch, unsigned patchLength, unsigned long nowMs);
+
+    // the pending object; valid until the next merge or reset
+    const char* getData() { return *buffer; }
+    unsigned getLength() { return length; }
+
+    // drops the pending members
+    void reset();
+
+    // Brackets the publish of the pending object. Publishing may run do_work
+    // (and the handlers that send properties) before it returns; the batch
+    // must not change or flush under it.
+    bool isSending() { return sending; }
+    void beginSend() { sending = true; }
+    // drops the pending members if they were sent
+    void endSend(bool sent) {
+        sending = false;
+        if (sent) reset();
+    }
+};
+
+} // namespace AzureIOT
+
+#endif // AZURE_IOTC_LITE_PROPERTY_BATCH_H
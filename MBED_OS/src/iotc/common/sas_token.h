@@ -0,0 +1,49 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license.
+
+#ifndef AZURE_IOTC_LITE_SAS_TOKEN_H
+#define AZURE_IOTC_LITE_SAS_TOKEN_H
+
+#include "string_buffer.h"
+
+#define SAS_TOKEN_PREFIX "SharedAccessSignature sr="
+#define SAS_TOKEN_PREFIX_LENGTH (sizeof(SAS_TOKEN_PREFIX) - 1)
+
+// resource URI sections (already url-encoded)
+#define SAS_DEVICES_SECTION "%2Fdevices%2F"
+#define SAS_REGISTRATIONS_SECTION "%2Fregistrations%2F"
+
+namespace AzureIOT {
+
+// Shared access signature generator.
+//
+// initialize() decodes the key and url-encodes the resource URI once. write()
+// then signs a fresh token straight into the caller's buffer, so renewing the
+// token on a reconnect doesn't re-parse or re-encode anything and doesn't
+// touch the heap.
+class SASToken {
+    StringBuffer key;         // base64 decoded signing key
+    StringBuffer resourceURI; // url-encoded <root><section><id>
+    unsigned long expiresAt;  // expiry of the last token written (seconds)
+
+public:
+    SASToken(): expiresAt(0) { }
+
+    // returns 0 if there is no error
+    int initialize(const char* base64Key, unsigned base64KeyLength,
+        const char* root, unsigned rootLength, const char* section,
+        const char* id, unsigned idLength);
+    void clear();
+    bool isInitialized() { return *key != NULL; }
+
+    // Writes "SharedAccessSignature sr=<uri>&sig=<signature>&se=<expires>000"
+    // into buffer and \0 terminates it.
+    // returns the length of the token, 0 if the buffer is too small
+    unsigned write(char* buffer, unsigned bufferSize, unsigned long expires);
+
+    unsigned long getExpiresAt() { return expiresAt; }
+};
+
+} // namespace AzureIOT
+
+#endif // AZURE_IOTC_LITE_SAS_TOKEN_H
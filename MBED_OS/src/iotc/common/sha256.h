@@ -1,15 +1,22 @@
-#ifdef ARDUINO
+#if defined(ARDUINO) || defined(IOTC_POSIX)
 
 #ifndef Sha256_h
 #define Sha256_h
 
 #include <inttypes.h>
+#include <stddef.h>
+#ifdef ARDUINO
 #include "Print.h"
+#endif // ARDUINO
 
 #define HASH_LENGTH 32
 #define BLOCK_LENGTH 64
 
+#ifdef ARDUINO
 class Sha256 : public Print {
+#else
+class Sha256 {
+#endif // ARDUINO
 
   union Buffer {
     uint8_t b[BLOCK_LENGTH];
@@ -28,14 +35,26 @@ class Sha256 : public Print {
     // Reset to initial state, but preserve key material.
     void reset(void);
 
+    // Hash `length` bytes. Whole 64 byte blocks skip the per byte path.
+    void update(const uint8_t* data, size_t length);
+
     uint8_t* result(void);
     uint8_t* resultHmac(void);
 #if defined(ARDUINO) && ARDUINO >= 100
     virtual size_t write(uint8_t);
-#else
+#elif defined(ARDUINO)
     virtual void write(uint8_t);
+#else
+    size_t write(uint8_t);
+    size_t print(const char* str) {
+      size_t n = 0;
+      while (*str) n += write((uint8_t)*str++);
+      return n;
+    }
 #endif
+#ifdef ARDUINO
     using Print::write;
+#endif // ARDUINO
 
   private:
     void hashBlock();
@@ -54,4 +73,4 @@ class Sha256 : public Print {
 
 #endif
 
-#endif // ARDUINO
\ No newline at end of file
+#endif // defined(ARDUINO) || defined(IOTC_POSIX)
\ No newline at end of file
@@ -3,31 +3,11 @@
 
 #include <stdlib.h>
 #include <stdio.h>
-#include <ctype.h>
 #include "iotc_internal.h"
+#include "string_pool.h"
 
 namespace AzureIOT {
 
-static char convertToHex(char ch) {
-    static const char * lst = "0123456789ABCDEF";
-    return *(lst + (ch & 15));
-}
-
-static char convertFromHex(char ch) {
-    assert(isdigit(ch) || isalpha(ch)); // isalnum ?
-    if (ch <= '9') {
-       return ch - '0';
-    } else {
-        if (ch <= 'Z') {
-            ch = ch - 'A';
-        } else {
-            ch = ch - 'a';
-        }
-
-        return ch + 10;
-    }
-}
-
 bool StringBuffer::startsWith(const char* str, size_t len) {
     if (len > length) return false;
 
@@ -72,170 +52,83 @@ int32_t StringBuffer::indexOf(const char* look_for, size_t look_for_length,
 
 bool StringBuffer::urlEncode() {
     assert(data != NULL);
-    size_t buffer_length = (length * 3) + 1;
-    char *buffer = (char*) malloc(buffer_length);
-    if (buffer == NULL) {
-        return false;
+    unsigned encodedLength = urlEncodedLength(data, length);
+    if (encodedLength == length) {
+        return true; // nothing to escape
     }
 
-    char *tmp = buffer;
-    assert(buffer != NULL);
-
-    for (size_t i = 0; i < length; i++) {
-        char ch = data[i];
-        if (isalnum(ch) ||
-            ch == '_' || ch == '-' || ch == '~' || ch == '.') {
-          *tmp = ch;
-        } else if (ch == ' ') {
-          *tmp = '+';
-        } else {
-            *tmp++ = '%';
-            *tmp++ = convertToHex(ch >> 4);
-            *tmp   = convertToHex(ch & 15);
-        }
-        tmp++;
+    char *buffer = (char*) StringPool::allocate(encodedLength + 1);
+    if (buffer == NULL) {
+        return false;
     }
-    *tmp = 0;
+    urlEncodeTo(buffer, data, length);
 
     clear(); // free prev memory
 
     data = buffer;
-    length = (size_t)tmp - (size_t)buffer;
+    setLength(encodedLength);
     return true;
 }
 
 bool StringBuffer::urlDecode() { // in-memory
     assert(data != NULL);
-    char *tmp = data; // fast
-
-    for (size_t i = 0; i < length; i++) {
-        char ch = data[i];
-        if (ch == '%') {
-            if (i + 2 < length) {
-                *tmp = convertFromHex(data[i + 1]) << 4 |
-                       convertFromHex(data[i + 2]);
-                i += 2;
-            }
-        } else if (ch == '+') {
-            *tmp = ' ';
-        } else {
-            *tmp = ch;
-        }
-        tmp++;
-    }
-    *tmp = 0;
-    length = (size_t)tmp - (size_t)data;
-
+    setLength(urlDecodeTo(data, data, length));
     return true;
 }
 
-#ifdef TARGET_MXCHIP
-
-/* NOOP */
-bool StringBuffer::hash(const char *key, unsigned key_length) { abort(); }
-bool StringBuffer::base64Decode() { abort(); }
-bool StringBuffer::base64Encode() { abort(); }
-
-#elif defined(__MBED__)
-bool StringBuffer::hash(const char *key, unsigned key_length)
-{
-    assert(data != NULL);
-    mbedtls_md_type_t md = MBEDTLS_MD_SHA256;
-    const mbedtls_md_info_t *md_info;
-    mbedtls_md_context_t ctx;
-
-    md_info = mbedtls_md_info_from_type(md);
-    unsigned hash_size = (unsigned) mbedtls_md_get_size(md_info);
-    unsigned char *hmac_hash = (unsigned char*) malloc(hash_size + 1);
-
-    mbedtls_md_init(&ctx);
-    mbedtls_md_setup(&ctx, md_info, 1);
-    mbedtls_md_hmac_starts(&ctx, (const unsigned char*) key, key_length);
-    mbedtls_md_hmac_update(&ctx, (const unsigned char*) data, length);
-    mbedtls_md_hmac_finish(&ctx, hmac_hash);
-
-    free(data);
-    data = (char*)hmac_hash;
-    setLength(hash_size);
-    mbedtls_md_free(&ctx);
-
-    return true;
-}
-
-bool StringBuffer::base64Decode() {
+bool StringBuffer::base64Decode() { // in-memory
     assert(data != NULL && length > 0);
-    char *decoded = (char*) malloc(length + 1); assert(decoded != NULL);
-    size_t keyLength = 0;
-    mbedtls_base64_decode((unsigned char*)decoded, length, &keyLength,
-        (const unsigned char*)data, getLength());
-    assert(keyLength > 0);
-    free(data);
-    data = (char*) malloc(keyLength + 1); assert(data != NULL);
-    memcpy(data, decoded, keyLength);
-    setLength(keyLength);
-    free(decoded);
+    unsigned size = 0;
+    if (!base64DecodeTo((unsigned char*) data, data, length, size)) {
+        return false;
+    }
+    setLength(size);
     return true;
 }
 
 bool StringBuffer::base64Encode() {
     assert(data != NULL && length > 0);
-    char *decoded = (char*) malloc(length * 3); assert(decoded != NULL);
-    size_t keyLength = 0;
-    mbedtls_base64_encode((unsigned char*)decoded, length * 3, &keyLength,
-        (const unsigned char*)data, getLength());
-    assert(keyLength > 0);
-    free(data);
-    data = (char*) malloc(keyLength + 1); assert(data != NULL);
-    memcpy(data, decoded, keyLength);
-    setLength(keyLength);
-    free(decoded);
+    unsigned size = base64EncodedLength(length);
+    char *encoded = (char*) StringPool::allocate(size + 1);
+    if (encoded == NULL) {
+        return false;
+    }
+    base64EncodeTo(encoded, (const unsigned char*) data, length);
+    StringPool::release(data);
+    data = encoded;
+    setLength(size);
     return true;
 }
-#elif defined(ARDUINO)
+
+#ifdef TARGET_MXCHIP
+
+/* NOOP */
+bool StringBuffer::hash(const char *key, unsigned key_length) { abort(); }
+
+#elif defined(__MBED__) || defined(ARDUINO) || defined(IOTC_POSIX)
 bool StringBuffer::hash(const char *key, unsigned key_length)
 {
     assert(data != NULL);
 
-    Sha256 *sha256 = new Sha256();
-    sha256->initHmac((const uint8_t*)key, (size_t)key_length);
-    sha256->print(data);
-    char* sign = (char*) sha256->resultHmac();
-    if (length < HASH_LENGTH) {
-        free(data);
-        data = (char*) malloc(HASH_LENGTH + 1);
+    unsigned char digest[HMAC_SHA256_LENGTH];
+    HmacSha256 hmac;
+    if (!hmac.init(key, key_length) || !hmac.update(data, length) || !hmac.final(digest)) {
+        return false;
     }
-    memcpy(data, sign, HASH_LENGTH);
-    setLength(HASH_LENGTH);
-    delete sha256;
-    return true;
-}
-
-bool StringBuffer::base64Decode() {
-    assert(data != NULL && length > 0);
-    char *decoded = (char*) malloc(length + 1); assert(decoded != NULL);
-    size_t size = base64_decode(decoded, data, length);
-    assert (size <= length + 1);
-    free(data);
-    data = (char*) malloc(size + 1); assert(data != NULL);
-    memcpy(data, decoded, size);
-    setLength(size);
-    free(decoded);
-    return true;
-}
 
-bool StringBuffer::base64Encode() {
-    assert(data != NULL && length > 0);
-    char *decoded = (char*) malloc(length * 3); assert(decoded != NULL);
-    size_t size = base64_encode(decoded, data, length);
-    assert (size < length * 3);
-    free(data);
-    data = (char*) malloc(size + 1); assert(data != NULL);
-    memcpy(data, decoded, size);
-    setLength(size);
-    free(decoded);
+    if (length < HMAC_SHA256_LENGTH) {
+        StringPool::release(data);
+        data = (char*) StringPool::allocate(HMAC_SHA256_LENGTH + 1);
+        if (data == NULL) {
+            length = 0;
+            return false;
+        }
+    }
+    memcpy(data, digest, HMAC_SHA256_LENGTH);
+    setLength(HMAC_SHA256_LENGTH);
     return true;
 }
-#endif // __MBED__
+#endif // TARGET_MXCHIP
 
 StringBuffer::StringBuffer(StringBuffer &buffer): data(NULL), immutable(NULL) {
     length = 0;
@@ -280,7 +173,7 @@ void StringBuffer::initialize(const char * str, unsigned lengthStr) {
 void StringBuffer::alloc(unsigned lengthStr) {
     ASSERT_OR_FAIL_FAST(lengthStr != 0 && data == NULL && immutable == NULL);
 
-    data = (char*) malloc(lengthStr);
+    data = (char*) StringPool::allocate(lengthStr);
 
     ASSERT_OR_FAIL_FAST(data != NULL);
     memset(data, 0, lengthStr);
@@ -293,7 +186,7 @@ void StringBuffer::set(unsigned index, char c) {
 
 void StringBuffer::clear() {
     if (data != NULL) {
-        free(data);
+        StringPool::release(data);
         data = NULL;
     }
 }
@@ -32,7 +32,7 @@ public:
     bool startsWith(const char* str, size_t len);
     int32_t indexOf(const char* look_for, size_t look_for_length, int32_t start_index = 0);
 
-#if defined(__MBED__) || defined(ARDUINO)
+#if defined(__MBED__) || defined(ARDUINO) || defined(IOTC_POSIX)
     bool hash(const char* key, unsigned key_length);
 #endif
 
@@ -0,0 +1,144 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license.
+
+#include <stdlib.h>
+#include <string.h>
+#include "iotc_internal.h"
+#include "string_pool.h"
+
+namespace AzureIOT {
+
+typedef struct StringPoolClass_TAG {
+    char *start;
+    char *end;
+    void *freeList;
+    unsigned blockSize;
+} StringPoolClass;
+
+static StringPoolClass poolClasses[STRING_POOL_CLASS_COUNT];
+static char *poolStart = NULL;
+static char *poolEnd = NULL;
+static unsigned scopeDepth = 0;
+static IOTMemoryStats poolStats;
+
+static inline void* nextOf(void* block) { return *(void**)block; }
+
+void* StringPool::allocate(size_t size) {
+    if (scopeDepth > 0 && poolStart != NULL) {
+        for (unsigned i = 0; i < STRING_POOL_CLASS_COUNT; i++) {
+            StringPoolClass &poolClass = poolClasses[i];
+            if (size > poolClass.blockSize || poolClass.freeList == NULL) continue;
+
+            void *block = poolClass.freeList;
+            poolClass.freeList = nextOf(block);
+
+            poolStats.allocations++;
+            poolStats.inUse += poolClass.blockSize;
+            if (poolStats.inUse > poolStats.highWaterMark) {
+                poolStats.highWaterMark = poolStats.inUse;
+            }
+            return block;
+        }
+        poolStats.poolMisses++;
+    }
+
+    void *ptr = malloc(size);
+    if (ptr == NULL) {
+        poolStats.failedAllocations++;
+    }
+    return ptr;
+}
+
+void StringPool::release(void* ptr) {
+    if (ptr == NULL) return;
+
+    if ((char*)ptr < poolStart || (char*)ptr >= poolEnd) {
+        free(ptr);
+        return;
+    }
+
+    for (unsigned i = 0; i < STRING_POOL_CLASS_COUNT; i++) {
+        StringPoolClass &poolClass = poolClasses[i];
+        if ((char*)ptr >= poolClass.start && (char*)ptr < poolClass.end) {
+            *(void**)ptr = poolClass.freeList;
+            poolClass.freeList = ptr;
+            poolStats.inUse -= poolClass.blockSize;
+            return;
+        }
+    }
+    assert(0 && "pointer within the pool but not in any size class");
+}
+
+bool StringPool::owns(const void* ptr) {
+    return (const char*)ptr >= poolStart && (const char*)ptr < poolEnd;
+}
+
+StringPoolScope::StringPoolScope() { scopeDepth++; }
+StringPoolScope::~StringPoolScope() { scopeDepth--; }
+
+StringHeapScope::StringHeapScope(): savedDepth(scopeDepth) { scopeDepth = 0; }
+StringHeapScope::~StringHeapScope() { scopeDepth = savedDepth; }
+
+} // namespace AzureIOT
+
+/* extern */
+int iotc_set_string_pool(void* memory, unsigned size) {
+    using namespace AzureIOT;
+
+    if (poolStats.inUse != 0) {
+        IOTC_LOG(F("ERROR: (iotc_set_string_pool) pool memory is still in use"));
+        return 1;
+    }
+
+    memset(poolClasses, 0, sizeof(poolClasses));
+    memset(&poolStats, 0, sizeof(poolStats));
+    poolStart = poolEnd = NULL;
+    if (memory == NULL || size == 0) {
+        return 0;
+    }
+
+    // align to pointer size so the free list link can live in the block
+    char *cursor = (char*)memory;
+    size_t misalignment = (size_t)cursor % sizeof(void*);
+    if (misalignment) {
+        cursor += sizeof(void*) - misalignment;
+        size -= iotc_min(size, (unsigned)(sizeof(void*) - misalignment));
+    }
+
+    unsigned share = size / STRING_POOL_CLASS_COUNT;
+    poolStart = cursor;
+    for (unsigned i = 0; i < STRING_POOL_CLASS_COUNT; i++) {
+        StringPoolClass &poolClass = poolClasses[i];
+        poolClass.blockSize = STRING_POOL_MIN_CLASS << i;
+        poolClass.start = cursor;
+
+        unsigned count = share / poolClass.blockSize;
+        for (unsigned block = 0; block < count; block++) {
+            *(void**)cursor = poolClass.freeList;
+            poolClass.freeList = cursor;
+            cursor += poolClass.blockSize;
+        }
+        poolClass.end = cursor;
+    }
+    poolEnd = cursor;
+    poolStats.poolSize = (unsigned)(poolEnd - poolStart);
+
+    return 0;
+}
+
+/* extern */
+int iotc_get_memory_stats(IOTMemoryStats* stats) {
+    CHECK_NOT_NULL(stats)
+
+    *stats = AzureIOT::poolStats;
+    return 0;
+}
+
+/* extern */
+int iotc_reset_memory_stats() {
+    AzureIOT::poolStats.highWaterMark = AzureIOT::poolStats.inUse;
+    AzureIOT::poolStats.allocations = 0;
+    AzureIOT::poolStats.poolMisses = 0;
+    AzureIOT::poolStats.failedAllocations = 0;
+    return 0;
+}
@@ -0,0 +1,81 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license.
+
+#include <string.h>
+#include "iotc_internal.h"
+#include "string_pool.h"
+
+namespace AzureIOT {
+
+int TelemetryBatch::configure(unsigned samples, unsigned maxBytes, unsigned ageMs) {
+    clear();
+    if (samples == 0) return 0;
+
+    if (maxBytes < TELEMETRY_BATCH_MIN_BYTES) maxBytes = TELEMETRY_BATCH_MIN_BYTES;
+    if (maxBytes > TELEMETRY_BATCH_MAX_BYTES) maxBytes = TELEMETRY_BATCH_MAX_BYTES;
+    StringHeapScope heapScope; // kept while batching is on
+    buffer.alloc(maxBytes + 1);
+    if (*buffer == NULL) return 1;
+
+    if (samples > TELEMETRY_BATCH_MAX_SAMPLES) samples = TELEMETRY_BATCH_MAX_SAMPLES;
+    capacity = maxBytes;
+    maxCount = samples;
+    maxAgeMs = ageMs;
+    reset();
+    return 0;
+}
+
+void TelemetryBatch::clear() {
+    buffer.clear();
+    capacity = 0;
+    length = 0;
+    maxCount = 0;
+    maxAgeMs = 0;
+    count = 0;
+    sending = false;
+}
+
+void TelemetryBatch::reset() {
+    count = 0;
+    if (*buffer == NULL) return;
+
+    char* data = *buffer;
+    data[0] = '[';
+    data[1] = ']';
+    data[2] = 0;
+    length = 2;
+}
+
+unsigned long TelemetryBatch::getWaitMs(unsigned long nowMs) {
+    if (sending || isEmpty()) return IOTC_MAX_WAIT_MS;
+    if (isDue(nowMs)) return 0;
+    if (maxAgeMs == 0) return IOTC_MAX_WAIT_MS;
+    return iotc_min(firstSampleMs + maxAgeMs - nowMs, (unsigned long) IOTC_MAX_WAIT_MS);
+}
+
+int TelemetryBatch::add(const char* sample, unsigned sampleLength, unsigned long nowMs) {
+    if (!fits(sampleLength)) return 1;
+
+    // "[...]" -> "[...,<sample>]"
+    char* data = *buffer;
+    char* p = data + length - 1;
+    if (count > 0) *p++ = ',';
+    memcpy(p, sample, sampleLength);
+    p += sampleLength;
+    ends[count] = (unsigned short)(p - data);
+    *p++ = ']';
+    *p = 0;
+    length = (unsigned)(p - data);
+
+    if (count++ == 0) firstSampleMs = nowMs;
+    return 0;
+}
+
+const char* TelemetryBatch::getSample(unsigned index, unsigned &sampleLength) {
+    // skips '[' or the ',' in front of the sample
+    unsigned start = index == 0 ? 1 : ends[index - 1] + 1;
+    sampleLength = ends[index] - start;
+    return *buffer + start;
+}
+
+} // namespace AzureIOT
@@ -0,0 +1,85 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license.
+
+#ifndef AZURE_IOTC_LITE_TELEMETRY_BATCH_H
+#define AZURE_IOTC_LITE_TELEMETRY_BATCH_H
+
+#include "string_buffer.h"
+
+#define TELEMETRY_BATCH_MAX_SAMPLES 64
+#define TELEMETRY_BATCH_MIN_BYTES 64
+#define TELEMETRY_BATCH_MAX_BYTES 65535 // sample ends are 16 bits
+
+namespace AzureIOT {
+
+// Telemetry samples waiting to go out as a single message.
+//
+// The samples are kept as one JSON array ("[s0,s1,...]"), so flushing it
+// doesn't copy anything. Where each sample ends is remembered, so the
+// delivery of every sample can still be reported on its own.
+//
+// Off while zeroed; configure() turns it on.
+class TelemetryBatch {
+    StringBuffer buffer; // capacity bytes + \0
+    unsigned capacity;
+    unsigned length;
+    unsigned maxCount;
+    unsigned maxAgeMs;
+    unsigned count;
+    unsigned short ends[TELEMETRY_BATCH_MAX_SAMPLES]; // offset of the byte after each sample
+    unsigned long firstSampleMs; // when the oldest pending sample came in
+    bool sending;
+
+public:
+    // maxCount == 0 disables the batch (and frees the buffer). maxCount is
+    // capped at TELEMETRY_BATCH_MAX_SAMPLES. maxAgeMs == 0 doesn't age the
+    // samples; only count and size send them.
+    // returns 0 if there is no error
+    int configure(unsigned maxCount, unsigned maxBytes, unsigned maxAgeMs);
+    void clear();
+
+    bool isEnabled() { return maxCount != 0; }
+    bool isEmpty() { return count == 0; }
+    bool isFull() { return count >= maxCount; }
+    unsigned getCount() { return count; }
+
+    // true if a sample of this size can be added without a flush first
+    bool fits(unsigned sampleLength) {
+        return !isFull() && length + sampleLength + 1 <= capacity;
+    }
+
+    // true once the batch is full or the oldest sample waited for maxAgeMs
+    bool isDue(unsigned long nowMs) {
+        return !sending && !isEmpty() &&
+            (isFull() || (maxAgeMs != 0 && nowMs - firstSampleMs >= maxAgeMs));
+    }
+
+    // how long until isDue() (0 once it is); IOTC_MAX_WAIT_MS when age
+    // doesn't flush the pending samples (or there are none)
+    unsigned long getWaitMs(unsigned long nowMs);
+
+    // returns 0 if the sample was added, 1 if it doesn't fit (see fits)
+    int add(const char* sample, unsigned sampleLength, unsigned long nowMs);
+
+    // the pending array; valid until the next add or reset
+    const char* getData() { return *buffer; }
+    unsigned getLength() { return length; }
+    // a view into getData(); not \0 terminated
+    const char* getSample(unsigned index, unsigned &sampleLength);
+
+    // drops the pending samples
+    void reset();
+
+    // Brackets the publish of the pending array (see PropertyBatch)
+    bool isSending() { return sending; }
+    void beginSend() { sending = true; }
+    // drops the pending samples if they were sent
+    void endSend(bool sent) {
+        sending = false;
+        if (sent) reset();
+    }
+};
+
+} // namespace AzureIOT
+
+#endif // AZURE_IOTC_LITE_TELEMETRY_BATCH_H
@@ -4,7 +4,7 @@
 #ifndef AZURE_IOTC_API
 #define AZURE_IOTC_API
 
-#if !defined(ESP_PLATFORM) && !defined(__MBED__)
+#if !defined(ESP_PLATFORM) && !defined(__MBED__) && !defined(IOTC_POSIX)
 // MXCHIP
 #define TARGET_MXCHIP_AZ3166
 #endif
@@ -46,6 +46,15 @@ typedef struct IOTCallbackInfo_TAG {
 
 typedef void* IOTContext;
 
+typedef struct IOTMemoryStats_TAG {
+  unsigned poolSize;          // bytes of the string pool (0 when not set)
+  unsigned inUse;             // pool bytes currently held
+  unsigned highWaterMark;     // peak of inUse
+  unsigned allocations;       // requests served from the pool
+  unsigned poolMisses;        // requests the pool couldn't serve (went to heap)
+  unsigned failedAllocations; // requests that couldn't be served at all
+} IOTMemoryStats;
+
 // ***** Macro definitions *****
 #define IOTC_PROTOCOL_MQTT 0x01
 #define IOTC_PROTOCOL_AMQP 0x02
@@ -77,11 +86,28 @@ typedef short IOTConnectionState;
 #define IOTC_MESSAGE_ABANDONED  0x04
 typedef short IOTMessageStatus;
 
+// the longest wait iotc_get_wait_ms reports (ms)
+#define IOTC_MAX_WAIT_MS 60000
+
+typedef void(*IOTWakeCallback)(void* appContext);
+
 // ***** API *****
 // Set the level of logging (see the options above)
 // returns 0 if there is no error. Otherwise, error code will be returned.
 int iotc_set_logging(IOTLogLevel level);
 
+// Back the SDK's string buffers with a size-class pool carved from `memory`
+// (blocks of 32 to 512 bytes). SAS token and inbound message handling draw
+// from it instead of the heap. Pass NULL to go back to malloc / free.
+// Call this before `init_context`
+// returns 0 if there is no error. Otherwise, error code will be returned.
+int iotc_set_string_pool(void* memory, unsigned size);
+
+// Read / reset (high water mark = in use, counters = 0) the string pool stats
+// returns 0 if there is no error. Otherwise, error code will be returned.
+int iotc_get_memory_stats(IOTMemoryStats* stats);
+int iotc_reset_memory_stats();
+
 // Initialize the device context. The context variable will be used by rest of the API
 // returns 0 if there is no error. Otherwise, error code will be returned.
 int iotc_init_context(IOTContext *ctx);
@@ -97,6 +123,16 @@ int iotc_free_context(IOTContext ctx);
 int iotc_connect(IOTContext ctx, const char* scope, const char* keyORcert,
                                  const char* deviceId, IOTConnectType type);
 
+// Connect to Azure IoT Central without blocking on device provisioning
+// Registration with DPS runs a step at a time in `do_work`, and the hub
+// connection is opened once DPS assigns the device. `ConnectionStatus`
+// reports the outcome (IOTC_CONNECTION_OK or an error). Connection strings
+// need no provisioning; those connect right away like `connect`.
+// Call this after `init_context`
+// returns 0 if there is no error. Otherwise, error code will be returned.
+int iotc_connect_async(IOTContext ctx, const char* scope, const char* keyORcert,
+                                 const char* deviceId, IOTConnectType type);
+
 // Disconnect
 // returns 0 if there is no error. Otherwise, error code will be returned.
 int iotc_disconnect(IOTContext ctx);
@@ -122,6 +158,35 @@ int iotc_set_proxy(IOTContext ctx, IOTC_HTTP_PROXY_OPTIONS proxy);
 // returns 0 if there is no error. Otherwise, error code will be returned.
 int iotc_send_telemetry(IOTContext ctx, const char* payload, unsigned length);
 
+// Collects telemetry samples (iotc_send_telemetry, iotc_send_state and
+// iotc_send_event) and sends them as one JSON array ("[sample,...]"). The
+// array is sent once maxCount samples are in, before a sample that doesn't
+// fit into maxBytes, by `do_work` once the oldest sample waited maxAgeMs
+// (0: no age limit) and on `disconnect`. `MessageSent` still fires for
+// every sample, once the array was sent.
+// maxCount == 0 (default) sends every sample right away. At most 64.
+// Pending samples are sent before the setting changes.
+// Call this after `init_context`
+// returns 0 if there is no error. Otherwise, error code will be returned.
+int iotc_set_telemetry_batching(IOTContext ctx, unsigned maxCount, unsigned maxBytes, unsigned maxAgeMs);
+
+// Keeps telemetry that can't be sent (i.e. while offline) in the file at path
+// and sends it once the connection is back: one message every
+// drainIntervalMs, with the time it was created (iothub-creation-time-utc).
+// The file holds slotCount messages of up to slotSize - 12 bytes each; once
+// it is full the oldest message is dropped. Messages left over from an
+// earlier run are sent too. `MessageSent` fires when a stored message is sent.
+// path == NULL closes the store.
+// Call this after `init_context`
+// returns 0 if there is no error. Otherwise, error code will be returned.
+int iotc_set_offline_store(IOTContext ctx, const char* path, unsigned slotCount,
+    unsigned slotSize, unsigned drainIntervalMs);
+
+// Sends the pending telemetry samples now (see iotc_set_telemetry_batching)
+// Call this after `connect`
+// returns 0 if there is no error. Otherwise, error code will be returned.
+int iotc_flush_telemetry(IOTContext ctx);
+
 // Sends a state payload (JSON)
 // Call this after `connect`
 // returns 0 if there is no error. Otherwise, error code will be returned.
@@ -137,6 +202,50 @@ int iotc_send_event    (IOTContext ctx, const char* payload, unsigned length);
 // returns 0 if there is no error. Otherwise, error code will be returned.
 int iotc_send_property (IOTContext ctx, const char* payload, unsigned length);
 
+// Coalesces reported properties (iotc_send_property and the desired property
+// echoes) into a single patch. A property sent again before the patch goes out
+// replaces the pending value. The patch is sent by `do_work` once the oldest
+// pending property waited intervalMs, before a property that doesn't fit into
+// maxBytes and on `disconnect`. `MessageSent` fires with the merged patch.
+// intervalMs == 0 (default) sends every property right away.
+// Pending properties are sent before the setting changes.
+// Call this after `init_context`
+// returns 0 if there is no error. Otherwise, error code will be returned.
+int iotc_set_property_batching(IOTContext ctx, unsigned intervalMs, unsigned maxBytes);
+
+// Sends the pending reported properties now (see iotc_set_property_batching)
+// Call this after `connect`
+// returns 0 if there is no error. Otherwise, error code will be returned.
+int iotc_flush_properties(IOTContext ctx);
+
+// Keeps up to `window` QoS1 publishes waiting for their acknowledgement on the
+// platforms that support it (ESP8266). Here messages go out with QoS0 and
+// `MessageSent` fires right away, which is window == 0; any other window is
+// refused.
+// Call this after `init_context`
+// returns 0 if there is no error. Otherwise, error code will be returned.
+int iotc_set_inflight_window(IOTContext ctx, unsigned window);
+
+// Sets the auth token expiration globally (seconds, 6 hours by default)
+// The light client renews the token of a live connection before it expires.
+// Call this before `connect` to take effect
+// returns 0 if there is no error. Otherwise, error code will be returned.
+int iotc_set_token_expiration(IOTContext ctx, unsigned timeout);
+
+// Opens the hub connection again from `do_work` once it was lost. Tries are
+// spread with jittered exponential backoff: every delay is picked at random
+// between baseMs and three times the previous one, up to capMs. The backoff
+// starts over once a connection stayed up for stableMs. An expired token is
+// renewed right away, a disabled device isn't retried and refused
+// credentials are retried a few times. After maxAttempts (0: no limit) tries
+// without a stable connection `ConnectionStatus` reports
+// IOTC_CONNECTION_RETRY_EXPIRED and the SDK stops trying.
+// baseMs == 0 (default) turns it off; reconnecting is up to the application.
+// Call this after `init_context`
+// returns 0 if there is no error. Otherwise, error code will be returned.
+int iotc_set_reconnect(IOTContext ctx, unsigned baseMs, unsigned capMs, unsigned stableMs,
+                       unsigned maxAttempts);
+
 /*
 eventName:
   ConnectionStatus
@@ -144,6 +253,15 @@ eventName:
   Command
   SettingsUpdated
   Error
+  ConnectionTiming
+
+ConnectionTiming fires once a connection is open; tag is "dps" (provisioning
+service) or "hub". payload has the time (ms) each phase took, i.e.
+{"dns":12,"tcp":40,"tls":180,"connack":95,"resumed":false} ("connack" for the
+hub only) and statusCode the total. "resumed" is true when the TLS session of
+an earlier connection to the same host was resumed. On mbed OS the TLS socket
+resolves, connects and shakes hands in one call; the payload only has the
+total of those and "connack", i.e. {"connect":232,"connack":95}.
 */
 typedef void(*IOTCallback)(IOTContext, IOTCallbackInfo*);
 
@@ -152,11 +270,47 @@ typedef void(*IOTCallback)(IOTContext, IOTCallbackInfo*);
 // returns 0 if there is no error. Otherwise, error code will be returned.
 int iotc_on(IOTContext ctx, const char* eventName, IOTCallback callback, void* appContext);
 
+// Register to the inbound messages whose topic starts with topicPrefix
+// (i.e. "devices/<deviceId>/messages/devicebound/"). The longest matching
+// prefix wins. The callback gets eventName "Topic" and the topic as tag.
+// Pass a NULL callback to unregister. Method calls and desired properties
+// stay with `Command` and `SettingsUpdated`.
+// Call this after `init_context`
+// returns 0 if there is no error. Otherwise, error code will be returned.
+int iotc_on_topic(IOTContext ctx, const char* topicPrefix, IOTCallback callback, void* appContext);
+
 // Lets SDK to do background work
 // Call this after `connect`
 // returns 0 if there is no error. Otherwise, error code will be returned.
 int iotc_do_work(IOTContext ctx);
 
+// How long (ms) `do_work` has nothing to do: the time until the next
+// keep-alive ping, reconnect try, batch flush, stored message or token
+// renewal, IOTC_MAX_WAIT_MS at most. 0 means call `do_work` now. Inbound
+// packets aren't a deadline; instead of calling `do_work` in a tight loop,
+// block until waitMs passed or the hub connection has data (see
+// iotc_get_socket and iotc_set_wake_callback), then call `do_work`.
+// Ask again after every `do_work` and every send.
+// Call this after `init_context`
+// returns 0 if there is no error. Otherwise, error code will be returned.
+int iotc_get_wait_ms(IOTContext ctx, unsigned long* waitMs);
+
+// POSIX: the socket of the hub connection, -1 while there is none (i.e.
+// provisioning or waiting to reconnect). `do_work` has packets to read once
+// it is readable; wait for it with select / poll and iotc_get_wait_ms.
+// It changes when the connection is opened again.
+// returns 0 if there is no error. Otherwise, error code will be returned.
+int iotc_get_socket(IOTContext ctx, int* socketFd);
+
+// mbed OS: wake(appContext) is called when the hub connection has data for
+// `do_work`. It runs in the context of the network stack (an interrupt or
+// the event thread): only signal the thread that runs `do_work` from it,
+// i.e. with EventFlags. While it is set, `do_work` doesn't block waiting for
+// packets. Pass NULL to go back to polling.
+// Call this after `init_context`
+// returns 0 if there is no error. Otherwise, error code will be returned.
+int iotc_set_wake_callback(IOTContext ctx, IOTWakeCallback wake, void* appContext);
+
 // Provide platform dependent NetworkInterface
 int iotc_set_network_interface(void* networkInterface);
 
@@ -7,9 +7,21 @@
 #include "../common/json.h"
 #include "../common/iotc_internal.h"
 
+// handles what came in meanwhile. the message is out either way; a lost
+// connection is for the next iotc_do_work to tear down
+static void yieldAfterPublish(IOTContextInternal *internal) {
+    if (internal->wakeCallback != NULL) {
+        internal->mqttClient->yield(IOTC_WAKE_YIELD_MS);
+    } else {
+        internal->mqttClient->yield();
+    }
+}
+
 int mqtt_publish(IOTContextInternal *internal, const char* topic, unsigned long topic_length,
     const char* msg, unsigned long msg_length) {
 
+    if (internal->mqttClient == NULL) return 1; // the connection is gone
+
     MQTT::Message message;
     message.retained = false;
     message.dup = false;
@@ -24,7 +36,8 @@ int mqtt_publish(IOTContextInternal *internal, const char* topic, unsigned long
     if(rc != MQTT::SUCCESS) {
         return rc;
     }
-    return iotc_do_work(internal);
+    yieldAfterPublish(internal);
+    return 0;
 }
 
 #endif // defined(USE_LIGHT_CLIENT)
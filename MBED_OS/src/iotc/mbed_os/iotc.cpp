@@ -16,156 +16,14 @@ unsigned long getNow() {
     return AzureIOT::TLSClient::nowTime();
 }
 
-int socketReadThemAll(AzureIOT::TLSClient *client, AzureIOT::StringBuffer &readBuffer) {
-    int retryCount = 0;
-
-retry_getOperationId_read:
-    char *readBufferCSTR = *readBuffer;
-    WAITMS(3000); // give 3 secs to server to process
-
-    int index = 0;
-    while (index < STRING_BUFFER_1024 - 1) {
-        unsigned char buff[8];
-        int rc = client->read(buff, 8, 2);
-        if (rc <= 0) {
-            if (rc == NSAPI_ERROR_WOULD_BLOCK)
-                continue;
-            else
-                break;
-        }
-        const int inc = iotc_min(rc, STRING_BUFFER_1024 - index);
-        memcpy(readBufferCSTR, buff, inc);
-        index += inc;
-        readBufferCSTR += rc;
-    }
-    assert(index < STRING_BUFFER_1024 - 1);
-    if (index >= 0) {
-        readBuffer.setLength(index);
-
-        if (index == 0) {
-            if (retryCount > 2) return 1;
-            retryCount++;
-            goto retry_getOperationId_read;
-        }
-    } else {
-        readBuffer.setLength(0);
-        IOTC_LOG(F("ERROR: (socketReadThemAll) client->read returned %d"), index);
-        return 1;
-    }
-
-    return 0;
-}
-
-int _getOperationId(const char* dpsEndpoint, const char* scopeId, const char* deviceId,
-    const char* authHeader, char *operationId, char *hostName) {
-    AzureIOT::TLSClient *client = new AzureIOT::TLSClient();
-    int exitCode = 0;
-
-    if (client->connect(dpsEndpoint, AZURE_HTTPS_SERVER_PORT) != 0) {
-        IOTC_LOG(F("ERROR: %s endpoint PUT call has failed."), hostName == NULL ? "PUT" : "GET");
-        delete client;
-        return 1;
-    }
-
-    AzureIOT::StringBuffer tmpBuffer(STRING_BUFFER_1024);
-    AzureIOT::StringBuffer deviceIdEncoded(deviceId, strlen(deviceId));
-    deviceIdEncoded.urlEncode();
-
-    size_t size = 0;
-    if (hostName == NULL) {
-        size = sprintf(NULL, "{\"registrationId\":\"%s\"}", deviceId);
-        size = snprintf(*tmpBuffer, STRING_BUFFER_1024, F("\
-PUT /%s/registrations/%s/register?api-version=2018-11-01 HTTP/1.1\r\n\
-Host: %s\r\n\
-content-type: application/json; charset=utf-8\r\n\
-%s\r\n\
-accept: */*\r\n\
-content-length: %d\r\n\
-%s\r\n\
-connection: close\r\n\
-\r\n\
-{\"registrationId\":\"%s\"}\r\n\
-    "),
-        scopeId, *deviceIdEncoded, dpsEndpoint,
-        AZURE_IOT_CENTRAL_CLIENT_SIGNATURE, size, authHeader, deviceId);
-    } else {
-        size = snprintf(*tmpBuffer, STRING_BUFFER_1024, F("\
-GET /%s/registrations/%s/operations/%s?api-version=2018-11-01 HTTP/1.1\r\n\
-Host: %s\r\n\
-content-type: application/json; charset=utf-8\r\n\
-%s\r\n\
-accept: */*\r\n\
-%s\r\n\
-connection: close\r\n\
-\r\n"),
-        scopeId, *deviceIdEncoded, operationId, dpsEndpoint,
-        AZURE_IOT_CENTRAL_CLIENT_SIGNATURE, authHeader);
-    }
-    assert(size != 0 && size < STRING_BUFFER_1024);
-    tmpBuffer.setLength(size);
-
-    const char* lookFor=  hostName == NULL ? "{\"operationId\":\"" : "\"assignedHub\":\"";
-    int index = 0;
-
-    size_t total = 0;
-    while (size > total) {
-        int sent = client->write((const unsigned char*)*tmpBuffer + total, strlen(*tmpBuffer + total), 100);
-        if (sent < 0) {
-            IOTC_LOG(F("ERROR: tlsSocket send has failed with error code %d. Remaining buffer size was %lu"), sent, size);
-            exitCode = 1;
-            goto exit_operationId;
-        }
-        total += sent;
-    }
-
-    WAITMS(2000);
-    memset(*tmpBuffer, 0, STRING_BUFFER_1024);
-    if (socketReadThemAll(client, tmpBuffer) != 0) goto error_exit;
-
-    index = tmpBuffer.indexOf(lookFor, strlen(lookFor), 0);
-    if (index == -1) {
-error_exit:
-        IOTC_LOG(F("ERROR: DPS (%s) request has failed.\r\n%s"), hostName == NULL ? "PUT" : "GET", *tmpBuffer);
-        exitCode = 1;
-        goto exit_operationId;
-    } else {
-        index += strlen(lookFor);
-        int index2 = tmpBuffer.indexOf("\"", 1, index + 1);
-        if (index2 == -1) goto error_exit;
-        tmpBuffer.setLength(index2);
-        strcpy(hostName == NULL ? operationId : hostName, (*tmpBuffer) + index);
-        client->disconnect();
-    }
-
-exit_operationId:
-    delete client;
-    return exitCode;
+unsigned long getTickMs() {
+    return (unsigned long) Kernel::get_ms_count();
 }
 
-int getHubHostName(const char* dpsEndpoint, const char *scopeId, const char* deviceId, const char* key, char *hostName) {
-    AzureIOT::StringBuffer authHeader(STRING_BUFFER_256);
-    size_t size = 0;
-
-    IOTC_LOG(F("- iotc.dps : getting auth..."));
-    if (getDPSAuthString(scopeId, deviceId, key, *authHeader, STRING_BUFFER_256, size)) {
-        IOTC_LOG(F("ERROR: getDPSAuthString has failed"));
-        return 1;
-    }
-    IOTC_LOG(F("- iotc.dps : getting operation id..."));
-    AzureIOT::StringBuffer operationId(STRING_BUFFER_64);
-    int retval = 0;
-    if ((retval = _getOperationId(dpsEndpoint, scopeId, deviceId, *authHeader, *operationId, NULL)) == 0) {
-        WAITMS(4000);
-        IOTC_LOG(F("- iotc.dps : getting host name..."));
-        for (int i = 0; i < 5; i++) {
-            retval = _getOperationId(dpsEndpoint, scopeId, deviceId, *authHeader, *operationId, hostName);
-            if (retval == 0) break;
-            WAITMS(3000);
-        }
-    }
-
-    return retval;
-}
+// keep-alive interval (seconds) the hub connection asks for
+#ifndef MQTT_KEEPALIVE
+#define MQTT_KEEPALIVE 2
+#endif
 
 static void messageArrived(MQTT::MessageData& md)
 {
@@ -195,6 +53,13 @@ int iotc_free_context(IOTContext ctx) {
     if (internal->tlsClient != NULL) {
         iotc_disconnect(ctx);
     }
+    clearTopics(internal);
+    clearTopicCallbacks(internal);
+    internal->properties.clear();
+    internal->telemetry.clear();
+    internal->store.close();
+    internal->dps.clear();
+    clearHubCredentials(internal);
 
     free(internal);
 
@@ -203,63 +68,56 @@ int iotc_free_context(IOTContext ctx) {
     return 0;
 }
 
-int iotc_connect(IOTContext ctx, const char* scope, const char* keyORcert,
-  const char* deviceId, IOTConnectType type) {
-
-    CHECK_NOT_NULL(ctx)
-    GET_LENGTH_NOT_NULL(keyORcert, 512);
+static void closeHubConnection(IOTContextInternal *internal) {
+    if (internal->mqttClient) {
+        if(internal->mqttClient->isConnected()) {
+            internal->mqttClient->disconnect();
+        }
+        delete internal->mqttClient;
+        internal->mqttClient = NULL;
+    }
 
-    AzureIOT::StringBuffer hostName;
-    AzureIOT::StringBuffer username;
-    AzureIOT::StringBuffer password;
-    IOTContextInternal *internal = (IOTContextInternal*)ctx;
+    if(internal->tlsClient) {
+        internal->tlsClient->disconnect();
+        delete internal->tlsClient;
+        internal->tlsClient = NULL;
+    }
+}
 
-    if (type == IOTC_CONNECT_CONNECTION_STRING) {
-        getUsernameAndPasswordFromConnectionString(keyORcert,
-            strlen(keyORcert), hostName, internal->deviceId, username, password);
-    } else if (type == IOTC_CONNECT_SYMM_KEY) {
-        assert(scope != NULL && deviceId != NULL);
-        AzureIOT::StringBuffer tmpHostname(STRING_BUFFER_128);
-        if (getHubHostName(internal->endpoint == NULL ?
-                DEFAULT_ENDPOINT : internal->endpoint, scope, deviceId, keyORcert, *tmpHostname)) {
-            return 1;
-        }
-        AzureIOT::StringBuffer cstr(STRING_BUFFER_256);
-        int rc = snprintf(*cstr, STRING_BUFFER_256,
-            F("HostName=%s;DeviceId=%s;SharedAccessKey=%s"), *tmpHostname, deviceId, keyORcert);
-        assert(rc > 0 && rc < STRING_BUFFER_256);
-        cstr.setLength(rc);
-
-        // TODO: move into iotc_dps and do not re-parse from connection string
-        getUsernameAndPasswordFromConnectionString(*cstr, rc, hostName, internal->deviceId, username, password);
-    } else if (type == IOTC_CONNECT_X509_CERT) {
-        IOTC_LOG(F("ERROR: IOTC_CONNECT_X509_CERT NOT IMPLEMENTED"));
-        connectionStatusCallback(IOTC_CONNECTION_DEVICE_DISABLED, (IOTContextInternal*)ctx);
-        return 1;
+// connects to internal->hostName with a fresh SAS token and subscribes
+// returns 0 if there is no error. Otherwise, the IOTConnectionState that tells why
+static int openHubConnection(IOTContextInternal *internal) {
+    char password[STRING_BUFFER_512];
+    if (getHubPassword(internal, password, STRING_BUFFER_512) != 0) {
+        return IOTC_CONNECTION_BAD_CREDENTIAL;
     }
 
     MQTTPacket_connectData data = MQTTPacket_connectData_initializer;
     data.MQTTVersion = 4;
     data.clientID.cstring = *internal->deviceId;
-    data.username.cstring = *username;
-    data.password.cstring = *password;
-    data.keepAliveInterval = 2;
+    data.username.cstring = *internal->username;
+    data.password.cstring = password;
+    data.keepAliveInterval = MQTT_KEEPALIVE;
     data.cleansession = 1;
 
     internal->tlsClient = new AzureIOT::TLSClient();
+    internal->tlsClient->setWakeCallback(internal->wakeCallback, internal->wakeContext);
     internal->mqttClient = new MQTT::Client<AzureIOT::TLSClient, Countdown, STRING_BUFFER_1024, 5>(*(internal->tlsClient));
 
-    if (internal->tlsClient->connect(*hostName, AZURE_MQTT_SERVER_PORT) != 0) {
-        IOTC_LOG(F("ERROR: TLSClient connect attempt failed to %s\r\nMake sure both certificate and host are correct."), *hostName);
-        connectionStatusCallback(IOTC_CONNECTION_BAD_CREDENTIAL, (IOTContextInternal*)ctx);
-        return 1;
+    if (internal->tlsClient->connect(*internal->hostName, AZURE_MQTT_SERVER_PORT) != 0) {
+        IOTC_LOG(F("ERROR: TLSClient connect attempt failed to %s\r\nMake sure both certificate and host are correct."), *internal->hostName);
+        closeHubConnection(internal);
+        return IOTC_CONNECTION_COMMUNICATION_ERROR;
     }
 
+    unsigned long connackMs = getTickMs();
     if (internal->mqttClient->connect(data) != MQTT::SUCCESS) {
         IOTC_LOG(F("ERROR: TLSClient connect attempt failed. Check host, deviceId, username and password."));
-        connectionStatusCallback(IOTC_CONNECTION_BAD_CREDENTIAL, (IOTContextInternal*)ctx);
-        return 1;
+        closeHubConnection(internal);
+        return IOTC_CONNECTION_BAD_CREDENTIAL;
     }
+    connackMs = getTickMs() - connackMs;
+    connectionTimingCallback(internal, "hub", internal->tlsClient->getTiming(), (long) connackMs);
 
     AzureIOT::StringBuffer buffer(STRING_BUFFER_64);
     size_t size = snprintf(*buffer, 63, "devices/%s/messages/events/#", *internal->deviceId);
@@ -283,8 +141,10 @@ int iotc_connect(IOTContext ctx, const char* scope, const char* keyORcert,
         IOTC_LOG(F("ERROR: mqttClient couldn't subscribe to twin/methods etc. error code sum => %d"), errorCode);
 
     internal->mqttClient->setDefaultMessageHandler(messageArrived);
-    connectionStatusCallback(IOTC_CONNECTION_OK, (IOTContextInternal*)ctx);
+    return 0;
+}
 
+static void requestTwin(IOTContextInternal *internal) {
     iotc_do_work(internal);
     const char* twin_topic = "$iothub/twin/GET/?$rid=0";
     internal->messageId++; // next rid=1
@@ -292,29 +152,110 @@ int iotc_connect(IOTContext ctx, const char* scope, const char* keyORcert,
         IOTC_LOG(F("ERROR: Couldn't send the TWIN update request message"));
     }
     iotc_do_work(internal);
+}
+
+// the hub credentials are set; opens the connection and asks for the twin
+static int connectHub(IOTContextInternal *internal) {
+    if (cacheTopics(internal) != 0) {
+        return 1;
+    }
+
+    int reason = openHubConnection(internal);
+    if (reason != 0) {
+        connectionStatusCallback((IOTConnectionState) reason, internal);
+        return 1;
+    }
+
+    hubConnected(internal);
+    requestTwin(internal);
     return 0;
 }
 
-/* extern */
-int iotc_disconnect(IOTContext ctx) {
+// the next try of the reconnect policy is due
+static int reconnectHub(IOTContextInternal *internal) {
+    int reason = openHubConnection(internal);
+    if (reason != 0) {
+        scheduleReconnect(internal, (IOTConnectionState) reason);
+        return 1;
+    }
+
+    hubConnected(internal);
+    // desired properties may have changed while the device was away
+    requestTwin(internal);
+    return 0;
+}
+
+// the hub connection is gone
+static void hubConnectionLost(IOTContextInternal *internal, IOTConnectionState reason) {
+    closeHubConnection(internal);
+    connectionStatusCallback(IOTC_CONNECTION_DISCONNECTED, internal);
+    scheduleReconnect(internal, reason);
+}
+
+static int startConnect(IOTContext ctx, const char* scope, const char* keyORcert,
+  const char* deviceId, IOTConnectType type, bool async) {
+
     CHECK_NOT_NULL(ctx)
+    GET_LENGTH_NOT_NULL(keyORcert, 512);
 
     IOTContextInternal *internal = (IOTContextInternal*)ctx;
-    MUST_CALL_AFTER_CONNECT(internal);
+    internal->reconnect.cancel();
 
-    if (internal->mqttClient) {
-        if(internal->mqttClient->isConnected()) {
-            internal->mqttClient->disconnect();
+    if (type == IOTC_CONNECT_CONNECTION_STRING) {
+        if (setHubCredentialsFromConnectionString(internal, keyORcert, keyORcert_len)) {
+            return 1;
         }
-        delete internal->mqttClient;
-        internal->mqttClient = NULL;
+    } else if (type == IOTC_CONNECT_SYMM_KEY) {
+        assert(scope != NULL && deviceId != NULL);
+        if (beginProvisioning(internal, scope, deviceId, keyORcert) != 0) {
+            return 1;
+        }
+        if (async) {
+            return 0; // iotc_do_work takes it from here
+        }
+        if (finishProvisioning(internal) != 0) {
+            return 1;
+        }
+    } else if (type == IOTC_CONNECT_X509_CERT) {
+        IOTC_LOG(F("ERROR: IOTC_CONNECT_X509_CERT NOT IMPLEMENTED"));
+        connectionStatusCallback(IOTC_CONNECTION_DEVICE_DISABLED, (IOTContextInternal*)ctx);
+        return 1;
     }
 
-    if(internal->tlsClient) {
-        internal->tlsClient->disconnect();
-        delete internal->tlsClient;
-        internal->tlsClient = NULL;
+    return connectHub(internal);
+}
+
+int iotc_connect(IOTContext ctx, const char* scope, const char* keyORcert,
+  const char* deviceId, IOTConnectType type) {
+    return startConnect(ctx, scope, keyORcert, deviceId, type, false);
+}
+
+/* extern */
+int iotc_connect_async(IOTContext ctx, const char* scope, const char* keyORcert,
+  const char* deviceId, IOTConnectType type) {
+    return startConnect(ctx, scope, keyORcert, deviceId, type, true);
+}
+
+/* extern */
+int iotc_disconnect(IOTContext ctx) {
+    CHECK_NOT_NULL(ctx)
+
+    IOTContextInternal *internal = (IOTContextInternal*)ctx;
+    if (internal->dps.isBusy()) { // still provisioning
+        internal->dps.clear();
+        return 0;
+    }
+    if (internal->mqttClient == NULL && internal->reconnect.isPending()) {
+        internal->reconnect.cancel(); // DISCONNECTED was reported already
+        return 0;
     }
+    internal->reconnect.cancel();
+    MUST_CALL_AFTER_CONNECT(internal);
+
+    // pending telemetry and reported properties would be lost otherwise
+    flushTelemetry(internal);
+    flushProperties(internal);
+    closeHubConnection(internal);
     connectionStatusCallback(IOTC_CONNECTION_DISCONNECTED, (IOTContextInternal*)ctx);
     return 0;
 }
@@ -324,9 +265,88 @@ int iotc_do_work(IOTContext ctx) {
     CHECK_NOT_NULL(ctx)
 
     IOTContextInternal *internal = (IOTContextInternal*)ctx;
+    if (internal->dps.isBusy()) { // iotc_connect_async
+        int rc = provisionStep(internal, 0);
+        if (rc == 2) return 0;
+        if (rc != 0) {
+            connectionStatusCallback(internal->dps.getStatusCode() == 401 ?
+                IOTC_CONNECTION_BAD_CREDENTIAL : IOTC_CONNECTION_COMMUNICATION_ERROR, internal);
+            return 1;
+        }
+        return connectHub(internal);
+    }
+    if (internal->mqttClient == NULL && internal->reconnect.isPending()) {
+        return internal->reconnect.isDue(getTickMs()) ? reconnectHub(internal) : 0;
+    }
     MUST_CALL_AFTER_CONNECT(internal);
 
-    return internal->mqttClient->yield();
+    if (hubTokenNeedsRenewal(internal)) {
+        // the hub drops the connection once the token expires. reconnect
+        // with a fresh one before that happens
+        IOTC_LOG(F("- iotc : renewing the SAS token"));
+        closeHubConnection(internal);
+        int reason = openHubConnection(internal);
+        if (reason != 0) {
+            connectionStatusCallback(IOTC_CONNECTION_DISCONNECTED, internal);
+            scheduleReconnect(internal, (IOTConnectionState) reason);
+            return 1;
+        }
+    }
+
+    flushDueBatches(internal);
+    drainStore(internal);
+    if (internal->mqttClient == NULL) {
+        return 1; // a callback has disconnected
+    }
+
+    // the wake callback tells when there is more
+    int rc = internal->wakeCallback != NULL ?
+        internal->mqttClient->yield(IOTC_WAKE_YIELD_MS) : internal->mqttClient->yield();
+    if (rc != MQTT::SUCCESS && !internal->mqttClient->isConnected() &&
+        internal->reconnect.isEnabled()) {
+        hubConnectionLost(internal, IOTC_CONNECTION_DISCONNECTED);
+    }
+    return rc;
+}
+
+/* extern */
+int iotc_get_wait_ms(IOTContext ctx, unsigned long* waitMs) {
+    CHECK_NOT_NULL(ctx)
+    CHECK_NOT_NULL(waitMs)
+
+    IOTContextInternal *internal = (IOTContextInternal*)ctx;
+    unsigned long now = getTickMs();
+    *waitMs = getWorkWaitMs(internal, now);
+    if (internal->mqttClient != NULL && internal->mqttClient->isConnected()) {
+        // the ping is due a keep-alive interval after the older of the last
+        // read and the last write
+        AzureIOT::TLSClient *tls = internal->tlsClient;
+        unsigned long idleMs = iotc_max(now - tls->getLastReadMs(), now - tls->getLastWriteMs());
+        unsigned long periodMs = MQTT_KEEPALIVE * 1000UL;
+        *waitMs = idleMs >= periodMs ? 0 : iotc_min(*waitMs, periodMs - idleMs);
+    }
+    return 0;
+}
+
+/* extern */
+int iotc_get_socket(IOTContext ctx, int* socketFd) {
+    CHECK_NOT_NULL(ctx)
+
+    IOTC_LOG(F("ERROR: (iotc_get_socket) not supported on mbed OS. See iotc_set_wake_callback"));
+    return 1;
+}
+
+/* extern */
+int iotc_set_wake_callback(IOTContext ctx, IOTWakeCallback wake, void* appContext) {
+    CHECK_NOT_NULL(ctx)
+
+    IOTContextInternal *internal = (IOTContextInternal*)ctx;
+    internal->wakeCallback = wake;
+    internal->wakeContext = appContext;
+    if (internal->tlsClient != NULL) {
+        internal->tlsClient->setWakeCallback(wake, appContext);
+    }
+    return 0;
 }
 
 /* extern */
@@ -13,12 +13,16 @@ NetworkInterface* TLSClient::networkInterface = NULL;
 
 int TLSClient::read(unsigned char* buffer, int len, int timeout) {
     tlsSocket->set_timeout(iotc_max(timeout, 10));
-    return tlsSocket->recv(buffer, len);
+    int rc = tlsSocket->recv(buffer, len);
+    if (rc > 0) lastReadMs = (unsigned long) Kernel::get_ms_count();
+    return rc;
 }
 
 int TLSClient::write(const unsigned char* buffer, int len, int timeout) {
     tlsSocket->set_timeout(iotc_max(timeout, 10));
-    return tlsSocket->send(buffer, len);
+    int rc = tlsSocket->send(buffer, len);
+    if (rc > 0) lastWriteMs = (unsigned long) Kernel::get_ms_count();
+    return rc;
 }
 
 bool TLSClient::connect(const char* host, int port) {
@@ -34,7 +38,12 @@ bool TLSClient::connect(const char* host, int port) {
     tlsSocket->set_client_cert_key(SSL_CLIENT_CERT_PEM, SSL_CLIENT_PRIVATE_KEY_PEM);
     tlsSocket->set_blocking(true);
 
-    return tlsSocket->connect(host, port);
+    memset(&timing, 0, sizeof(timing));
+    uint64_t startMs = Kernel::get_ms_count();
+    bool rc = tlsSocket->connect(host, port);
+    timing.handshakeMs = (unsigned long)(Kernel::get_ms_count() - startMs);
+    lastReadMs = lastWriteMs = (unsigned long) Kernel::get_ms_count();
+    return rc;
 }
 
 bool TLSClient::disconnect() {
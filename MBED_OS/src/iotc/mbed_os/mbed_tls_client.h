@@ -10,19 +10,27 @@
 #include "NTPClient.h"
 #include <assert.h>
 #include "iotc_definitions.h"
+#include "../iotc.h"
+
+// how long MQTT::Client::yield waits for packets while a wake callback is set
+#define IOTC_WAKE_YIELD_MS 10
 
 namespace AzureIOT {
 
 class TLSClient {
     static NetworkInterface* networkInterface;
     TLSSocket* tlsSocket;
+    ConnectTiming timing;
+    unsigned long lastReadMs;   // Kernel ticks of the last bytes in
+    unsigned long lastWriteMs;  // and out
 
     static time_t timestamp;
     static time_t timeStart;
 public:
-    TLSClient() {
+    TLSClient(): lastReadMs(0), lastWriteMs(0) {
         tlsSocket = new TLSSocket();
         assert(tlsSocket);
+        memset(&timing, 0, sizeof(timing));
     }
 
     int read(unsigned char* buffer, int len, int timeout);
@@ -34,6 +42,25 @@ public:
 
     bool connect(const char* host, int port);
     bool disconnect();
+    // wake(appContext) runs when the socket has data (TLSSocket::sigio);
+    // NULL turns it off
+    void setWakeCallback(IOTWakeCallback wake, void* appContext) {
+        if (wake != NULL) {
+            tlsSocket->sigio(mbed::callback(wake, appContext));
+        } else {
+            tlsSocket->sigio(NULL);
+        }
+    }
+    // the last connect. TLSSocket resolves, connects and shakes hands in one
+    // call, so there is only the total (handshakeMs, phased is false). It
+    // doesn't expose the session either, so there is no resumption.
+    const ConnectTiming &getTiming() { return timing; }
+
+    // MQTT::Client pings once the keep-alive interval passed since it last
+    // sent or received. Its timers are private; these track the same traffic
+    // on the socket (set by connect, read and write)
+    unsigned long getLastReadMs() const { return lastReadMs; }
+    unsigned long getLastWriteMs() const { return lastWriteMs; }
 
     ~TLSClient() {
       delete tlsSocket;
@@ -0,0 +1,27 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#if defined(IOTC_POSIX)
+#include "../common/iotc_platform.h"
+#if defined(USE_LIGHT_CLIENT)
+#include "../common/json.h"
+#include "../common/iotc_internal.h"
+
+int mqtt_publish(IOTContextInternal *internal, const char* topic, unsigned long topic_length,
+    const char* msg, unsigned long msg_length) {
+
+    if (internal->mqttClient == NULL) return 1; // the connection is gone
+
+    ++internal->messageId;
+    int rc = internal->mqttClient->publish(topic, topic_length, msg, msg_length);
+    if (rc != 0) {
+        return rc;
+    }
+    // handles what came in meanwhile. the message is out either way; a lost
+    // connection is for the next iotc_do_work to tear down
+    internal->mqttClient->yield(0);
+    return 0;
+}
+
+#endif // defined(USE_LIGHT_CLIENT)
+#endif // defined(IOTC_POSIX)
@@ -0,0 +1,328 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#if defined(IOTC_POSIX)
+#include "../common/iotc_platform.h"
+#if defined(USE_LIGHT_CLIENT)
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <assert.h>
+#include "../common/json.h"
+#include "../common/iotc_internal.h"
+
+unsigned long getNow() {
+    return AzureIOT::TLSClient::nowTime();
+}
+
+unsigned long getTickMs() {
+    return AzureIOT::TLSClient::tickMs();
+}
+
+static void messageArrived(char* topic, unsigned long topicLength, char* payload, unsigned long payloadLength) {
+    handlePayload(payload, payloadLength, topic, topicLength);
+}
+
+/* extern */
+int iotc_free_context(IOTContext ctx) {
+    MUST_CALL_AFTER_INIT(ctx);
+
+    IOTContextInternal *internal = (IOTContextInternal*)ctx;
+    if (internal->endpoint != NULL) {
+        free(internal->endpoint);
+    }
+
+    if (internal->tlsClient != NULL) {
+        iotc_disconnect(ctx);
+    }
+    clearTopics(internal);
+    clearTopicCallbacks(internal);
+    internal->properties.clear();
+    internal->telemetry.clear();
+    internal->store.close();
+    internal->dps.clear();
+    clearHubCredentials(internal);
+
+    free(internal);
+
+    setSingletonContext(NULL);
+
+    return 0;
+}
+
+static void closeHubConnection(IOTContextInternal *internal) {
+    if (internal->mqttClient) {
+        if (internal->mqttClient->isConnected()) {
+            internal->mqttClient->disconnect();
+        }
+        delete internal->mqttClient;
+        internal->mqttClient = NULL;
+    }
+
+    if (internal->tlsClient) {
+        internal->tlsClient->disconnect();
+        delete internal->tlsClient;
+        internal->tlsClient = NULL;
+    }
+}
+
+// connects to internal->hostName with a fresh SAS token and subscribes
+// returns 0 if there is no error. Otherwise, the IOTConnectionState that tells why
+static int openHubConnection(IOTContextInternal *internal) {
+    char password[STRING_BUFFER_512];
+    if (getHubPassword(internal, password, STRING_BUFFER_512) != 0) {
+        return IOTC_CONNECTION_BAD_CREDENTIAL;
+    }
+
+    internal->tlsClient = new AzureIOT::TLSClient();
+    internal->mqttClient = new AzureIOT::MQTTClient(*(internal->tlsClient));
+
+    if (internal->tlsClient->connect(*internal->hostName, AZURE_MQTT_SERVER_PORT) != 0) {
+        IOTC_LOG(F("ERROR: TLSClient connect attempt failed to %s\r\nMake sure both certificate and host are correct."), *internal->hostName);
+        closeHubConnection(internal);
+        return IOTC_CONNECTION_COMMUNICATION_ERROR;
+    }
+
+    unsigned long connackMs = getTickMs();
+    if (internal->mqttClient->connect(*internal->deviceId, *internal->username, password, MQTT_KEEPALIVE) != 0) {
+        IOTC_LOG(F("ERROR: MQTTClient connect attempt failed. Check host, deviceId, username and password."));
+        closeHubConnection(internal);
+        return IOTC_CONNECTION_BAD_CREDENTIAL;
+    }
+    connackMs = getTickMs() - connackMs;
+    connectionTimingCallback(internal, "hub", internal->tlsClient->getTiming(), (long) connackMs);
+    internal->mqttClient->setMessageHandler(messageArrived);
+
+    AzureIOT::StringBuffer buffer(internal->deviceId.getLength() + STRING_BUFFER_64);
+    size_t size = snprintf(*buffer, buffer.getLength(), "devices/%s/messages/events/#", *internal->deviceId);
+    buffer.setLength(size);
+
+    int errorCode = 0;
+    if ( (errorCode = internal->mqttClient->subscribe(*buffer, 1)) != 0)
+        IOTC_LOG(F("ERROR: mqttClient couldn't subscribe to %s. error code => %d"), *buffer, errorCode);
+
+    size = snprintf(*buffer, buffer.getLength(), "devices/%s/messages/devicebound/#", *internal->deviceId);
+    buffer.setLength(size);
+
+    if ( (errorCode = internal->mqttClient->subscribe(*buffer, 1)) != 0)
+        IOTC_LOG(F("ERROR: mqttClient couldn't subscribe to %s. error code => %d"), *buffer, errorCode);
+
+    errorCode  = internal->mqttClient->subscribe("$iothub/twin/PATCH/properties/desired/#", 1); // twin desired property changes
+    errorCode += internal->mqttClient->subscribe("$iothub/twin/res/#", 1); // twin properties response
+    errorCode += internal->mqttClient->subscribe("$iothub/methods/POST/#", 1);
+
+    if (errorCode != 0)
+        IOTC_LOG(F("ERROR: mqttClient couldn't subscribe to twin/methods etc. error code sum => %d"), errorCode);
+
+    return 0;
+}
+
+static void requestTwin(IOTContextInternal *internal) {
+    iotc_do_work(internal);
+    const char* twin_topic = "$iothub/twin/GET/?$rid=0";
+    internal->messageId++; // next rid=1
+    if (mqtt_publish(internal, twin_topic, strlen(twin_topic), " ", 1) != 0) {
+        IOTC_LOG(F("ERROR: Couldn't send the TWIN update request message"));
+    }
+    iotc_do_work(internal);
+}
+
+// the hub credentials are set; opens the connection and asks for the twin
+static int connectHub(IOTContextInternal *internal) {
+    if (cacheTopics(internal) != 0) {
+        return 1;
+    }
+
+    int reason = openHubConnection(internal);
+    if (reason != 0) {
+        connectionStatusCallback((IOTConnectionState) reason, internal);
+        return 1;
+    }
+
+    hubConnected(internal);
+    requestTwin(internal);
+    return 0;
+}
+
+// the next try of the reconnect policy is due
+static int reconnectHub(IOTContextInternal *internal) {
+    int reason = openHubConnection(internal);
+    if (reason != 0) {
+        scheduleReconnect(internal, (IOTConnectionState) reason);
+        return 1;
+    }
+
+    hubConnected(internal);
+    // desired properties may have changed while the device was away
+    requestTwin(internal);
+    return 0;
+}
+
+// the hub connection is gone
+static void hubConnectionLost(IOTContextInternal *internal, IOTConnectionState reason) {
+    closeHubConnection(internal);
+    connectionStatusCallback(IOTC_CONNECTION_DISCONNECTED, internal);
+    scheduleReconnect(internal, reason);
+}
+
+static int startConnect(IOTContext ctx, const char* scope, const char* keyORcert,
+  const char* deviceId, IOTConnectType type, bool async) {
+
+    CHECK_NOT_NULL(ctx)
+    GET_LENGTH_NOT_NULL(keyORcert, 512);
+
+    IOTContextInternal *internal = (IOTContextInternal*)ctx;
+    internal->reconnect.cancel();
+
+    if (type == IOTC_CONNECT_CONNECTION_STRING) {
+        if (setHubCredentialsFromConnectionString(internal, keyORcert, keyORcert_len)) {
+            return 1;
+        }
+    } else if (type == IOTC_CONNECT_SYMM_KEY) {
+        assert(scope != NULL && deviceId != NULL);
+        if (beginProvisioning(internal, scope, deviceId, keyORcert) != 0) {
+            return 1;
+        }
+        if (async) {
+            return 0; // iotc_do_work takes it from here
+        }
+        if (finishProvisioning(internal) != 0) {
+            return 1;
+        }
+    } else if (type == IOTC_CONNECT_X509_CERT) {
+        IOTC_LOG(F("ERROR: IOTC_CONNECT_X509_CERT NOT IMPLEMENTED"));
+        connectionStatusCallback(IOTC_CONNECTION_DEVICE_DISABLED, (IOTContextInternal*)ctx);
+        return 1;
+    }
+
+    return connectHub(internal);
+}
+
+int iotc_connect(IOTContext ctx, const char* scope, const char* keyORcert,
+  const char* deviceId, IOTConnectType type) {
+    return startConnect(ctx, scope, keyORcert, deviceId, type, false);
+}
+
+/* extern */
+int iotc_connect_async(IOTContext ctx, const char* scope, const char* keyORcert,
+  const char* deviceId, IOTConnectType type) {
+    return startConnect(ctx, scope, keyORcert, deviceId, type, true);
+}
+
+/* extern */
+int iotc_disconnect(IOTContext ctx) {
+    CHECK_NOT_NULL(ctx)
+
+    IOTContextInternal *internal = (IOTContextInternal*)ctx;
+    if (internal->dps.isBusy()) { // still provisioning
+        internal->dps.clear();
+        return 0;
+    }
+    if (internal->mqttClient == NULL && internal->reconnect.isPending()) {
+        internal->reconnect.cancel(); // DISCONNECTED was reported already
+        return 0;
+    }
+    internal->reconnect.cancel();
+    MUST_CALL_AFTER_CONNECT(internal);
+
+    // pending telemetry and reported properties would be lost otherwise
+    flushTelemetry(internal);
+    flushProperties(internal);
+    closeHubConnection(internal);
+    connectionStatusCallback(IOTC_CONNECTION_DISCONNECTED, (IOTContextInternal*)ctx);
+    return 0;
+}
+
+/* extern */
+int iotc_do_work(IOTContext ctx) {
+    CHECK_NOT_NULL(ctx)
+
+    IOTContextInternal *internal = (IOTContextInternal*)ctx;
+    if (internal->dps.isBusy()) { // iotc_connect_async
+        int rc = provisionStep(internal, 0);
+        if (rc == 2) return 0;
+        if (rc != 0) {
+            connectionStatusCallback(internal->dps.getStatusCode() == 401 ?
+                IOTC_CONNECTION_BAD_CREDENTIAL : IOTC_CONNECTION_COMMUNICATION_ERROR, internal);
+            return 1;
+        }
+        return connectHub(internal);
+    }
+    if (internal->mqttClient == NULL && internal->reconnect.isPending()) {
+        return internal->reconnect.isDue(getTickMs()) ? reconnectHub(internal) : 0;
+    }
+    MUST_CALL_AFTER_CONNECT(internal);
+
+    if (hubTokenNeedsRenewal(internal)) {
+        // the hub drops the connection once the token expires. reconnect
+        // with a fresh one before that happens
+        IOTC_LOG(F("- iotc : renewing the SAS token"));
+        closeHubConnection(internal);
+        int reason = openHubConnection(internal);
+        if (reason != 0) {
+            connectionStatusCallback(IOTC_CONNECTION_DISCONNECTED, internal);
+            scheduleReconnect(internal, (IOTConnectionState) reason);
+            return 1;
+        }
+    }
+
+    flushDueBatches(internal);
+    drainStore(internal);
+    if (internal->mqttClient == NULL) {
+        return 1; // a callback has disconnected
+    }
+
+    if (internal->mqttClient->yield(0) != 0) {
+        if (!internal->mqttClient->isConnected()) {
+            if (internal->reconnect.isEnabled()) {
+                hubConnectionLost(internal, IOTC_CONNECTION_DISCONNECTED);
+            } else {
+                connectionStatusCallback(IOTC_CONNECTION_DISCONNECTED, internal);
+            }
+        }
+        return 1;
+    }
+    return 0;
+}
+
+/* extern */
+int iotc_get_wait_ms(IOTContext ctx, unsigned long* waitMs) {
+    CHECK_NOT_NULL(ctx)
+    CHECK_NOT_NULL(waitMs)
+
+    IOTContextInternal *internal = (IOTContextInternal*)ctx;
+    unsigned long now = getTickMs();
+    *waitMs = getWorkWaitMs(internal, now);
+    if (internal->mqttClient != NULL) {
+        *waitMs = iotc_min(*waitMs, internal->mqttClient->getWaitMs(now));
+    }
+    return 0;
+}
+
+/* extern */
+int iotc_get_socket(IOTContext ctx, int* socketFd) {
+    CHECK_NOT_NULL(ctx)
+    CHECK_NOT_NULL(socketFd)
+
+    IOTContextInternal *internal = (IOTContextInternal*)ctx;
+    *socketFd = internal->mqttClient != NULL ? internal->tlsClient->getSocket() : -1;
+    return 0;
+}
+
+/* extern */
+int iotc_set_wake_callback(IOTContext ctx, IOTWakeCallback wake, void* appContext) {
+    CHECK_NOT_NULL(ctx)
+
+    IOTC_LOG(F("ERROR: (iotc_set_wake_callback) not supported on POSIX. Wait on iotc_get_socket"));
+    return 1;
+}
+
+/* extern */
+int iotc_set_network_interface(void* networkInterface) {
+    // NO-OP
+    return 0;
+}
+
+#endif // defined(USE_LIGHT_CLIENT)
+#endif // IOTC_POSIX
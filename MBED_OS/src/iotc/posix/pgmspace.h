@@ -0,0 +1,23 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license.
+
+#ifndef AZURE_IOTC_POSIX_PGMSPACE_H
+#define AZURE_IOTC_POSIX_PGMSPACE_H
+
+#if defined(IOTC_POSIX)
+#include <stdint.h>
+#include <string.h>
+
+// Hosts have a flat address space. Map the AVR flash helpers used by
+// sha256.cpp and base64.cpp to plain memory access.
+#ifndef PROGMEM
+#define PROGMEM
+#endif
+
+#define memcpy_P memcpy
+#define pgm_read_byte(addr) (*(const uint8_t*)(addr))
+#define pgm_read_dword(addr) (*(const uint32_t*)(addr))
+
+#endif // IOTC_POSIX
+
+#endif // AZURE_IOTC_POSIX_PGMSPACE_H
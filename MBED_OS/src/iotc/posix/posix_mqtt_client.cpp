@@ -0,0 +1,298 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license.
+
+#if defined(IOTC_POSIX)
+#include "../common/iotc_internal.h"
+#if defined(USE_LIGHT_CLIENT)
+
+// Leave room in front of every outbound packet for the fixed header
+// (1 byte type + up to 4 bytes remaining length)
+#define MQTT_MAX_HEADER_SIZE 5
+// the most the four remaining length bytes can say
+#define MQTT_MAX_REMAINING_LENGTH 268435455UL
+
+namespace AzureIOT {
+
+MQTTClient::MQTTClient(TLSClient &tlsClient): client(tlsClient), messageHandler(NULL),
+    nextPacketId(0), keepAliveSeconds(0), lastOutActivity(0), lastInActivity(0),
+    pingOutstanding(false), connected(false) { }
+
+unsigned short MQTTClient::getNextPacketId() {
+    if (++nextPacketId == 0) nextPacketId = 1;
+    return nextPacketId;
+}
+
+int MQTTClient::readFully(unsigned char* target, unsigned length, int timeout) {
+    unsigned total = 0;
+    while (total < length) {
+        int rc = client.read(target + total, length - total, timeout);
+        if (rc <= 0) return 1;
+        total += rc;
+    }
+    return 0;
+}
+
+// returns the packet header, 0 on timeout, -1 on failure
+int MQTTClient::readPacket(int timeout, unsigned &packetLength) {
+    unsigned char header = 0;
+    int rc = client.read(&header, 1, timeout);
+    if (rc == 0) return 0;
+    if (rc < 0) {
+        connected = false;
+        return -1;
+    }
+
+    unsigned multiplier = 1, length = 0;
+    unsigned char digit = 0;
+    int count = 0;
+    do {
+        if (++count > 4 || readFully(&digit, 1, IOTC_SERVER_RESPONSE_TIMEOUT * 1000)) {
+            connected = false;
+            return -1;
+        }
+        length += (digit & 127) * multiplier;
+        multiplier *= 128;
+    } while ((digit & 128) != 0);
+
+    packetLength = length;
+    if (length >= sizeof(readBuffer)) {
+        // too large for us. drain it and report an empty packet
+        unsigned char sink[STRING_BUFFER_64];
+        while (length > 0) {
+            unsigned chunk = iotc_min(length, (unsigned) sizeof(sink));
+            if (readFully(sink, chunk, IOTC_SERVER_RESPONSE_TIMEOUT * 1000)) {
+                connected = false;
+                return -1;
+            }
+            length -= chunk;
+        }
+        IOTC_LOG(F("ERROR: (MQTTClient) dropped an inbound packet of %u bytes"), packetLength);
+        packetLength = 0;
+        return header;
+    }
+
+    if (length > 0 && readFully(readBuffer, length, IOTC_SERVER_RESPONSE_TIMEOUT * 1000)) {
+        connected = false;
+        return -1;
+    }
+
+    lastInActivity = TLSClient::tickMs();
+    return header;
+}
+
+// writes the packet that was built at sendBuffer + MQTT_MAX_HEADER_SIZE, then
+// the payload (if any) from where it is
+int MQTTClient::writePacket(unsigned char header, unsigned length,
+    const unsigned char* payload, unsigned long payloadLength) {
+    unsigned char lengthBytes[4];
+    unsigned long remaining = length + payloadLength;
+    unsigned count = 0;
+    do {
+        unsigned char digit = remaining % 128;
+        remaining /= 128;
+        if (remaining > 0) digit |= 0x80;
+        lengthBytes[count++] = digit;
+    } while (remaining > 0 && count < 4);
+
+    unsigned char *start = sendBuffer + MQTT_MAX_HEADER_SIZE - (count + 1);
+    start[0] = header;
+    memcpy(start + 1, lengthBytes, count);
+
+    WriteSegment segments[2] = {
+        { start, length + count + 1 },
+        { payload, (unsigned) payloadLength }
+    };
+    int total = (int)(segments[0].length + segments[1].length);
+    if (client.writev(segments, payloadLength ? 2 : 1, IOTC_SERVER_RESPONSE_TIMEOUT * 1000) != total) {
+        connected = false;
+        return 1;
+    }
+
+    lastOutActivity = TLSClient::tickMs();
+    return 0;
+}
+
+unsigned MQTTClient::writeString(unsigned pos, const char* str, unsigned length) {
+    sendBuffer[pos++] = (unsigned char)(length >> 8);
+    sendBuffer[pos++] = (unsigned char)(length & 0xFF);
+    memcpy(sendBuffer + pos, str, length);
+    return pos + length;
+}
+
+int MQTTClient::waitFor(unsigned char packetType, int timeout) {
+    unsigned long start = TLSClient::tickMs();
+    while (TLSClient::tickMs() - start < (unsigned long) timeout) {
+        unsigned packetLength = 0;
+        int header = readPacket(timeout, packetLength);
+        if (header < 0) return 1;
+        if (header == 0) continue;
+
+        if ((header & 0xF0) == packetType) return 0;
+        if ((header & 0xF0) == IOTC_MQTT_PUBLISH) {
+            dispatchPublish((unsigned char) header, packetLength);
+        }
+    }
+    return 1;
+}
+
+int MQTTClient::connect(const char* clientId, const char* username,
+    const char* password, unsigned short keepAlive) {
+    static const unsigned char protocol[7] = {0x00, 0x04, 'M', 'Q', 'T', 'T', 0x04};
+    unsigned clientIdLength = strlen(clientId), usernameLength = strlen(username),
+        passwordLength = strlen(password);
+
+    if (MQTT_MAX_HEADER_SIZE + 10 + 6 + clientIdLength + usernameLength +
+        passwordLength > sizeof(sendBuffer)) {
+        IOTC_LOG(F("ERROR: (MQTTClient::connect) credentials do not fit into the buffer"));
+        return 1;
+    }
+
+    unsigned pos = MQTT_MAX_HEADER_SIZE;
+    memcpy(sendBuffer + pos, protocol, sizeof(protocol));
+    pos += sizeof(protocol);
+    sendBuffer[pos++] = 0x80 | 0x40 | 0x02; // username, password, clean session
+    sendBuffer[pos++] = (unsigned char)(keepAlive >> 8);
+    sendBuffer[pos++] = (unsigned char)(keepAlive & 0xFF);
+    pos = writeString(pos, clientId, clientIdLength);
+    pos = writeString(pos, username, usernameLength);
+    pos = writeString(pos, password, passwordLength);
+
+    keepAliveSeconds = keepAlive;
+    connected = true;
+    pingOutstanding = false;
+    if (writePacket(IOTC_MQTT_CONNECT, pos - MQTT_MAX_HEADER_SIZE) != 0) return 1;
+
+    unsigned packetLength = 0;
+    int header = readPacket(IOTC_SERVER_RESPONSE_TIMEOUT * 1000, packetLength);
+    if ((header & 0xF0) != IOTC_MQTT_CONNACK || packetLength != 2 || readBuffer[1] != 0) {
+        IOTC_LOG(F("ERROR: (MQTTClient::connect) CONNACK was not accepted (%d)"),
+            header > 0 && packetLength == 2 ? readBuffer[1] : -1);
+        connected = false;
+        return 1;
+    }
+
+    return 0;
+}
+
+int MQTTClient::subscribe(const char* topic, int qos) {
+    unsigned topicLength = strlen(topic);
+    if (MQTT_MAX_HEADER_SIZE + 5 + topicLength > sizeof(sendBuffer)) return 1;
+
+    unsigned short packetId = getNextPacketId();
+    unsigned pos = MQTT_MAX_HEADER_SIZE;
+    sendBuffer[pos++] = (unsigned char)(packetId >> 8);
+    sendBuffer[pos++] = (unsigned char)(packetId & 0xFF);
+    pos = writeString(pos, topic, topicLength);
+    sendBuffer[pos++] = (unsigned char) qos;
+
+    if (writePacket(IOTC_MQTT_SUBSCRIBE | 0x02, pos - MQTT_MAX_HEADER_SIZE) != 0) return 1;
+    return waitFor(IOTC_MQTT_SUBACK, IOTC_SERVER_RESPONSE_TIMEOUT * 1000);
+}
+
+int MQTTClient::publish(const char* topic, unsigned long topicLength,
+    const char* payload, unsigned long payloadLength) {
+    if (!isConnected()) return 1;
+    if (MQTT_MAX_HEADER_SIZE + 2 + topicLength > sizeof(sendBuffer) ||
+        2 + topicLength + payloadLength > MQTT_MAX_REMAINING_LENGTH) {
+        IOTC_LOG(F("ERROR: (MQTTClient::publish) message is too large (%lu)"), payloadLength);
+        return 1;
+    }
+
+    // the topic goes through sendBuffer, the payload straight to the socket
+    unsigned pos = writeString(MQTT_MAX_HEADER_SIZE, topic, topicLength);
+    return writePacket(IOTC_MQTT_PUBLISH, pos - MQTT_MAX_HEADER_SIZE,
+        (const unsigned char*) payload, payloadLength);
+}
+
+void MQTTClient::dispatchPublish(unsigned char header, unsigned packetLength) {
+    if (packetLength < 2) return;
+
+    unsigned topicLength = (readBuffer[0] << 8) | readBuffer[1];
+    unsigned pos = 2 + topicLength;
+    if (pos > packetLength) return;
+
+    unsigned short packetId = 0;
+    bool qos1 = (header & 0x06) == 0x02;
+    if (qos1) {
+        if (pos + 2 > packetLength) return;
+        packetId = (readBuffer[pos] << 8) | readBuffer[pos + 1];
+        pos += 2;
+    }
+
+    // move the topic one byte to the front and end it with \0
+    memmove(readBuffer + 1, readBuffer + 2, topicLength);
+    readBuffer[1 + topicLength] = 0;
+
+    if (messageHandler) {
+        messageHandler((char*)readBuffer + 1, topicLength, (char*)readBuffer + pos, packetLength - pos);
+    }
+
+    if (qos1) {
+        sendBuffer[MQTT_MAX_HEADER_SIZE] = (unsigned char)(packetId >> 8);
+        sendBuffer[MQTT_MAX_HEADER_SIZE + 1] = (unsigned char)(packetId & 0xFF);
+        writePacket(IOTC_MQTT_PUBACK, 2);
+    }
+}
+
+int MQTTClient::yield(int timeout) {
+    if (!isConnected()) return 1;
+
+    unsigned long start = TLSClient::tickMs();
+    do {
+        unsigned long now = TLSClient::tickMs();
+        if (keepAliveSeconds && now - lastOutActivity >= keepAliveSeconds * 1000UL) {
+            if (pingOutstanding && now - lastInActivity >= keepAliveSeconds * 1000UL) {
+                IOTC_LOG(F("ERROR: (MQTTClient::yield) keep-alive timeout"));
+                connected = false;
+                client.disconnect();
+                return 1;
+            }
+
+            if (writePacket(IOTC_MQTT_PINGREQ, 0) != 0) return 1;
+            pingOutstanding = true;
+        }
+
+        unsigned packetLength = 0;
+        int header = readPacket(timeout, packetLength);
+        if (header < 0) return 1;
+
+        switch (header & 0xF0) {
+            case IOTC_MQTT_PUBLISH:
+                dispatchPublish((unsigned char) header, packetLength);
+                break;
+            case IOTC_MQTT_PINGRESP:
+                pingOutstanding = false;
+                break;
+            default:
+                break;
+        }
+
+        if (header == 0) break;
+    } while (TLSClient::tickMs() - start < (unsigned long) timeout);
+
+    return 0;
+}
+
+unsigned long MQTTClient::getWaitMs(unsigned long nowMs) {
+    if (!isConnected()) return IOTC_MAX_WAIT_MS;
+    // already read off the socket; poll wouldn't tell
+    if (client.hasPending()) return 0;
+    if (keepAliveSeconds == 0) return IOTC_MAX_WAIT_MS;
+
+    unsigned long periodMs = keepAliveSeconds * 1000UL;
+    unsigned long idleMs = nowMs - lastOutActivity;
+    return idleMs >= periodMs ? 0 : iotc_min(periodMs - idleMs, (unsigned long) IOTC_MAX_WAIT_MS);
+}
+
+int MQTTClient::disconnect() {
+    if (connected) {
+        writePacket(IOTC_MQTT_DISCONNECT, 0);
+        connected = false;
+    }
+    return client.disconnect() ? 0 : 1;
+}
+
+} // namespace AzureIOT
+
+#endif // defined(USE_LIGHT_CLIENT)
+#endif // IOTC_POSIX
@@ -0,0 +1,88 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license.
+
+#ifndef AZURE_IOTC_POSIX_MQTT_CLIENT_H
+#define AZURE_IOTC_POSIX_MQTT_CLIENT_H
+
+#if defined(IOTC_POSIX)
+#include "posix_tls_client.h"
+
+// Maximum size of an MQTT packet (fixed header excluded) the host client keeps
+// in memory. Larger inbound packets are drained and dropped. A PUBLISH payload
+// goes out from the caller's memory and doesn't count against it.
+#ifndef IOTC_POSIX_MQTT_BUFFER_SIZE
+#define IOTC_POSIX_MQTT_BUFFER_SIZE STRING_BUFFER_4096
+#endif
+
+// keep-alive interval (seconds) iotc_connect asks for
+#ifndef MQTT_KEEPALIVE
+#define MQTT_KEEPALIVE 15
+#endif
+
+#define IOTC_MQTT_CONNECT     0x10
+#define IOTC_MQTT_CONNACK     0x20
+#define IOTC_MQTT_PUBLISH     0x30
+#define IOTC_MQTT_PUBACK      0x40
+#define IOTC_MQTT_SUBSCRIBE   0x80
+#define IOTC_MQTT_SUBACK      0x90
+#define IOTC_MQTT_PINGREQ     0xC0
+#define IOTC_MQTT_PINGRESP    0xD0
+#define IOTC_MQTT_DISCONNECT  0xE0
+
+namespace AzureIOT {
+
+// Minimal MQTT 3.1.1 client for the host build. Covers the subset the light
+// client uses on devices: CONNECT, SUBSCRIBE, QoS0 PUBLISH out, QoS0/1 PUBLISH
+// in, keep-alive and DISCONNECT.
+class MQTTClient {
+public:
+    typedef void (*MessageHandler)(char* topic, unsigned long topicLength,
+        char* payload, unsigned long payloadLength);
+
+private:
+    TLSClient &client;
+    MessageHandler messageHandler;
+    unsigned short nextPacketId;
+    unsigned short keepAliveSeconds;
+    unsigned long lastOutActivity;
+    unsigned long lastInActivity;
+    bool pingOutstanding;
+    bool connected;
+    unsigned char readBuffer[IOTC_POSIX_MQTT_BUFFER_SIZE];
+    unsigned char sendBuffer[IOTC_POSIX_MQTT_BUFFER_SIZE];
+
+    int readFully(unsigned char* target, unsigned length, int timeout);
+    int readPacket(int timeout, unsigned &packetLength);
+    int writePacket(unsigned char header, unsigned length,
+        const unsigned char* payload = NULL, unsigned long payloadLength = 0);
+    unsigned writeString(unsigned pos, const char* str, unsigned length);
+    unsigned short getNextPacketId();
+    int waitFor(unsigned char packetType, int timeout);
+    void dispatchPublish(unsigned char header, unsigned packetLength);
+
+public:
+    MQTTClient(TLSClient &tlsClient);
+
+    // returns 0 if there is no error
+    int connect(const char* clientId, const char* username, const char* password,
+        unsigned short keepAlive);
+    int subscribe(const char* topic, int qos);
+    int publish(const char* topic, unsigned long topicLength,
+        const char* payload, unsigned long payloadLength);
+
+    // Process inbound packets for up to `timeout` ms and keep the session alive
+    int yield(int timeout = 0);
+    // how long yield() has nothing to do unless the socket turns readable:
+    // until the next keep-alive ping (or its timeout), IOTC_MAX_WAIT_MS at most
+    unsigned long getWaitMs(unsigned long nowMs);
+    int disconnect();
+    bool isConnected() { return connected && client.isConnected(); }
+
+    void setMessageHandler(MessageHandler handler) { messageHandler = handler; }
+};
+
+} // namespace AzureIOT
+
+#endif // IOTC_POSIX
+
+#endif // AZURE_IOTC_POSIX_MQTT_CLIENT_H
@@ -0,0 +1,425 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license.
+
+#if defined(IOTC_POSIX)
+#include "../common/iotc_internal.h"
+#if defined(USE_LIGHT_CLIENT)
+
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/types.h>
+
+#if defined(IOTC_POSIX_USE_OPENSSL)
+#include <openssl/err.h>
+#include <openssl/pem.h>
+#include <openssl/x509.h>
+#include <openssl/x509v3.h>
+#endif // IOTC_POSIX_USE_OPENSSL
+
+namespace AzureIOT {
+
+#if defined(IOTC_POSIX_USE_OPENSSL)
+bool TLSClient::useTLS = true;
+#else
+bool TLSClient::useTLS = false;
+#endif // IOTC_POSIX_USE_OPENSSL
+
+TLSClient::TLSClient(): socketFd(-1), sendTimeout(-1) {
+    memset(&timing, 0, sizeof(timing));
+#if defined(IOTC_POSIX_USE_OPENSSL)
+    ssl = NULL;
+    sessionKey[0] = 0;
+#endif // IOTC_POSIX_USE_OPENSSL
+}
+
+#if defined(IOTC_POSIX_USE_OPENSSL)
+typedef struct CachedSession_TAG {
+    char key[STRING_BUFFER_256 + STRING_BUFFER_16];
+    SSL_SESSION *session;
+} CachedSession;
+
+static CachedSession cachedSessions[IOTC_TLS_SESSION_CACHE_SIZE];
+static unsigned nextCachedSession = 0;
+
+SSL_CTX *TLSClient::sslContext = NULL;
+
+SSL_CTX *TLSClient::getContext() {
+    if (sslContext != NULL) return sslContext;
+
+    SSL_CTX *context = SSL_CTX_new(TLS_client_method());
+    if (context == NULL) return NULL;
+
+    SSL_CTX_set_verify(context, SSL_VERIFY_PEER, NULL);
+    SSL_CTX_set_default_verify_paths(context);
+    BIO *bio = BIO_new_mem_buf((const void*)SSL_CA_PEM_DEF, -1);
+    X509 *cert = PEM_read_bio_X509(bio, NULL, NULL, NULL);
+    if (cert != NULL) {
+        X509_STORE_add_cert(SSL_CTX_get_cert_store(context), cert);
+        X509_free(cert);
+    }
+    BIO_free(bio);
+
+    // sessions are kept in cachedSessions; TLS 1.3 tickets arrive after the
+    // handshake, so they are taken as they come (onNewSession)
+    SSL_CTX_set_session_cache_mode(context,
+        SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+    SSL_CTX_sess_set_new_cb(context, onNewSession);
+
+    sslContext = context;
+    return sslContext;
+}
+
+// the handshake fails unless the certificate is issued to host (a DNS name,
+// or an address when host is one)
+int TLSClient::setExpectedHost(const char* host) {
+    X509_VERIFY_PARAM *param = SSL_get0_param(ssl);
+    unsigned char address[sizeof(struct in6_addr)];
+    if (inet_pton(AF_INET, host, address) == 1 || inet_pton(AF_INET6, host, address) == 1) {
+        return X509_VERIFY_PARAM_set1_ip_asc(param, host) == 1 ? 0 : 1;
+    }
+    X509_VERIFY_PARAM_set_hostflags(param, X509_CHECK_FLAG_NO_PARTIAL_WILDCARDS);
+    return SSL_set1_host(ssl, host) == 1 ? 0 : 1;
+}
+
+int TLSClient::onNewSession(SSL *ssl, SSL_SESSION *session) {
+    TLSClient *client = (TLSClient*) SSL_get_app_data(ssl);
+    if (client == NULL || client->sessionKey[0] == 0) return 0;
+
+    storeSession(client->sessionKey, session);
+    return 1; // the cache holds the reference now
+}
+
+SSL_SESSION *TLSClient::findSession(const char* key) {
+    for (unsigned i = 0; i < IOTC_TLS_SESSION_CACHE_SIZE; i++) {
+        if (cachedSessions[i].session != NULL && strcmp(cachedSessions[i].key, key) == 0) {
+            return cachedSessions[i].session;
+        }
+    }
+    return NULL;
+}
+
+// session == NULL drops the one of key
+void TLSClient::storeSession(const char* key, SSL_SESSION *session) {
+    CachedSession *slot = NULL;
+    for (unsigned i = 0; i < IOTC_TLS_SESSION_CACHE_SIZE && slot == NULL; i++) {
+        if (cachedSessions[i].session != NULL && strcmp(cachedSessions[i].key, key) == 0) {
+            slot = &cachedSessions[i];
+        }
+    }
+
+    if (slot == NULL) {
+        if (session == NULL) return;
+        for (unsigned i = 0; i < IOTC_TLS_SESSION_CACHE_SIZE && slot == NULL; i++) {
+            if (cachedSessions[i].session == NULL) slot = &cachedSessions[i];
+        }
+        if (slot == NULL) {
+            slot = &cachedSessions[nextCachedSession];
+            nextCachedSession = (nextCachedSession + 1) % IOTC_TLS_SESSION_CACHE_SIZE;
+        }
+    }
+
+    if (slot->session != NULL) {
+        SSL_SESSION_free(slot->session);
+    }
+    slot->session = session;
+    snprintf(slot->key, sizeof(slot->key), "%s", key);
+}
+#endif // IOTC_POSIX_USE_OPENSSL
+
+void TLSClient::clearSessions() {
+#if defined(IOTC_POSIX_USE_OPENSSL)
+    for (unsigned i = 0; i < IOTC_TLS_SESSION_CACHE_SIZE; i++) {
+        if (cachedSessions[i].session != NULL) {
+            SSL_SESSION_free(cachedSessions[i].session);
+            cachedSessions[i].session = NULL;
+        }
+    }
+    nextCachedSession = 0;
+#endif // IOTC_POSIX_USE_OPENSSL
+}
+
+bool TLSClient::hasPending() {
+#if defined(IOTC_POSIX_USE_OPENSSL)
+    return ssl != NULL && SSL_pending(ssl) > 0;
+#else
+    return false;
+#endif // IOTC_POSIX_USE_OPENSSL
+}
+
+bool TLSClient::waitReadable(int timeout) {
+    if (hasPending()) return true;
+
+    struct pollfd pfd;
+    pfd.fd = socketFd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+
+    int rc = 0;
+    do {
+        rc = poll(&pfd, 1, timeout);
+    } while (rc == -1 && errno == EINTR);
+
+    return rc > 0;
+}
+
+int TLSClient::read(unsigned char* buffer, int len, int timeout) {
+    if (socketFd == -1) return -1;
+    if (!waitReadable(iotc_max(timeout, 0))) return 0;
+
+    int rc = 0;
+#if defined(IOTC_POSIX_USE_OPENSSL)
+    if (ssl != NULL) {
+        rc = SSL_read(ssl, buffer, len);
+        if (rc <= 0) {
+            int error = SSL_get_error(ssl, rc);
+            if (error == SSL_ERROR_WANT_READ || error == SSL_ERROR_WANT_WRITE) return 0;
+            return -1;
+        }
+        return rc;
+    }
+#endif // IOTC_POSIX_USE_OPENSSL
+
+    do {
+        rc = (int) recv(socketFd, buffer, len, 0);
+    } while (rc == -1 && errno == EINTR);
+
+    if (rc == 0) return -1; // peer closed the connection
+    if (rc < 0) return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+    return rc;
+}
+
+// a send that can't make progress for timeout ms fails (EAGAIN); 0 blocks
+void TLSClient::setSendTimeout(int timeout) {
+    timeout = iotc_max(timeout, 0);
+    if (timeout == sendTimeout) return;
+
+    struct timeval tv;
+    tv.tv_sec = timeout / 1000;
+    tv.tv_usec = (timeout % 1000) * 1000;
+    if (setsockopt(socketFd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv)) == 0) {
+        sendTimeout = timeout;
+    }
+}
+
+int TLSClient::write(const unsigned char* buffer, int len, int timeout) {
+    if (socketFd == -1) return -1;
+    setSendTimeout(timeout);
+
+    int total = 0;
+    while (total < len) {
+        int rc = 0;
+#if defined(IOTC_POSIX_USE_OPENSSL)
+        if (ssl != NULL) {
+            rc = SSL_write(ssl, buffer + total, len - total);
+            if (rc <= 0) return -1;
+            total += rc;
+            continue;
+        }
+#endif // IOTC_POSIX_USE_OPENSSL
+        rc = (int) send(socketFd, buffer + total, len - total, MSG_NOSIGNAL);
+        if (rc < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        total += rc;
+    }
+
+    return total;
+}
+
+// sends (and empties) what writev has gathered
+static int flushGathered(TLSClient* client, const unsigned char* gather, unsigned &gathered, int timeout) {
+    if (gathered == 0) return 0;
+    int rc = client->write(gather, (int) gathered, timeout);
+    if (rc != (int) gathered) return -1;
+    gathered = 0;
+    return rc;
+}
+
+int TLSClient::writev(const WriteSegment* segments, int count, int timeout) {
+    if (socketFd == -1) return -1;
+    setSendTimeout(timeout);
+
+#if defined(IOTC_POSIX_USE_OPENSSL)
+    if (ssl != NULL) {
+        // a record per SSL_write; small segments (headers) share one
+        unsigned char gather[IOTC_TLS_GATHER_SIZE];
+        unsigned gathered = 0;
+        int total = 0;
+        for (int i = 0; i < count; i++) {
+            const WriteSegment &segment = segments[i];
+            total += segment.length;
+            if (segment.length < IOTC_TLS_GATHER_SIZE) {
+                if (gathered + segment.length > IOTC_TLS_GATHER_SIZE &&
+                    flushGathered(this, gather, gathered, timeout) < 0) return -1;
+                memcpy(gather + gathered, segment.data, segment.length);
+                gathered += segment.length;
+                continue;
+            }
+            if (flushGathered(this, gather, gathered, timeout) < 0 ||
+                write(segment.data, (int) segment.length, timeout) != (int) segment.length) {
+                return -1;
+            }
+        }
+        return flushGathered(this, gather, gathered, timeout) < 0 ? -1 : total;
+    }
+#endif // IOTC_POSIX_USE_OPENSSL
+
+    // plain TCP: one sendmsg for all of it
+    struct iovec vectors[IOTC_TLS_MAX_SEGMENTS];
+    if (count > IOTC_TLS_MAX_SEGMENTS) return -1;
+    int total = 0;
+    for (int i = 0; i < count; i++) {
+        vectors[i].iov_base = (void*) segments[i].data;
+        vectors[i].iov_len = segments[i].length;
+        total += segments[i].length;
+    }
+
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = vectors;
+    message.msg_iovlen = count;
+    int sent = 0;
+    while (sent < total) {
+        ssize_t rc = sendmsg(socketFd, &message, MSG_NOSIGNAL);
+        if (rc < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        sent += (int) rc;
+        // skip what went out
+        while (rc > 0 && message.msg_iovlen > 0) {
+            if ((size_t) rc >= message.msg_iov->iov_len) {
+                rc -= message.msg_iov->iov_len;
+                message.msg_iov++;
+                message.msg_iovlen--;
+            } else {
+                message.msg_iov->iov_base = (char*) message.msg_iov->iov_base + rc;
+                message.msg_iov->iov_len -= rc;
+                rc = 0;
+            }
+        }
+    }
+
+    return total;
+}
+
+int TLSClient::connect(const char* host, int port) {
+    IOTC_LOG(F("TLSClient::connect host(%s)"), host);
+    assert(host != NULL && socketFd == -1);
+
+    char hostName[STRING_BUFFER_256] = {0};
+    char portName[STRING_BUFFER_16] = {0};
+    const char* colon = strrchr(host, ':');
+    if (colon != NULL) {
+        unsigned length = iotc_min((unsigned)(colon - host), (unsigned) STRING_BUFFER_256 - 1);
+        memcpy(hostName, host, length);
+        snprintf(portName, STRING_BUFFER_16, "%s", colon + 1);
+    } else {
+        snprintf(hostName, STRING_BUFFER_256, "%s", host);
+        snprintf(portName, STRING_BUFFER_16, "%d", port);
+    }
+
+    memset(&timing, 0, sizeof(timing));
+    timing.phased = true;
+    unsigned long startMs = tickMs();
+
+    struct addrinfo hints, *addresses = NULL;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    if (getaddrinfo(hostName, portName, &hints, &addresses) != 0) {
+        IOTC_LOG(F("ERROR: TLSClient::connect couldn't resolve %s"), hostName);
+        return 1;
+    }
+    timing.dnsMs = tickMs() - startMs;
+    startMs += timing.dnsMs;
+
+    for (struct addrinfo *address = addresses; address != NULL; address = address->ai_next) {
+        socketFd = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+        if (socketFd == -1) continue;
+
+        if (::connect(socketFd, address->ai_addr, address->ai_addrlen) == 0) break;
+
+        close(socketFd);
+        socketFd = -1;
+    }
+    freeaddrinfo(addresses);
+
+    if (socketFd == -1) {
+        IOTC_LOG(F("ERROR: TLSClient::connect failed"));
+        return 1;
+    }
+
+    int flag = 1;
+    setsockopt(socketFd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+    timing.tcpMs = tickMs() - startMs;
+    startMs += timing.tcpMs;
+
+#if defined(IOTC_POSIX_USE_OPENSSL)
+    if (useTLS) {
+        SSL_CTX *context = getContext();
+        if (context == NULL) goto tls_error;
+
+        ssl = SSL_new(context);
+        if (ssl == NULL) goto tls_error;
+
+        snprintf(sessionKey, sizeof(sessionKey), "%s:%s", hostName, portName);
+        SSL_set_app_data(ssl, this);
+        SSL_set_fd(ssl, socketFd);
+        SSL_set_tlsext_host_name(ssl, hostName);
+        if (setExpectedHost(hostName) != 0) goto tls_error;
+        {
+            SSL_SESSION *session = findSession(sessionKey);
+            if (session != NULL) SSL_set_session(ssl, session);
+        }
+        if (SSL_connect(ssl) != 1) goto tls_error;
+
+        timing.handshakeMs = tickMs() - startMs;
+        timing.resumed = SSL_session_reused(ssl) == 1;
+    }
+#endif // IOTC_POSIX_USE_OPENSSL
+
+    return 0;
+
+#if defined(IOTC_POSIX_USE_OPENSSL)
+tls_error:
+    IOTC_LOG(F("ERROR: TLSClient::connect TLS handshake has failed (%lu)"), ERR_get_error());
+    if (sessionKey[0] != 0) {
+        storeSession(sessionKey, NULL); // start over with a full handshake
+    }
+    disconnect();
+    return 1;
+#endif // IOTC_POSIX_USE_OPENSSL
+}
+
+bool TLSClient::disconnect() {
+    if (socketFd == -1) return true;
+
+    IOTC_LOG(F("TLSClient::disconnect"));
+#if defined(IOTC_POSIX_USE_OPENSSL)
+    if (ssl != NULL) {
+        SSL_shutdown(ssl);
+        SSL_free(ssl);
+        ssl = NULL;
+    }
+#endif // IOTC_POSIX_USE_OPENSSL
+
+    int rc = close(socketFd);
+    socketFd = -1;
+    sendTimeout = -1;
+    return rc == 0;
+}
+
+} // namespace AzureIOT
+
+#endif // defined(USE_LIGHT_CLIENT)
+#endif // IOTC_POSIX
@@ -0,0 +1,121 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license.
+
+#ifndef AZURE_IOTC_POSIX_TLS_CLIENT_H
+#define AZURE_IOTC_POSIX_TLS_CLIENT_H
+
+#if defined(IOTC_POSIX)
+#include <assert.h>
+#include <errno.h>
+#include <time.h>
+#include "../common/iotc_definitions.h"
+
+#if defined(IOTC_POSIX_USE_OPENSSL)
+#include <openssl/ssl.h>
+#endif // IOTC_POSIX_USE_OPENSSL
+
+// TLS sessions kept for resumption, one per host:port (oldest goes first)
+#ifndef IOTC_TLS_SESSION_CACHE_SIZE
+#define IOTC_TLS_SESSION_CACHE_SIZE 4
+#endif
+
+// TLSClient::writev: segments shorter than this share a TLS record
+#ifndef IOTC_TLS_GATHER_SIZE
+#define IOTC_TLS_GATHER_SIZE STRING_BUFFER_256
+#endif
+// TLSClient::writev: the most segments of a plain TCP write
+#ifndef IOTC_TLS_MAX_SEGMENTS
+#define IOTC_TLS_MAX_SEGMENTS 8
+#endif
+
+namespace AzureIOT {
+
+// BSD socket transport with the same surface as the mbed TLSClient.
+// TLS is optional; when IOTC_POSIX_USE_OPENSSL is not defined, or TLS was
+// turned off with setUseTLS(false), the client speaks plain TCP. That is what
+// the loopback hub used for host benchmarks expects.
+//
+// The server certificate has to chain to the CA (SSL_CA_PEM_DEF, or the
+// system store) and name the host that was connected to.
+//
+// All clients share one SSL_CTX (the CA is parsed once). The session the
+// server hands out is kept per host:port, and the next connect to the same
+// endpoint (hub reconnects, DPS sessions) offers it for an abbreviated
+// handshake.
+class TLSClient {
+    static bool useTLS;
+
+    int socketFd;
+    int sendTimeout; // ms, as set on socketFd (-1: not yet)
+    ConnectTiming timing;
+#if defined(IOTC_POSIX_USE_OPENSSL)
+    SSL *ssl;
+    char sessionKey[STRING_BUFFER_256 + STRING_BUFFER_16]; // host:port
+
+    static SSL_CTX *sslContext;
+    static SSL_CTX *getContext();
+    static int onNewSession(SSL *ssl, SSL_SESSION *session);
+    static SSL_SESSION *findSession(const char* key);
+    static void storeSession(const char* key, SSL_SESSION *session);
+    int setExpectedHost(const char* host);
+#endif // IOTC_POSIX_USE_OPENSSL
+
+    bool waitReadable(int timeout);
+    void setSendTimeout(int timeout);
+public:
+    TLSClient();
+
+    // returns number of bytes read, 0 on timeout, -1 when the connection is gone
+    int read(unsigned char* buffer, int len, int timeout);
+    // fails (-1) once the socket takes no data for `timeout` ms (0: blocks)
+    int write(const unsigned char* buffer, int len, int timeout);
+    // Sends the segments in order, as one write. Over TLS the segments shorter
+    // than IOTC_TLS_GATHER_SIZE are gathered into one record with their neighbours,
+    // the others go out as they are. returns the bytes written, -1 on error
+    int writev(const WriteSegment* segments, int count, int timeout);
+
+    // host may carry an explicit port ("127.0.0.1:8883"). It overrides `port`.
+    // returns 0 if there is no error
+    int connect(const char* host, int port);
+    bool disconnect();
+    bool isConnected() { return socketFd != -1; }
+    int getSocket() { return socketFd; }
+    // true if read() has decrypted bytes that don't show on the socket
+    bool hasPending();
+    // phases of the last connect
+    const ConnectTiming &getTiming() { return timing; }
+
+    ~TLSClient() {
+      disconnect();
+    }
+
+    static void setUseTLS(bool enabled) { useTLS = enabled; }
+    static bool getUseTLS() { return useTLS; }
+    // forgets the cached TLS sessions (next connects do a full handshake)
+    static void clearSessions();
+
+    static unsigned long nowTime() {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        return (unsigned long) ts.tv_sec;
+    }
+
+    static unsigned long tickMs() {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (unsigned long) (ts.tv_sec * 1000UL + ts.tv_nsec / 1000000UL);
+    }
+
+    static void waitMs(unsigned ms) {
+        struct timespec ts;
+        ts.tv_sec = ms / 1000;
+        ts.tv_nsec = (ms % 1000) * 1000000L;
+        while (nanosleep(&ts, &ts) == -1 && errno == EINTR) { }
+    }
+};
+
+} // namespace AzureIOT
+
+#endif // IOTC_POSIX
+
+#endif // AZURE_IOTC_POSIX_TLS_CLIENT_H
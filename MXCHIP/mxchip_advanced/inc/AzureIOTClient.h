@@ -14,17 +14,27 @@ typedef struct EVENT_INSTANCE_TAG {
     int messageTrackingId; // For tracking the messages within the user callback.
 } EVENT_INSTANCE;
 
-struct DirectMethodNode
+// direct methods waiting for the telemetry loop (a power of two)
+#define DIRECT_METHOD_SLOTS        8
+#define DIRECT_METHOD_NAME_SIZE    64
+#define DIRECT_METHOD_PAYLOAD_SIZE 512
+// a full queue that wasn't served for this long answers 503 instead of 429
+#define DIRECT_METHOD_STALL_MS     10000
+
+// reconnect backoff (see scheduleReconnect)
+#define HUB_RECONNECT_BASE_MS   2000
+#define HUB_RECONNECT_CAP_MS    300000 // 5 minutes
+// a connection that stayed up this long starts the backoff over
+#define HUB_RECONNECT_STABLE_MS 60000
+
+static_assert((DIRECT_METHOD_SLOTS & (DIRECT_METHOD_SLOTS - 1)) == 0,
+    "DIRECT_METHOD_SLOTS must be a power of two");
+
+struct DirectMethod
 {
-    char *methodName;
-    char *payload;
+    char methodName[DIRECT_METHOD_NAME_SIZE];
+    char payload[DIRECT_METHOD_PAYLOAD_SIZE]; // + \0
     size_t length;
-
-    DirectMethodNode *next;
-    DirectMethodNode():
-        methodName(NULL), payload(NULL), length(0), next(NULL) { }
-    DirectMethodNode(char *m, char *p, size_t s):
-        methodName(m), payload(p), length(s), next(NULL) { }
 };
 
 class AzureIOTClient
@@ -35,15 +45,30 @@ class AzureIOTClient
     int displayCharPos;
     int waitCount;
     char *deviceId;
+    bool usingCachedHub; // connected without DPS (see ConfigController::readHubCache)
+
+    // FIFO ring of direct methods; head and tail only grow, the slot is
+    // index & (DIRECT_METHOD_SLOTS - 1)
+    DirectMethod methods[DIRECT_METHOD_SLOTS];
+    unsigned methodHead, methodTail;
+    uint32_t lastMethodServed; // millis() of the last release (or the first push)
 
-    DirectMethodNode *rootNode, *lastNode;
+    // a reconnect is due at reconnectAt (millis()); set from the
+    // ConnectionStatus callback, served by checkConnection
+    bool needsReconnect;
+    uint32_t reconnectAt;
+    uint32_t reconnectDelay; // the last backoff delay, 0 before the first one
+    uint32_t connectedAt;    // millis() of the last IOTC_CONNECTION_OK
+    bool connected;
 
     void init();
     void close();
 
 public:
     AzureIOTClient(): context(NULL), hasError(false), displayCharPos(0),
-                    rootNode(NULL), lastNode(NULL), needsReconnect(false)
+                    usingCachedHub(false), methodHead(0), methodTail(0),
+                    lastMethodServed(0), needsReconnect(false), reconnectAt(0),
+                    reconnectDelay(0), connectedAt(0), connected(false)
     {
         init();
     }
@@ -60,65 +85,73 @@ public:
         ThreadAPI_Sleep(1 /* waitTime */);
     }
 
-    void pushDirectMethod(char *method, char *payload, size_t size) {
-        if (!rootNode) {
-            rootNode = new DirectMethodNode(method, payload, size);
-            lastNode = rootNode;
-        } else {
-            lastNode->next = new DirectMethodNode(method, payload, size);
-            lastNode = lastNode->next;
+    // Queues a copy of the method for the telemetry loop.
+    // returns 200, or the status the hub should answer with instead:
+    // 413 (payload too large), 429 (queue is full) or 503 (queue is full
+    // and nobody has served it for DIRECT_METHOD_STALL_MS)
+    int pushDirectMethod(const char *method, const char *payload, size_t size) {
+        if (size >= DIRECT_METHOD_PAYLOAD_SIZE || strlen(method) >= DIRECT_METHOD_NAME_SIZE) {
+            return 413;
         }
-    }
 
-    DirectMethodNode * popDirectMethod() {
-        if (!lastNode) {
-            return NULL;
+        if (methodHead - methodTail == DIRECT_METHOD_SLOTS) {
+            return millis() - lastMethodServed >= DIRECT_METHOD_STALL_MS ? 503 : 429;
         }
 
-        DirectMethodNode *tmp = rootNode;
-        if (lastNode == rootNode) {
-            rootNode = NULL;
-            lastNode = NULL;
-            return tmp;
+        if (methodHead == methodTail) {
+            lastMethodServed = millis(); // the stall is counted from here
         }
 
-        while(tmp->next != lastNode) {
-            tmp = tmp->next;
-            if (!tmp) {
-                LOG_ERROR("tmp shouldn't be NULL");
-                return NULL;
-            }
-        }
+        DirectMethod *slot = &methods[methodHead & (DIRECT_METHOD_SLOTS - 1)];
+        strcpy(slot->methodName, method);
+        memcpy(slot->payload, payload, size);
+        slot->payload[size] = 0;
+        slot->length = size;
+        methodHead++;
 
-        lastNode = tmp;
-        tmp = tmp->next;
-        lastNode->next = NULL;
+        return 200;
+    }
 
-        return tmp;
+    // The oldest queued method, NULL if there is none. The slot stays
+    // reserved until releaseDirectMethod, so the handler may yield to the
+    // hub (and more methods may arrive) while it runs.
+    DirectMethod * peekDirectMethod() {
+        if (methodHead == methodTail) {
+            return NULL;
+        }
+        return &methods[methodTail & (DIRECT_METHOD_SLOTS - 1)];
     }
 
-    void freeDirectMethod(DirectMethodNode *node) {
-        free(node->methodName);
-        free(node->payload);
-        memset(node, 0, sizeof(DirectMethodNode));
-        delete node;
+    void releaseDirectMethod() {
+        if (methodHead != methodTail) {
+            methodTail++;
+            lastMethodServed = millis();
+        }
     }
 
     bool wasInitialized() {
         return !hasError;
     }
 
+    // Opens the hub connection again once the scheduled reconnect is due.
+    // Call it from the loop (yield / send), never from an SDK callback: it
+    // frees the context the callback runs in
     void checkConnection() {
-        if (needsReconnect) {
-            // simple reconnection of the client in the event of a disconnect
+        if (needsReconnect && (int32_t)(millis() - reconnectAt) >= 0) {
             LOG_VERBOSE("Reconnecting to the IoT Hub");
+            needsReconnect = false;
             close();
             init();
-
-            needsReconnect = false;
         }
     }
 
+    // The connection is gone; checkConnection opens it again after a
+    // jittered backoff delay. Nothing changes while a reconnect is pending
+    void scheduleReconnect();
+
+    // ConnectionStatus reported IOTC_CONNECTION_OK
+    void onConnected();
+
     bool sendTelemetry(const char *payload);
     bool sendReportedProperty(const char *payload);
 
@@ -126,10 +159,13 @@ public:
 
     void displayDeviceInfo(); // TODO: should this go under device?
 
+    // The cached hub refused the device (i.e. it was moved to another hub).
+    // Provision again on the next reconnect
+    void dropCachedHub();
+
     // no reason for ordered map here yet toolchain has a messed up references to `ceil`.
     // which is required by unordered_map
     std::map<string, hubMethodCallback> methodCallbacks;
-    bool needsReconnect;
 };
 
 #endif /* AZURE_IOT_CLIENT_H */
\ No newline at end of file
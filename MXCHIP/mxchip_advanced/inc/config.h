@@ -23,6 +23,11 @@ public:
     static void readIotCentralConfig(char * iotCentralConfig, uint32_t buffer_size);
     static void readGroupSXKeyAndDeviceId(char * scopeId, char * registrationId, char * sas, char &atype);
 
+    // the hub DPS assigned the device to; kept for HUB_CACHE_TTL seconds
+    static void storeHubCache(const char* hostName);
+    static bool readHubCache(char* hostName, uint32_t buffer_size);
+    static void clearHubCache();
+
     static void clearWiFiEEPROM();
     static void clearAzureEEPROM();
     static void clearIotCentralEEPROM();
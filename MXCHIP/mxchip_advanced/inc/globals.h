@@ -33,6 +33,9 @@
 #define OLED_SINGLE_FRAME_BUFFER 576
 #define SAS_SCOPE_ID_ENDS 64
 #define SAS_REG_ID_ENDS 192
+// the hub DPS assigned the device to (AZ_IOT_HUB_ZONE_IDX, past the key)
+#define HUB_CACHE_STARTS 320
+#define HUB_CACHE_TTL (7 * 24 * 60 * 60) // seconds
 
 #define TELEMETRY_SEND_INTERVAL 5000
 #define TELEMETRY_REPORTED_SEND_INTERVAL 2000
@@ -44,14 +44,17 @@ void onCommand(IOTContext ctx, IOTCallbackInfo *callbackInfo) {
 
         auto it = client->methodCallbacks.find(methodName);
         if (it != client->methodCallbacks.end()) {
-            char *pcopy = (char*) malloc(callbackInfo->payloadLength + 1);
-            assert(pcopy);
-            memcpy(pcopy, (const char*)callbackInfo->payload, callbackInfo->payloadLength);
-            pcopy[callbackInfo->payloadLength] = 0;
-            char *mcopy = strdup(methodName.c_str());
-            assert(mcopy);
-
-            client->pushDirectMethod(mcopy, pcopy, callbackInfo->payloadLength);
+            int status = client->pushDirectMethod(methodName.c_str(),
+                (const char*)callbackInfo->payload, callbackInfo->payloadLength);
+            if (status != 200) {
+                LOG_ERROR("AzureIOTClient::onCommand (methodName:%s) is not queued, status:%d",
+                    methodName.c_str(), status);
+                StatsController::incrementErrorCount();
+                // the response is freed by the SDK
+                callbackInfo->callbackResponse = strdup(status == 413 ? "{\"error\":\"payload is too large\"}" :
+                    "{\"error\":\"device is busy, try again later\"}");
+                callbackInfo->statusCode = status;
+            }
         }
     }
 }
@@ -61,20 +64,28 @@ void onConnectionStatus(IOTContext ctx, IOTCallbackInfo *callbackInfo) {
     AzureIOTClient *client = (AzureIOTClient*) callbackInfo->appContext;
     assert(client != NULL);
 
-    if (callbackInfo->statusCode != IOTC_CONNECTION_OK) {
-        if (callbackInfo->statusCode == IOTC_CONNECTION_DEVICE_DISABLED) {
-            LOG_ERROR("Device was disabled.");
-        } else if (callbackInfo->statusCode == IOTC_CONNECTION_NO_NETWORK) {
-            LOG_ERROR("No network connection");
-            client->needsReconnect = true;
-        } else if (callbackInfo->statusCode != IOTC_CONNECTION_BAD_CREDENTIAL) {
-            LOG_ERROR("Connection timeout");
-            client->needsReconnect = true;
-        } else {
-            LOG_ERROR("Bad credentials");
-            client->needsReconnect = true;
-        }
-        client->checkConnection();
+    // this runs inside iotc_do_work; the reconnect waits for checkConnection
+    if (callbackInfo->statusCode == IOTC_CONNECTION_OK) {
+        client->onConnected();
+        return;
+    }
+
+    if (callbackInfo->statusCode == IOTC_CONNECTION_DEVICE_DISABLED ||
+        callbackInfo->statusCode == IOTC_CONNECTION_BAD_CREDENTIAL) {
+        client->dropCachedHub();
+    }
+
+    if (callbackInfo->statusCode == IOTC_CONNECTION_DEVICE_DISABLED) {
+        LOG_ERROR("Device was disabled.");
+    } else if (callbackInfo->statusCode == IOTC_CONNECTION_NO_NETWORK) {
+        LOG_ERROR("No network connection");
+        client->scheduleReconnect();
+    } else if (callbackInfo->statusCode != IOTC_CONNECTION_BAD_CREDENTIAL) {
+        LOG_ERROR("Connection timeout");
+        client->scheduleReconnect();
+    } else {
+        LOG_ERROR("Bad credentials");
+        client->scheduleReconnect();
     }
 }
 
@@ -117,6 +128,12 @@ void AzureIOTClient::init() {
     int errorCode = iotc_init_context(&context);
     assert(errorCode == 0);
 
+    iotc_on(context, "MessageSent", onMessageSent, this);
+    iotc_on(context, "Command", onCommand, this);
+    iotc_on(context, "ConnectionStatus", onConnectionStatus, this);
+    iotc_on(context, "SettingsUpdated", onSettingsUpdated, this);
+    iotc_on(context, "Error", onError, this);
+
     IOTConnectType connectType;
 
 #ifdef IOT_CENTRAL_CONNECTION_STRING
@@ -140,14 +157,32 @@ void AzureIOTClient::init() {
             abort(); // unlikely
     }
 #endif
-    errorCode = iotc_connect(context, scopeId, stringBuffer, registrationId, connectType);
-    assert(errorCode == 0);
-
-    iotc_on(context, "MessageSent", onMessageSent, this);
-    iotc_on(context, "Command", onCommand, this);
-    iotc_on(context, "ConnectionStatus", onConnectionStatus, this);
-    iotc_on(context, "SettingsUpdated", onSettingsUpdated, this);
-    iotc_on(context, "Error", onError, this);
+    char hubHostName[STRING_BUFFER_128] = {0};
+    usingCachedHub = connectType == IOTC_CONNECT_SYMM_KEY &&
+        ConfigController::readHubCache(hubHostName, STRING_BUFFER_128);
+    if (usingCachedHub) {
+        // DPS assigned this device before; connect straight to that hub
+        LOG_VERBOSE("- using the cached hub => %s", hubHostName);
+        char connectionString[AZ_IOT_HUB_MAX_LEN] = {0};
+        snprintf(connectionString, AZ_IOT_HUB_MAX_LEN, "HostName=%s;DeviceId=%s;SharedAccessKey=%s",
+            hubHostName, registrationId, stringBuffer);
+        errorCode = iotc_connect(context, scopeId, connectionString, registrationId,
+            IOTC_CONNECT_CONNECTION_STRING);
+    } else {
+        errorCode = iotc_connect(context, scopeId, stringBuffer, registrationId, connectType);
+        if (errorCode == 0 && connectType == IOTC_CONNECT_SYMM_KEY &&
+            iotc_get_hub_host_name(context, hubHostName, STRING_BUFFER_128) == 0) {
+            ConfigController::storeHubCache(hubHostName);
+        }
+    }
+    if (errorCode != 0) {
+        LOG_ERROR("AzureIOTClient::init iotc_connect has failed. Code %d", errorCode);
+        if (usingCachedHub) {
+            dropCachedHub(); // schedules the reconnect
+        } else {
+            scheduleReconnect();
+        }
+    }
 
     WatchdogController::reset();
     LOG_VERBOSE("AzureIOTClient::init END");
@@ -178,9 +213,51 @@ void AzureIOTClient::close()
     iotc_disconnect(context);
     iotc_free_context(context);
     context = NULL;
+    free(deviceId);
+    deviceId = NULL;
     LOG_ERROR("AzureIOTClient::close!");
 }
 
+void AzureIOTClient::scheduleReconnect() {
+    if (needsReconnect) return;
+
+    uint32_t now = millis();
+    if (reconnectDelay == 0) {
+        // devices that lost the hub at once don't come back in lockstep
+        unsigned seed = now;
+        for (const char *ch = deviceId; ch != NULL && *ch != 0; ch++) {
+            seed = seed * 31 + (unsigned char) *ch;
+        }
+        srand(seed);
+    }
+    if (reconnectDelay == 0 || (connected && now - connectedAt >= HUB_RECONNECT_STABLE_MS)) {
+        reconnectDelay = HUB_RECONNECT_BASE_MS;
+    }
+    connected = false;
+
+    // decorrelated jitter: [base, 3 * previous], capped
+    uint32_t upper = reconnectDelay * 3 < HUB_RECONNECT_CAP_MS ? reconnectDelay * 3 : HUB_RECONNECT_CAP_MS;
+    reconnectDelay = HUB_RECONNECT_BASE_MS + rand() % (upper - HUB_RECONNECT_BASE_MS + 1);
+
+    LOG_VERBOSE("AzureIOTClient::scheduleReconnect in %u ms", (unsigned) reconnectDelay);
+    reconnectAt = now + reconnectDelay;
+    needsReconnect = true;
+}
+
+void AzureIOTClient::onConnected() {
+    connected = true;
+    connectedAt = millis();
+}
+
+void AzureIOTClient::dropCachedHub() {
+    if (usingCachedHub) {
+        LOG_ERROR("The cached hub refused the device. Provisioning again.");
+        ConfigController::clearHubCache();
+        usingCachedHub = false;
+        scheduleReconnect();
+    }
+}
+
 void AzureIOTClient::displayDeviceInfo() {
     char buff[STRING_BUFFER_128] = {0};
 
@@ -3,6 +3,7 @@
 
 #include "../inc/globals.h"
 #include <EEPROMInterface.h>
+#include <time.h>
 #include "../inc/utility.h"
 #include "../inc/config.h"
 
@@ -127,6 +128,69 @@ void ConfigController::readGroupSXKeyAndDeviceId(char * scopeId, char * registra
     assert(atype == 'X' || atype == 'C' || atype == 'S');
 }
 
+// Next to the device credentials; storeKey and clearAzureEEPROM drop it too
+struct HubCache {
+    char magic[4]; // HUB_CACHE_MAGIC
+    uint32_t expiresAt;
+    char hostName[STRING_BUFFER_128];
+};
+#define HUB_CACHE_MAGIC "HUB1"
+static_assert(HUB_CACHE_STARTS + sizeof(HubCache) <= AZ_IOT_HUB_MAX_LEN - 4,
+    "HubCache overlaps the auth type at the end of the Azure zone");
+
+static void writeHubCache(const HubCache &cache) {
+    char buffer[AZ_IOT_HUB_MAX_LEN];
+    EEPROMInterface eeprom;
+    eeprom.read((uint8_t*) buffer, AZ_IOT_HUB_MAX_LEN, 0, AZ_IOT_HUB_ZONE_IDX);
+    memcpy(buffer + HUB_CACHE_STARTS, &cache, sizeof(HubCache));
+    eeprom.write((uint8_t*) buffer, AZ_IOT_HUB_MAX_LEN, AZ_IOT_HUB_ZONE_IDX);
+}
+
+void ConfigController::storeHubCache(const char* hostName) {
+    HubCache cache;
+    memset(&cache, 0, sizeof(HubCache));
+    if (strlen(hostName) >= sizeof(cache.hostName)) {
+        LOG_ERROR("ConfigController::storeHubCache hostName is too long");
+        return;
+    }
+
+    memcpy(cache.magic, HUB_CACHE_MAGIC, 4);
+    cache.expiresAt = (uint32_t) time(NULL) + HUB_CACHE_TTL;
+    strcpy(cache.hostName, hostName);
+    LOG_VERBOSE("STORE hub:%s", hostName);
+    writeHubCache(cache);
+}
+
+bool ConfigController::readHubCache(char* hostName, uint32_t buffer_size) {
+    char buffer[AZ_IOT_HUB_MAX_LEN];
+    EEPROMInterface eeprom;
+    eeprom.read((uint8_t*) buffer, AZ_IOT_HUB_MAX_LEN, 0, AZ_IOT_HUB_ZONE_IDX);
+
+    HubCache cache;
+    memcpy(&cache, buffer + HUB_CACHE_STARTS, sizeof(HubCache));
+    cache.hostName[sizeof(cache.hostName) - 1] = 0;
+
+    if (memcmp(cache.magic, HUB_CACHE_MAGIC, 4) != 0 || cache.hostName[0] == 0 ||
+        strlen(cache.hostName) >= buffer_size) {
+        return false;
+    }
+
+    if ((uint32_t) time(NULL) >= cache.expiresAt) {
+        LOG_VERBOSE("ConfigController::readHubCache hub cache has expired");
+        return false;
+    }
+
+    strcpy(hostName, cache.hostName);
+    return true;
+}
+
+void ConfigController::clearHubCache() {
+    LOG_VERBOSE("ConfigController::clearHubCache");
+    HubCache cache;
+    memset(&cache, 0, sizeof(HubCache));
+    writeHubCache(cache);
+}
+
 void ConfigController::readIotCentralConfig(char* iotCentralConfig, uint32_t buffer_size) {
     assert(iotCentralConfig != NULL);
     assert(buffer_size == IOT_CENTRAL_MAX_LEN);
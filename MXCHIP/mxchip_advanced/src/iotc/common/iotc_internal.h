@@ -41,6 +41,7 @@ typedef struct IOTContextInternal_TAG {
     AzureIOT::StringBuffer deviceId;
 #else // use azure iot client
     IOTHUB_CLIENT_LL_HANDLE clientHandle;
+    char *hubHostName; // assigned by DPS
 #endif // USE_LIGHT_CLIENT
 
 #ifdef USE_LIGHT_CLIENT
@@ -4,6 +4,8 @@
 #ifndef AZURE_IOT_COMMON_JSON_H
 #define AZURE_IOT_COMMON_JSON_H
 
+#include <stdlib.h>
+#include <string.h>
 #include "parson.h"
 #include "../iotc.h"
 
@@ -113,6 +115,235 @@ namespace AzureIOT
             return json_object_get_number(object, name);
         }
     };
+
+    // A view of one JSON value in the raw text. Nothing is parsed up front;
+    // a lookup scans only the text it needs and nothing is copied or
+    // allocated. Use it instead of JSObject when a few keys are needed (i.e.
+    // `value` and `$version` of a desired property).
+    //
+    // getNumberByName / getObjectByName behave like their JSObject versions.
+    // Names are compared to the raw (escaped) text. Not a validator; a
+    // malformed document makes the lookups fail, not crash.
+    class JSCursor
+    {
+    private:
+        const char* data;   // first character of the value
+        unsigned length;    // quotes and brackets included
+
+        static bool isWhitespace(char c) {
+            return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+        }
+
+        static const char* skipWhitespace(const char* p, const char* end) {
+            while (p < end && isWhitespace(*p)) p++;
+            return p;
+        }
+
+        // returns the end of the string at p, NULL if it isn't closed
+        static const char* skipString(const char* p, const char* end) {
+            for (p++; p < end; p++) {
+                if (*p == '\\') {
+                    p++;
+                } else if (*p == '"') {
+                    return p + 1;
+                }
+            }
+            return NULL;
+        }
+
+        // returns the end of the value at p, NULL if it's malformed
+        static const char* skipValue(const char* p, const char* end) {
+            if (p >= end) return NULL;
+
+            if (*p == '"') return skipString(p, end);
+
+            if (*p == '{' || *p == '[') {
+                unsigned depth = 0;
+                while (p < end) {
+                    char c = *p;
+                    if (c == '"') {
+                        p = skipString(p, end);
+                        if (p == NULL) return NULL;
+                        continue;
+                    }
+                    if (c == '{' || c == '[') {
+                        depth++;
+                    } else if (c == '}' || c == ']') {
+                        if (--depth == 0) return p + 1;
+                    }
+                    p++;
+                }
+                return NULL;
+            }
+
+            // number, true, false or null
+            const char* start = p;
+            while (p < end && *p != ',' && *p != '}' && *p != ']' && *p != 0 &&
+                   !isWhitespace(*p)) p++;
+            return p == start ? NULL : p;
+        }
+
+        void set(const char* start, const char* end) {
+            data = start;
+            length = (unsigned)(end - start);
+        }
+
+    public:
+        JSCursor(): data(NULL), length(0) { }
+
+        JSCursor(const char* json) : data(NULL), length(0) {
+            if (json != NULL) reset(json, (unsigned)strlen(json));
+        }
+
+        JSCursor(const char* json, unsigned jsonLength) : data(NULL), length(0) {
+            reset(json, jsonLength);
+        }
+
+        void reset(const char* json, unsigned jsonLength) {
+            data = NULL;
+            length = 0;
+            if (json == NULL) return;
+
+            const char* end = json + jsonLength;
+            const char* start = skipWhitespace(json, end);
+            const char* valueEnd = skipValue(start, end);
+            if (valueEnd != NULL) set(start, valueEnd);
+        }
+
+        bool isValid() const { return data != NULL; }
+        bool isObject() const { return data != NULL && *data == '{'; }
+        bool isString() const { return data != NULL && *data == '"'; }
+        bool isNumber() const {
+            return data != NULL && (*data == '-' || (*data >= '0' && *data <= '9'));
+        }
+
+        // the raw text of the value, not \0 terminated
+        const char* getData() const { return data; }
+        unsigned getLength() const { return length; }
+
+        // Walks the members of an object. Start with offset = 0.
+        // returns false after the last member
+        bool getNextMember(unsigned &offset, JSCursor* outName, JSCursor* outValue) const {
+            if (!isObject()) return false;
+
+            const char* end = data + length - 1; // '}'
+            const char* p = skipWhitespace(data + (offset ? offset : 1), end);
+            if (p >= end || *p != '"') return false;
+
+            const char* nameEnd = skipString(p, end);
+            if (nameEnd == NULL) return false;
+            const char* valueStart = skipWhitespace(nameEnd, end);
+            if (valueStart >= end || *valueStart != ':') return false;
+            valueStart = skipWhitespace(valueStart + 1, end);
+            const char* valueEnd = skipValue(valueStart, end);
+            if (valueEnd == NULL) return false;
+
+            if (outName) outName->set(p, nameEnd);
+            if (outValue) outValue->set(valueStart, valueEnd);
+
+            p = skipWhitespace(valueEnd, end);
+            if (p < end && *p == ',') p++;
+            offset = (unsigned)(p - data);
+            return true;
+        }
+
+        bool getMemberAt(unsigned index, JSCursor* outName, JSCursor* outValue) const {
+            unsigned offset = 0;
+            while (getNextMember(offset, outName, outValue)) {
+                if (index-- == 0) return true;
+            }
+            return false;
+        }
+
+        unsigned getCount() const {
+            unsigned count = 0, offset = 0;
+            while (getNextMember(offset, NULL, NULL)) count++;
+            return count;
+        }
+
+        // the value of the member `name` of this object
+        bool get(const char* name, JSCursor* outValue) const {
+            unsigned nameLength = (unsigned)strlen(name);
+            unsigned offset = 0;
+            JSCursor memberName, value;
+            while (getNextMember(offset, &memberName, &value)) {
+                if (memberName.length == nameLength + 2 &&
+                    memcmp(memberName.data + 1, name, nameLength) == 0) {
+                    *outValue = value;
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        // i.e. getPath("fanSpeed.value", &value)
+        bool getPath(const char* path, JSCursor* outValue) const {
+            char name[64];
+            JSCursor current = *this;
+            while (*path) {
+                const char* dot = strchr(path, '.');
+                unsigned nameLength = dot ? (unsigned)(dot - path) : (unsigned)strlen(path);
+                if (nameLength >= sizeof(name)) return false;
+                memcpy(name, path, nameLength);
+                name[nameLength] = 0;
+                if (!current.get(name, &current)) return false;
+                path += nameLength + (dot ? 1 : 0);
+            }
+            *outValue = current;
+            return true;
+        }
+
+        // 0 if it isn't a number
+        double toNumber() const {
+            if (!isNumber()) return 0;
+
+            char number[32]; // the text isn't \0 terminated
+            unsigned numberLength = length < sizeof(number) ? length : sizeof(number) - 1;
+            memcpy(number, data, numberLength);
+            number[numberLength] = 0;
+            return strtod(number, NULL);
+        }
+
+        // Unescaped contents of a string into buffer, \0 terminated and cut
+        // to bufferSize. returns the length written
+        unsigned copyString(char* buffer, unsigned bufferSize) const {
+            if (bufferSize == 0) return 0;
+            unsigned written = 0;
+            if (isString()) {
+                const char* end = data + length - 1;
+                for (const char* p = data + 1; p < end && written + 1 < bufferSize; p++) {
+                    char c = *p;
+                    if (c == '\\' && p + 1 < end) {
+                        c = *++p;
+                        switch (c) {
+                            case 'b': c = '\b'; break;
+                            case 'f': c = '\f'; break;
+                            case 'n': c = '\n'; break;
+                            case 'r': c = '\r'; break;
+                            case 't': c = '\t'; break;
+                            case 'u': c = '?'; p += (end - p > 4 ? 4 : end - p - 1); break;
+                            default: break; // \" \\ \/
+                        }
+                    }
+                    buffer[written++] = c;
+                }
+            }
+            buffer[written] = 0;
+            return written;
+        }
+
+        double getNumberByName(const char* name) const {
+            JSCursor value;
+            return get(name, &value) ? value.toNumber() : 0;
+        }
+
+        bool getObjectByName(const char* name, JSCursor* outJSCursor) const {
+            JSCursor value;
+            if (!get(name, &value) || !value.isObject()) return false;
+            *outJSCursor = value;
+            return true;
+        }
+    };
 } // namespace AzureIOT
 
 #endif // AZURE_IOT_COMMON_JSON_H
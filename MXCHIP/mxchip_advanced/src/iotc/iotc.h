@@ -92,6 +92,13 @@ int iotc_free_context(IOTContext ctx);
 int iotc_connect(IOTContext ctx, const char* scope, const char* keyORcert,
                                  const char* deviceId, IOTConnectType type);
 
+// Copies the host name of the hub DPS assigned the device to into buffer
+// (IOTC_CONNECT_SYMM_KEY and IOTC_CONNECT_X509_CERT). Keep it to connect
+// straight to that hub next time, with a connection string.
+// Call this after `connect`
+// returns 0 if there is no error. Otherwise, error code will be returned.
+int iotc_get_hub_host_name(IOTContext ctx, char* buffer, unsigned bufferSize);
+
 // Disconnect
 // returns 0 if there is no error. Otherwise, error code will be returned.
 int iotc_disconnect(IOTContext ctx);
@@ -136,7 +143,8 @@ int iotc_send_property (IOTContext ctx, const char* payload, unsigned length);
 eventName:
   ConnectionStatus
   MessageSent
-  Command
+  Command          (callbackResponse: a malloc'd JSON response, freed by the
+                    SDK. statusCode: the method status, 0 is 200)
   SettingsUpdated
   Error
 */
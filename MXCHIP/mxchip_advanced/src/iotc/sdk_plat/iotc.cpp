@@ -157,7 +157,8 @@ static int onCommand(const char* method_name, const unsigned char* payload,
             *resp_size = 2;
             // resp should be freed by SDK
         }
-        return 200;
+        // the callback may answer with its own status (i.e. 429 when it is busy)
+        return info.statusCode != 0 ? info.statusCode : 200;
     }
 
     return 500;
@@ -213,11 +214,9 @@ void sendOnError(IOTContextInternal *internal, const char* message) {
 
 void echoDesired(IOTContextInternal *internal, const char *propertyName,
   const char *message, const char *status, int statusCode) {
-    AzureIOT::JSObject rootObject(message);
-    AzureIOT::JSObject propertyNameObject, desiredObject, desiredObjectPropertyName;
-
-    const char* methodName = rootObject.getStringByName("methodName");
-    rootObject.getObjectByName(propertyName, &propertyNameObject);
+    // only `value` and `$version` are needed; no DOM
+    AzureIOT::JSCursor rootObject(message);
+    AzureIOT::JSCursor propertyNameObject, desiredObject, desiredObjectPropertyName;
 
     double value = 0, desiredVersion = 0;
     if (rootObject.getObjectByName("desired", &desiredObject) &&
@@ -226,7 +225,7 @@ void echoDesired(IOTContextInternal *internal, const char *propertyName,
         value = desiredObjectPropertyName.getNumberByName("value");
         desiredVersion = desiredObject.getNumberByName("$version");
     } else {
-        propertyName = rootObject.getNameAt(0);
+        rootObject.getObjectByName(propertyName, &propertyNameObject);
 
         value = propertyNameObject.getNumberByName("value");
         desiredVersion = rootObject.getNumberByName("$version");
@@ -347,6 +346,10 @@ int iotc_free_context(IOTContext ctx) {
         IoTHubClient_LL_Destroy(internal->clientHandle);
     }
 
+    if (internal->hubHostName != NULL) {
+        free(internal->hubHostName);
+    }
+
     free(internal);
 
     return 0;
@@ -474,6 +477,12 @@ int iotc_connect(IOTContext ctx, const char* scope, const char* keyORcert,
             goto fnc_exit;
         }
 
+        // iotc_get_hub_host_name
+        if (internal->hubHostName != NULL) {
+            free(internal->hubHostName);
+        }
+        internal->hubHostName = user_ctx.iothub_uri;
+
         if (type == IOTC_CONNECT_SYMM_KEY) {
             pos = snprintf(stringBuffer, AZ_IOT_HUB_MAX_LEN,
                 "HostName=%s;DeviceId=%s;SharedAccessKey=%s",
@@ -544,6 +553,28 @@ fnc_exit:
     return errorCode;
 }
 
+/* extern */
+int iotc_get_hub_host_name(IOTContext ctx, char* buffer, unsigned bufferSize) {
+    CHECK_NOT_NULL(ctx)
+    CHECK_NOT_NULL(buffer)
+
+    IOTContextInternal *internal = (IOTContextInternal*)ctx;
+    MUST_CALL_AFTER_CONNECT(internal);
+
+    if (internal->hubHostName == NULL) {
+        IOTC_LOG(F("ERROR: (iotc_get_hub_host_name) the hub wasn't assigned by DPS."));
+        return 1;
+    }
+
+    unsigned length = strlen(internal->hubHostName);
+    if (length >= bufferSize) {
+        IOTC_LOG(F("ERROR: (iotc_get_hub_host_name) buffer is too small."));
+        return 1;
+    }
+    memcpy(buffer, internal->hubHostName, length + 1);
+    return 0;
+}
+
 /* extern */
 int iotc_disconnect(IOTContext ctx) {
     CHECK_NOT_NULL(ctx)
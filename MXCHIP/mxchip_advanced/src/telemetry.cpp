@@ -155,7 +155,7 @@ void TelemetryController::loop() {
         lastTelemetrySend = millis();
     }
 
-    DirectMethodNode * task = iotClient->popDirectMethod();
+    DirectMethod * task = iotClient->peekDirectMethod();
     if (task) {
         string methodNameStr = task->methodName;
         auto it = iotClient->methodCallbacks.find(methodNameStr);
@@ -164,7 +164,7 @@ void TelemetryController::loop() {
         } else {
             LOG_ERROR("task method name wasn't registered: (%s)", task->methodName);
         }
-        iotClient->freeDirectMethod(task);
+        iotClient->releaseDirectMethod();
     }
 
 #ifndef DISABLE_SHAKE
@@ -224,14 +224,13 @@ void sendOnError(IOTContextInternal *internal, const char* message) {
 
 void echoDesired(IOTContextInternal *internal, const char *propertyName,
   AzureIOT::StringBuffer &message, const char *status, int statusCode) {
-    AzureIOT::JSObject rootObject(*message);
-    AzureIOT::JSObject propertyNameObject;
+    // only `value` and `$version` are needed; no DOM
+    AzureIOT::JSCursor rootObject(*message, message.getLength());
+    AzureIOT::JSCursor propertyNameObject;
 
     rootObject.getObjectByName(propertyName, &propertyNameObject);
 
     double value = 0, desiredVersion = 0;
-    propertyName = rootObject.getNameAt(0);
-
     value = propertyNameObject.getNumberByName("value");
     desiredVersion = rootObject.getNumberByName("$version");
 
@@ -280,12 +279,15 @@ static void deviceTwinGetStateCallback(DEVICE_TWIN_UPDATE_STATE update_state,
     IOTContextInternal *internal = (IOTContextInternal*)userContextCallback;
     assert(internal != NULL);
 
-    AzureIOT::JSObject desired(*payload);
+    AzureIOT::JSCursor desired(*payload, payload.getLength());
+    AzureIOT::JSCursor name;
 
-    for (unsigned i = 0, count = desired.getCount(); i < count; i++) {
-        const char * itemName = desired.getNameAt(i);
-        if (itemName != NULL && itemName[0] != '$') {
-            callDesiredCallback(internal, itemName, payload);
+    for (unsigned offset = 0; desired.getNextMember(offset, &name, NULL); ) {
+        // name.getLength() includes the quotes
+        if (name.getLength() > 2 && name.getData()[1] != '$') {
+            AzureIOT::StringBuffer itemName(name.getLength() - 1);
+            itemName.setLength(name.copyString(*itemName, name.getLength() - 1));
+            callDesiredCallback(internal, *itemName, payload);
         }
     }
 }
@@ -213,11 +213,9 @@ void sendOnError(IOTContextInternal *internal, const char* message) {
 
 void echoDesired(IOTContextInternal *internal, const char *propertyName,
   const char *message, const char *status, int statusCode) {
-    AzureIOT::JSObject rootObject(message);
-    AzureIOT::JSObject propertyNameObject, desiredObject, desiredObjectPropertyName;
-
-    const char* methodName = rootObject.getStringByName("methodName");
-    rootObject.getObjectByName(propertyName, &propertyNameObject);
+    // only `value` and `$version` are needed; no DOM
+    AzureIOT::JSCursor rootObject(message);
+    AzureIOT::JSCursor propertyNameObject, desiredObject, desiredObjectPropertyName;
 
     double value = 0, desiredVersion = 0;
     if (rootObject.getObjectByName("desired", &desiredObject) &&
@@ -226,7 +224,7 @@ void echoDesired(IOTContextInternal *internal, const char *propertyName,
         value = desiredObjectPropertyName.getNumberByName("value");
         desiredVersion = desiredObject.getNumberByName("$version");
     } else {
-        propertyName = rootObject.getNameAt(0);
+        rootObject.getObjectByName(propertyName, &propertyNameObject);
 
         value = propertyNameObject.getNumberByName("value");
         desiredVersion = rootObject.getNumberByName("$version");
@@ -0,0 +1,158 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <poll.h>
+
+#include "src/iotc/iotc.h"
+#include "src/iotc/common/string_buffer.h"
+#include "src/iotc/posix/posix_tls_client.h"
+#include "loopback_hub.h"
+
+// Real IoT Central credentials are taken from the environment
+// (IOTC_SCOPE_ID, IOTC_DEVICE_ID, IOTC_DEVICE_KEY). When they are missing,
+// the sample talks to the in-process loopback hub instead.
+static const char* loopbackDeviceKey = "MDEyMzQ1Njc4OTAxMjM0NTY3ODkwMTIzNDU2Nzg5MDE=";
+
+static IOTContext context = NULL;
+static bool isConnected = false;
+
+// Blocks until do_work has something to do (the hub sent data or a deadline
+// like the keep-alive ping is due), maxMs at most
+static void waitForWork(IOTContext ctx, unsigned long maxMs) {
+    unsigned long waitMs = 0;
+    if (iotc_get_wait_ms(ctx, &waitMs) != 0) return;
+    if (waitMs > maxMs) waitMs = maxMs;
+    if (waitMs == 0) return;
+
+    int socketFd = -1;
+    if (iotc_get_socket(ctx, &socketFd) != 0 || socketFd == -1) {
+        AzureIOT::TLSClient::waitMs(waitMs);
+        return;
+    }
+    struct pollfd pfd;
+    pfd.fd = socketFd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    poll(&pfd, 1, (int) waitMs);
+}
+
+void onEvent(IOTContext ctx, IOTCallbackInfo *callbackInfo) {
+    if (strcmp(callbackInfo->eventName, "ConnectionStatus") == 0) {
+        LOG_VERBOSE("Is connected ? %s (%d)", callbackInfo->statusCode == IOTC_CONNECTION_OK ? "YES" : "NO", callbackInfo->statusCode);
+        isConnected = callbackInfo->statusCode == IOTC_CONNECTION_OK;
+    }
+
+    AzureIOT::StringBuffer buffer;
+    if (callbackInfo->payloadLength > 0) {
+        buffer.initialize(callbackInfo->payload, callbackInfo->payloadLength);
+    }
+    LOG_VERBOSE("- [%s] event was received. Payload => %s", callbackInfo->eventName, buffer.getLength() ? *buffer : "EMPTY");
+
+    if (strcmp(callbackInfo->eventName, "Command") == 0 ||
+        strcmp(callbackInfo->eventName, "Topic") == 0) {
+        LOG_VERBOSE("- %s was => %s\r\n", callbackInfo->eventName, callbackInfo->tag);
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    const char* scopeId = getenv("IOTC_SCOPE_ID");
+    const char* deviceId = getenv("IOTC_DEVICE_ID");
+    const char* deviceKey = getenv("IOTC_DEVICE_KEY");
+    unsigned messageCount = argc > 1 ? (unsigned) atoi(argv[1]) : 10;
+
+    AzureIOT::LoopbackHub hub;
+    bool useLoopback = scopeId == NULL || deviceId == NULL || deviceKey == NULL;
+    if (useLoopback) {
+        if (hub.start() != 0) {
+            LOG_ERROR("Couldn't start the loopback hub");
+            return 1;
+        }
+        AzureIOT::TLSClient::setUseTLS(false);
+        scopeId = "0ne00000000";
+        deviceId = "posix-device";
+        deviceKey = loopbackDeviceKey;
+        LOG_VERBOSE("Using the loopback hub at %s", hub.getDPSEndpoint());
+    }
+
+    int errorCode = iotc_init_context(&context);
+    if (errorCode != 0) {
+        LOG_ERROR("Error initializing IOTC. Code %d", errorCode);
+        return 1;
+    }
+
+    iotc_set_logging(IOTC_LOGGING_API_ONLY);
+    if (useLoopback) {
+        iotc_set_global_endpoint(context, hub.getDPSEndpoint());
+    }
+
+    // for the simplicity of this sample, used same callback for all the events below
+    iotc_on(context, "MessageSent", onEvent, NULL);
+    iotc_on(context, "Command", onEvent, NULL);
+    iotc_on(context, "ConnectionStatus", onEvent, NULL);
+    iotc_on(context, "SettingsUpdated", onEvent, NULL);
+    iotc_on(context, "Error", onEvent, NULL);
+
+    // cloud to device messages
+    char c2dTopic[128];
+    snprintf(c2dTopic, sizeof(c2dTopic), "devices/%s/messages/devicebound/", deviceId);
+    iotc_on_topic(context, c2dTopic, onEvent, NULL);
+
+    errorCode = iotc_connect(context, scopeId, deviceKey, deviceId, IOTC_CONNECT_SYMM_KEY);
+    if (errorCode != 0) {
+        LOG_ERROR("Error @ iotc_connect. Code %d", errorCode);
+        iotc_free_context(context);
+        return 1;
+    }
+
+    if (useLoopback) {
+        hub.sendDesired("{\"fanSpeed\":{\"value\":42},\"$version\":2}");
+        hub.sendMethod("reboot", "{\"delay\":1}");
+        hub.sendCloudMessage(deviceId, "{\"text\":\"hello\"}");
+    }
+
+    for (unsigned loopId = 0; isConnected && loopId < messageCount; loopId++) {
+        char msg[64] = {0};
+        int pos = 0;
+
+        if (loopId % 2 == 0) { // send telemetry
+            pos = snprintf(msg, sizeof(msg) - 1, "{\"accelerometerX\": %d}", 10 + (rand() % 20));
+            errorCode = iotc_send_telemetry(context, msg, pos);
+        } else { // send property
+            pos = snprintf(msg, sizeof(msg) - 1, "{\"dieNumber\":%d}", 1 + (rand() % 5));
+            errorCode = iotc_send_property(context, msg, pos);
+        }
+
+        if (errorCode != 0) {
+            LOG_ERROR("Sending message has failed with error code %d", errorCode);
+        }
+
+        iotc_do_work(context); // do background work for iotc
+        if (!useLoopback) AzureIOT::TLSClient::waitMs(1000);
+    }
+
+    if (useLoopback) {
+        // twin GET + messages + echo for the desired patch + method response
+        unsigned long expected = 1 + messageCount + 2;
+        unsigned long start = AzureIOT::TLSClient::tickMs();
+        unsigned long elapsed = 0;
+        while (hub.getPublishCount() < expected && elapsed < 5000) {
+            iotc_do_work(context);
+            // woken by the hub's packets; the count is checked every 10 ms
+            waitForWork(context, 10);
+            elapsed = AzureIOT::TLSClient::tickMs() - start;
+        }
+        LOG_VERBOSE("Loopback hub received %lu messages (%lu bytes of payload)",
+            hub.getPublishCount(), hub.getPublishBytes());
+        errorCode = hub.getPublishCount() >= expected ? 0 : 1;
+    }
+
+    iotc_disconnect(context);
+    iotc_free_context(context);
+    hub.stop();
+
+    return errorCode;
+}
@@ -0,0 +1,89 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license.
+
+#include "alloc_counter.h"
+
+#include <malloc.h>
+#include <stdlib.h>
+
+extern "C" {
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t count, size_t size);
+void* __real_realloc(void* ptr, size_t size);
+void __real_free(void* ptr);
+}
+
+static thread_local bool trackThisThread = false;
+static unsigned long allocations = 0;
+static long currentBytes = 0;
+static long peakBytes = 0;
+
+static inline void onAlloc(void* ptr) {
+    if (!trackThisThread || ptr == NULL) return;
+    allocations++;
+    currentBytes += (long) malloc_usable_size(ptr);
+    if (currentBytes > peakBytes) peakBytes = currentBytes;
+}
+
+static inline void onFree(void* ptr) {
+    if (!trackThisThread || ptr == NULL) return;
+    currentBytes -= (long) malloc_usable_size(ptr);
+}
+
+extern "C" {
+
+void* __wrap_malloc(size_t size) {
+    void* ptr = __real_malloc(size);
+    onAlloc(ptr);
+    return ptr;
+}
+
+void* __wrap_calloc(size_t count, size_t size) {
+    void* ptr = __real_calloc(count, size);
+    onAlloc(ptr);
+    return ptr;
+}
+
+void* __wrap_realloc(void* ptr, size_t size) {
+    onFree(ptr);
+    void* result = __real_realloc(ptr, size);
+    onAlloc(result);
+    return result;
+}
+
+void __wrap_free(void* ptr) {
+    onFree(ptr);
+    __real_free(ptr);
+}
+
+} // extern "C"
+
+// route `new` through the wrapped malloc too
+void* operator new(size_t size) {
+    void* ptr = __wrap_malloc(size == 0 ? 1 : size);
+    if (ptr == NULL) abort();
+    return ptr;
+}
+
+void* operator new[](size_t size) {
+    return operator new(size);
+}
+
+void operator delete(void* ptr) noexcept { __wrap_free(ptr); }
+void operator delete[](void* ptr) noexcept { __wrap_free(ptr); }
+void operator delete(void* ptr, size_t) noexcept { __wrap_free(ptr); }
+void operator delete[](void* ptr, size_t) noexcept { __wrap_free(ptr); }
+
+namespace AzureIOT {
+
+void allocTrackThisThread(bool enabled) { trackThisThread = enabled; }
+unsigned long allocCount() { return allocations; }
+long allocCurrentBytes() { return currentBytes; }
+long allocPeakBytes() { return peakBytes; }
+
+long allocMarkPeak() {
+    peakBytes = currentBytes;
+    return currentBytes;
+}
+
+} // namespace AzureIOT
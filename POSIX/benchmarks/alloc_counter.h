@@ -0,0 +1,29 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license.
+
+#ifndef AZURE_IOTC_POSIX_ALLOC_COUNTER_H
+#define AZURE_IOTC_POSIX_ALLOC_COUNTER_H
+
+#include <stddef.h>
+
+// Heap accounting for the benchmarks. malloc/calloc/realloc/free are wrapped
+// at link time (-Wl,--wrap=...), so only allocations made by statically
+// linked code (the iotc library, parson, the benchmarks) are seen.
+// Only the calling thread is tracked, after allocTrackThisThread(true).
+namespace AzureIOT {
+
+void allocTrackThisThread(bool enabled);
+
+// number of allocations (malloc, calloc, realloc) since start
+unsigned long allocCount();
+
+// bytes currently allocated
+long allocCurrentBytes();
+
+// reset the high-water mark to the current usage and return it
+long allocMarkPeak();
+long allocPeakBytes();
+
+} // namespace AzureIOT
+
+#endif // AZURE_IOTC_POSIX_ALLOC_COUNTER_H
@@ -0,0 +1,376 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license.
+
+// Benchmarks for the iotc common layer. Covers the code that runs on every
+// reconnect (SAS tokens) and on every cloud-to-device message.
+//
+// Besides time per op, each benchmark reports
+//  - allocs/op : heap allocations per op
+//  - peak_heap : largest heap growth (bytes) seen within a single op
+
+#include <benchmark/benchmark.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "src/iotc/common/iotc_internal.h"
+#include "src/iotc/common/json.h"
+#include "src/iotc/common/string_buffer.h"
+#include "src/iotc/posix/posix_tls_client.h"
+#include "loopback_hub.h"
+#include "alloc_counter.h"
+
+void echoDesired(IOTContextInternal *internal, const char *propertyName,
+  AzureIOT::StringBuffer &message, const char *status, int statusCode);
+
+static const char* deviceKey = "MDEyMzQ1Njc4OTAxMjM0NTY3ODkwMTIzNDU2Nzg5MDE=";
+static const char* connectionString = "HostName=iotc-00000000-0000-0000-0000-000000000000.azure-devices.net;"
+    "DeviceId=bench-device;SharedAccessKey=MDEyMzQ1Njc4OTAxMjM0NTY3ODkwMTIzNDU2Nzg5MDE=";
+static const char* desiredPatch = "{\"fanSpeed\":{\"value\":42},\"$version\":7}";
+
+static IOTContext context = NULL;
+
+// measures heap use of the statement(s) in the benchmark loop. Only what
+// happens between begin() and end() is counted; the setup, the teardown and
+// the benchmark library's own bookkeeping are not.
+class AllocProbe {
+    benchmark::State &state;
+    unsigned long startCount;
+    unsigned long count;
+    long base;
+    long peak;
+public:
+    AllocProbe(benchmark::State &s): state(s), startCount(0), count(0), base(0), peak(0) { }
+
+    void begin() {
+        base = AzureIOT::allocMarkPeak();
+        startCount = AzureIOT::allocCount();
+    }
+    void end() {
+        count += AzureIOT::allocCount() - startCount;
+        long growth = AzureIOT::allocPeakBytes() - base;
+        if (growth > peak) peak = growth;
+    }
+
+    ~AllocProbe() {
+        state.counters["allocs/op"] = benchmark::Counter((double) count, benchmark::Counter::kAvgIterations);
+        state.counters["peak_heap"] = (double) peak;
+    }
+};
+
+#define MEASURE(state, ...) \
+    AllocProbe probe(state); \
+    for (auto _ : state) { \
+        probe.begin(); \
+        __VA_ARGS__; \
+        probe.end(); \
+    }
+
+// benchmarks taking a `pool` argument run with iotc_set_string_pool when it is 1
+class PoolSetup {
+    benchmark::State &state;
+    bool enabled;
+public:
+    PoolSetup(benchmark::State &s): state(s), enabled(s.range(0) != 0) {
+        static char poolMemory[STRING_BUFFER_4096];
+        if (enabled) iotc_set_string_pool(poolMemory, sizeof(poolMemory));
+    }
+
+    ~PoolSetup() {
+        if (!enabled) return;
+        IOTMemoryStats stats;
+        iotc_get_memory_stats(&stats);
+        state.counters["pool_hwm"] = (double) stats.highWaterMark;
+        state.counters["pool_misses"] = benchmark::Counter(
+            (double) stats.poolMisses, benchmark::Counter::kAvgIterations);
+        iotc_set_string_pool(NULL, 0);
+    }
+};
+
+static void onSettingsUpdated(IOTContext /* ctx */, IOTCallbackInfo* /* callbackInfo */) { }
+static void onCommand(IOTContext /* ctx */, IOTCallbackInfo* /* callbackInfo */) { }
+
+static void BM_getUsernameAndPasswordFromConnectionString(benchmark::State& state) {
+    PoolSetup pool(state);
+    size_t length = strlen(connectionString);
+    MEASURE(state, {
+        AzureIOT::StringBuffer hostName, deviceId, username, password;
+        int rc = getUsernameAndPasswordFromConnectionString(connectionString, length,
+            hostName, deviceId, username, password);
+        benchmark::DoNotOptimize(rc);
+    });
+}
+BENCHMARK(BM_getUsernameAndPasswordFromConnectionString)->ArgName("pool")->Arg(0)->Arg(1);
+
+static void BM_getDPSAuthString(benchmark::State& state) {
+    PoolSetup pool(state);
+    char buffer[STRING_BUFFER_256];
+    MEASURE(state, {
+        size_t length = 0;
+        int rc = getDPSAuthString("0ne00000000", "bench-device", deviceKey, buffer, STRING_BUFFER_256, length);
+        benchmark::DoNotOptimize(rc);
+        benchmark::DoNotOptimize(length);
+    });
+}
+BENCHMARK(BM_getDPSAuthString)->ArgName("pool")->Arg(0)->Arg(1);
+
+// token renewal: the key and resource URI were prepared by iotc_connect
+static void BM_getHubPassword(benchmark::State& state) {
+    IOTContextInternal *internal = (IOTContextInternal*)context;
+    char buffer[STRING_BUFFER_512];
+    MEASURE(state, {
+        int rc = getHubPassword(internal, buffer, STRING_BUFFER_512);
+        benchmark::DoNotOptimize(rc);
+    });
+}
+BENCHMARK(BM_getHubPassword);
+
+static void fillText(char* target, unsigned length) {
+    static const char* sample = "0ne00000000/registrations/bench device\n1234567890";
+    unsigned sampleLength = strlen(sample);
+    for (unsigned i = 0; i < length; i++) target[i] = sample[i % sampleLength];
+}
+
+static void BM_StringBuffer_urlEncode(benchmark::State& state) {
+    unsigned length = (unsigned) state.range(0);
+    char text[STRING_BUFFER_4096];
+    fillText(text, length);
+    MEASURE(state, {
+        AzureIOT::StringBuffer buffer(text, length);
+        bool ok = buffer.urlEncode();
+        benchmark::DoNotOptimize(ok);
+    });
+    state.SetBytesProcessed(state.iterations() * length);
+}
+BENCHMARK(BM_StringBuffer_urlEncode)->Arg(32)->Arg(128)->Arg(1024);
+
+static void BM_StringBuffer_base64Encode(benchmark::State& state) {
+    unsigned length = (unsigned) state.range(0);
+    char text[STRING_BUFFER_4096];
+    fillText(text, length);
+    MEASURE(state, {
+        AzureIOT::StringBuffer buffer(text, length);
+        bool ok = buffer.base64Encode();
+        benchmark::DoNotOptimize(ok);
+    });
+    state.SetBytesProcessed(state.iterations() * length);
+}
+BENCHMARK(BM_StringBuffer_base64Encode)->Arg(32)->Arg(128)->Arg(1024);
+
+// kernels writing into a caller buffer
+static void BM_urlEncodeTo(benchmark::State& state) {
+    unsigned length = (unsigned) state.range(0);
+    char text[STRING_BUFFER_4096];
+    char target[3 * STRING_BUFFER_4096];
+    fillText(text, length);
+    MEASURE(state, {
+        unsigned size = AzureIOT::urlEncodeTo(target, text, length);
+        benchmark::DoNotOptimize(size);
+    });
+    state.SetBytesProcessed(state.iterations() * length);
+}
+BENCHMARK(BM_urlEncodeTo)->Arg(32)->Arg(128)->Arg(1024);
+
+static void BM_base64DecodeTo(benchmark::State& state) {
+    unsigned length = (unsigned) state.range(0);
+    char text[STRING_BUFFER_4096];
+    char encoded[2 * STRING_BUFFER_4096];
+    unsigned char target[STRING_BUFFER_4096];
+    fillText(text, length);
+    unsigned encodedLength = AzureIOT::base64EncodeTo(encoded, (const unsigned char*) text, length);
+    MEASURE(state, {
+        unsigned size = 0;
+        bool ok = AzureIOT::base64DecodeTo(target, encoded, encodedLength, size);
+        benchmark::DoNotOptimize(ok);
+    });
+    state.SetBytesProcessed(state.iterations() * length);
+}
+BENCHMARK(BM_base64DecodeTo)->Arg(32)->Arg(128)->Arg(1024);
+
+static void BM_StringBuffer_hash(benchmark::State& state) {
+    unsigned length = (unsigned) state.range(0);
+    char text[STRING_BUFFER_4096];
+    fillText(text, length);
+    AzureIOT::StringBuffer key(deviceKey, strlen(deviceKey));
+    key.base64Decode();
+    MEASURE(state, {
+        AzureIOT::StringBuffer buffer(text, length);
+        bool ok = buffer.hash(*key, key.getLength());
+        benchmark::DoNotOptimize(ok);
+    });
+    state.SetBytesProcessed(state.iterations() * length);
+}
+BENCHMARK(BM_StringBuffer_hash)->Arg(32)->Arg(128)->Arg(1024);
+
+// streaming HMAC fed in 64 byte parts
+static void BM_HmacSha256(benchmark::State& state) {
+    unsigned length = (unsigned) state.range(0);
+    char text[STRING_BUFFER_4096];
+    fillText(text, length);
+    AzureIOT::StringBuffer key(deviceKey, strlen(deviceKey));
+    key.base64Decode();
+    unsigned char digest[HMAC_SHA256_LENGTH];
+    MEASURE(state, {
+        AzureIOT::HmacSha256 hmac;
+        hmac.init(*key, key.getLength());
+        for (unsigned pos = 0; pos < length; pos += 64) {
+            hmac.update(text + pos, iotc_min(64U, length - pos));
+        }
+        bool ok = hmac.final(digest);
+        benchmark::DoNotOptimize(ok);
+    });
+    state.SetBytesProcessed(state.iterations() * length);
+}
+BENCHMARK(BM_HmacSha256)->Arg(32)->Arg(128)->Arg(1024);
+
+static void onRoutedTopic(const char* /* topic */, unsigned /* topicLength */,
+    const AzureIOT::TopicFields &fields, char* /* payload */, unsigned long /* payloadLength */,
+    void* /* handlerContext */) {
+    benchmark::DoNotOptimize(fields.requestIdLength);
+}
+
+// routing only: three built-in like prefixes and a C2D one
+static void BM_TopicRouter_dispatch(benchmark::State& state) {
+    AzureIOT::TopicRouter router;
+    memset(&router, 0, sizeof(router));
+    router.add("$iothub/methods/POST/", onRoutedTopic, NULL);
+    router.add("$iothub/twin/PATCH/properties/desired/", onRoutedTopic, NULL);
+    router.add("$iothub/twin/res/", onRoutedTopic, NULL);
+    router.add("devices/bench-device/messages/devicebound/", onRoutedTopic, NULL);
+    char topic[] = "$iothub/twin/res/204/?$rid=17&$version=9";
+    MEASURE(state, {
+        bool routed = router.dispatch(topic, sizeof(topic) - 1, NULL, 0);
+        benchmark::DoNotOptimize(routed);
+    });
+}
+BENCHMARK(BM_TopicRouter_dispatch);
+
+static void BM_handlePayload_method(benchmark::State& state) {
+    PoolSetup pool(state);
+    char topic[] = "$iothub/methods/POST/reboot/?$rid=42";
+    char payload[] = "{\"delay\":1}";
+    MEASURE(state, {
+        handlePayload(payload, strlen(payload), topic, strlen(topic));
+    });
+}
+BENCHMARK(BM_handlePayload_method)->ArgName("pool")->Arg(0)->Arg(1);
+
+static void BM_handlePayload_twinPatch(benchmark::State& state) {
+    PoolSetup pool(state);
+    char topic[] = "$iothub/twin/PATCH/properties/desired/?$version=7";
+    char payload[STRING_BUFFER_128];
+    unsigned length = (unsigned) snprintf(payload, sizeof(payload), "%s", desiredPatch);
+    MEASURE(state, {
+        handlePayload(payload, length, topic, strlen(topic));
+    });
+}
+BENCHMARK(BM_handlePayload_twinPatch)->ArgName("pool")->Arg(0)->Arg(1);
+
+// what echoDesired reads from a patch: DOM (0) vs raw text cursor (1)
+static void BM_desiredLookup(benchmark::State& state) {
+    bool lazy = state.range(0) == 1;
+    MEASURE(state, {
+        double value = 0, version = 0;
+        if (lazy) {
+            AzureIOT::JSCursor root(desiredPatch), property;
+            root.getObjectByName("fanSpeed", &property);
+            value = property.getNumberByName("value");
+            version = root.getNumberByName("$version");
+        } else {
+            AzureIOT::JSObject root(desiredPatch), property;
+            root.getObjectByName("fanSpeed", &property);
+            value = property.getNumberByName("value");
+            version = root.getNumberByName("$version");
+        }
+        benchmark::DoNotOptimize(value + version);
+    });
+}
+BENCHMARK(BM_desiredLookup)->ArgName("cursor")->Arg(0)->Arg(1);
+
+static void BM_echoDesired(benchmark::State& state) {
+    IOTContextInternal *internal = (IOTContextInternal*) context;
+    MEASURE(state, {
+        AzureIOT::StringBuffer message(desiredPatch, strlen(desiredPatch));
+        echoDesired(internal, "fanSpeed", message, "completed", 200);
+    });
+}
+BENCHMARK(BM_echoDesired);
+
+static void BM_iotc_send_telemetry(benchmark::State& state) {
+    const char* telemetry = "{\"temperature\":21.5,\"humidity\":48}";
+    unsigned length = strlen(telemetry);
+    MEASURE(state, {
+        int rc = iotc_send_telemetry(context, telemetry, length);
+        benchmark::DoNotOptimize(rc);
+    });
+}
+BENCHMARK(BM_iotc_send_telemetry);
+
+// one publish per 64 samples
+static void BM_iotc_send_telemetry_batched(benchmark::State& state) {
+    const char* telemetry = "{\"temperature\":21.5,\"humidity\":48}";
+    unsigned length = strlen(telemetry);
+    iotc_set_telemetry_batching(context, 64, 4096, 0);
+    MEASURE(state, {
+        int rc = iotc_send_telemetry(context, telemetry, length);
+        benchmark::DoNotOptimize(rc);
+    });
+    iotc_set_telemetry_batching(context, 0, 0, 0);
+}
+BENCHMARK(BM_iotc_send_telemetry_batched);
+
+static void BM_iotc_send_property(benchmark::State& state) {
+    const char* property = "{\"dieNumber\":4}";
+    unsigned length = strlen(property);
+    MEASURE(state, {
+        int rc = iotc_send_property(context, property, length);
+        benchmark::DoNotOptimize(rc);
+    });
+}
+BENCHMARK(BM_iotc_send_property);
+
+// the same property again and again; merged, sent once batching is turned off
+static void BM_iotc_send_property_batched(benchmark::State& state) {
+    const char* property = "{\"dieNumber\":4}";
+    unsigned length = strlen(property);
+    iotc_set_property_batching(context, 60000, 512);
+    MEASURE(state, {
+        int rc = iotc_send_property(context, property, length);
+        benchmark::DoNotOptimize(rc);
+    });
+    iotc_set_property_batching(context, 0, 0);
+}
+BENCHMARK(BM_iotc_send_property_batched);
+
+int main(int argc, char** argv) {
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv)) return 1;
+
+    // handlePayload / echoDesired publish responses; keep a session with the loopback hub
+    AzureIOT::LoopbackHub hub;
+    if (hub.start() != 0) {
+        fprintf(stderr, "couldn't start the loopback hub\r\n");
+        return 1;
+    }
+    AzureIOT::TLSClient::setUseTLS(false);
+
+    iotc_set_logging(IOTC_LOGGING_DISABLED);
+    if (iotc_init_context(&context) != 0) return 1;
+    iotc_set_global_endpoint(context, hub.getDPSEndpoint());
+    iotc_on(context, "SettingsUpdated", onSettingsUpdated, NULL);
+    iotc_on(context, "Command", onCommand, NULL);
+
+    if (iotc_connect(context, "0ne00000000", deviceKey, "bench-device", IOTC_CONNECT_SYMM_KEY) != 0) {
+        fprintf(stderr, "couldn't connect to the loopback hub\r\n");
+        return 1;
+    }
+
+    AzureIOT::allocTrackThisThread(true);
+    benchmark::RunSpecifiedBenchmarks();
+    AzureIOT::allocTrackThisThread(false);
+
+    iotc_disconnect(context);
+    iotc_free_context(context);
+    hub.stop();
+    benchmark::Shutdown();
+    return 0;
+}
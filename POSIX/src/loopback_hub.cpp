@@ -0,0 +1,475 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license.
+
+#include "loopback_hub.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#define LOOPBACK_MAX_PACKET (64 * 1024)
+
+namespace AzureIOT {
+
+static int openListener(int &port) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd == -1) return -1;
+
+    int flag = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &flag, sizeof(flag));
+
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = 0;
+
+    socklen_t length = sizeof(address);
+    if (bind(fd, (struct sockaddr*)&address, sizeof(address)) != 0 ||
+        listen(fd, 4) != 0 ||
+        getsockname(fd, (struct sockaddr*)&address, &length) != 0) {
+        close(fd);
+        return -1;
+    }
+
+    port = ntohs(address.sin_port);
+    return fd;
+}
+
+// returns the accepted socket, or -1 once the listener is shut down
+static int acceptClient(int listener, volatile bool &running) {
+    while (running) {
+        struct pollfd pfd;
+        pfd.fd = listener;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        if (poll(&pfd, 1, 50) <= 0) continue;
+
+        int fd = accept(listener, NULL, NULL);
+        if (fd == -1) continue;
+
+        int flag = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+        return fd;
+    }
+    return -1;
+}
+
+// 0 on success, 1 when the peer is gone or the hub is stopping
+static int readFully(int fd, unsigned char* target, unsigned length, volatile bool &running) {
+    unsigned total = 0;
+    while (total < length) {
+        struct pollfd pfd;
+        pfd.fd = fd;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        int rc = poll(&pfd, 1, 50);
+        if (!running) return 1;
+        if (rc == 0 || (rc == -1 && errno == EINTR)) continue;
+        if (rc < 0) return 1;
+
+        ssize_t size = recv(fd, target + total, length - total, 0);
+        if (size <= 0) return 1;
+        total += (unsigned) size;
+    }
+    return 0;
+}
+
+static int writeFully(int fd, const unsigned char* source, unsigned length) {
+    unsigned total = 0;
+    while (total < length) {
+        ssize_t size = send(fd, source + total, length - total, MSG_NOSIGNAL);
+        if (size < 0) {
+            if (errno == EINTR) continue;
+            return 1;
+        }
+        total += (unsigned) size;
+    }
+    return 0;
+}
+
+LoopbackHub::LoopbackHub(): dpsListener(-1), mqttListener(-1), dpsPort(0), mqttPort(0),
+    sessionFd(-1), running(false), publishCount(0), publishBytes(0), twinVersion(1),
+    requestId(0), dpsAssigningPolls(0), dpsRetryAfter(0), dpsSessions(0), dpsRequests(0) {
+    dpsEndpoint[0] = 0;
+    pthread_mutex_init(&lock, NULL);
+    pthread_cond_init(&changed, NULL);
+}
+
+LoopbackHub::~LoopbackHub() {
+    stop();
+    pthread_cond_destroy(&changed);
+    pthread_mutex_destroy(&lock);
+}
+
+int LoopbackHub::start() {
+    if (running) return 0;
+
+    dpsListener = openListener(dpsPort);
+    mqttListener = openListener(mqttPort);
+    if (dpsListener == -1 || mqttListener == -1) {
+        stop();
+        return 1;
+    }
+    snprintf(dpsEndpoint, sizeof(dpsEndpoint), "127.0.0.1:%d", dpsPort);
+
+    running = true;
+    if (pthread_create(&dpsThread, NULL, dpsMain, this) != 0) {
+        running = false;
+        stop();
+        return 1;
+    }
+    if (pthread_create(&mqttThread, NULL, mqttMain, this) != 0) {
+        running = false;
+        pthread_join(dpsThread, NULL);
+        stop();
+        return 1;
+    }
+
+    return 0;
+}
+
+void LoopbackHub::stop() {
+    if (running) {
+        running = false;
+        pthread_join(dpsThread, NULL);
+        pthread_join(mqttThread, NULL);
+    }
+
+    if (dpsListener != -1) close(dpsListener);
+    if (mqttListener != -1) close(mqttListener);
+    dpsListener = mqttListener = -1;
+}
+
+void* LoopbackHub::dpsMain(void* self) {
+    LoopbackHub *hub = (LoopbackHub*) self;
+    int fd = -1;
+    while ((fd = acceptClient(hub->dpsListener, hub->running)) != -1) {
+        hub->serveDPS(fd);
+        close(fd);
+    }
+    return NULL;
+}
+
+void* LoopbackHub::mqttMain(void* self) {
+    LoopbackHub *hub = (LoopbackHub*) self;
+    int fd = -1;
+    while ((fd = acceptClient(hub->mqttListener, hub->running)) != -1) {
+        hub->serveMQTT(fd);
+    }
+    return NULL;
+}
+
+// 0 once a whole request (headers and `content-length` bytes of body) is in
+static int readRequest(int fd, char* request, unsigned size, volatile bool &running) {
+    unsigned length = 0;
+    const char* headerEnd = NULL;
+    while (headerEnd == NULL && length < size - 1) {
+        struct pollfd pfd;
+        pfd.fd = fd;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        int rc = poll(&pfd, 1, 50);
+        if (!running) return 1;
+        if (rc == 0 || (rc == -1 && errno == EINTR)) continue;
+        if (rc < 0) return 1;
+
+        ssize_t read = recv(fd, request + length, size - 1 - length, 0);
+        if (read <= 0) return 1;
+        length += (unsigned) read;
+        request[length] = 0;
+        headerEnd = strstr(request, "\r\n\r\n");
+    }
+    if (headerEnd == NULL) return 1;
+
+    const char* contentLength = strstr(request, "content-length: ");
+    unsigned bodyLength = contentLength ? (unsigned) atoi(contentLength + 16) : 0;
+    unsigned expected = (unsigned)(headerEnd + 4 - request) + bodyLength;
+    if (expected > length && expected < size &&
+        readFully(fd, (unsigned char*) request + length, expected - length, running) != 0) {
+        return 1;
+    }
+    return 0;
+}
+
+void LoopbackHub::serveDPS(int fd) {
+    pthread_mutex_lock(&lock);
+    dpsSessions++;
+    pthread_mutex_unlock(&lock);
+
+    char request[4096];
+    unsigned polls = 0;
+    while (readRequest(fd, request, sizeof(request), running) == 0) {
+        if (answerDPS(fd, request, polls) != 0) return;
+    }
+}
+
+// returns 0 if the session stays open for the next request
+int LoopbackHub::answerDPS(int fd, const char* request, unsigned &polls) {
+    pthread_mutex_lock(&lock);
+    dpsRequests++;
+    pthread_mutex_unlock(&lock);
+
+    bool keepAlive = strstr(request, "connection: keep-alive") != NULL;
+    bool assigning = strncmp(request, "PUT ", 4) == 0 ?
+        dpsAssigningPolls > 0 : polls++ < dpsAssigningPolls;
+
+    char body[256];
+    int bodySize = assigning ?
+        snprintf(body, sizeof(body), "{\"operationId\":\"4.loopback.0\",\"status\":\"assigning\"}") :
+        snprintf(body, sizeof(body),
+            "{\"operationId\":\"4.loopback.0\",\"status\":\"assigned\",\"registrationState\":"
+            "{\"assignedHub\":\"127.0.0.1:%d\",\"status\":\"assigned\"}}", mqttPort);
+
+    char retryAfter[32] = "";
+    if (assigning) {
+        snprintf(retryAfter, sizeof(retryAfter), "retry-after: %u\r\n", dpsRetryAfter);
+    }
+
+    char response[512];
+    int responseSize = snprintf(response, sizeof(response),
+        "HTTP/1.1 %s\r\ncontent-type: application/json; charset=utf-8\r\n"
+        "%scontent-length: %d\r\nconnection: %s\r\n\r\n%s",
+        assigning ? "202 Accepted" : "200 OK", retryAfter, bodySize,
+        keepAlive ? "keep-alive" : "close", body);
+    if (writeFully(fd, (const unsigned char*) response, (unsigned) responseSize) != 0) return 1;
+    return keepAlive ? 0 : 1;
+}
+
+int LoopbackHub::sendPacket(unsigned char header, const unsigned char* body, unsigned length) {
+    unsigned char fixed[5];
+    unsigned count = 0, remaining = length;
+    fixed[count++] = header;
+    do {
+        unsigned char digit = remaining % 128;
+        remaining /= 128;
+        if (remaining > 0) digit |= 0x80;
+        fixed[count++] = digit;
+    } while (remaining > 0 && count < 5);
+
+    pthread_mutex_lock(&lock);
+    int rc = 1;
+    if (sessionFd != -1) {
+        rc = writeFully(sessionFd, fixed, count);
+        if (rc == 0 && length) rc = writeFully(sessionFd, body, length);
+    }
+    pthread_mutex_unlock(&lock);
+    return rc;
+}
+
+int LoopbackHub::sendPublish(const char* topic, const char* payload, unsigned payloadLength) {
+    unsigned topicLength = strlen(topic);
+    unsigned length = 2 + topicLength + payloadLength;
+    unsigned char* body = (unsigned char*) malloc(length);
+    if (body == NULL) return 1;
+
+    body[0] = (unsigned char)(topicLength >> 8);
+    body[1] = (unsigned char)(topicLength & 0xFF);
+    memcpy(body + 2, topic, topicLength);
+    if (payloadLength) memcpy(body + 2 + topicLength, payload, payloadLength);
+
+    int rc = sendPacket(0x30, body, length);
+    free(body);
+    return rc;
+}
+
+void LoopbackHub::onPublish(const unsigned char* body, unsigned length, unsigned char header) {
+    if (length < 2) return;
+    unsigned topicLength = (body[0] << 8) | body[1];
+    if (2 + topicLength > length) return;
+
+    unsigned pos = 2 + topicLength;
+    if ((header & 0x06) != 0) {
+        if (pos + 2 > length) return;
+        unsigned char puback[2] = { body[pos], body[pos + 1] };
+        sendPacket(0x40, puback, 2);
+        pos += 2;
+    }
+
+    char topic[256];
+    unsigned copy = topicLength < sizeof(topic) - 1 ? topicLength : (unsigned) sizeof(topic) - 1;
+    memcpy(topic, body + 2, copy);
+    topic[copy] = 0;
+
+    pthread_mutex_lock(&lock);
+    unsigned long version = (strncmp(topic, "$iothub/twin/PATCH/", 19) == 0) ? ++twinVersion : twinVersion;
+    pthread_mutex_unlock(&lock);
+
+    const char* rid = strstr(topic, "$rid=");
+    char responseTopic[128];
+    if (strncmp(topic, "$iothub/twin/GET/", 17) == 0 && rid != NULL) {
+        char twin[128];
+        snprintf(twin, sizeof(twin), "{\"desired\":{\"$version\":%lu},\"reported\":{\"$version\":%lu}}",
+            version, version);
+        snprintf(responseTopic, sizeof(responseTopic), "$iothub/twin/res/200/?%s", rid);
+        sendPublish(responseTopic, twin, strlen(twin));
+    } else if (strncmp(topic, "$iothub/twin/PATCH/properties/reported/", 39) == 0 && rid != NULL) {
+        snprintf(responseTopic, sizeof(responseTopic), "$iothub/twin/res/204/?%s&$version=%lu",
+            rid, version);
+        sendPublish(responseTopic, NULL, 0);
+    }
+
+    pthread_mutex_lock(&lock);
+    publishCount++;
+    publishBytes += length - pos;
+    pthread_cond_broadcast(&changed);
+    pthread_mutex_unlock(&lock);
+}
+
+void LoopbackHub::serveMQTT(int fd) {
+    pthread_mutex_lock(&lock);
+    sessionFd = fd;
+    pthread_mutex_unlock(&lock);
+
+    unsigned char* body = (unsigned char*) malloc(LOOPBACK_MAX_PACKET);
+    while (body != NULL && running) {
+        unsigned char header = 0, digit = 0;
+        if (readFully(fd, &header, 1, running)) break;
+
+        unsigned length = 0, multiplier = 1;
+        int count = 0;
+        do {
+            if (++count > 4 || readFully(fd, &digit, 1, running)) goto session_end;
+            length += (digit & 127) * multiplier;
+            multiplier *= 128;
+        } while (digit & 128);
+
+        if (length > LOOPBACK_MAX_PACKET || readFully(fd, body, length, running)) break;
+
+        switch (header & 0xF0) {
+            case 0x10: { // CONNECT
+                static const unsigned char connack[2] = {0, 0};
+                sendPacket(0x20, connack, 2);
+                break;
+            }
+            case 0x30: // PUBLISH
+                onPublish(body, length, header);
+                break;
+            case 0x80: { // SUBSCRIBE
+                unsigned char suback[3] = { body[0], body[1], 0 };
+                sendPacket(0x90, suback, 3);
+                break;
+            }
+            case 0xC0: // PINGREQ
+                sendPacket(0xD0, NULL, 0);
+                break;
+            case 0xE0: // DISCONNECT
+                goto session_end;
+            default:
+                break;
+        }
+    }
+
+session_end:
+    free(body);
+    pthread_mutex_lock(&lock);
+    sessionFd = -1;
+    pthread_cond_broadcast(&changed);
+    pthread_mutex_unlock(&lock);
+    close(fd);
+}
+
+bool LoopbackHub::hasSession() {
+    pthread_mutex_lock(&lock);
+    bool result = sessionFd != -1;
+    pthread_mutex_unlock(&lock);
+    return result;
+}
+
+void LoopbackHub::dropSession() {
+    pthread_mutex_lock(&lock);
+    if (sessionFd != -1) {
+        shutdown(sessionFd, SHUT_RDWR); // serveMQTT closes it
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+void LoopbackHub::setDPSAssigning(unsigned polls, unsigned retryAfterSeconds) {
+    pthread_mutex_lock(&lock);
+    dpsAssigningPolls = polls;
+    dpsRetryAfter = retryAfterSeconds;
+    pthread_mutex_unlock(&lock);
+}
+
+unsigned long LoopbackHub::getDPSSessionCount() {
+    pthread_mutex_lock(&lock);
+    unsigned long result = dpsSessions;
+    pthread_mutex_unlock(&lock);
+    return result;
+}
+
+unsigned long LoopbackHub::getDPSRequestCount() {
+    pthread_mutex_lock(&lock);
+    unsigned long result = dpsRequests;
+    pthread_mutex_unlock(&lock);
+    return result;
+}
+
+unsigned long LoopbackHub::getPublishCount() {
+    pthread_mutex_lock(&lock);
+    unsigned long result = publishCount;
+    pthread_mutex_unlock(&lock);
+    return result;
+}
+
+unsigned long LoopbackHub::getPublishBytes() {
+    pthread_mutex_lock(&lock);
+    unsigned long result = publishBytes;
+    pthread_mutex_unlock(&lock);
+    return result;
+}
+
+int LoopbackHub::waitForPublishes(unsigned long count, int timeoutMs) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += timeoutMs / 1000;
+    deadline.tv_nsec += (timeoutMs % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+
+    pthread_mutex_lock(&lock);
+    int rc = 0;
+    while (publishCount < count && rc == 0) {
+        rc = pthread_cond_timedwait(&changed, &lock, &deadline);
+    }
+    bool done = publishCount >= count;
+    pthread_mutex_unlock(&lock);
+    return done ? 0 : 1;
+}
+
+int LoopbackHub::sendDesired(const char* json) {
+    char topic[96];
+    pthread_mutex_lock(&lock);
+    unsigned long version = ++twinVersion;
+    pthread_mutex_unlock(&lock);
+    snprintf(topic, sizeof(topic), "$iothub/twin/PATCH/properties/desired/?$version=%lu", version);
+    return sendPublish(topic, json, strlen(json));
+}
+
+int LoopbackHub::sendMethod(const char* methodName, const char* json) {
+    char topic[192];
+    pthread_mutex_lock(&lock);
+    unsigned id = ++requestId;
+    pthread_mutex_unlock(&lock);
+    snprintf(topic, sizeof(topic), "$iothub/methods/POST/%s/?$rid=%u", methodName, id);
+    return sendPublish(topic, json, strlen(json));
+}
+
+int LoopbackHub::sendCloudMessage(const char* deviceId, const char* json) {
+    char topic[192];
+    snprintf(topic, sizeof(topic), "devices/%s/messages/devicebound/%%24.to=%%2Fdevices%%2F%s%%2Fmessages%%2FdeviceBound",
+        deviceId, deviceId);
+    return sendPublish(topic, json, strlen(json));
+}
+
+} // namespace AzureIOT
@@ -0,0 +1,89 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license.
+
+#ifndef AZURE_IOTC_POSIX_LOOPBACK_HUB_H
+#define AZURE_IOTC_POSIX_LOOPBACK_HUB_H
+
+#include <pthread.h>
+
+namespace AzureIOT {
+
+// In-process stand-in for DPS and IoT Hub. Listens on 127.0.0.1 (plain TCP)
+// on two ephemeral ports:
+//  - DPS: answers registration PUT/GET with `assigned` and points the device
+//    to the MQTT port below (optionally after a few `assigning` polls).
+//    Keeps the session open when the device asks for `keep-alive`.
+//  - MQTT: accepts one device session at a time. CONNACK, SUBACK, PINGRESP,
+//    twin GET / reported PATCH responses. Every inbound PUBLISH is counted.
+//
+// Good enough to drive iotc_connect / iotc_send_* / handlePayload on a host
+// without network access. It is not an MQTT broker.
+class LoopbackHub {
+    int dpsListener;
+    int mqttListener;
+    int dpsPort;
+    int mqttPort;
+    int sessionFd;
+    volatile bool running;
+
+    pthread_t dpsThread;
+    pthread_t mqttThread;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+
+    unsigned long publishCount;
+    unsigned long publishBytes;
+    unsigned long twinVersion;
+    unsigned requestId;
+    unsigned dpsAssigningPolls;
+    unsigned dpsRetryAfter;
+    unsigned long dpsSessions;
+    unsigned long dpsRequests;
+
+    char dpsEndpoint[32];
+
+    static void* dpsMain(void* self);
+    static void* mqttMain(void* self);
+    void serveDPS(int fd);
+    int answerDPS(int fd, const char* request, unsigned &polls);
+    void serveMQTT(int fd);
+    int sendPacket(unsigned char header, const unsigned char* body, unsigned length);
+    int sendPublish(const char* topic, const char* payload, unsigned payloadLength);
+    void onPublish(const unsigned char* body, unsigned length, unsigned char header);
+
+public:
+    LoopbackHub();
+    ~LoopbackHub();
+
+    // returns 0 if there is no error
+    int start();
+    void stop();
+
+    // pass this as the DPS endpoint (iotc_set_global_endpoint)
+    const char* getDPSEndpoint() { return dpsEndpoint; }
+    int getMQTTPort() { return mqttPort; }
+    bool hasSession();
+    // closes the device session, as if the network went away
+    void dropSession();
+
+    // The operation stays `assigning` (with `retry-after: retryAfterSeconds`)
+    // for the first `polls` status GETs of a session. Call before connecting
+    void setDPSAssigning(unsigned polls, unsigned retryAfterSeconds);
+    unsigned long getDPSSessionCount();
+    unsigned long getDPSRequestCount();
+
+    unsigned long getPublishCount();
+    unsigned long getPublishBytes();
+    // blocks until `count` PUBLISH packets were received in total.
+    // returns 0 if they arrived within `timeoutMs`
+    int waitForPublishes(unsigned long count, int timeoutMs);
+
+    // server -> device. returns 0 if there is no error
+    int sendDesired(const char* json);
+    int sendMethod(const char* methodName, const char* json);
+    int sendCloudMessage(const char* deviceId, const char* json);
+};
+
+} // namespace AzureIOT
+
+#endif // AZURE_IOTC_POSIX_LOOPBACK_HUB_H
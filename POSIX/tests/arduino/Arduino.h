@@ -0,0 +1,32 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license.
+
+// Just enough of the Arduino core to build ESP8266/src/iotc/arduino/PubSubClient
+// on a host (see pubsub_client_test). Time only moves when delay() is called.
+
+#ifndef AZURE_IOTC_POSIX_TEST_ARDUINO_H
+#define AZURE_IOTC_POSIX_TEST_ARDUINO_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef bool boolean;
+typedef uint8_t byte;
+
+#define F(x) x
+
+extern unsigned long testMillis;
+inline unsigned long millis() { return testMillis; }
+inline void delay(unsigned long ms) { testMillis += ms; }
+inline void yield() { testMillis++; }
+
+class Print {
+public:
+    virtual size_t write(uint8_t b) = 0;
+    virtual size_t write(const uint8_t* buffer, size_t size) = 0;
+    virtual ~Print() {}
+};
+
+#endif // AZURE_IOTC_POSIX_TEST_ARDUINO_H
@@ -0,0 +1,13 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license.
+
+#ifndef AZURE_IOTC_POSIX_TEST_IPADDRESS_H
+#define AZURE_IOTC_POSIX_TEST_IPADDRESS_H
+
+class IPAddress {
+public:
+    IPAddress() {}
+    IPAddress(uint8_t, uint8_t, uint8_t, uint8_t) {}
+};
+
+#endif // AZURE_IOTC_POSIX_TEST_IPADDRESS_H
@@ -0,0 +1,11 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license.
+
+#ifndef AZURE_IOTC_POSIX_TEST_STREAM_H
+#define AZURE_IOTC_POSIX_TEST_STREAM_H
+
+#include "Arduino.h"
+
+class Stream : public Print {};
+
+#endif // AZURE_IOTC_POSIX_TEST_STREAM_H
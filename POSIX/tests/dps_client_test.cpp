@@ -0,0 +1,166 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license.
+
+// DPSClient against the loopback hub's provisioning endpoint, one step at a
+// time (keep-alive polls, Retry-After, the poll limit, an endpoint that isn't
+// there), then iotc_connect_async driven by do_work and the ConnectionTiming
+// it reports.
+
+#include <stdio.h>
+#include <string.h>
+
+#include "src/iotc/common/iotc_internal.h"
+#include "loopback_device.h"
+
+using namespace AzureIOT;
+
+// steps with the real clock until the client is done, failed or waits
+static DPSState stepUntilSettled(DPSClient &dps, unsigned long timeoutMs) {
+    unsigned long start = TLSClient::tickMs();
+    DPSState state = dps.getState();
+    while (state != DPS_DONE && state != DPS_FAILED && state != DPS_WAIT &&
+        TLSClient::tickMs() - start < timeoutMs) {
+        state = dps.step(TLSClient::tickMs(), 0);
+        if (state == DPS_READ) TLSClient::waitMs(1);
+    }
+    return state;
+}
+
+static DPSState provision(DPSClient &dps, unsigned long timeoutMs) {
+    unsigned long start = TLSClient::tickMs();
+    DPSState state = dps.getState();
+    while (state != DPS_DONE && state != DPS_FAILED && TLSClient::tickMs() - start < timeoutMs) {
+        state = stepUntilSettled(dps, timeoutMs);
+        if (state == DPS_WAIT) state = dps.step(TLSClient::tickMs(), 0);
+    }
+    return state;
+}
+
+static void testPolls(LoopbackHub &hub) {
+    DPSClient dps;
+    memset(&dps, 0, sizeof(dps)); // as in IOTContextInternal
+    CHECK(dps.getState() == DPS_IDLE && !dps.isBusy());
+
+    // two polls answered `assigning`; one session for the PUT and all three GETs
+    hub.setDPSAssigning(2, 0);
+    unsigned long sessions = hub.getDPSSessionCount();
+    unsigned long requests = hub.getDPSRequestCount();
+    CHECK(dps.begin(hub.getDPSEndpoint(), "0ne00000000", "dps-device", deviceKey) == 0);
+    CHECK(dps.getState() == DPS_CONNECT && dps.isBusy());
+
+    ConnectTiming timing;
+    CHECK(!dps.takeTiming(timing));
+    CHECK(dps.step(TLSClient::tickMs(), 0) == DPS_SEND);
+    CHECK(dps.takeTiming(timing) && timing.phased);
+    CHECK(!dps.takeTiming(timing));
+    CHECK(dps.step(TLSClient::tickMs(), 0) == DPS_READ);
+
+    CHECK(provision(dps, 5000) == DPS_DONE);
+    CHECK(dps.getStatusCode() == 200);
+    CHECK(strncmp(*dps.getHostName(), "127.0.0.1:", 10) == 0);
+    CHECK(strcmp(*dps.getDeviceId(), "dps-device") == 0);
+    CHECK(hub.getDPSRequestCount() - requests == 4);
+    CHECK(hub.getDPSSessionCount() - sessions == 1);
+    dps.clear();
+    CHECK(dps.getState() == DPS_IDLE && dps.getStatusCode() == 200);
+}
+
+static void testRetryAfter(LoopbackHub &hub) {
+    DPSClient dps;
+    memset(&dps, 0, sizeof(dps));
+
+    hub.setDPSAssigning(1, 2);
+    CHECK(dps.begin(hub.getDPSEndpoint(), "0ne00000000", "dps-device", deviceKey) == 0);
+    CHECK(stepUntilSettled(dps, 5000) == DPS_WAIT);
+    CHECK(dps.getStatusCode() == 202);
+
+    // the clock is ours while it waits
+    unsigned long now = TLSClient::tickMs();
+    unsigned long waitMs = dps.getWaitMs(now);
+    CHECK(waitMs > 1000 && waitMs <= 2000);
+    CHECK(dps.step(now + waitMs - 1, 0) == DPS_WAIT);
+    CHECK(dps.getWaitMs(now + waitMs - 1) == 1);
+    CHECK(dps.step(now + waitMs, 0) == DPS_SEND);
+    CHECK(dps.getWaitMs(now + waitMs) == 0);
+
+    CHECK(provision(dps, 5000) == DPS_DONE);
+}
+
+static void testPollLimit(LoopbackHub &hub) {
+    DPSClient dps;
+    memset(&dps, 0, sizeof(dps));
+
+    hub.setDPSAssigning(DPS_MAX_POLLS + 5, 0);
+    unsigned long requests = hub.getDPSRequestCount();
+    CHECK(dps.begin(hub.getDPSEndpoint(), "0ne00000000", "dps-device", deviceKey) == 0);
+    CHECK(provision(dps, 5000) == DPS_FAILED);
+    CHECK(!dps.isBusy());
+    // the PUT and DPS_MAX_POLLS GETs
+    CHECK(hub.getDPSRequestCount() - requests == DPS_MAX_POLLS + 1);
+}
+
+static void testUnreachable() {
+    DPSClient dps;
+    memset(&dps, 0, sizeof(dps));
+
+    CHECK(dps.begin("127.0.0.1:1", "0ne00000000", "dps-device", deviceKey) == 0);
+    CHECK(dps.step(TLSClient::tickMs(), 0) == DPS_FAILED);
+    CHECK(!dps.isBusy() && dps.getStatusCode() == 0);
+}
+
+static unsigned timings = 0;
+static bool dpsTimingPhased = false;
+static bool hubTimingHasConnack = false;
+
+static void onTiming(IOTContext ctx, IOTCallbackInfo *info) {
+    (void) ctx;
+    timings++;
+    if (strcmp(info->tag, "dps") == 0) {
+        dpsTimingPhased = strstr(info->payload, "\"dns\":") != NULL &&
+            strstr(info->payload, "\"tcp\":") != NULL &&
+            strstr(info->payload, "\"tls\":") != NULL &&
+            strstr(info->payload, "\"connack\":") == NULL;
+    } else {
+        hubTimingHasConnack = strstr(info->payload, "\"connack\":") != NULL;
+    }
+}
+
+static void testConnectAsync(LoopbackDevice &device) {
+    IOTContext ctx = device.ctx;
+    iotc_on(ctx, "ConnectionTiming", onTiming, NULL);
+
+    device.hub.setDPSAssigning(1, 1);
+    CHECK(iotc_connect_async(ctx, "0ne00000000", deviceKey, "async-device", IOTC_CONNECT_SYMM_KEY) == 0);
+    CHECK(events.connects == 0);
+
+    // do_work never blocks on the Retry-After; get_wait_ms says how long
+    bool waited = false;
+    unsigned long start = TLSClient::tickMs();
+    while (events.connects == 0 && events.disconnects == 0 && TLSClient::tickMs() - start < 5000) {
+        unsigned long before = TLSClient::tickMs();
+        iotc_do_work(ctx);
+        CHECK(TLSClient::tickMs() - before < 500);
+
+        unsigned long waitMs = 0;
+        CHECK(iotc_get_wait_ms(ctx, &waitMs) == 0);
+        if (waitMs > 500) waited = true;
+        TLSClient::waitMs(waitMs < 5 ? waitMs : 5);
+    }
+    CHECK(waited);
+    CHECK(events.connects == 1 && events.disconnects == 0);
+    CHECK(timings == 2 && dpsTimingPhased && hubTimingHasConnack);
+}
+
+int main() {
+    iotc_set_logging(IOTC_LOGGING_DISABLED);
+
+    LoopbackDevice device;
+    CHECK(device.start() == 0);
+    testPolls(device.hub);
+    testRetryAfter(device.hub);
+    testPollLimit(device.hub);
+    testUnreachable();
+    testConnectAsync(device);
+    device.stop();
+    return TEST_RESULT();
+}
@@ -0,0 +1,203 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license.
+
+// Differential fuzz test for the url / base64 kernels (common/encoding.cpp).
+// Random inputs are run through the kernels and through the implementations
+// they replaced; outputs have to match byte for byte.
+//
+//   encoding_fuzz_test [iterations] [seed]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "src/iotc/common/base64.h"
+#include "src/iotc/common/encoding.h"
+
+using namespace AzureIOT;
+
+#define MAX_INPUT 300
+
+static unsigned long long rngState = 0;
+
+static unsigned nextRandom() {
+    // xorshift64*
+    rngState ^= rngState >> 12;
+    rngState ^= rngState << 25;
+    rngState ^= rngState >> 27;
+    return (unsigned)((rngState * 2685821657736338717ULL) >> 32);
+}
+
+// former StringBuffer::urlEncode
+static unsigned legacyUrlEncode(char* target, const char* data, unsigned length) {
+    static const char* hex = "0123456789ABCDEF";
+    char *tmp = target;
+    for (unsigned i = 0; i < length; i++) {
+        char ch = data[i];
+        if (isalnum((unsigned char) ch) ||
+            ch == '_' || ch == '-' || ch == '~' || ch == '.') {
+            *tmp = ch;
+        } else if (ch == ' ') {
+            *tmp = '+';
+        } else {
+            *tmp++ = '%';
+            *tmp++ = hex[(ch >> 4) & 15];
+            *tmp   = hex[ch & 15];
+        }
+        tmp++;
+    }
+    return (unsigned)(tmp - target);
+}
+
+// former StringBuffer::urlDecode (valid escapes only; it asserted on the rest)
+static unsigned legacyUrlDecode(char* data, unsigned length) {
+    char *tmp = data;
+    for (unsigned i = 0; i < length; i++) {
+        char ch = data[i];
+        if (ch == '%') {
+            if (i + 2 < length) {
+                char hi = data[i + 1], lo = data[i + 2];
+                hi = hi <= '9' ? hi - '0' : (hi <= 'Z' ? hi - 'A' : hi - 'a') + 10;
+                lo = lo <= '9' ? lo - '0' : (lo <= 'Z' ? lo - 'A' : lo - 'a') + 10;
+                *tmp = hi << 4 | lo;
+                i += 2;
+            }
+        } else if (ch == '+') {
+            *tmp = ' ';
+        } else {
+            *tmp = ch;
+        }
+        tmp++;
+    }
+    return (unsigned)(tmp - data);
+}
+
+static int failures = 0;
+
+static void check(bool ok, const char* what, unsigned iteration) {
+    if (!ok && failures++ < 10) {
+        printf("FAIL: %s (iteration %u)\n", what, iteration);
+    }
+}
+
+static unsigned randomBytes(char* buffer) {
+    unsigned length = nextRandom() % MAX_INPUT;
+    unsigned mode = nextRandom() % 3;
+    for (unsigned i = 0; i < length; i++) {
+        unsigned r = nextRandom();
+        if (mode == 0) {
+            buffer[i] = (char) r; // anything
+        } else if (mode == 1) {
+            buffer[i] = (char)(32 + r % 95); // printable
+        } else {
+            buffer[i] = "aZ09 _-.~/%+"[r % 12]; // mostly safe
+        }
+    }
+    return length;
+}
+
+// escapes, '+' and plain characters; every '%' is followed by two hex digits
+static unsigned randomUrlEncoded(char* buffer) {
+    static const char* hex = "0123456789ABCDEFabcdef";
+    unsigned length = 0;
+    unsigned count = nextRandom() % 100;
+    for (unsigned i = 0; i < count; i++) {
+        unsigned r = nextRandom() % 10;
+        if (r == 0) {
+            buffer[length++] = '%';
+            buffer[length++] = hex[nextRandom() % 22];
+            buffer[length++] = hex[nextRandom() % 22];
+        } else if (r == 1) {
+            buffer[length++] = '+';
+        } else {
+            buffer[length++] = (char)(32 + nextRandom() % 95);
+            if (buffer[length - 1] == '%') buffer[length - 1] = '*';
+        }
+    }
+    return length;
+}
+
+int main(int argc, char** argv) {
+    unsigned iterations = argc > 1 ? (unsigned) atoi(argv[1]) : 20000;
+    rngState = argc > 2 ? strtoull(argv[2], NULL, 10) : 0x9E3779B97F4A7C15ULL;
+    if (rngState == 0) rngState = 1;
+
+    char input[MAX_INPUT * 3 + 4];
+    char expected[MAX_INPUT * 3 + 4];
+    char actual[MAX_INPUT * 3 + 4];
+
+    for (unsigned n = 0; n < iterations; n++) {
+        unsigned length = randomBytes(input);
+
+        // url encode
+        unsigned expectedLength = legacyUrlEncode(expected, input, length);
+        unsigned size = urlEncodedLength(input, length);
+        memset(actual, 0x7F, sizeof(actual));
+        unsigned actualLength = urlEncodeTo(actual, input, length);
+        check(size == expectedLength && actualLength == expectedLength &&
+            memcmp(actual, expected, expectedLength) == 0, "urlEncodeTo", n);
+        check((unsigned char) actual[size] == 0x7F, "urlEncodeTo overrun", n);
+
+        // and back
+        actualLength = urlDecodeTo(actual, actual, actualLength);
+        check(actualLength == length && memcmp(actual, input, length) == 0,
+            "urlDecodeTo round trip", n);
+
+        // url decode of foreign input, in place and into another buffer
+        length = randomUrlEncoded(input);
+        memcpy(expected, input, length);
+        expectedLength = legacyUrlDecode(expected, length);
+        actualLength = urlDecodeTo(actual, input, length);
+        check(actualLength == expectedLength &&
+            memcmp(actual, expected, expectedLength) == 0, "urlDecodeTo", n);
+        actualLength = urlDecodeTo(input, input, length);
+        check(actualLength == expectedLength &&
+            memcmp(input, expected, expectedLength) == 0, "urlDecodeTo in place", n);
+
+        // base64 encode
+        length = randomBytes(input);
+        expectedLength = base64_encode(expected, input, length);
+        size = base64EncodedLength(length);
+        memset(actual, 0x7F, sizeof(actual));
+        actualLength = base64EncodeTo(actual, (const unsigned char*) input, length);
+        check(size == expectedLength && actualLength == expectedLength &&
+            memcmp(actual, expected, expectedLength) == 0, "base64EncodeTo", n);
+        check((unsigned char) actual[size] == 0x7F, "base64EncodeTo overrun", n);
+
+        // base64 decode, padded and unpadded, in place and into another buffer
+        unsigned encodedLength = actualLength;
+        if (nextRandom() & 1) {
+            while (encodedLength > 0 && actual[encodedLength - 1] == '=') encodedLength--;
+        }
+        memcpy(input, actual, encodedLength);
+        expectedLength = base64_decode(expected, input, encodedLength);
+        check(base64DecodedLength(input, encodedLength) == expectedLength,
+            "base64DecodedLength", n);
+        unsigned decodedLength = 0;
+        check(base64DecodeTo((unsigned char*) actual, input, encodedLength, decodedLength) &&
+            decodedLength == expectedLength &&
+            memcmp(actual, expected, expectedLength) == 0, "base64DecodeTo", n);
+        // exactly sized heap target, so a sanitizer build catches overruns
+        unsigned char *exact = (unsigned char*) malloc(expectedLength ? expectedLength : 1);
+        check(base64DecodeTo(exact, input, encodedLength, decodedLength) &&
+            decodedLength == expectedLength &&
+            memcmp(exact, expected, expectedLength) == 0, "base64DecodeTo exact target", n);
+        free(exact);
+        check(base64DecodeTo((unsigned char*) input, input, encodedLength, decodedLength) &&
+            decodedLength == expectedLength &&
+            memcmp(input, expected, expectedLength) == 0, "base64DecodeTo in place", n);
+
+        // a stray character has to be rejected
+        if (encodedLength > 1) {
+            base64EncodeTo(input, (const unsigned char*) expected, expectedLength);
+            input[nextRandom() % (encodedLength - 1)] = "!*.-_\n\x80"[nextRandom() % 7];
+            check(!base64DecodeTo((unsigned char*) actual, input, encodedLength, decodedLength),
+                "base64DecodeTo invalid input", n);
+        }
+    }
+
+    printf("%u iterations, %d failures (SWAR %s)\n", iterations, failures,
+        IOTC_ENCODING_SWAR ? "on" : "off");
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,117 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license.
+
+#ifndef AZURE_IOTC_POSIX_LOOPBACK_DEVICE_H
+#define AZURE_IOTC_POSIX_LOOPBACK_DEVICE_H
+
+#include <stdio.h>
+#include <string.h>
+
+#include "src/iotc/iotc.h"
+#include "src/iotc/posix/posix_tls_client.h"
+#include "loopback_hub.h"
+#include "test_check.h"
+
+// the loopback hub takes any key; this one decodes to 32 bytes
+static const char* deviceKey = "MDEyMzQ1Njc4OTAxMjM0NTY3ODkwMTIzNDU2Nzg5MDE=";
+
+#define DEVICE_EVENTS_SENT 8
+#define DEVICE_EVENTS_SENT_SIZE 128
+
+// what the SDK reported to the device's callbacks so far
+typedef struct DeviceEvents_TAG {
+    unsigned connects;    // ConnectionStatus OK
+    unsigned disconnects; // any other ConnectionStatus
+    unsigned commands;
+    unsigned settings;    // SettingsUpdated
+    unsigned topics;      // iotc_on_topic routes
+    char lastCommand[64]; // tag of the last Command
+    char sent[DEVICE_EVENTS_SENT][DEVICE_EVENTS_SENT_SIZE]; // MessageSent payloads
+    unsigned sentCount;
+} DeviceEvents;
+
+static DeviceEvents events;
+
+static void onDeviceEvent(IOTContext ctx, IOTCallbackInfo *info) {
+    (void) ctx;
+    if (strcmp(info->eventName, "ConnectionStatus") == 0) {
+        if (info->statusCode == IOTC_CONNECTION_OK) {
+            events.connects++;
+        } else {
+            events.disconnects++;
+        }
+    } else if (strcmp(info->eventName, "MessageSent") == 0) {
+        if (events.sentCount < DEVICE_EVENTS_SENT) {
+            snprintf(events.sent[events.sentCount], DEVICE_EVENTS_SENT_SIZE, "%.*s",
+                (int) info->payloadLength, info->payload);
+        }
+        events.sentCount++;
+    } else if (strcmp(info->eventName, "Command") == 0) {
+        events.commands++;
+        snprintf(events.lastCommand, sizeof(events.lastCommand), "%s", info->tag);
+    } else if (strcmp(info->eventName, "SettingsUpdated") == 0) {
+        events.settings++;
+    } else if (strcmp(info->eventName, "Topic") == 0) {
+        events.topics++;
+    }
+}
+
+// A device context on a loopback hub of its own (plain TCP), with
+// onDeviceEvent registered for the connection, message and cloud events.
+// Configure `ctx` between start() and connect(); stop() tears both down.
+class LoopbackDevice {
+public:
+    AzureIOT::LoopbackHub hub;
+    IOTContext ctx;
+
+    LoopbackDevice(): ctx(NULL) { memset(&events, 0, sizeof(events)); }
+    ~LoopbackDevice() { stop(); }
+
+    // returns 0 if there is no error
+    int start() {
+        AzureIOT::TLSClient::setUseTLS(false);
+        if (hub.start() != 0 || iotc_init_context(&ctx) != 0) return 1;
+
+        iotc_set_global_endpoint(ctx, hub.getDPSEndpoint());
+        iotc_on(ctx, "ConnectionStatus", onDeviceEvent, NULL);
+        iotc_on(ctx, "MessageSent", onDeviceEvent, NULL);
+        iotc_on(ctx, "Command", onDeviceEvent, NULL);
+        iotc_on(ctx, "SettingsUpdated", onDeviceEvent, NULL);
+        return 0;
+    }
+
+    // registers deviceId through the hub's DPS endpoint and connects
+    int connect(const char* deviceId) {
+        return iotc_connect(ctx, "0ne00000000", deviceKey, deviceId, IOTC_CONNECT_SYMM_KEY);
+    }
+
+    void stop() {
+        if (ctx != NULL) {
+            iotc_disconnect(ctx);
+            iotc_free_context(ctx);
+            ctx = NULL;
+        }
+        hub.stop();
+    }
+
+    // runs do_work until `counter` (a member of `events`) reaches count,
+    // timeoutMs at most. returns whether it did
+    bool workUntil(const unsigned &counter, unsigned count, unsigned long timeoutMs) {
+        unsigned long start = AzureIOT::TLSClient::tickMs();
+        while (counter < count && AzureIOT::TLSClient::tickMs() - start < timeoutMs) {
+            iotc_do_work(ctx);
+            AzureIOT::TLSClient::waitMs(5);
+        }
+        return counter >= count;
+    }
+
+    void workFor(unsigned long ms) {
+        unsigned long start = AzureIOT::TLSClient::tickMs();
+        while (AzureIOT::TLSClient::tickMs() - start < ms) {
+            iotc_do_work(ctx);
+            AzureIOT::TLSClient::waitMs(5);
+        }
+    }
+};
+
+#endif // AZURE_IOTC_POSIX_LOOPBACK_DEVICE_H
@@ -0,0 +1,160 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license.
+
+// MessageStore on its own (wrap around, reopen, torn and corrupted records),
+// then iotc_set_offline_store against the loopback hub: telemetry sent while
+// the connection is gone goes out in order once do_work has reconnected.
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "src/iotc/common/iotc_internal.h"
+#include "loopback_device.h"
+
+using namespace AzureIOT;
+
+#define STORE_PATH "message_store_test.bin"
+#define SLOT_SIZE 64
+
+static void openEmpty(MessageStore &store, unsigned slotCount) {
+    memset(&store, 0, sizeof(store)); // as in IOTContextInternal
+    remove(STORE_PATH);
+    CHECK(store.open(STORE_PATH, slotCount, SLOT_SIZE) == 0);
+    CHECK(store.isOpen() && store.isEmpty());
+}
+
+static void appendMessage(MessageStore &store, unsigned id) {
+    char message[32];
+    int length = snprintf(message, sizeof(message), "{\"id\":%u}", id);
+    CHECK(store.append(message, (unsigned) length, 1000 + id) == 0);
+}
+
+// pops the messages in order; they have to be `first`..`last`
+static void checkDrain(MessageStore &store, unsigned first, unsigned last) {
+    for (unsigned id = first; id <= last; id++) {
+        StringBuffer message;
+        unsigned long timestamp = 0;
+        char expected[32];
+        snprintf(expected, sizeof(expected), "{\"id\":%u}", id);
+        CHECK(store.peek(message, timestamp) == 0);
+        CHECK(message.getLength() == strlen(expected) && strcmp(*message, expected) == 0);
+        CHECK(timestamp == 1000 + id);
+        CHECK(store.pop() == 0);
+    }
+}
+
+static void testWrapAround() {
+    MessageStore store;
+    openEmpty(store, 4);
+    for (unsigned id = 1; id <= 6; id++) appendMessage(store, id);
+    // the two oldest were dropped
+    checkDrain(store, 3, 6);
+    CHECK(store.isEmpty());
+
+    // too long for a slot
+    char big[SLOT_SIZE];
+    memset(big, 'x', sizeof(big));
+    CHECK(store.append(big, sizeof(big), 0) != 0);
+    store.close();
+}
+
+static void testReopen() {
+    MessageStore store;
+    openEmpty(store, 4);
+    for (unsigned id = 1; id <= 7; id++) appendMessage(store, id);
+    CHECK(store.pop() == 0); // 4 was sent
+    store.close();
+
+    memset(&store, 0, sizeof(store));
+    CHECK(store.open(STORE_PATH, 4, SLOT_SIZE) == 0);
+    checkDrain(store, 5, 7);
+    store.close();
+}
+
+static void testTornAppend() {
+    MessageStore store;
+    openEmpty(store, 4);
+    for (unsigned id = 1; id <= 3; id++) appendMessage(store, id);
+    store.close();
+
+    // the last message (slot 3) lost its tail
+    CHECK(truncate(STORE_PATH, 3 * SLOT_SIZE + MESSAGE_STORE_HEADER_SIZE + 2) == 0);
+    memset(&store, 0, sizeof(store));
+    CHECK(store.open(STORE_PATH, 4, SLOT_SIZE) == 0);
+    checkDrain(store, 1, 2);
+    CHECK(store.isEmpty());
+
+    // the store goes on over the torn slot
+    appendMessage(store, 3);
+    checkDrain(store, 3, 3);
+    store.close();
+}
+
+static void testCorruptedRecord() {
+    MessageStore store;
+    openEmpty(store, 4);
+    for (unsigned id = 1; id <= 3; id++) appendMessage(store, id);
+    store.close();
+
+    // a bit of message 2 (slot 2) flipped
+    FILE* file = fopen(STORE_PATH, "r+b");
+    CHECK(file != NULL);
+    if (file != NULL) {
+        long offset = 2 * SLOT_SIZE + MESSAGE_STORE_HEADER_SIZE + 1;
+        fseek(file, offset, SEEK_SET);
+        int ch = fgetc(file);
+        fseek(file, offset, SEEK_SET);
+        fputc(ch ^ 0x01, file);
+        fclose(file);
+    }
+
+    memset(&store, 0, sizeof(store));
+    CHECK(store.open(STORE_PATH, 4, SLOT_SIZE) == 0);
+    checkDrain(store, 1, 1);
+    checkDrain(store, 3, 3);
+    CHECK(store.isEmpty());
+    store.close();
+}
+
+static void testDrainAfterReconnect() {
+    remove(STORE_PATH);
+    LoopbackDevice device;
+    CHECK(device.start() == 0);
+    IOTContext ctx = device.ctx;
+    CHECK(iotc_set_reconnect(ctx, 200, 400, 60000, 0) == 0);
+    CHECK(iotc_set_offline_store(ctx, STORE_PATH, 8, 128, 20) == 0);
+    CHECK(device.connect("store-device") == 0);
+
+    device.hub.dropSession();
+    CHECK(device.workUntil(events.disconnects, 1, 5000));
+    CHECK(events.disconnects == 1);
+
+    // offline; these go into the store
+    unsigned long before = device.hub.getPublishCount();
+    CHECK(iotc_send_telemetry(ctx, "{\"n\":1}", 7) == 0);
+    CHECK(iotc_send_telemetry(ctx, "{\"n\":2}", 7) == 0);
+    CHECK(iotc_send_telemetry(ctx, "{\"n\":3}", 7) == 0);
+    CHECK(events.sentCount == 0);
+
+    CHECK(device.workUntil(events.connects, 2, 5000));
+    CHECK(device.workUntil(events.sentCount, 3, 5000));
+    CHECK(strcmp(events.sent[0], "{\"n\":1}") == 0);
+    CHECK(strcmp(events.sent[1], "{\"n\":2}") == 0);
+    CHECK(strcmp(events.sent[2], "{\"n\":3}") == 0);
+    // the twin GET after the reconnect and the three messages
+    CHECK(device.hub.getPublishCount() >= before + 4);
+
+    device.stop();
+    remove(STORE_PATH);
+}
+
+int main() {
+    iotc_set_logging(IOTC_LOGGING_DISABLED);
+    testWrapAround();
+    testReopen();
+    testTornAppend();
+    testCorruptedRecord();
+    testDrainAfterReconnect();
+    return TEST_RESULT();
+}
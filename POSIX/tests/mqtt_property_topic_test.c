@@ -0,0 +1,183 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license.
+
+// Differential test for the cached property encoder of the ESP32 SDK's MQTT
+// transport (iothubtransport_mqtt_common.c). Every combination of user
+// properties, system properties, diagnostic data, output name and the url
+// encode option is turned into a telemetry topic by the transport and by the
+// STRING_sprintf path it replaced; the topics have to match byte for byte.
+// The combinations are run in several orders, so the topics come from fresh
+// encodes, cache hits and entries that replaced others.
+//
+// The transport is built in here; only the part reachable from the encoder
+// is linked (--gc-sections), no MQTT client or TLS.
+
+#include "iothub_client/src/iothubtransport_mqtt_common.c"
+
+#define COMBINATIONS 1024
+
+static const char* eventTopic = "devices/bench-device/messages/events/";
+static int failures = 0;
+
+// ---- former addPropertiesTouMqttMessage and its system property part ----
+
+static int legacyAddSystemProperties(IOTHUB_MESSAGE_HANDLE iothub_message_handle, STRING_HANDLE topic_string, size_t* index_ptr, bool urlencode)
+{
+    int result = 0;
+    size_t index = *index_ptr;
+
+    const char* correlation_id = IoTHubMessage_GetCorrelationId(iothub_message_handle);
+    if (correlation_id != NULL)
+    {
+        result = addSystemPropertyToTopicString(topic_string, index, CORRELATION_ID_PROPERTY, correlation_id, urlencode);
+        index++;
+    }
+    if (result == 0)
+    {
+        const char* msg_id = IoTHubMessage_GetMessageId(iothub_message_handle);
+        if (msg_id != NULL)
+        {
+            result = addSystemPropertyToTopicString(topic_string, index, MESSAGE_ID_PROPERTY, msg_id, urlencode);
+            index++;
+        }
+    }
+    if (result == 0)
+    {
+        const char* content_type = IoTHubMessage_GetContentTypeSystemProperty(iothub_message_handle);
+        if (content_type != NULL)
+        {
+            result = addSystemPropertyToTopicString(topic_string, index, CONTENT_TYPE_PROPERTY, content_type, urlencode);
+            index++;
+        }
+    }
+    if (result == 0)
+    {
+        const char* content_encoding = IoTHubMessage_GetContentEncodingSystemProperty(iothub_message_handle);
+        if (content_encoding != NULL)
+        {
+            result = addSystemPropertyToTopicString(topic_string, index, CONTENT_ENCODING_PROPERTY, content_encoding, urlencode);
+            index++;
+        }
+    }
+    *index_ptr = index;
+    return result;
+}
+
+static STRING_HANDLE legacyAddProperties(IOTHUB_MESSAGE_HANDLE iothub_message_handle, const char* eventTopic, bool urlencode)
+{
+    size_t index = 0;
+    STRING_HANDLE result = STRING_construct(eventTopic);
+    if (result == NULL ||
+        addUserPropertiesTouMqttMessage(iothub_message_handle, result, &index, urlencode) != 0 ||
+        legacyAddSystemProperties(iothub_message_handle, result, &index, urlencode) != 0 ||
+        addDiagnosticPropertiesTouMqttMessage(iothub_message_handle, result, &index) != 0)
+    {
+        STRING_delete(result);
+        return NULL;
+    }
+
+    const char* output_name = IoTHubMessage_GetOutputName(iothub_message_handle);
+    if (output_name != NULL)
+    {
+        if (STRING_sprintf(result, "%s%%24.on=%s/", index == 0 ? "" : PROPERTY_SEPARATOR, output_name) != 0)
+        {
+            STRING_delete(result);
+            result = NULL;
+        }
+        index++;
+    }
+    return result;
+}
+
+// ---- messages ----
+
+// bits of a combination:
+//   0-1  number of user properties (0 to 3)
+//   2    the user property values need url encoding
+//   3    correlation id      4  message id
+//   5    content type        6  content encoding
+//   7    diagnostic data     8  output name
+//   9    the transport's url encode option
+static IOTHUB_MESSAGE_HANDLE createMessage(unsigned combination)
+{
+    static const char* keys[] = { "temperatureAlert", "unit", "zone" };
+    static const char* plainValues[] = { "true", "celsius", "3" };
+    static const char* encodedValues[] = { "a b", "deg/C", "z=3&x" };
+    static IOTHUB_MESSAGE_DIAGNOSTIC_PROPERTY_DATA diagnostic = { "diag-1", "1571234567.890" };
+
+    IOTHUB_MESSAGE_HANDLE message = IoTHubMessage_CreateFromString("{\"t\":21}");
+    if (message == NULL) return NULL;
+
+    MAP_HANDLE properties = IoTHubMessage_Properties(message);
+    const char** values = (combination & (1 << 2)) ? encodedValues : plainValues;
+    for (unsigned index = 0; index < (combination & 3); index++)
+    {
+        Map_AddOrUpdate(properties, keys[index], values[index]);
+    }
+    if (combination & (1 << 3)) IoTHubMessage_SetCorrelationId(message, "corr 7");
+    if (combination & (1 << 4)) IoTHubMessage_SetMessageId(message, "msg-42");
+    if (combination & (1 << 5)) IoTHubMessage_SetContentTypeSystemProperty(message, "application/json");
+    if (combination & (1 << 6)) IoTHubMessage_SetContentEncodingSystemProperty(message, "utf-8");
+    if (combination & (1 << 7)) IoTHubMessage_SetDiagnosticPropertyData(message, &diagnostic);
+    if (combination & (1 << 8)) IoTHubMessage_SetOutputName(message, "alerts");
+    return message;
+}
+
+static void check(MQTTTRANSPORT_HANDLE_DATA* transport, unsigned combination, const char* pass)
+{
+    IOTHUB_MESSAGE_HANDLE message = createMessage(combination);
+    if (message == NULL)
+    {
+        printf("FAILED %s %u: couldn't create the message\r\n", pass, combination);
+        failures++;
+        return;
+    }
+
+    transport->auto_url_encode_decode = (combination & (1 << 9)) != 0;
+    STRING_HANDLE expected = legacyAddProperties(message, eventTopic, transport->auto_url_encode_decode);
+    const char* actual = addPropertiesTouMqttMessage(transport, message);
+    if (expected == NULL || actual == NULL || strcmp(STRING_c_str(expected), actual) != 0)
+    {
+        printf("FAILED %s %u:\r\n  expected %s\r\n  actual   %s\r\n", pass, combination,
+            expected == NULL ? "(null)" : STRING_c_str(expected), actual == NULL ? "(null)" : actual);
+        failures++;
+    }
+    STRING_delete(expected);
+    IoTHubMessage_Destroy(message);
+}
+
+int main(void)
+{
+    MQTTTRANSPORT_HANDLE_DATA transport;
+    memset(&transport, 0, sizeof(transport));
+    transport.topic_MqttEvent = STRING_construct(eventTopic);
+
+    // fresh encodes, each one evicting an older entry
+    for (unsigned combination = 0; combination < COMBINATIONS; combination++)
+    {
+        check(&transport, combination, "in order");
+    }
+    // every message twice in a row: the second one is a cache hit
+    for (unsigned combination = 0; combination < COMBINATIONS; combination++)
+    {
+        check(&transport, combination, "first");
+        check(&transport, combination, "repeated");
+    }
+    // a few sets taking turns, so hits and replacements mix
+    for (unsigned n = 0; n < 4 * COMBINATIONS; n++)
+    {
+        check(&transport, (n * 7919u) % 6 * 171u % COMBINATIONS, "mixed");
+    }
+
+    for (size_t index = 0; index < PROPERTY_CACHE_SIZE; index++)
+    {
+        free(transport.property_cache[index].key);
+        STRING_delete(transport.property_cache[index].encoded);
+    }
+    free(transport.property_key);
+    free(transport.topic_buffer);
+    STRING_delete(transport.topic_MqttEvent);
+
+    printf("%u combinations, %d failures\r\n", COMBINATIONS, failures);
+    return failures == 0 ? 0 : 1;
+}
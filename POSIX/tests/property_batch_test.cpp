@@ -0,0 +1,128 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license.
+
+// PropertyBatch on its own (merge, last writer wins, room, the interval),
+// then iotc_set_property_batching against the loopback hub: properties sent
+// within the interval go out as one patch.
+
+#include <stdio.h>
+#include <string.h>
+
+#include "src/iotc/common/iotc_internal.h"
+#include "loopback_device.h"
+
+using namespace AzureIOT;
+
+static int merge(PropertyBatch &batch, const char* patch, unsigned long nowMs) {
+    return batch.merge(patch, strlen(patch), nowMs);
+}
+
+static bool pendingIs(PropertyBatch &batch, const char* expected) {
+    return batch.getLength() == strlen(expected) && strcmp(batch.getData(), expected) == 0;
+}
+
+static void testMerge() {
+    PropertyBatch batch;
+    memset(&batch, 0, sizeof(batch)); // as in IOTContextInternal
+    CHECK(!batch.isEnabled() && batch.isEmpty());
+
+    CHECK(batch.configure(100, 128) == 0);
+    CHECK(batch.isEnabled() && batch.isEmpty() && pendingIs(batch, "{}"));
+    CHECK(batch.getWaitMs(0) == IOTC_MAX_WAIT_MS);
+
+    CHECK(merge(batch, "{\"a\":1}", 1000) == 0);
+    CHECK(merge(batch, "{\"b\":{\"value\":\"x\"},\"c\":[1,2]}", 1050) == 0);
+    CHECK(pendingIs(batch, "{\"a\":1,\"b\":{\"value\":\"x\"},\"c\":[1,2]}"));
+
+    // a member that is pending again is replaced; first, middle and last
+    CHECK(merge(batch, "{\"b\":2}", 1060) == 0);
+    CHECK(pendingIs(batch, "{\"a\":1,\"c\":[1,2],\"b\":2}"));
+    CHECK(merge(batch, "{\"a\":true}", 1070) == 0);
+    CHECK(pendingIs(batch, "{\"c\":[1,2],\"b\":2,\"a\":true}"));
+    CHECK(merge(batch, "{\"a\":null}", 1080) == 0);
+    CHECK(pendingIs(batch, "{\"c\":[1,2],\"b\":2,\"a\":null}"));
+
+    // not objects
+    CHECK(merge(batch, "[1]", 1090) != 0);
+    CHECK(merge(batch, "42", 1090) != 0);
+    CHECK(pendingIs(batch, "{\"c\":[1,2],\"b\":2,\"a\":null}"));
+
+    // the interval runs from the first merge into an empty batch
+    CHECK(!batch.isDue(1099));
+    CHECK(batch.getWaitMs(1040) == 60);
+    CHECK(batch.isDue(1100) && batch.getWaitMs(1100) == 0);
+
+    // nothing flushes (or changes) while the patch is published
+    batch.beginSend();
+    CHECK(!batch.isDue(2000) && batch.getWaitMs(2000) == IOTC_MAX_WAIT_MS);
+    batch.endSend(false);
+    CHECK(batch.isDue(2000));
+    batch.beginSend();
+    batch.endSend(true);
+    CHECK(batch.isEmpty() && pendingIs(batch, "{}"));
+
+    CHECK(merge(batch, "{\"d\":1}", 5000) == 0);
+    CHECK(!batch.isDue(5099) && batch.isDue(5100));
+
+    // room: maxBytes is at least PROPERTY_BATCH_MIN_BYTES, "{}" included
+    CHECK(batch.configure(100, 1) == 0);
+    char big[PROPERTY_BATCH_MIN_BYTES + 1];
+    int length = snprintf(big, sizeof(big), "{\"x\":\"%0*d\"}", PROPERTY_BATCH_MIN_BYTES - 8, 0);
+    CHECK(length == PROPERTY_BATCH_MIN_BYTES);
+    CHECK(!batch.fits((unsigned) length) && batch.merge(big, (unsigned) length, 0) != 0);
+    length = snprintf(big, sizeof(big), "{\"x\":\"%0*d\"}", PROPERTY_BATCH_MIN_BYTES - 10, 0);
+    CHECK(batch.fits((unsigned) length) && batch.merge(big, (unsigned) length, 0) == 0);
+    CHECK(batch.getLength() == PROPERTY_BATCH_MIN_BYTES - 2);
+    CHECK(!batch.fits(7) && merge(batch, "{\"y\":1}", 0) != 0);
+
+    CHECK(batch.configure(0, 0) == 0);
+    CHECK(!batch.isEnabled());
+}
+
+static void testLoopback() {
+    LoopbackDevice device;
+    CHECK(device.start() == 0);
+    IOTContext ctx = device.ctx;
+    LoopbackHub &hub = device.hub;
+    CHECK(iotc_set_property_batching(ctx, 200, 256) == 0);
+    CHECK(device.connect("property-device") == 0);
+    CHECK(events.connects == 1);
+    device.workFor(50); // the twin GET after connect
+
+    unsigned long before = hub.getPublishCount();
+    CHECK(iotc_send_property(ctx, "{\"fw\":\"1.0\"}", 12) == 0);
+    CHECK(iotc_send_property(ctx, "{\"mode\":1}", 10) == 0);
+    CHECK(iotc_send_property(ctx, "{\"fw\":\"1.1\"}", 12) == 0);
+    CHECK(events.sentCount == 0);
+    CHECK(hub.getPublishCount() == before);
+
+    // due after the interval; one patch, the newest value of each member
+    unsigned long waitMs = 0;
+    CHECK(iotc_get_wait_ms(ctx, &waitMs) == 0 && waitMs <= 200);
+    device.workFor(300);
+    CHECK(events.sentCount == 1 && strcmp(events.sent[0], "{\"mode\":1,\"fw\":\"1.1\"}") == 0);
+    CHECK(hub.waitForPublishes(before + 1, 1000) == 0);
+    CHECK(hub.getPublishCount() == before + 1);
+
+    // flushed on demand, and nothing left to flush afterwards
+    CHECK(iotc_send_property(ctx, "{\"mode\":2}", 10) == 0);
+    CHECK(iotc_flush_properties(ctx) == 0);
+    CHECK(events.sentCount == 2 && strcmp(events.sent[1], "{\"mode\":2}") == 0);
+    CHECK(iotc_flush_properties(ctx) == 0);
+    CHECK(hub.waitForPublishes(before + 2, 1000) == 0);
+
+    // turning batching off sends what is pending
+    CHECK(iotc_send_property(ctx, "{\"mode\":3}", 10) == 0);
+    CHECK(iotc_set_property_batching(ctx, 0, 0) == 0);
+    CHECK(events.sentCount == 3 && strcmp(events.sent[2], "{\"mode\":3}") == 0);
+    CHECK(iotc_send_property(ctx, "{\"mode\":4}", 10) == 0);
+    CHECK(events.sentCount == 4);
+    CHECK(hub.waitForPublishes(before + 4, 1000) == 0);
+}
+
+int main() {
+    iotc_set_logging(IOTC_LOGGING_DISABLED);
+    testMerge();
+    testLoopback();
+    return TEST_RESULT();
+}
@@ -0,0 +1,201 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license.
+
+// ESP8266 PubSubClient (ESP8266/src/iotc/arduino) against an in-memory
+// network client: PUBLISH packets bigger than the buffer go to the chunk
+// callback, and a topic that fills the whole buffer drops the connection
+// instead of running past the buffer.
+
+#include <stdio.h>
+#include <string.h>
+
+#include "PubSubClient.h"
+#include "test_check.h"
+
+unsigned long testMillis = 1000;
+
+#define TEST_BUFFER_SIZE 256
+
+// what the "broker" sent (in) and what the device wrote (out)
+class MemoryClient : public Client {
+    uint8_t in[4096];
+    size_t inLength;
+    size_t inPos;
+    bool up;
+
+public:
+    uint8_t out[4096];
+    size_t outLength;
+
+    MemoryClient() : inLength(0), inPos(0), up(false), outLength(0) {}
+
+    int connect(IPAddress, uint16_t) { return 0; }
+    int connect(const char*, uint16_t) {
+        static const uint8_t connack[] = { 0x20, 2, 0, 0 };
+        up = true;
+        inLength = inPos = 0;
+        push(connack, sizeof(connack));
+        return 1;
+    }
+    size_t write(uint8_t b) { return write(&b, 1); }
+    size_t write(const uint8_t* buffer, size_t size) {
+        if (outLength + size > sizeof(out)) size = sizeof(out) - outLength;
+        memcpy(out + outLength, buffer, size);
+        outLength += size;
+        return size;
+    }
+    int available() { return up ? (int)(inLength - inPos) : 0; }
+    int read() { return available() > 0 ? in[inPos++] : -1; }
+    int read(uint8_t* buffer, size_t size) {
+        size_t n = (size_t) available();
+        if (n > size) n = size;
+        memcpy(buffer, in + inPos, n);
+        inPos += n;
+        return (int) n;
+    }
+    void flush() {}
+    void stop() { up = false; }
+    uint8_t connected() { return up; }
+
+    void push(const uint8_t* data, size_t size) {
+        memcpy(in + inLength, data, size);
+        inLength += size;
+    }
+
+    // queues a PUBLISH with a topic of topicLength 't's and a payload of
+    // payloadLength bytes ('a' + offset % 26)
+    void pushPublish(unsigned topicLength, unsigned payloadLength, bool qos1, uint16_t msgId) {
+        uint8_t header[5];
+        unsigned pos = 0;
+        unsigned long remaining = 2 + topicLength + (qos1 ? 2 : 0) + payloadLength;
+        header[pos++] = qos1 ? 0x32 : 0x30;
+        do {
+            uint8_t digit = remaining % 128;
+            remaining /= 128;
+            if (remaining > 0) digit |= 0x80;
+            header[pos++] = digit;
+        } while (remaining > 0);
+        push(header, pos);
+
+        uint8_t b = topicLength >> 8;
+        push(&b, 1);
+        b = topicLength & 0xFF;
+        push(&b, 1);
+        for (unsigned i = 0; i < topicLength; i++) {
+            b = 't';
+            push(&b, 1);
+        }
+        if (qos1) {
+            b = msgId >> 8;
+            push(&b, 1);
+            b = msgId & 0xFF;
+            push(&b, 1);
+        }
+        for (unsigned i = 0; i < payloadLength; i++) {
+            b = 'a' + i % 26;
+            push(&b, 1);
+        }
+    }
+};
+
+static unsigned chunkCalls = 0;
+static unsigned chunkBytes = 0;
+static unsigned chunkTotal = 0;
+static bool chunkInOrder = true;
+
+static void onChunk(char* topic, uint8_t* data, unsigned int length, uint32_t offset, uint32_t total) {
+    for (unsigned i = 0; i < length; i++) {
+        if (data[i] != 'a' + (offset + i) % 26) chunkInOrder = false;
+    }
+    if (offset != chunkBytes) chunkInOrder = false;
+    chunkCalls++;
+    chunkBytes += length;
+    chunkTotal = total;
+}
+
+static unsigned messages = 0;
+
+static void onMessage(char* topic, uint8_t* payload, unsigned int length) {
+    messages++;
+}
+
+static void reset() {
+    chunkCalls = chunkBytes = chunkTotal = 0;
+    chunkInOrder = true;
+    messages = 0;
+}
+
+// the topic length that leaves `room` bytes of the buffer after the topic
+// (for a remaining length of 2 bytes)
+static unsigned topicLeaving(unsigned room) {
+    return TEST_BUFFER_SIZE - (1 + 2 + 2) - room;
+}
+
+static void testTopicFillsBuffer(bool qos1) {
+    reset();
+    MemoryClient network;
+    PubSubClient client("hub", 8883, &network);
+    client.setCallback(onMessage);
+    client.setChunkCallback(onChunk);
+    CHECK(client.setBufferSize(TEST_BUFFER_SIZE));
+    CHECK(client.connect("device", "user", "pass"));
+
+    network.outLength = 0;
+    network.pushPublish(topicLeaving(0), 400, qos1, 7);
+    client.loop();
+    CHECK(!client.connected());
+    CHECK(chunkCalls == 0 && messages == 0);
+    CHECK(network.outLength == 0); // no PUBACK
+}
+
+static void testMessageIdFillsBuffer() {
+    reset();
+    MemoryClient network;
+    PubSubClient client("hub", 8883, &network);
+    client.setChunkCallback(onChunk);
+    CHECK(client.setBufferSize(TEST_BUFFER_SIZE));
+    CHECK(client.connect("device", "user", "pass"));
+
+    // room for the message id but none for the payload
+    network.pushPublish(topicLeaving(2), 400, true, 7);
+    client.loop();
+    CHECK(!client.connected());
+    CHECK(chunkCalls == 0);
+}
+
+static void testChunkedQos1() {
+    reset();
+    MemoryClient network;
+    PubSubClient client("hub", 8883, &network);
+    client.setCallback(onMessage);
+    client.setChunkCallback(onChunk);
+    CHECK(client.setBufferSize(TEST_BUFFER_SIZE));
+    CHECK(client.connect("device", "user", "pass"));
+
+    // a byte of payload per chunk
+    network.outLength = 0;
+    network.pushPublish(topicLeaving(3), 400, true, 0x1234);
+    client.loop();
+    CHECK(client.connected());
+    CHECK(chunkCalls == 400 && chunkBytes == 400 && chunkTotal == 400 && chunkInOrder);
+    static const uint8_t puback[] = { 0x40, 2, 0x12, 0x34 };
+    CHECK(network.outLength == 4 && memcmp(network.out, puback, 4) == 0);
+
+    // roomier topics still work, and so do the messages that fit
+    reset();
+    network.pushPublish(20, 1000, false, 0);
+    network.pushPublish(20, 100, false, 0);
+    client.loop();
+    client.loop();
+    CHECK(client.connected());
+    CHECK(chunkBytes == 1000 && chunkInOrder);
+    CHECK(messages == 1);
+}
+
+int main() {
+    testTopicFillsBuffer(true);
+    testTopicFillsBuffer(false);
+    testMessageIdFillsBuffer();
+    testChunkedQos1();
+    return TEST_RESULT();
+}
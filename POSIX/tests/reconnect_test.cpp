@@ -0,0 +1,90 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license.
+
+// ReconnectPolicy on its own, then iotc_set_reconnect against the loopback
+// hub: the session is dropped while a telemetry batch is pending and do_work
+// has to bring the connection back (without touching the one it tore down).
+
+#include <stdio.h>
+#include <string.h>
+
+#include "src/iotc/common/reconnect_policy.h"
+#include "loopback_device.h"
+
+using namespace AzureIOT;
+
+static void testPolicy() {
+    ReconnectPolicy policy;
+    memset(&policy, 0, sizeof(policy)); // as in IOTContextInternal
+    CHECK(!policy.isEnabled());
+    CHECK(policy.schedule(0, IOTC_CONNECTION_DISCONNECTED) == -1);
+
+    policy.configure(100, 1000, 5000, 0);
+    policy.seed(12345);
+    long previous = 100;
+    for (int i = 0; i < 20; i++) {
+        long delay = policy.schedule(0, IOTC_CONNECTION_DISCONNECTED);
+        CHECK(delay >= 100 && delay <= 1000);
+        CHECK(delay <= previous * 3);
+        CHECK(policy.isPending() && !policy.isDue(delay - 1) && policy.isDue(delay));
+        CHECK(policy.getWaitMs(0) == (unsigned long) delay);
+        previous = delay;
+    }
+    CHECK(policy.getAttempts() == 20);
+
+    // a stable connection starts the backoff over
+    policy.onConnected(1000);
+    CHECK(!policy.isPending());
+    long delay = policy.schedule(1000 + 5000, IOTC_CONNECTION_DISCONNECTED);
+    CHECK(delay >= 100 && delay <= 300);
+    CHECK(policy.getAttempts() == 1);
+
+    CHECK(policy.schedule(0, IOTC_CONNECTION_EXPIRED_SAS_TOKEN) < 100);
+    CHECK(policy.schedule(0, IOTC_CONNECTION_DEVICE_DISABLED) == -1);
+    CHECK(!policy.isPending());
+
+    policy.configure(100, 1000, 5000, 0);
+    for (int i = 0; i < RECONNECT_MAX_REFUSED; i++) {
+        CHECK(policy.schedule(0, IOTC_CONNECTION_BAD_CREDENTIAL) >= 0);
+    }
+    CHECK(policy.schedule(0, IOTC_CONNECTION_BAD_CREDENTIAL) == -1);
+
+    policy.configure(100, 1000, 5000, 2);
+    CHECK(policy.schedule(0, IOTC_CONNECTION_NO_NETWORK) >= 0);
+    CHECK(policy.schedule(0, IOTC_CONNECTION_NO_NETWORK) >= 0);
+    CHECK(policy.schedule(0, IOTC_CONNECTION_NO_NETWORK) == -1);
+
+    policy.cancel();
+    CHECK(!policy.isPending() && policy.getWaitMs(0) == 0);
+}
+
+static void testDropWithPendingBatch() {
+    LoopbackDevice device;
+    CHECK(device.start() == 0);
+    CHECK(iotc_set_reconnect(device.ctx, 50, 200, 60000, 0) == 0);
+    CHECK(iotc_set_telemetry_batching(device.ctx, 10, 512, 50) == 0);
+    CHECK(device.connect("reconnect-device") == 0);
+    CHECK(events.connects == 1);
+
+    unsigned long before = device.hub.getPublishCount();
+    CHECK(iotc_send_telemetry(device.ctx, "{\"t\":1}", 7) == 0);
+    device.hub.dropSession();
+    TLSClient::waitMs(100); // the batch is due and the socket is closed
+
+    // the batch flush notices the lost connection first
+    CHECK(device.workUntil(events.connects, 2, 5000));
+    CHECK(events.disconnects == 1);
+
+    // the connection that came back works
+    CHECK(iotc_send_telemetry(device.ctx, "{\"t\":2}", 7) == 0);
+    CHECK(iotc_flush_telemetry(device.ctx) == 0);
+    // the twin GET after the reconnect and the second sample
+    CHECK(device.hub.waitForPublishes(before + 2, 5000) == 0);
+}
+
+int main() {
+    iotc_set_logging(IOTC_LOGGING_DISABLED);
+    testPolicy();
+    testDropWithPendingBatch();
+    return TEST_RESULT();
+}
@@ -0,0 +1,53 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license.
+
+// The string pool is for temporaries: once an operation is done no pool block
+// is held, even with the context connected and a callback that turned on
+// telemetry batching from inside a pool scope.
+
+#include <stdio.h>
+#include <string.h>
+
+#include "loopback_device.h"
+
+using namespace AzureIOT;
+
+static void onSettingsUpdated(IOTContext ctx, IOTCallbackInfo *info) {
+    onDeviceEvent(ctx, info);
+    iotc_set_telemetry_batching(ctx, 10, 200, 1000); // fits a pool block
+}
+
+static unsigned poolInUse() {
+    IOTMemoryStats stats;
+    CHECK(iotc_get_memory_stats(&stats) == 0);
+    return stats.inUse;
+}
+
+static void testNothingPinned() {
+    static char pool[4096];
+    CHECK(iotc_set_string_pool(pool, sizeof(pool)) == 0);
+
+    LoopbackDevice device;
+    CHECK(device.start() == 0);
+    iotc_on(device.ctx, "SettingsUpdated", onSettingsUpdated, NULL);
+    CHECK(device.connect("pool-device") == 0);
+
+    IOTMemoryStats stats;
+    CHECK(iotc_get_memory_stats(&stats) == 0);
+    CHECK(stats.allocations > 0); // the SAS tokens were computed in the pool
+    CHECK(stats.inUse == 0);
+
+    CHECK(device.hub.sendDesired("{\"fanSpeed\":{\"value\":5},\"$version\":2}") == 0);
+    CHECK(device.workUntil(events.settings, 1, 5000));
+    CHECK(poolInUse() == 0);
+
+    device.stop();
+
+    CHECK(iotc_set_string_pool(NULL, 0) == 0);
+}
+
+int main() {
+    iotc_set_logging(IOTC_LOGGING_DISABLED);
+    testNothingPinned();
+    return TEST_RESULT();
+}
@@ -0,0 +1,147 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license.
+
+// TelemetryBatch on its own (the array, the samples in it, count, size and
+// age), then iotc_set_telemetry_batching against the loopback hub: samples
+// go out as one message and MessageSent still fires for each of them.
+
+#include <stdio.h>
+#include <string.h>
+
+#include "src/iotc/common/iotc_internal.h"
+#include "loopback_device.h"
+
+using namespace AzureIOT;
+
+static int add(TelemetryBatch &batch, const char* sample, unsigned long nowMs) {
+    return batch.add(sample, strlen(sample), nowMs);
+}
+
+static bool pendingIs(TelemetryBatch &batch, const char* expected) {
+    return batch.getLength() == strlen(expected) && strcmp(batch.getData(), expected) == 0;
+}
+
+static bool sampleIs(TelemetryBatch &batch, unsigned index, const char* expected) {
+    unsigned length = 0;
+    const char* sample = batch.getSample(index, length);
+    return length == strlen(expected) && memcmp(sample, expected, length) == 0;
+}
+
+static void testBatch() {
+    TelemetryBatch batch;
+    memset(&batch, 0, sizeof(batch)); // as in IOTContextInternal
+    CHECK(!batch.isEnabled() && batch.isEmpty());
+
+    CHECK(batch.configure(3, 128, 100) == 0);
+    CHECK(batch.isEnabled() && pendingIs(batch, "[]"));
+    CHECK(batch.getWaitMs(0) == IOTC_MAX_WAIT_MS);
+
+    CHECK(add(batch, "{\"t\":1}", 1000) == 0);
+    CHECK(add(batch, "{\"t\":22}", 1050) == 0);
+    CHECK(pendingIs(batch, "[{\"t\":1},{\"t\":22}]"));
+    CHECK(batch.getCount() == 2);
+    CHECK(sampleIs(batch, 0, "{\"t\":1}") && sampleIs(batch, 1, "{\"t\":22}"));
+
+    // age runs from the oldest sample
+    CHECK(!batch.isDue(1099) && batch.getWaitMs(1060) == 40);
+    CHECK(batch.isDue(1100) && batch.getWaitMs(1100) == 0);
+
+    // count
+    CHECK(add(batch, "3", 1060) == 0);
+    CHECK(batch.isFull() && batch.isDue(1060) && !batch.fits(1));
+    CHECK(add(batch, "4", 1060) != 0);
+    CHECK(sampleIs(batch, 2, "3"));
+
+    // nothing flushes (or changes) while the array is published
+    batch.beginSend();
+    CHECK(!batch.isDue(2000) && batch.getWaitMs(2000) == IOTC_MAX_WAIT_MS);
+    batch.endSend(false);
+    CHECK(batch.getCount() == 3);
+    batch.beginSend();
+    batch.endSend(true);
+    CHECK(batch.isEmpty() && pendingIs(batch, "[]"));
+
+    // size: the array and a comma per sample have to fit into maxBytes
+    // (at least TELEMETRY_BATCH_MIN_BYTES)
+    CHECK(batch.configure(10, 1, 0) == 0);
+    char sample[TELEMETRY_BATCH_MIN_BYTES];
+    memset(sample, '1', sizeof(sample));
+    CHECK(!batch.fits(TELEMETRY_BATCH_MIN_BYTES - 2));
+    CHECK(batch.add(sample, TELEMETRY_BATCH_MIN_BYTES - 2, 0) != 0);
+    CHECK(batch.add(sample, TELEMETRY_BATCH_MIN_BYTES - 3, 0) == 0);
+    CHECK(batch.getLength() == TELEMETRY_BATCH_MIN_BYTES - 1);
+    CHECK(!batch.fits(1));
+
+    // no age limit; only count and size send them
+    CHECK(batch.configure(10, 128, 0) == 0);
+    CHECK(add(batch, "1", 0) == 0);
+    CHECK(!batch.isDue(1000000) && batch.getWaitMs(1000000) == IOTC_MAX_WAIT_MS);
+
+    CHECK(batch.configure(TELEMETRY_BATCH_MAX_SAMPLES + 10, 1024, 0) == 0);
+    for (unsigned i = 0; i < TELEMETRY_BATCH_MAX_SAMPLES; i++) {
+        CHECK(add(batch, "1", 0) == 0);
+    }
+    CHECK(batch.isFull());
+
+    CHECK(batch.configure(0, 0, 0) == 0);
+    CHECK(!batch.isEnabled());
+}
+
+static void testLoopback() {
+    LoopbackDevice device;
+    CHECK(device.start() == 0);
+    IOTContext ctx = device.ctx;
+    LoopbackHub &hub = device.hub;
+    CHECK(iotc_set_telemetry_batching(ctx, 3, 256, 200) == 0);
+    CHECK(device.connect("telemetry-device") == 0);
+    CHECK(events.connects == 1);
+    device.workFor(50); // the twin GET after connect
+
+    // the third sample fills the batch
+    unsigned long before = hub.getPublishCount();
+    unsigned long beforeBytes = hub.getPublishBytes();
+    CHECK(iotc_send_telemetry(ctx, "{\"t\":1}", 7) == 0);
+    CHECK(iotc_send_state(ctx, "{\"s\":2}", 7) == 0);
+    CHECK(events.sentCount == 0 && hub.getPublishCount() == before);
+    CHECK(iotc_send_event(ctx, "{\"e\":3}", 7) == 0);
+    CHECK(events.sentCount == 3);
+    CHECK(strcmp(events.sent[0], "{\"t\":1}") == 0);
+    CHECK(strcmp(events.sent[1], "{\"s\":2}") == 0);
+    CHECK(strcmp(events.sent[2], "{\"e\":3}") == 0);
+    CHECK(hub.waitForPublishes(before + 1, 1000) == 0);
+    CHECK(hub.getPublishCount() == before + 1);
+    CHECK(hub.getPublishBytes() - beforeBytes >= 3 * 7 + 4); // [..,..,..]
+
+    // age
+    CHECK(iotc_send_telemetry(ctx, "{\"t\":4}", 7) == 0);
+    unsigned long waitMs = 0;
+    CHECK(iotc_get_wait_ms(ctx, &waitMs) == 0 && waitMs <= 200);
+    device.workFor(300);
+    CHECK(events.sentCount == 4 && strcmp(events.sent[3], "{\"t\":4}") == 0);
+    CHECK(hub.waitForPublishes(before + 2, 1000) == 0);
+
+    // bigger than the whole batch; goes out on its own
+    char big[300];
+    int length = snprintf(big, sizeof(big), "{\"x\":\"%0*d\"}", 280, 0);
+    CHECK(iotc_send_telemetry(ctx, big, (unsigned) length) == 0);
+    CHECK(events.sentCount == 5);
+    CHECK(hub.waitForPublishes(before + 3, 1000) == 0);
+
+    // flushed on demand, and on disconnect
+    CHECK(iotc_send_telemetry(ctx, "{\"t\":6}", 7) == 0);
+    CHECK(iotc_flush_telemetry(ctx) == 0);
+    CHECK(events.sentCount == 6);
+    CHECK(iotc_flush_telemetry(ctx) == 0);
+    CHECK(hub.waitForPublishes(before + 4, 1000) == 0);
+    CHECK(iotc_send_telemetry(ctx, "{\"t\":7}", 7) == 0);
+    iotc_disconnect(ctx);
+    CHECK(events.sentCount == 7 && strcmp(events.sent[6], "{\"t\":7}") == 0);
+    CHECK(hub.waitForPublishes(before + 5, 1000) == 0);
+}
+
+int main() {
+    iotc_set_logging(IOTC_LOGGING_DISABLED);
+    testBatch();
+    testLoopback();
+    return TEST_RESULT();
+}
@@ -0,0 +1,22 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license.
+
+#ifndef AZURE_IOTC_POSIX_TEST_CHECK_H
+#define AZURE_IOTC_POSIX_TEST_CHECK_H
+
+#include <stdio.h>
+
+// failed checks so far; a test returns TEST_RESULT() from main
+static unsigned testFailures = 0;
+
+#define CHECK(x) \
+    do { \
+        if (!(x)) { \
+            printf("FAILED %s:%d: %s\r\n", __FILE__, __LINE__, #x); \
+            testFailures++; \
+        } \
+    } while (0)
+
+#define TEST_RESULT() (testFailures == 0 ? 0 : 1)
+
+#endif // AZURE_IOTC_POSIX_TEST_CHECK_H
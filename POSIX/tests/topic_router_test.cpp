@@ -0,0 +1,144 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license.
+
+// TopicRouter on its own (longest prefix, replace, remove, a full router,
+// the fields behind the prefix), then the routes iotc_init_context and
+// iotc_on_topic add, against the loopback hub.
+
+#include <stdio.h>
+#include <string.h>
+
+#include "src/iotc/common/topic_router.h"
+#include "loopback_device.h"
+
+using namespace AzureIOT;
+
+// what the last handler call saw
+static int lastRoute = -1;
+static TopicFields lastFields;
+static unsigned long lastPayloadLength = 0;
+
+static void onRoute(const char* topic, unsigned topicLength, const TopicFields &fields,
+    char* payload, unsigned long payloadLength, void* handlerContext) {
+    lastRoute = (int)(long) handlerContext;
+    lastFields = fields;
+    lastPayloadLength = payloadLength;
+}
+
+static bool route(TopicRouter &router, const char* topic) {
+    lastRoute = -1;
+    char payload[] = "{}";
+    return router.dispatch(topic, strlen(topic), payload, 2);
+}
+
+static bool fieldIs(const char* value, unsigned length, const char* expected) {
+    return value != NULL && length == strlen(expected) && memcmp(value, expected, length) == 0;
+}
+
+static void testRouting() {
+    TopicRouter router;
+    memset(&router, 0, sizeof(router)); // as in IOTContextInternal
+    CHECK(!route(router, "anything"));
+
+    CHECK(router.add("$iothub/", onRoute, (void*) 1) == 0);
+    CHECK(router.add("$iothub/methods/POST/", onRoute, (void*) 2) == 0);
+    CHECK(router.add("$iothub/twin/res/", onRoute, (void*) 3) == 0);
+    CHECK(router.add("devices/d1/messages/devicebound/", onRoute, (void*) 4) == 0);
+
+    // the longest prefix wins
+    CHECK(route(router, "$iothub/methods/POST/reboot/?$rid=7") && lastRoute == 2);
+    CHECK(fieldIs(lastFields.segment, lastFields.segmentLength, "reboot"));
+    CHECK(fieldIs(lastFields.requestId, lastFields.requestIdLength, "7"));
+    CHECK(route(router, "$iothub/twin/res/204/?$rid=3&$version=12") && lastRoute == 3);
+    CHECK(lastFields.status == 204 && lastFields.version == 12);
+    CHECK(route(router, "$iothub/other") && lastRoute == 1);
+    CHECK(route(router, "$iothub/") && lastRoute == 1);
+    CHECK(lastPayloadLength == 2);
+    CHECK(!route(router, "$iothub"));
+    CHECK(!route(router, "devices/d2/messages/devicebound/x"));
+    CHECK(!route(router, ""));
+
+    // same prefix again replaces the handler
+    CHECK(router.add("$iothub/twin/res/", onRoute, (void*) 5) == 0);
+    CHECK(route(router, "$iothub/twin/res/200/?$rid=1") && lastRoute == 5);
+
+    CHECK(router.remove("$iothub/methods/POST/") == 0);
+    CHECK(router.remove("$iothub/methods/POST/") == 1);
+    CHECK(route(router, "$iothub/methods/POST/reboot/?$rid=7") && lastRoute == 1);
+    CHECK(route(router, "devices/d1/messages/devicebound/%24.to=x") && lastRoute == 4);
+
+    router.clear();
+    static char prefixes[TOPIC_ROUTER_MAX_ROUTES + 1][8];
+    for (unsigned i = 0; i <= TOPIC_ROUTER_MAX_ROUTES; i++) {
+        snprintf(prefixes[i], sizeof(prefixes[i]), "p%u/", i);
+        int rc = router.add(prefixes[i], onRoute, (void*)(long) i);
+        CHECK(rc == (i < TOPIC_ROUTER_MAX_ROUTES ? 0 : 1));
+    }
+    CHECK(route(router, "p7/x") && lastRoute == 7);
+}
+
+static void testFields() {
+    TopicFields fields;
+    const char* rest = "reboot/?$rid=42";
+    TopicRouter::parseFields(rest, strlen(rest), fields);
+    CHECK(fieldIs(fields.segment, fields.segmentLength, "reboot"));
+    CHECK(fields.status == -1);
+    CHECK(fieldIs(fields.requestId, fields.requestIdLength, "42"));
+    CHECK(fields.version == -1);
+
+    rest = "200/?$rid=1&$version=17";
+    TopicRouter::parseFields(rest, strlen(rest), fields);
+    CHECK(fields.status == 200);
+    CHECK(fieldIs(fields.requestId, fields.requestIdLength, "1"));
+    CHECK(fields.version == 17);
+
+    rest = "?$version=3";
+    TopicRouter::parseFields(rest, strlen(rest), fields);
+    CHECK(fields.segmentLength == 0 && fields.status == -1);
+    CHECK(fields.requestId == NULL && fields.version == 3);
+
+    // names without values, unknown names, a version that isn't a number
+    rest = "x/?flag&other=1&$rid=&$version=abc";
+    TopicRouter::parseFields(rest, strlen(rest), fields);
+    CHECK(fieldIs(fields.segment, fields.segmentLength, "x"));
+    CHECK(fields.requestId != NULL && fields.requestIdLength == 0);
+    CHECK(fields.version == -1);
+
+    TopicRouter::parseFields("", 0, fields);
+    CHECK(fields.segmentLength == 0 && fields.requestId == NULL && fields.version == -1);
+}
+
+static void testLoopback() {
+    LoopbackDevice device;
+    CHECK(device.start() == 0);
+    IOTContext ctx = device.ctx;
+    // the built-in prefixes can't be taken over
+    CHECK(iotc_on_topic(ctx, "$iothub/methods/POST/", onDeviceEvent, NULL) != 0);
+    CHECK(iotc_on_topic(ctx, "devices/router-device/messages/devicebound/", onDeviceEvent, NULL) == 0);
+    CHECK(device.connect("router-device") == 0);
+
+    CHECK(device.hub.sendMethod("reboot", "{\"delay\":1}") == 0);
+    CHECK(device.hub.sendDesired("{\"fanSpeed\":{\"value\":1},\"$version\":2}") == 0);
+    CHECK(device.hub.sendCloudMessage("router-device", "{\"text\":\"hello\"}") == 0);
+
+    CHECK(device.workUntil(events.commands, 1, 5000));
+    CHECK(device.workUntil(events.settings, 1, 5000));
+    CHECK(device.workUntil(events.topics, 1, 5000));
+    CHECK(events.commands == 1 && strcmp(events.lastCommand, "reboot") == 0);
+    CHECK(events.settings == 1);
+    CHECK(events.topics == 1);
+
+    // removed again; the hub's message finds no route
+    CHECK(iotc_on_topic(ctx, "devices/router-device/messages/devicebound/", NULL, NULL) == 0);
+    CHECK(device.hub.sendCloudMessage("router-device", "{\"text\":\"again\"}") == 0);
+    device.workFor(100);
+    CHECK(events.topics == 1);
+}
+
+int main() {
+    iotc_set_logging(IOTC_LOGGING_DISABLED);
+    testRouting();
+    testFields();
+    testLoopback();
+    return TEST_RESULT();
+}
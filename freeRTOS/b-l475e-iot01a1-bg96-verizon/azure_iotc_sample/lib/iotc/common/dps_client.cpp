@@ -0,0 +1,329 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license.
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+#include "iotc_internal.h"
+
+static bool startsWithNoCase(const char *text, const char *prefix) {
+  for (; *prefix != 0; text++, prefix++) {
+    if (tolower((unsigned char)*text) != *prefix) return false;
+  }
+  return true;
+}
+
+// value of the `name` (lower case) header line, NULL if there is none
+static const char *findHeader(const char *headers, unsigned length,
+                              const char *name) {
+  unsigned nameLength = strlen(name);
+  for (unsigned pos = 0; pos + nameLength < length;) {
+    if (startsWithNoCase(headers + pos, name) &&
+        headers[pos + nameLength] == ':') {
+      const char *value = headers + pos + nameLength + 1;
+      while (*value == ' ') value++;
+      return value;
+    }
+
+    const char *lineEnd =
+        (const char *)memchr(headers + pos, '\n', length - pos);
+    if (lineEnd == NULL) break;
+    pos = (unsigned)(lineEnd - headers) + 1;
+  }
+  return NULL;
+}
+
+static int findJSONString(StringBuffer &buffer, const char *lookFor,
+                          StringBuffer &target) {
+  int index = buffer.indexOf(lookFor, strlen(lookFor), 0);
+  if (index == -1) return 1;
+
+  index += strlen(lookFor);
+  int index2 = buffer.indexOf("\"", 1, index);
+  if (index2 == -1 || index2 == index) return 1;
+
+  target.clear();
+  target.initialize(*buffer + index, index2 - index);
+  return 0;
+}
+
+int DPSClient::begin(const char *dpsEndpoint, const char *scope,
+                     const char *id, const char *deviceKey,
+                     const char *model) {
+  clear();
+  statusCode = 0;
+
+  IOTC_LOG(F("- iotc.dps : getting auth..."));
+  size_t size = 0;
+  authHeader.alloc(STRING_BUFFER_256);
+  if (getDPSAuthString(scope, id, deviceKey, *authHeader, STRING_BUFFER_256,
+                       size)) {
+    IOTC_LOG(F("ERROR: getDPSAuthString has failed"));
+    clear();
+    return 1;
+  }
+  authHeader.setLength(size);
+
+  endpoint.initialize(dpsEndpoint, strlen(dpsEndpoint));
+  scopeId.initialize(scope, strlen(scope));
+  deviceId.initialize(id, strlen(id));
+  if (model != NULL) {
+    modelData.initialize(model, strlen(model));
+  }
+  response.alloc(DPS_RESPONSE_SIZE + 1);
+
+  retryMs = DPS_DEFAULT_RETRY_MS;
+  state = DPS_CONNECT;
+  return 0;
+}
+
+void DPSClient::clear() {
+  closeSession();
+  endpoint.clear();
+  scopeId.clear();
+  deviceId.clear();
+  modelData.clear();
+  authHeader.clear();
+  operationId.clear();
+  hostName.clear();
+  response.clear();
+  state = DPS_IDLE;
+  polls = 0;
+}
+
+void DPSClient::closeSession() {
+  if (sessionOpen) {
+    iotc_socket_close();
+    sessionOpen = false;
+  }
+  sessionRequests = 0;
+}
+
+DPSState DPSClient::step(unsigned long nowMs, unsigned readTimeoutMs) {
+  switch (state) {
+    case DPS_CONNECT:
+      state = connect(nowMs);
+      break;
+    case DPS_SEND:
+      state = send(nowMs);
+      break;
+    case DPS_READ:
+      state = read(nowMs, readTimeoutMs);
+      break;
+    case DPS_WAIT:
+      if ((long)(nowMs - deadlineMs) >= 0) {
+        state = sessionOpen ? DPS_SEND : DPS_CONNECT;
+      }
+      break;
+    default:
+      break;
+  }
+
+  if (state == DPS_DONE || state == DPS_FAILED) {
+    closeSession();
+  }
+  return state;
+}
+
+DPSState DPSClient::connect(unsigned long nowMs) {
+  closeSession();
+  if (iotc_socket_open(*endpoint) != 0) {
+    // the modem may not be ready yet; the poll budget bounds the tries
+    IOTC_LOG(F("ERROR: DPS endpoint %s couldn't be reached."), *endpoint);
+    return retry(nowMs);
+  }
+  sessionOpen = true;
+  return DPS_SEND;
+}
+
+DPSState DPSClient::send(unsigned long nowMs) {
+  StringBuffer deviceIdEncoded(*deviceId, deviceId.getLength());
+  deviceIdEncoded.urlEncode();
+
+  char *data = *response;
+  int size = 0;
+  if (*operationId == NULL) {
+    IOTC_LOG(F("- iotc.dps : getting operation id..."));
+    bool hasModel = *modelData != NULL;
+    const char *modelPrefix = hasModel ? ",\"data\":" : "";
+    const char *model = hasModel ? *modelData : "";
+    int bodySize = snprintf(NULL, 0, "{\"registrationId\":\"%s\"%s%s}",
+                            *deviceId, modelPrefix, model);
+    size = snprintf(data, DPS_RESPONSE_SIZE, F("\
+PUT /%s/registrations/%s/register?api-version=%s HTTP/1.1\r\n\
+Host: %s\r\n\
+content-type: application/json; charset=utf-8\r\n\
+%s\r\n\
+accept: */*\r\n\
+content-length: %d\r\n\
+%s\r\n\
+connection: keep-alive\r\n\
+\r\n\
+{\"registrationId\":\"%s\"%s%s}"),
+                    *scopeId, *deviceIdEncoded,
+                    hasModel ? DPS_MODEL_API_VERSION : DPS_API_VERSION,
+                    *endpoint, AZURE_IOT_CENTRAL_CLIENT_SIGNATURE, bodySize,
+                    *authHeader, *deviceId, modelPrefix, model);
+  } else {
+    IOTC_LOG(F("- iotc.dps : getting host name..."));
+    size = snprintf(data, DPS_RESPONSE_SIZE, F("\
+GET /%s/registrations/%s/operations/%s?api-version=" DPS_API_VERSION " HTTP/1.1\r\n\
+Host: %s\r\n\
+content-type: application/json; charset=utf-8\r\n\
+%s\r\n\
+accept: */*\r\n\
+%s\r\n\
+connection: keep-alive\r\n\
+\r\n"),
+                    *scopeId, *deviceIdEncoded, *operationId, *endpoint,
+                    AZURE_IOT_CENTRAL_CLIENT_SIGNATURE, *authHeader);
+  }
+
+  if (size <= 0 || size >= DPS_RESPONSE_SIZE) {
+    IOTC_LOG(F("ERROR: DPS request doesn't fit into %d bytes"),
+             DPS_RESPONSE_SIZE);
+    return DPS_FAILED;
+  }
+
+  if (iotc_socket_send(data, (uint32_t)size) != pdPASS) {
+    // the service drops idle sessions; go again on a new one
+    bool reused = sessionRequests > 0;
+    closeSession();
+    if (reused) return DPS_CONNECT;
+
+    IOTC_LOG(F("ERROR: DPS request couldn't be sent."));
+    return retry(nowMs);
+  }
+
+  sessionRequests++;
+  received = 0;
+  headerLength = 0;
+  contentLength = 0;
+  hasContentLength = false;
+  keepAlive = true;
+  statusCode = 0;
+  retryMs = DPS_DEFAULT_RETRY_MS;
+  response.setLength(0);
+  deadlineMs = nowMs + IOTC_SERVER_RESPONSE_TIMEOUT * 1000UL;
+  return DPS_READ;
+}
+
+DPSState DPSClient::read(unsigned long nowMs, unsigned timeoutMs) {
+  char *data = *response;
+  long rc = iotc_socket_recv(data + received, DPS_RESPONSE_SIZE - received,
+                             timeoutMs);
+
+  if (rc < 0) {
+    bool reused = sessionRequests > 1;
+    closeSession();
+    if (received == 0 && reused) {
+      return DPS_CONNECT;  // the session was closed under the request
+    }
+    if (headerLength == 0) {
+      IOTC_LOG(F("ERROR: DPS closed the connection before it answered."));
+      return retry(nowMs);
+    }
+    // no content-length; the body ends with the connection
+    return onResponse(nowMs);
+  }
+
+  if (rc == 0) {
+    if ((long)(nowMs - deadlineMs) >= 0) {
+      IOTC_LOG(F("ERROR: DPS didn't answer within %d secs."),
+               IOTC_SERVER_RESPONSE_TIMEOUT);
+      closeSession();
+      return retry(nowMs);
+    }
+    return DPS_READ;
+  }
+
+  unsigned from = received > 3 ? received - 3 : 0;
+  received += (unsigned)rc;
+  response.setLength(received);
+
+  if (headerLength == 0) {
+    int index = response.indexOf("\r\n\r\n", 4, from);
+    if (index == -1) {
+      if (received < DPS_RESPONSE_SIZE) return DPS_READ;
+      IOTC_LOG(F("ERROR: DPS response header doesn't fit into %d bytes"),
+               DPS_RESPONSE_SIZE);
+      closeSession();
+      return retry(nowMs);
+    }
+    headerLength = index + 4;
+    parseHeader();
+  }
+
+  if (hasContentLength && received >= headerLength + contentLength) {
+    return onResponse(nowMs);
+  }
+
+  if (received == DPS_RESPONSE_SIZE) {
+    // the rest of the body is dropped; the session can't take another request
+    closeSession();
+    return onResponse(nowMs);
+  }
+  return DPS_READ;
+}
+
+void DPSClient::parseHeader() {
+  const char *data = *response;
+  statusCode = strncmp(data, "HTTP/1.", 7) == 0 ? atoi(data + 9) : 0;
+
+  const char *value = findHeader(data, headerLength, "content-length");
+  if (value != NULL) {
+    hasContentLength = true;
+    contentLength = (unsigned)strtoul(value, NULL, 10);
+  }
+
+  // HTTP/1.1 sessions are kept alive unless the service says otherwise
+  value = findHeader(data, headerLength, "connection");
+  keepAlive = value == NULL || !startsWithNoCase(value, "close");
+
+  value = findHeader(data, headerLength, "retry-after");
+  if (value != NULL && isdigit((unsigned char)*value)) {
+    unsigned long seconds = strtoul(value, NULL, 10);
+    retryMs = seconds > DPS_MAX_RETRY_MS / 1000 ? DPS_MAX_RETRY_MS
+                                                : (unsigned)seconds * 1000;
+  }
+}
+
+DPSState DPSClient::onResponse(unsigned long nowMs) {
+  if (!keepAlive) {
+    closeSession();
+  }
+
+  // DPS may assign the device with the PUT response already
+  if (findJSONString(response, "\"assignedHub\":\"", hostName) == 0) {
+    return DPS_DONE;
+  }
+
+  bool registering = *operationId == NULL;
+  if (registering) {
+    findJSONString(response, "\"operationId\":\"", operationId);
+  }
+
+  bool throttled = statusCode == 429 || statusCode >= 500;
+  bool assigning =
+      *operationId != NULL && statusCode >= 200 && statusCode < 300 &&
+      response.indexOf("\"status\":\"failed\"", 17, headerLength) == -1 &&
+      response.indexOf("\"status\":\"disabled\"", 19, headerLength) == -1;
+  if (throttled || assigning) {
+    return retry(nowMs);
+  }
+
+  IOTC_LOG(F("ERROR: DPS (%s) request has failed.\r\n%s"),
+           registering ? "PUT" : "GET", *response);
+  return DPS_FAILED;
+}
+
+DPSState DPSClient::retry(unsigned long nowMs) {
+  if (++polls > DPS_MAX_POLLS) {
+    IOTC_LOG(F("ERROR: DPS didn't assign a hub after %d attempts."),
+             DPS_MAX_POLLS);
+    return DPS_FAILED;
+  }
+
+  deadlineMs = nowMs + retryMs;
+  return DPS_WAIT;
+}
@@ -0,0 +1,95 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license.
+
+#ifndef AZURE_IOTC_LITE_DPS_CLIENT_H
+#define AZURE_IOTC_LITE_DPS_CLIENT_H
+
+#include "iotc_definitions.h"
+#include "string_buffer.h"
+
+#define DPS_API_VERSION "2018-11-01"
+#define DPS_MODEL_API_VERSION "2019-01-15"  // registrations with model data
+#define DPS_RESPONSE_SIZE STRING_BUFFER_1024
+#define DPS_DEFAULT_RETRY_MS 2500  // when the service doesn't send Retry-After
+#define DPS_MAX_RETRY_MS 60000
+#define DPS_MAX_POLLS 10
+
+typedef enum DPSState_TAG {
+  DPS_IDLE = 0,
+  DPS_CONNECT,  // opens the TLS session
+  DPS_SEND,     // registration PUT, or operation status GET
+  DPS_READ,     // the response is coming in
+  DPS_WAIT,     // for the next poll (Retry-After)
+  DPS_DONE,     // getHostName() is the assigned hub
+  DPS_FAILED
+} DPSState;
+
+// Device registration with the provisioning service, one step at a time.
+//
+// Every step() does a bounded amount of work (the TLS handshake aside) and
+// returns. The PUT and the operation status polls share one keep-alive
+// session (the iotc_socket_* socket); the session is opened again only if
+// the service closes it. The response is read as it arrives and is complete
+// once `content-length` bytes of body are in.
+//
+// A zeroed client is DPS_IDLE and holds nothing.
+class DPSClient {
+  bool sessionOpen;
+  DPSState state;
+  StringBuffer endpoint;
+  StringBuffer scopeId;
+  StringBuffer deviceId;
+  StringBuffer modelData;  // sent with the PUT (see iotc_set_model_data)
+  StringBuffer authHeader;
+  StringBuffer operationId;
+  StringBuffer hostName;
+  StringBuffer response;  // DPS_RESPONSE_SIZE + \0. the request is formatted here too
+  unsigned received;
+  unsigned headerLength;  // 0 until the empty line is in
+  unsigned contentLength;
+  bool hasContentLength;
+  bool keepAlive;
+  unsigned sessionRequests;  // sent over the current session
+  int statusCode;
+  unsigned retryMs;
+  unsigned polls;
+  unsigned long deadlineMs;  // response timeout (DPS_READ), next poll (DPS_WAIT)
+
+  void closeSession();
+  DPSState connect(unsigned long nowMs);
+  DPSState send(unsigned long nowMs);
+  DPSState read(unsigned long nowMs, unsigned timeoutMs);
+  void parseHeader();
+  DPSState onResponse(unsigned long nowMs);
+  DPSState retry(unsigned long nowMs);
+
+ public:
+  // Starts the registration of deviceId. The strings are copied; modelData
+  // may be NULL.
+  // returns 0 if there is no error
+  int begin(const char *endpoint, const char *scopeId, const char *deviceId,
+            const char *key, const char *modelData);
+  // Closes the session and drops everything (back to DPS_IDLE)
+  void clear();
+
+  // Moves the registration one step further. A read waits for up to
+  // readTimeoutMs for the response.
+  DPSState step(unsigned long nowMs, unsigned readTimeoutMs);
+
+  DPSState getState() { return state; }
+  bool isBusy() {
+    return state != DPS_IDLE && state != DPS_DONE && state != DPS_FAILED;
+  }
+  // how long step() has nothing to do
+  unsigned long getWaitMs(unsigned long nowMs) {
+    return state == DPS_WAIT && deadlineMs - nowMs <= DPS_MAX_RETRY_MS
+               ? deadlineMs - nowMs
+               : 0;
+  }
+  // HTTP status of the last response (0 if none); kept by clear()
+  int getStatusCode() { return statusCode; }
+
+  StringBuffer &getHostName() { return hostName; }
+};
+
+#endif  // AZURE_IOTC_LITE_DPS_CLIENT_H
@@ -130,8 +130,49 @@ int iotc_set_model_data(IOTContext ctx, const char* modelData) {
   return internal->modelData != NULL;
 }
 
+/* extern */
+int iotc_set_inflight_window(IOTContext ctx, unsigned window) {
+  CHECK_NOT_NULL(ctx)
+
+  IOTContextInternal* internal = (IOTContextInternal*)ctx;
+  MUST_CALL_AFTER_INIT(internal);
+
+  if (window != 0) {
+    IOTC_LOG(F("ERROR: (iotc_set_inflight_window) Not implemented."));
+    return 1;
+  }
+  return 0;
+}
+
 /* extern */
 int iotc_set_token_expiration(IOTContext ctx, unsigned timeout) {
   setEXPIRES(timeout);
   return 0;
-}
\ No newline at end of file
+}
+
+/* extern */
+int iotc_set_reconnect(IOTContext ctx, unsigned baseMs, unsigned capMs,
+                       unsigned stableMs, unsigned maxAttempts) {
+  CHECK_NOT_NULL(ctx)
+
+  IOTContextInternal* internal = (IOTContextInternal*)ctx;
+  internal->reconnect.configure(baseMs, capMs, stableMs, maxAttempts);
+  return 0;
+}
+
+/* extern */
+int iotc_set_offline_store(IOTContext ctx, const char* path, unsigned slotCount,
+                           unsigned slotSize, unsigned drainIntervalMs) {
+  CHECK_NOT_NULL(ctx)
+
+  IOTContextInternal* internal = (IOTContextInternal*)ctx;
+  internal->store.close();
+  internal->storeDrainMs = drainIntervalMs;
+  if (path == NULL) return 0;
+
+  if (internal->store.open(path, slotCount, slotSize) != 0) {
+    IOTC_LOG(F("ERROR: (iotc_set_offline_store) couldn't open %s"), path);
+    return 1;
+  }
+  return 0;
+}
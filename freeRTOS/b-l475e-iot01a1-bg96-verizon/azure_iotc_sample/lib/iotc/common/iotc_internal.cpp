@@ -266,10 +266,48 @@ void sendOnError(IOTContextInternal *internal, const char *message) {
   }
 }
 
+int cacheTopics(IOTContextInternal *internal) {
+  clearTopics(internal);
+
+  unsigned length = internal->deviceId.getLength() +
+                    strlen(EVENTS_TOPIC_TEMPLATE) - 2 /* %s */;
+  internal->eventsTopic.alloc(length + 1);
+  // + 11 for the request id (%d), + 1 for \0
+  internal->reportedTopic.alloc(REPORTED_TOPIC_PREFIX_LENGTH + 12);
+  if (*internal->eventsTopic == NULL || *internal->reportedTopic == NULL) {
+    IOTC_LOG(F("ERROR: (cacheTopics) out of memory"));
+    clearTopics(internal);
+    return 1;
+  }
+
+  internal->eventsTopic.setLength(snprintf(*internal->eventsTopic, length + 1,
+                                           EVENTS_TOPIC_TEMPLATE,
+                                           *internal->deviceId));
+  memcpy(*internal->reportedTopic, REPORTED_TOPIC_PREFIX,
+         REPORTED_TOPIC_PREFIX_LENGTH);
+  internal->reportedTopic.setLength(REPORTED_TOPIC_PREFIX_LENGTH);
+  return 0;
+}
+
+void clearTopics(IOTContextInternal *internal) {
+  internal->eventsTopic.clear();
+  internal->reportedTopic.clear();
+}
+
+// appends the next request id to the cached reported properties topic
+// returns the length of the topic
+static unsigned nextReportedTopic(IOTContextInternal *internal) {
+  int size = snprintf(*internal->reportedTopic + REPORTED_TOPIC_PREFIX_LENGTH,
+                      12, "%d", internal->messageId++);
+  internal->reportedTopic.setLength(REPORTED_TOPIC_PREFIX_LENGTH + size);
+  return internal->reportedTopic.getLength();
+}
+
 void echoDesired(IOTContextInternal *internal, const char *propertyName,
                  StringBuffer &message, const char *status, int statusCode) {
   jsobject_t rootObject;
-  jsobject_initialize(&rootObject, *message, message.getLength());
+  jsobject_initialize_pooled(&rootObject, *message, message.getLength(),
+                             &internal->echoTokens);
   jsobject_t propertyNameObject;
 
   if (jsobject_get_object_by_name(&rootObject, propertyName,
@@ -282,41 +320,33 @@ void echoDesired(IOTContextInternal *internal, const char *propertyName,
     return;
   }
 
-  char *value = jsobject_get_data_by_name(&propertyNameObject, "value");
+  const char *value = NULL;
+  int valueLength =
+      jsobject_get_data_span_by_name(&propertyNameObject, "value", &value);
+  if (valueLength == -1) {
+    value = "null";
+    valueLength = 4;
+  }
   double desiredVersion = jsobject_get_number_by_name(&rootObject, "$version");
 
   const char *echoTemplate =
-      "{\"%s\":{\"value\":%s,\"statusCode\":%d,\
+      "{\"%s\":{\"value\":%.*s,\"statusCode\":%d,\
 \"status\":\"%s\",\"desiredVersion\":%d}}";
-  uint32_t buffer_size = strlen(echoTemplate) + strlen(value) +
-                         3 /* statusCode */
-                         + 32 /* status */ + 23 /* version max */;
-  buffer_size = iotc_min(buffer_size, 512);
-
   const char *topicName = "$iothub/twin/PATCH/properties/reported/?$rid=%d";
-  DoNode *node = (DoNode *)IOTC_MALLOC(sizeof(DoNode));
-  memset(node, 0, sizeof(DoNode));
-
-  node->topic.alloc(strlen(topicName) + 21);
-  node->topic.setLength(snprintf(*node->topic, strlen(topicName) + 21,
-                                 topicName, internal->messageId++));
-  node->data.alloc(buffer_size);
-  node->data.setLength(snprintf(*node->data, buffer_size, echoTemplate,
-                                propertyName, value, statusCode, status,
-                                (int)desiredVersion));
-
-  IOTC_FREE(value);
-
-  assert(getSingletonContext()->DoNodeMutex != NULL);
-  xSemaphoreTake(getSingletonContext()->DoNodeMutex, portMAX_DELAY);
-  if (getSingletonContext()->DoNodeList == NULL) {
-    getSingletonContext()->DoNodeList = node;
-  } else {
-    DoNode *root = getSingletonContext()->DoNodeList;
-    getSingletonContext()->DoNodeList = node;
-    node->next = root;
+  ResponseSlot *slot = internal->responses.acquire();
+  if (slot != NULL) {
+    int dataLength = snprintf(slot->data, RESPONSE_DATA_SIZE, echoTemplate,
+                              propertyName, valueLength, value, statusCode,
+                              status, (int)desiredVersion);
+    if (dataLength < 0 || dataLength >= RESPONSE_DATA_SIZE) {
+      internal->responses.drop();
+    } else {
+      slot->dataLength = dataLength;
+      slot->topicLength = snprintf(slot->topic, RESPONSE_TOPIC_SIZE, topicName,
+                                   internal->messageId++);
+      internal->responses.commit();
+    }
   }
-  xSemaphoreGive(getSingletonContext()->DoNodeMutex);
 
   jsobject_free(&propertyNameObject);
   jsobject_free(&rootObject);
@@ -351,40 +381,45 @@ static void deviceTwinGetStateCallback(DEVICE_TWIN_UPDATE_STATE update_state,
   assert(internal != NULL);
 
   jsobject_t desired;
-  jsobject_initialize(&desired, *payload, payload.getLength());
+  jsobject_initialize_pooled(&desired, *payload, payload.getLength(),
+                             &internal->twinTokens);
 
   for (unsigned i = 0, count = jsobject_get_count(&desired); i < count;
        i += 2) {
-    char *itemName = jsobject_get_name_at(&desired, i);
-    if (itemName != NULL && itemName[0] != '$') {
-      callDesiredCallback(internal, itemName, payload);
+    const char *itemName = NULL;
+    int itemNameLength = jsobject_get_name_span_at(&desired, i, &itemName);
+    if (itemNameLength > 0 && itemName[0] != '$') {
+      // the callback wants a \0 terminated name
+      StringBuffer name(itemName, itemNameLength);
+      callDesiredCallback(internal, *name, payload);
     }
-    if (itemName) IOTC_FREE(itemName);
   }
   jsobject_free(&desired);
 }
 
-void sendDoNodes() {
-  if (getSingletonContext()->DoNodeMutex == NULL) {
-    getSingletonContext()->DoNodeMutex = xSemaphoreCreateMutex();
-  }
-
-  xSemaphoreTake(getSingletonContext()->DoNodeMutex, portMAX_DELAY);
-  while (getSingletonContext()->DoNodeList != NULL) {
-    DoNode *root = getSingletonContext()->DoNodeList;
-    getSingletonContext()->DoNodeList = getSingletonContext()->DoNodeList->next;
+void sendResponses() {
+  IOTContextInternal *internal = getSingletonContext();
+  if (internal == NULL) return;
 
-    if (mqtt_publish(getSingletonContext(), *root->topic,
-                     root->topic.getLength(), *root->data,
-                     root->data.getLength()) != 0) {
+  ResponseRing &ring = internal->responses;
+  for (ResponseSlot *slot = ring.peek(); slot != NULL; slot = ring.peek()) {
+    if (mqtt_publish(internal, slot->topic, slot->topicLength, slot->data,
+                     slot->dataLength) != 0) {
       IOTC_LOG(F("ERROR: mqtt_publish has failed during C2D with response "
-                 "topic '%s' and response '%s'"),
-               *root->topic, *root->data);
+                 "topic '%s' and response '%.*s'"),
+               slot->topic, (int)slot->dataLength, slot->data);
     }
-    sendConfirmationCallback(*root->data, root->data.getLength());
-    IOTC_FREE(root);
+    sendConfirmationCallback(slot->data, slot->dataLength);
+    ring.release();
+  }
+
+  unsigned dropped = ring.takeDropped();
+  if (dropped > 0) {
+    IOTC_LOG(F("ERROR: %u method responses / property echoes were dropped. "
+               "(RESPONSE_RING_SLOTS %d, RESPONSE_DATA_SIZE %d)"),
+             dropped, RESPONSE_RING_SLOTS, RESPONSE_DATA_SIZE);
+    sendOnError(internal, "responses were dropped");
   }
-  xSemaphoreGive(getSingletonContext()->DoNodeMutex);
 }
 
 void handlePayload(char *msg, unsigned long msg_length, char *topic,
@@ -437,27 +472,24 @@ void handlePayload(char *msg, unsigned long msg_length, char *topic,
         constResponse = response;
       }
 
-      DoNode *node = (DoNode *)IOTC_MALLOC(sizeof(DoNode));
-      memset(node, 0, sizeof(DoNode));
-
-      node->topic.alloc(STRING_BUFFER_128);
-      node->topic.setLength(snprintf(*node->topic, STRING_BUFFER_128,
-                                     "$iothub/methods/res/%d/?$rid=%s", rc,
-                                     topicId));
-      node->data.alloc(respSize);
-      memcpy(*node->data, constResponse, respSize);
-      node->data.setLength(respSize);
-
-      assert(getSingletonContext()->DoNodeMutex != NULL);
-      xSemaphoreTake(getSingletonContext()->DoNodeMutex, portMAX_DELAY);
-      if (getSingletonContext()->DoNodeList == NULL) {
-        getSingletonContext()->DoNodeList = node;
-      } else {
-        DoNode *root = getSingletonContext()->DoNodeList;
-        getSingletonContext()->DoNodeList = node;
-        node->next = root;
+      // the MQTT agent task runs this; the response goes out with do_work
+      ResponseRing &ring = getSingletonContext()->responses;
+      ResponseSlot *slot = ring.acquire();
+      if (slot != NULL) {
+        int topicLength =
+            snprintf(slot->topic, RESPONSE_TOPIC_SIZE,
+                     "$iothub/methods/res/%d/?$rid=%s", rc, topicId);
+        if (respSize >= RESPONSE_DATA_SIZE || topicLength < 0 ||
+            topicLength >= RESPONSE_TOPIC_SIZE) {
+          ring.drop();
+        } else {
+          memcpy(slot->data, constResponse, respSize);
+          slot->data[respSize] = 0;
+          slot->dataLength = respSize;
+          slot->topicLength = topicLength;
+          ring.commit();
+        }
       }
-      xSemaphoreGive(getSingletonContext()->DoNodeMutex);
 
       if (response != constResponse) {
         IOTC_FREE(response);
@@ -469,6 +501,54 @@ void handlePayload(char *msg, unsigned long msg_length, char *topic,
   }
 }
 
+// keeps telemetry that couldn't be sent for drainStore
+// returns 0 if it was stored
+static int storeMessage(IOTContextInternal *internal, const char *payload,
+                        unsigned length) {
+  if (!internal->store.isOpen()) return 1;
+
+  // no wall clock here (see getNow); it goes without a creation time
+  if (internal->store.append(payload, length, 0) != 0) {
+    IOTC_LOG(F("ERROR: (storeMessage) the message couldn't be stored."));
+    return 1;
+  }
+  return 0;
+}
+
+void drainStore(IOTContextInternal *internal, unsigned long nowMs) {
+  AzureIOT::MessageStore &store = internal->store;
+  if (internal->mqttClient == NULL || !store.isOpen() || store.isEmpty()) {
+    return;
+  }
+
+  if (nowMs - internal->lastDrainMs < internal->storeDrainMs) return;
+  internal->lastDrainMs = nowMs;
+
+  StringBuffer message;
+  unsigned long timestamp = 0;
+  if (store.peek(message, timestamp) != 0) return;
+
+  if (mqtt_publish(internal, *internal->eventsTopic,
+                   internal->eventsTopic.getLength(), *message,
+                   message.getLength()) != 0) {
+    return;  // tried again on the next turn
+  }
+
+  // popped first: a MessageSent handler may call iotc_do_work
+  store.pop();
+  sendConfirmationCallback(*message, message.getLength());
+}
+
+unsigned long getStoreWaitMs(IOTContextInternal *internal,
+                             unsigned long nowMs) {
+  AzureIOT::MessageStore &store = internal->store;
+  if (!store.isOpen() || store.isEmpty()) return IOTC_MAX_WAIT_MS;
+
+  unsigned long sinceMs = nowMs - internal->lastDrainMs;
+  return sinceMs >= internal->storeDrainMs ? 0
+                                           : internal->storeDrainMs - sinceMs;
+}
+
 /* extern */
 int iotc_send_telemetry(IOTContext ctx, const char *payload, unsigned length) {
   return iotc_send_telemetry_with_system_properties(ctx, payload, length, NULL,
@@ -484,6 +564,11 @@ int iotc_send_telemetry_with_system_properties(IOTContext ctx,
   CHECK_NOT_NULL(payload)
 
   IOTContextInternal *internal = (IOTContextInternal *)ctx;
+  if (internal->mqttClient == NULL && internal->store.isOpen() &&
+      sysPropPayloadLength == 0) {
+    // offline; iotc_do_work sends it once connected again
+    return storeMessage(internal, payload, length);
+  }
   MUST_CALL_AFTER_CONNECT(internal);
 
   if ((sysPropPayload == NULL && sysPropPayloadLength != 0) ||
@@ -494,20 +579,24 @@ int iotc_send_telemetry_with_system_properties(IOTContext ctx,
     return 1;
   }
 
-  StringBuffer topic(internal->deviceId.getLength() +
-                               strlen("devices/ /messages/events/") +
-                               sysPropPayloadLength);
+  const char *topic = *internal->eventsTopic;
+  unsigned topicLength = internal->eventsTopic.getLength();
+  StringBuffer sysPropTopic;
   if (sysPropPayloadLength > 0) {
-    topic.setLength(
-        snprintf(*topic, topic.getLength(), "devices/%s/messages/events/%.*s",
-                 *internal->deviceId, sysPropPayloadLength, sysPropPayload));
-  } else {
-    topic.setLength(snprintf(*topic, topic.getLength(),
-                             "devices/%s/messages/events/",
-                             *internal->deviceId));
+    // system properties change per message. only this case allocates
+    sysPropTopic.alloc(topicLength + sysPropPayloadLength + 1);
+    memcpy(*sysPropTopic, topic, topicLength);
+    memcpy(*sysPropTopic + topicLength, sysPropPayload, sysPropPayloadLength);
+    sysPropTopic.setLength(topicLength + sysPropPayloadLength);
+    topic = *sysPropTopic;
+    topicLength = sysPropTopic.getLength();
   }
 
-  if (mqtt_publish(internal, *topic, topic.getLength(), payload, length) != 0) {
+  if (mqtt_publish(internal, topic, topicLength, payload, length) != 0) {
+    if (sysPropPayloadLength == 0 &&
+        storeMessage(internal, payload, length) == 0) {
+      return 0;
+    }
     IOTC_LOG("ERROR: (iotc_send_telemetry) MQTTClient publish has failed => %s",
              payload);
     return 1;
@@ -525,13 +614,9 @@ int iotc_send_property(IOTContext ctx, const char *payload, unsigned length) {
   IOTContextInternal *internal = (IOTContextInternal *)ctx;
   MUST_CALL_AFTER_CONNECT(internal);
 
-  const char *topicName = "$iothub/twin/PATCH/properties/reported/?$rid=%d";
-  StringBuffer topic(strlen(topicName) +
-                     21);  // + 2 for %d == +23 in case requestId++ overflows
-  topic.setLength(
-      snprintf(*topic, topic.getLength(), topicName, internal->messageId++));
-
-  if (mqtt_publish(internal, *topic, topic.getLength(), payload, length) != 0) {
+  unsigned topicLength = nextReportedTopic(internal);
+  if (mqtt_publish(internal, *internal->reportedTopic, topicLength, payload,
+                   length) != 0) {
     IOTC_LOG(F("ERROR: (iotc_send_property) MQTTClient publish has failed."));
     return 1;
   }
@@ -555,11 +640,12 @@ int iotc_init_context(IOTContext *ctx) {
   IOTContextInternal *internal =
       (IOTContextInternal *)IOTC_MALLOC(sizeof(IOTContextInternal));
   CHECK_NOT_NULL(internal);
+  // no constructors run: every member (StringBuffer, DPSClient, ResponseRing,
+  // ...) is in its initial, empty state when all of its bytes are zero
   memset(internal, 0, sizeof(IOTContextInternal));
   *ctx = (void *)internal;
 
   setSingletonContext(internal);
-  sendDoNodes();
 
   return 0;
 }
@@ -10,12 +10,16 @@
 
 #include <assert.h>
 #include <limits.h>
-#include <semphr.h>  // mutex
 #include <stdarg.h>
 #include <stddef.h>  // size_t etc.
 #include <stdio.h>
 #include <string.h>
 #include "../iotc.h"
+#include "dps_client.h"
+#include "iotc_json.h"
+#include "message_store.h"
+#include "reconnect_policy.h"
+#include "response_ring.h"
 #include "string_buffer.h"
 
 #define AZ_IOT_HUB_MAX_LEN 1024
@@ -42,13 +46,6 @@ typedef struct CallbackBase_TAG {
 
 typedef void* Socket_t;
 
-struct DoNode {
-  StringBuffer topic;
-  StringBuffer data;
-
-  DoNode* next;
-};
-
 typedef struct IOTContextInternal_TAG {
   char* endpoint;
   char* modelData;
@@ -57,10 +54,35 @@ typedef struct IOTContextInternal_TAG {
 
   int messageId;
   StringBuffer deviceId;
+  // formatted once per connect (see cacheTopics)
+  StringBuffer eventsTopic;    // devices/<deviceId>/messages/events/
+  StringBuffer reportedTopic;  // REPORTED_TOPIC_PREFIX + room for the request id
+  // the hub's connection string; a reconnect signs a fresh SAS token with it
+  StringBuffer connectionString;
+  // when to open the hub connection again (see iotc_set_reconnect)
+  AzureIOT::ReconnectPolicy reconnect;
+  // set by the MQTT agent task once the broker dropped the connection.
+  // iotc_do_work closes it and schedules the reconnect
+  volatile bool hubLost;
+  // telemetry that couldn't be sent (see iotc_set_offline_store)
+  AzureIOT::MessageStore store;
+  unsigned storeDrainMs;
+  unsigned long lastDrainMs;
   MQTTAgentHandle_t mqttClient;
   Socket_t xSocket;
-  DoNode* DoNodeList;
-  SemaphoreHandle_t DoNodeMutex;
+  // method responses and desired property echoes, queued by the MQTT agent
+  // task and sent by iotc_do_work (see sendResponses)
+  ResponseRing responses;
+  // called by the MQTT agent task once responses are queued (see
+  // iotc_set_wake_callback)
+  IOTWakeCallback wakeCallback;
+  void* wakeContext;
+  // json tokens, kept between messages. echoDesired parses the document
+  // again while the twin callback still holds twinTokens
+  jstoken_pool_t twinTokens;
+  jstoken_pool_t echoTokens;
+  // registration with the provisioning service (see getHubHostName)
+  DPSClient dps;
 } IOTContextInternal;
 
 #define CHECK_NOT_NULL(x)             \
@@ -127,6 +149,10 @@ typedef enum DEVICE_TWIN_UPDATE_STATE_TAG {
   DEVICE_TWIN_UPDATE_ALL = 1
 } DEVICE_TWIN_UPDATE_STATE;
 
+#define EVENTS_TOPIC_TEMPLATE "devices/%s/messages/events/"
+#define REPORTED_TOPIC_PREFIX "$iothub/twin/PATCH/properties/reported/?$rid="
+#define REPORTED_TOPIC_PREFIX_LENGTH (sizeof(REPORTED_TOPIC_PREFIX) - 1)
+
 #define HOSTNAME_STRING "HostName="
 #define DEVICEID_STRING ";DeviceId="
 #define KEY_STRING ";SharedAccessKey="
@@ -154,6 +180,10 @@ IOTLogLevel getLogLevel();
 
 void handlePayload(char* msg, unsigned long msg_length, char* topic,
                    unsigned long topic_length);
+// Registers deviceId with DPS (internal->dps) and copies the assigned hub
+// into hostName (STRING_BUFFER_128 + 1 bytes). Polls as often as the
+// service's Retry-After asks, over one keep-alive session.
+// returns 0 if there is no error
 int getHubHostName(IOTContextInternal* internal, const char* dpsEndpoint,
                    const char* scopeId, const char* deviceId, const char* key,
                    char* hostName);
@@ -167,16 +197,48 @@ int mqtt_publish(IOTContextInternal* internal, const char* topic,
                  unsigned long topic_length, const char* msg,
                  unsigned long msg_length);
 
+// The medium of the offline store (see MessageStore): a region of the
+// internal flash (see IOTC_STORE_FLASH_ADDRESS), `size` bytes of it.
+// returns NULL if it can't be opened
+void* iotc_store_open(const char* path, unsigned long size);
+void iotc_store_close(void* medium);
+// returns 0 if all `length` bytes were read
+int iotc_store_read(void* medium, unsigned long offset, void* data,
+                    unsigned length);
+// returns 0 once all `length` bytes are written
+int iotc_store_write(void* medium, unsigned long offset, const void* data,
+                     unsigned length);
+
+// Sends the next stored message when it's time. Call it from iotc_do_work
+void drainStore(IOTContextInternal* internal, unsigned long nowMs);
+// how long until drainStore has a message to send (IOTC_MAX_WAIT_MS if there
+// is none)
+unsigned long getStoreWaitMs(IOTContextInternal* internal, unsigned long nowMs);
+
+// Formats the telemetry and reported property topics for internal->deviceId.
+// Call it from iotc_connect, once deviceId is known.
+// returns 0 if there is no error
+int cacheTopics(IOTContextInternal *internal);
+void clearTopics(IOTContextInternal *internal);
+
 void iotc_socket_close();
-int iotc_socket_open();
+int iotc_socket_open(const char* endpoint);
 long iotc_socket_send(const char* pcPayload, const uint32_t ulPayloadSize);
-long iotc_socket_read(char* pcBuffer, const uint32_t ulBufferSize,
-                      uint32_t* pulDataRecvSize);
-
-int iotc_mqtt_connect(const char* hubEndpoint, char* username, char* password);
+// Waits for up to ulTimeoutMs for data
+// returns the number of bytes read, 0 on timeout, -1 if the session is gone
+long iotc_socket_recv(char* pcBuffer, const uint32_t ulBufferSize,
+                      const uint32_t ulTimeoutMs);
+
+// Connects the MQTT agent to hubEndpoint. The connect is tried up to `tries`
+// times, with jittered backoff in between
+// returns 0 if there is no error
+int iotc_mqtt_connect(const char* hubEndpoint, char* username, char* password,
+                      unsigned tries);
 int iotc_mqtt_subscribe(const char* topic);
 
-void sendDoNodes();
+// Sends the queued method responses and desired property echoes, oldest
+// first, and reports the ones that were dropped. Call it from iotc_do_work
+void sendResponses();
 
 void vLoggingPrintf(const char* pcFormat, ...);
 #define IOTC_LOG(...)                          \
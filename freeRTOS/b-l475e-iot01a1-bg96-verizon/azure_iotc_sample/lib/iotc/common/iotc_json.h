@@ -11,16 +11,36 @@
 extern "C" {
 #endif
 
+// Token storage that is kept from one message to the next. It grows to the
+// largest document seen and is lent to one object at a time (see
+// jsobject_initialize_pooled). Zero initialized memory is an empty pool.
+typedef struct jstoken_pool_t_tag {
+  jsmntok_t *tokens;
+  unsigned capacity;
+  int busy;
+} jstoken_pool_t;
+
+void jstoken_pool_free(jstoken_pool_t *pool);
+
 typedef struct jsobject_t_tag {
   const char *json;
   unsigned length;
   jsmn_parser parser;
   jsmntok_t *tokens;
   int tokenCount;
+  jstoken_pool_t *pool;  // tokens were borrowed from the pool
+  int ownsTokens;        // tokens were malloc'ed for this object
 } jsobject_t;
 
+// returns 0 if there is no error, a JSMN_ERROR_* otherwise
 int jsobject_initialize(jsobject_t *object, const char *js, unsigned len);
 
+// Same as jsobject_initialize, with the tokens borrowed from the pool until
+// jsobject_free. Falls back to malloc while the pool is lent to another
+// object.
+int jsobject_initialize_pooled(jsobject_t *object, const char *js,
+                               unsigned len, jstoken_pool_t *pool);
+
 int jsobject_compare(jsobject_t *object, int index, const char *s);
 
 // caller responsible from free'ing the memory
@@ -29,6 +49,19 @@ char *jsobject_get_name_at(jsobject_t *object, int index);
 // caller responsible from free'ing the memory
 char *jsobject_get_string_at(jsobject_t *object, int index);
 
+// Span variants of the accessors. *out points into the json given to
+// jsobject_initialize; nothing is copied and it isn't \0 terminated.
+// return the length of the span, -1 if there is nothing at index/name
+int jsobject_get_name_span_at(jsobject_t *object, int index,
+                              const char **out);
+int jsobject_get_string_span_at(jsobject_t *object, int index,
+                                const char **out);
+int jsobject_get_string_span_by_name(jsobject_t *object, const char *name,
+                                     const char **out);
+// strings keep their quotes (see jsobject_get_data_by_name)
+int jsobject_get_data_span_by_name(jsobject_t *object, const char *name,
+                                   const char **out);
+
 unsigned jsobject_get_count(jsobject_t *object);
 
 int jsobject_get_index_by_name(jsobject_t *object, const char *name);
@@ -38,6 +71,8 @@ double jsobject_get_number_by_name(jsobject_t *object, const char *name);
 // caller responsible from free'ing the memory
 char *jsobject_get_string_by_name(jsobject_t *object, const char *name);
 
+// out shares the tokens of object (no parse, no allocation); free out
+// before object. returns 0 if there is no error
 int jsobject_get_object_by_name(jsobject_t *object, const char *name,
                                 jsobject_t *out);
 
@@ -0,0 +1,79 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license.
+
+#include "iotc_internal.h"
+
+namespace AzureIOT {
+
+void ReconnectPolicy::configure(unsigned base, unsigned cap, unsigned stable,
+                                unsigned maxTries) {
+  baseMs = base;
+  capMs = iotc_max(cap, base);
+  stableMs = stable;
+  maxAttempts = maxTries;
+  attempts = 0;
+  refused = 0;
+  delayMs = base;
+  pending = false;
+}
+
+void ReconnectPolicy::seed(unsigned long value) {
+  random ^= value;
+}
+
+unsigned long ReconnectPolicy::nextRandom() {
+  // xorshift32; zero would stay zero
+  unsigned long x = random & 0xFFFFFFFFUL;
+  if (x == 0) x = 0x9E3779B9UL;
+  x ^= (x << 13) & 0xFFFFFFFFUL;
+  x ^= x >> 17;
+  x ^= (x << 5) & 0xFFFFFFFFUL;
+  random = x;
+  return x;
+}
+
+void ReconnectPolicy::onConnected(unsigned long nowMs) {
+  connected = true;
+  connectedMs = nowMs;
+  pending = false;
+}
+
+long ReconnectPolicy::schedule(unsigned long nowMs,
+                               IOTConnectionState reason) {
+  if (!isEnabled()) return -1;
+
+  if (connected) {
+    connected = false;
+    if (nowMs - connectedMs >= stableMs) {
+      attempts = 0;
+      refused = 0;
+      delayMs = baseMs;
+    }
+  }
+
+  pending = false;
+  if (reason == IOTC_CONNECTION_DEVICE_DISABLED) return -1;
+  if (reason == IOTC_CONNECTION_BAD_CREDENTIAL &&
+      ++refused > RECONNECT_MAX_REFUSED) {
+    return -1;
+  }
+  if (maxAttempts != 0 && attempts >= maxAttempts) return -1;
+  attempts++;
+
+  unsigned long waitMs = 0;
+  if (reason == IOTC_CONNECTION_EXPIRED_SAS_TOKEN) {
+    waitMs = nextRandom() % baseMs;
+  } else {
+    // decorrelated jitter: [base, 3 * previous], capped
+    unsigned long upper = iotc_min(delayMs * 3, (unsigned long) capMs);
+    delayMs = upper > baseMs ? baseMs + nextRandom() % (upper - baseMs + 1)
+                             : baseMs;
+    waitMs = delayMs;
+  }
+
+  dueMs = nowMs + waitMs;
+  pending = true;
+  return (long) waitMs;
+}
+
+}  // namespace AzureIOT
@@ -0,0 +1,81 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license.
+
+#ifndef AZURE_IOTC_LITE_RECONNECT_POLICY_H
+#define AZURE_IOTC_LITE_RECONNECT_POLICY_H
+
+#include "../iotc.h"
+
+#define RECONNECT_DEFAULT_BASE_MS   1000
+#define RECONNECT_DEFAULT_CAP_MS    300000  // 5 minutes
+#define RECONNECT_DEFAULT_STABLE_MS 60000
+// refused connects (IOTC_CONNECTION_BAD_CREDENTIAL) before it gives up
+#define RECONNECT_MAX_REFUSED 3
+
+namespace AzureIOT {
+
+// When to try the hub connection again, after it was lost.
+//
+// The delays follow "decorrelated jitter": every delay is picked at random
+// between baseMs and three times the previous one, and capped at capMs.
+// Devices that lost the connection at the same moment spread out instead of
+// coming back in lockstep. A connection that stayed up for stableMs starts
+// over at baseMs; one that drops right away keeps backing off.
+//
+// The reason decides what happens:
+//   EXPIRED_SAS_TOKEN     right away (within baseMs); a fresh token fixes it
+//   DISCONNECTED, NO_NETWORK, COMMUNICATION_ERROR
+//                         backs off
+//   BAD_CREDENTIAL        backs off, gives up after RECONNECT_MAX_REFUSED
+//   DEVICE_DISABLED       gives up
+// and it gives up after maxAttempts (0: no limit) tries without a stable
+// connection in between.
+//
+// Disabled while zeroed; configure() turns it on.
+class ReconnectPolicy {
+  unsigned baseMs;
+  unsigned capMs;
+  unsigned stableMs;
+  unsigned maxAttempts;
+  unsigned attempts;  // since the last stable connection
+  unsigned refused;
+  unsigned long delayMs;  // the last backoff delay
+  unsigned long dueMs;
+  unsigned long connectedMs;
+  bool connected;
+  bool pending;
+  unsigned long random;  // xorshift state
+
+  unsigned long nextRandom();
+
+ public:
+  // baseMs == 0 disables it
+  void configure(unsigned baseMs, unsigned capMs, unsigned stableMs,
+                 unsigned maxAttempts);
+  // mixes a device specific value (i.e. a hash of the device id) into the
+  // jitter
+  void seed(unsigned long value);
+
+  bool isEnabled() { return baseMs != 0; }
+  bool isPending() { return pending; }
+  bool isDue(unsigned long nowMs) {
+    return pending && (long)(nowMs - dueMs) >= 0;
+  }
+  // how long until the next try (0 when it is due or nothing is pending)
+  unsigned long getWaitMs(unsigned long nowMs) {
+    return pending && (long)(dueMs - nowMs) > 0 ? dueMs - nowMs : 0;
+  }
+  unsigned getAttempts() { return attempts; }
+
+  // the connection is up
+  void onConnected(unsigned long nowMs);
+  // The connection is gone (or a try has failed) for `reason`.
+  // returns the delay until the next try, -1 if it gives up
+  long schedule(unsigned long nowMs, IOTConnectionState reason);
+  // nothing is pending anymore, the backoff stays (i.e. iotc_disconnect)
+  void cancel() { pending = false; }
+};
+
+}  // namespace AzureIOT
+
+#endif  // AZURE_IOTC_LITE_RECONNECT_POLICY_H
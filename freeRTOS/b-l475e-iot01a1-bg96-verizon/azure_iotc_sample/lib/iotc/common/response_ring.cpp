@@ -0,0 +1,43 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license.
+
+#include "response_ring.h"
+
+#if (RESPONSE_RING_SLOTS & (RESPONSE_RING_SLOTS - 1)) != 0
+#error RESPONSE_RING_SLOTS must be a power of two
+#endif
+
+// the slot contents are visible before the index that hands them over (and
+// the other way around); a full barrier on Cortex-M (dmb)
+#define RING_BARRIER() __sync_synchronize()
+
+ResponseSlot* ResponseRing::acquire() {
+  if (head - tail == RESPONSE_RING_SLOTS) {
+    drop();
+    return NULL;
+  }
+  return &slots[head & (RESPONSE_RING_SLOTS - 1)];
+}
+
+void ResponseRing::commit() {
+  RING_BARRIER();
+  head = head + 1;
+}
+
+ResponseSlot* ResponseRing::peek() {
+  if (head == tail) return NULL;
+  RING_BARRIER();
+  return &slots[tail & (RESPONSE_RING_SLOTS - 1)];
+}
+
+void ResponseRing::release() {
+  RING_BARRIER();
+  tail = tail + 1;
+}
+
+unsigned ResponseRing::takeDropped() {
+  unsigned count = dropped;
+  unsigned delta = count - reported;
+  reported = count;
+  return delta;
+}
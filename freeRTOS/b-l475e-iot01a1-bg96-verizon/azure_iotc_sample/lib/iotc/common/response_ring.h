@@ -0,0 +1,65 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license.
+
+#ifndef AZURE_IOTC_LITE_RESPONSE_RING_H
+#define AZURE_IOTC_LITE_RESPONSE_RING_H
+
+#include <stddef.h>  // NULL
+#include "iotc_definitions.h"
+
+// responses waiting for iotc_do_work (a power of two)
+#ifndef RESPONSE_RING_SLOTS
+#define RESPONSE_RING_SLOTS 4
+#endif
+
+#ifndef RESPONSE_TOPIC_SIZE
+#define RESPONSE_TOPIC_SIZE STRING_BUFFER_128
+#endif
+
+#ifndef RESPONSE_DATA_SIZE
+#define RESPONSE_DATA_SIZE STRING_BUFFER_512
+#endif
+
+typedef struct ResponseSlot_TAG {
+  char topic[RESPONSE_TOPIC_SIZE];
+  char data[RESPONSE_DATA_SIZE];
+  unsigned topicLength;
+  unsigned dataLength;
+} ResponseSlot;
+
+// Method responses and desired property echoes on their way from the MQTT
+// agent task (producer) to the task that runs iotc_do_work (consumer).
+//
+// A single-producer / single-consumer ring of preallocated slots: head is
+// only written by the producer, tail only by the consumer, so neither side
+// takes a lock and the agent task never waits. Responses go out in the
+// order they were queued. When the ring is full, or a response is too long
+// for a slot, the response is dropped and counted.
+//
+// A zeroed ring is empty.
+class ResponseRing {
+  ResponseSlot slots[RESPONSE_RING_SLOTS];
+  volatile unsigned head;     // next slot to fill
+  volatile unsigned tail;     // next slot to send
+  volatile unsigned dropped;  // written by the producer
+  unsigned reported;          // dropped, as the consumer last saw it
+
+ public:
+  // producer: the slot to fill, NULL (and counted) if the ring is full.
+  // The slot is queued by commit()
+  ResponseSlot* acquire();
+  void commit();
+  // producer: counts a response that couldn't be queued
+  void drop() { dropped = dropped + 1; }
+
+  // consumer: the oldest queued response, NULL if there is none. It stays
+  // queued until release()
+  ResponseSlot* peek();
+  void release();
+  // consumer: responses dropped since the last call
+  unsigned takeDropped();
+  // nothing queued and no drop to report
+  bool isIdle() { return head == tail && dropped == reported; }
+};
+
+#endif  // AZURE_IOTC_LITE_RESPONSE_RING_H
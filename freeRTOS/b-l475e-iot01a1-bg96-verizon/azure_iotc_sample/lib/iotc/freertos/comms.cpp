@@ -8,21 +8,19 @@
 
 #include "aws_secure_sockets.h"
 
+// the most iotc_mqtt_connect waits between two of its tries
+#define MQTT_CONNECT_CAP_MS 8000
+
 void iotc_socket_close() { SOCKETS_Close(getSingletonContext()->xSocket); }
 
-int iotc_socket_open() {
+int iotc_socket_open(const char *endpoint) {
   assert(getSingletonContext() != NULL);
-  const char *endpoint = getSingletonContext()->endpoint == NULL
-                             ? DEFAULT_ENDPOINT
-                             : getSingletonContext()->endpoint;
 
   SocketsSockaddr_t socko = {0};
   socko.usPort = SOCKETS_htons(AZURE_HTTPS_SERVER_PORT);
   socko.ulAddress = SOCKETS_GetHostByName(endpoint);
   if (socko.ulAddress == 0) {
-    // possibly modem is not ready
-    WAITMS(1200);
-    return -1;
+    return -1;  // possibly modem is not ready
   }
 
   Socket_t xSocket =
@@ -63,7 +61,7 @@ int iotc_socket_open() {
     }
     return -1;
   }
-  IOTC_LOG("- OpenSocket @global.azure-devices-provisioning.net");
+  IOTC_LOG("- OpenSocket @%s", endpoint);
   return 0;
 }
 
@@ -100,42 +98,24 @@ long iotc_socket_send(const char *pcPayload, const uint32_t ulPayloadSize) {
   return xStatus;
 }
 
-long iotc_socket_read(char *pcBuffer, const uint32_t ulBufferSize,
-                      uint32_t *pulDataRecvSize) {
-  int32_t lTmpStatus = 0;
-  BaseType_t xStatus = pdFAIL;
-  int retry = 0;
-
-  assert(pulDataRecvSize != NULL);
+long iotc_socket_recv(char *pcBuffer, const uint32_t ulBufferSize,
+                      const uint32_t ulTimeoutMs) {
   assert(pcBuffer != NULL);
+  Socket_t xSocket = getSingletonContext()->xSocket;
 
-  for (; retry < 3; retry++) {
-    lTmpStatus =
-        SOCKETS_Recv(getSingletonContext()->xSocket, (unsigned char *)pcBuffer,
-                     (uint32_t)ulBufferSize, (uint32_t)0);
-
-    if (lTmpStatus != 0) {
-      if (lTmpStatus < 0) {
-        IOTC_LOG("SecureConnect - recv error, %d", lTmpStatus);
-        xStatus = pdFAIL;
-      } else {
-        xStatus = pdPASS;
-      }
-
-      break;
-    } else {
-      /* It is a timeout, retry. */
-      IOTC_LOG("SecureConnect - recv Timeout");
-    }
-  }
+  // a zero timeout may block for good on some ports
+  TickType_t xReceiveTimeOut = pdMS_TO_TICKS(ulTimeoutMs);
+  if (xReceiveTimeOut == 0) xReceiveTimeOut = 1;
+  SOCKETS_SetSockOpt(xSocket, 0, SOCKETS_SO_RCVTIMEO, &xReceiveTimeOut,
+                     sizeof(xReceiveTimeOut));
 
-  if (retry == 3) {
-    IOTC_LOG("SecureConnect - recv number of Timeout exceeded");
-    xStatus = pdFAIL;
+  int32_t lStatus = SOCKETS_Recv(xSocket, (unsigned char *)pcBuffer,
+                                 (uint32_t)ulBufferSize, (uint32_t)0);
+  if (lStatus < 0) {
+    IOTC_LOG("SecureConnect - recv error, %d", lStatus);
+    return -1;
   }
-
-  *pulDataRecvSize = (uint32_t)lTmpStatus;
-  return xStatus;
+  return lStatus;  // 0: nothing arrived in time
 }
 
 int mqtt_publish(IOTContextInternal *internal, const char *topic,
@@ -157,19 +137,29 @@ int mqtt_publish(IOTContextInternal *internal, const char *topic,
   return (xReturned == eMQTTAgentSuccess) ? 0 : 1;
 }
 
+// the agent task queued responses (or dropped some), or lost the connection;
+// iotc_do_work has work
+static void wakeWorker(IOTContextInternal *internal) {
+  if (internal->wakeCallback != NULL &&
+      (!internal->responses.isIdle() || internal->hubLost)) {
+    internal->wakeCallback(internal->wakeContext);
+  }
+}
+
 static BaseType_t mqttCallback(void *ctx,
                                const MQTTAgentCallbackParams *cparams) {
-  bool isDisconnect = cparams->xMQTTEvent == eMQTTAgentDisconnect;
-  const MQTTPublishData_t *pxCallbackParams = &(cparams->u.xPublishData);
-
-  if (pxCallbackParams->usTopicLength == 0) {
-    IOTC_LOG("ERROR: mqttCallback without a topic.");
+  IOTContextInternal *internal = (IOTContextInternal *)ctx;
+  if (cparams->xMQTTEvent == eMQTTAgentDisconnect) {
+    // the agent task can't tear its own connection down. iotc_do_work does
+    internal->hubLost = true;
+    connectionStatusCallback(IOTC_CONNECTION_DISCONNECTED, internal);
+    wakeWorker(internal);
     return 0;
   }
 
-  if (isDisconnect) {
-    connectionStatusCallback(IOTC_CONNECTION_DISCONNECTED,
-                             (IOTContextInternal *)ctx);
+  const MQTTPublishData_t *pxCallbackParams = &(cparams->u.xPublishData);
+  if (pxCallbackParams->usTopicLength == 0) {
+    IOTC_LOG("ERROR: mqttCallback without a topic.");
     return 0;
   }
 
@@ -177,6 +167,7 @@ static BaseType_t mqttCallback(void *ctx,
                      pxCallbackParams->usTopicLength);
   handlePayload((char *)pxCallbackParams->pvData,
                 pxCallbackParams->ulDataLength, *topic, topic.getLength());
+  wakeWorker(internal);
   return 0;
 }
 
@@ -191,6 +182,7 @@ MQTTBool_t mqttSubCallback(void *ctx,
                      pxPublishData->usTopicLength);
   handlePayload((char *)pxPublishData->pvData, pxPublishData->ulDataLength,
                 *topic, topic.getLength());
+  wakeWorker((IOTContextInternal *)ctx);
   return eMQTTFalse;
 }
 
@@ -217,7 +209,8 @@ int iotc_mqtt_subscribe(const char *topic) {
   return (xReturned == eMQTTAgentSuccess) ? 0 : 1;
 }
 
-int iotc_mqtt_connect(const char *hubEndpoint, char *username, char *password) {
+int iotc_mqtt_connect(const char *hubEndpoint, char *username, char *password,
+                      unsigned tries) {
   assert(getSingletonContext() != NULL);
   IOTContextInternal *internal = getSingletonContext();
 
@@ -238,33 +231,37 @@ int iotc_mqtt_connect(const char *hubEndpoint, char *username, char *password) {
       0,              /* Size of certificate used for secure connection. */
       username,
       password};
+  xConnectParameters.usClientIdLength = internal->deviceId.getLength();
+  xConnectParameters.ulCertificateSize = strlen(SSL_CA_PEM_DEF) + 1 /* \0 */;
+
+  // devices that lost the hub at once don't come back in lockstep
+  AzureIOT::ReconnectPolicy backoff = AzureIOT::ReconnectPolicy();
+  backoff.configure(RECONNECT_DEFAULT_BASE_MS, MQTT_CONNECT_CAP_MS, 0, 0);
+  backoff.seed((unsigned long)xTaskGetTickCount());
 
-  int retryCount = 0;
-retry_mqtt_connect:
-  assert(internal->mqttClient == NULL);
-  if (MQTT_AGENT_Create(&internal->mqttClient) == eMQTTAgentSuccess) {
-    xConnectParameters.usClientIdLength = internal->deviceId.getLength();
-    xConnectParameters.ulCertificateSize = strlen(SSL_CA_PEM_DEF) + 1 /* \0 */;
+  for (unsigned attempt = 1;; attempt++) {
+    assert(internal->mqttClient == NULL);
+    if (MQTT_AGENT_Create(&internal->mqttClient) != eMQTTAgentSuccess) {
+      internal->mqttClient = NULL;
+      return 1;
+    }
 
     IOTC_LOG("MQTT connecting to %s.", hubEndpoint);
     MQTTAgentReturnCode_t xReturned =
         MQTT_AGENT_Connect(internal->mqttClient, &xConnectParameters,
                            pdMS_TO_TICKS(IOTC_SERVER_RESPONSE_TIMEOUT * 1000));
-
-    if (xReturned != eMQTTAgentSuccess) {
-      MQTT_AGENT_Delete(internal->mqttClient);
-      internal->mqttClient = NULL;
-      IOTC_LOG("ERROR: MQTT connect has failed. ret code: %d", xReturned);
-      if (retryCount++ < 3) {
-        IOTC_LOG("Retrying MQTT connect..");
-        goto retry_mqtt_connect;
-      }
-      return 1;
-    } else {
+    if (xReturned == eMQTTAgentSuccess) {
       IOTC_LOG("MQTT Connected!");
+      return 0;
     }
-    return 0;
-  }
 
-  return 1;
+    MQTT_AGENT_Delete(internal->mqttClient);
+    internal->mqttClient = NULL;
+    IOTC_LOG("ERROR: MQTT connect has failed. ret code: %d", xReturned);
+    if (attempt >= tries) return 1;
+
+    unsigned long tickMs = xTaskGetTickCount() * portTICK_PERIOD_MS;
+    IOTC_LOG("Retrying MQTT connect..");
+    WAITMS(backoff.schedule(tickMs, IOTC_CONNECTION_COMMUNICATION_ERROR));
+  }
 }
@@ -16,148 +16,40 @@ unsigned long getNow() {
   return (unsigned long)2200000;  // use ntp utc time to enable this
 }
 
-int _getOperationId(IOTContextInternal* internal, const char* dpsEndpoint,
-                    const char* scopeId, const char* deviceId,
-                    const char* authHeader, char* operationId, char* hostName) {
-  int exitCode = 0;
-  int tryCount = 0;
-
-  while ((exitCode = iotc_socket_open()) != 0) {
-    WAITMS(2000 * (tryCount + 1));
-
-    if (tryCount++ > 5) {
-      IOTC_LOG(F("ERROR: %s endpoint %s call has failed."), dpsEndpoint,
-               hostName == NULL ? "PUT" : "GET");
-      return 1;
-    } else {
-      iotc_socket_close();
-    }
-  }
-
-  StringBuffer tmpBuffer(STRING_BUFFER_1024);
-  StringBuffer deviceIdEncoded(deviceId, strlen(deviceId));
-  deviceIdEncoded.urlEncode();
-
-  size_t size = 0;
-  if (hostName == NULL) {
-    size = strlen("{\"registrationId\":\"%s\"}") + strlen(deviceId) - 2;
-    size += internal->modelData == NULL
-                ? 0
-                : strlen(internal->modelData) + 8;  // ,\"data\":
-    const char* preModalData = internal->modelData == NULL ? "" : ",\"data\":";
-    const char* apiDate =
-        internal->modelData == NULL ? "2018-11-01" : "2019-01-15";
-    size = snprintf(*tmpBuffer, STRING_BUFFER_1024,
-                    "\
-PUT /%s/registrations/%s/register?api-version=%s HTTP/1.1\r\n\
-Host: %s\r\n\
-content-type: application/json; charset=utf-8\r\n\
-%s\r\n\
-accept: */*\r\n\
-content-length: %d\r\n\
-%s\r\n\
-connection: close\r\n\
-\r\n\
-{\"registrationId\":\"%s\"%s%s}\r\n\
-    ",
-                    scopeId, *deviceIdEncoded, apiDate, dpsEndpoint,
-                    AZURE_IOT_CENTRAL_CLIENT_SIGNATURE, size, authHeader,
-                    deviceId, preModalData,
-                    internal->modelData == NULL ? "" : internal->modelData);
-  } else {
-    size = snprintf(
-        *tmpBuffer, STRING_BUFFER_1024,
-        F("GET /%s/registrations/%s/operations/%s?api-version=2018-11-01 HTTP/1.1\r\n\
-Host: %s\r\n\
-content-type: application/json; charset=utf-8\r\n\
-%s\r\n\
-accept: */*\r\n\
-%s\r\n\
-connection: close\r\n\
-\r\n"),
-        scopeId, *deviceIdEncoded, operationId, dpsEndpoint,
-        AZURE_IOT_CENTRAL_CLIENT_SIGNATURE, authHeader);
-  }
-  assert(size != 0 && size < STRING_BUFFER_1024);
-  tmpBuffer.setLength(size);
-
-  const char* lookFor =
-      hostName == NULL ? "{\"operationId\":\"" : "\"assignedHub\":\"";
-  int index = 0;
-  uint32_t rec_size = 0;
-
-  if (iotc_socket_send(*tmpBuffer, tmpBuffer.getLength()) != pdPASS) {
-    IOTC_LOG("ERROR: iotc_socket_send has failed during %s call.",
-             hostName == NULL ? "PUT" : "GET");
-    exitCode = 1;
-    goto exit_operationId;
-  }
-
-  WAITMS(1500);
-  memset(*tmpBuffer, 0, STRING_BUFFER_1024);
-  if (iotc_socket_read(*tmpBuffer, STRING_BUFFER_1024, &rec_size) != pdPASS) {
-    IOTC_LOG("ERROR: iotc_socket_read has failed during %s call.",
-             hostName == NULL ? "PUT" : "GET");
-    exitCode = 1;
-    goto exit_operationId;
-  }
-  assert(rec_size <= STRING_BUFFER_1024);
-  tmpBuffer.setLength(rec_size);
-
-  index = tmpBuffer.indexOf(lookFor, strlen(lookFor), 0);
-  if (index == -1) {
-  error_exit:
-    IOTC_LOG(F("ERROR: DPS (%s) request has failed.\r\n%s"),
-             hostName == NULL ? "PUT" : "GET", *tmpBuffer);
-    exitCode = 1;
-    goto exit_operationId;
-  } else {
-    index += strlen(lookFor);
-    int index2 = tmpBuffer.indexOf("\"", 1, index + 1);
-    if (index2 == -1) goto error_exit;
-    tmpBuffer.setLength(index2);
-    strcpy(hostName == NULL ? operationId : hostName, (*tmpBuffer) + index);
-  }
-
-exit_operationId:
-  iotc_socket_close();
-  return exitCode;
+static unsigned long tickMs() {
+  return (unsigned long)(xTaskGetTickCount() * portTICK_PERIOD_MS);
 }
 
+// how long each read waits for the response
+#define DPS_READ_TIMEOUT_MS 100
+
 int getHubHostName(IOTContextInternal* internal, const char* dpsEndpoint,
                    const char* scopeId, const char* deviceId, const char* key,
                    char* hostName) {
-  int tryCount = 0;
-  int retval = 0;
-try_getHubHostName : {
-  StringBuffer authHeader(STRING_BUFFER_256);
-  size_t size = 0;
-
-  IOTC_LOG(F("- iotc.dps : getting auth..."));
-  if (getDPSAuthString(scopeId, deviceId, key, *authHeader, STRING_BUFFER_256,
-                       size)) {
-    IOTC_LOG(F("ERROR: getDPSAuthString has failed"));
+  DPSClient& dps = internal->dps;
+  if (dps.begin(dpsEndpoint, scopeId, deviceId, key, internal->modelData) !=
+      0) {
     return 1;
   }
 
-  IOTC_LOG(F("- iotc.dps : getting operation id..."));
-  StringBuffer operationId(STRING_BUFFER_64);
-
-  if ((retval = _getOperationId(internal, dpsEndpoint, scopeId, deviceId,
-                                *authHeader, *operationId, NULL)) == 0) {
-    WAITMS(5000);
-    IOTC_LOG(F("- iotc.dps : getting host name..."));
-    for (int i = 0; i < 5; i++) {
-      retval = _getOperationId(internal, dpsEndpoint, scopeId, deviceId,
-                               *authHeader, *operationId, hostName);
-      if (retval == 0) break;
-      WAITMS(4000);
-    }
-  } else {
-    if (tryCount++ < 5) goto try_getHubHostName;
+  DPSState state = DPS_IDLE;
+  while ((state = dps.step(tickMs(), DPS_READ_TIMEOUT_MS)) != DPS_DONE &&
+         state != DPS_FAILED) {
+    unsigned long waitMs = dps.getWaitMs(tickMs());
+    if (waitMs > 0) WAITMS(waitMs);
   }
-}  // try_getHubHostName
 
+  int retval = 1;
+  StringBuffer& assignedHub = dps.getHostName();
+  if (state == DPS_DONE) {
+    if (assignedHub.getLength() <= STRING_BUFFER_128) {
+      memcpy(hostName, *assignedHub, assignedHub.getLength() + 1);
+      retval = 0;
+    } else {
+      IOTC_LOG(F("ERROR: hub name %s is too long."), *assignedHub);
+    }
+  }
+  dps.clear();
   return retval;
 }
 
@@ -178,6 +70,12 @@ int iotc_free_context(IOTContext ctx) {
   if (internal->mqttClient != NULL) {
     iotc_disconnect(ctx);
   }
+  internal->store.close();
+  internal->dps.clear();
+  internal->connectionString.clear();
+  clearTopics(internal);
+  jstoken_pool_free(&internal->twinTokens);
+  jstoken_pool_free(&internal->echoTokens);
 
   IOTC_FREE(internal);
 
@@ -190,58 +88,44 @@ extern "C" void CRYPTO_ConfigureHeap(void);
 
 static char* hostNameCache = NULL;
 
-int iotc_connect(IOTContext ctx, const char* scope, const char* keyORcert,
-                 const char* deviceId, IOTConnectType type) {
-  CHECK_NOT_NULL(ctx)
-  GET_LENGTH_NOT_NULL(keyORcert, 512);
+// tries of a blocking connect
+#define HUB_CONNECT_TRIES 4
 
-  CRYPTO_ConfigureHeap();
+static void closeHubConnection(IOTContextInternal* internal) {
+  internal->hubLost = false;
+  if (internal->mqttClient) {
+    MQTT_AGENT_Disconnect(internal->mqttClient,
+                          IOTC_SERVER_RESPONSE_TIMEOUT * 1000);
+    MQTT_AGENT_Delete(internal->mqttClient);
+    internal->mqttClient = NULL;
+  }
+}
 
+// connects to the hub in internal->connectionString with a fresh SAS token
+// and subscribes. The MQTT connect is tried up to `tries` times
+// returns 0 if there is no error. Otherwise, the IOTConnectionState that tells
+// why
+static int openHubConnection(IOTContextInternal* internal, unsigned tries) {
   StringBuffer hostName;
   StringBuffer username;
   StringBuffer password;
-  IOTContextInternal* internal = (IOTContextInternal*)ctx;
-
-  if (type == IOTC_CONNECT_CONNECTION_STRING) {
-    getUsernameAndPasswordFromConnectionString(keyORcert, strlen(keyORcert),
-                                               hostName, internal->deviceId,
-                                               username, password);
-  } else if (type == IOTC_CONNECT_SYMM_KEY) {
-    assert(scope != NULL && deviceId != NULL);
-    if (hostNameCache == NULL) {
-      hostNameCache = (char*) IOTC_MALLOC(STRING_BUFFER_128 + 1);
-      if (getHubHostName(
-              internal,
-              internal->endpoint == NULL ? DEFAULT_ENDPOINT : internal->endpoint,
-              scope, deviceId, keyORcert, hostNameCache)) {
-        return 1;
-      }
-    }
-
-    StringBuffer cstr(STRING_BUFFER_256);
-    int rc = snprintf(*cstr, STRING_BUFFER_256,
-                      F("HostName=%s;DeviceId=%s;SharedAccessKey=%s"),
-                      hostNameCache, deviceId, keyORcert);
-    assert(rc > 0 && rc < STRING_BUFFER_256);
-    cstr.setLength(rc);
+  internal->deviceId.clear();
+  if (getUsernameAndPasswordFromConnectionString(
+          *internal->connectionString, internal->connectionString.getLength(),
+          hostName, internal->deviceId, username, password) != 0) {
+    return IOTC_CONNECTION_BAD_CREDENTIAL;
+  }
 
-    // TODO: move into iotc_dps and do not re-parse from connection string
-    getUsernameAndPasswordFromConnectionString(
-        *cstr, rc, hostName, internal->deviceId, username, password);
-  } else if (type == IOTC_CONNECT_X509_CERT) {
-    IOTC_LOG(F("ERROR: IOTC_CONNECT_X509_CERT NOT IMPLEMENTED"));
-    connectionStatusCallback(IOTC_CONNECTION_DEVICE_DISABLED,
-                             (IOTContextInternal*)ctx);
-    return 1;
+  if (cacheTopics(internal) != 0) {
+    return IOTC_CONNECTION_COMMUNICATION_ERROR;
   }
 
-  if (iotc_mqtt_connect(*hostName, *username, *password) != 0) {
+  // the agent reports a refused CONNECT and a lost socket alike
+  if (iotc_mqtt_connect(*hostName, *username, *password, tries) != 0) {
     IOTC_LOG(
         F("ERROR: MQTT client connect attempt failed. Check host, deviceId, "
           "username and password."));
-    connectionStatusCallback(IOTC_CONNECTION_BAD_CREDENTIAL,
-                             (IOTContextInternal*)ctx);
-    return 1;
+    return IOTC_CONNECTION_COMMUNICATION_ERROR;
   }
 
   StringBuffer buffer(STRING_BUFFER_64);
@@ -269,8 +153,96 @@ int iotc_connect(IOTContext ctx, const char* scope, const char* keyORcert,
                "error code sum => %d"),
              errorCode);
   }
+  return 0;
+}
+
+// the hub connection is open: lets the reconnect policy know and fires
+// ConnectionStatus (IOTC_CONNECTION_OK)
+static void hubConnected(IOTContextInternal* internal) {
+  AzureIOT::ReconnectPolicy& policy = internal->reconnect;
+  if (policy.isEnabled()) {
+    // devices that boot together still draw different delays
+    unsigned long hash = 2166136261UL;  // FNV-1a
+    for (unsigned i = 0; i < internal->deviceId.getLength(); i++) {
+      hash = ((hash ^ (unsigned char)(*internal->deviceId)[i]) * 16777619UL) &
+             0xFFFFFFFFUL;
+    }
+    policy.seed(hash ^ (unsigned long)xTaskGetTickCount());
+    policy.onConnected(tickMs());
+  }
+  connectionStatusCallback(IOTC_CONNECTION_OK, internal);
+}
+
+// The hub connection was lost, or a try to open it again has failed, for
+// `reason`. Schedules the next try and fires ConnectionStatus with
+// IOTC_CONNECTION_RETRY_EXPIRED when the policy gives up.
+// returns 0 if a try is scheduled
+static int scheduleReconnect(IOTContextInternal* internal,
+                             IOTConnectionState reason) {
+  AzureIOT::ReconnectPolicy& policy = internal->reconnect;
+  if (!policy.isEnabled()) return 1;
+
+  long waitMs = policy.schedule(tickMs(), reason);
+  if (waitMs < 0) {
+    IOTC_LOG(F("ERROR: giving up on the hub connection (%d)"), reason);
+    connectionStatusCallback(IOTC_CONNECTION_RETRY_EXPIRED, internal);
+    return 1;
+  }
+
+  IOTC_LOG(F("- iotc : reconnecting in %ld ms (try %d)"), waitMs,
+           policy.getAttempts());
+  return 0;
+}
+
+int iotc_connect(IOTContext ctx, const char* scope, const char* keyORcert,
+                 const char* deviceId, IOTConnectType type) {
+  CHECK_NOT_NULL(ctx)
+  GET_LENGTH_NOT_NULL(keyORcert, 512);
+
+  CRYPTO_ConfigureHeap();
+
+  IOTContextInternal* internal = (IOTContextInternal*)ctx;
+  internal->reconnect.cancel();
+  internal->connectionString.clear();
+
+  if (type == IOTC_CONNECT_CONNECTION_STRING) {
+    internal->connectionString.initialize(keyORcert, keyORcert_len);
+  } else if (type == IOTC_CONNECT_SYMM_KEY) {
+    assert(scope != NULL && deviceId != NULL);
+    if (hostNameCache == NULL) {
+      hostNameCache = (char*) IOTC_MALLOC(STRING_BUFFER_128 + 1);
+      if (getHubHostName(
+              internal,
+              internal->endpoint == NULL ? DEFAULT_ENDPOINT : internal->endpoint,
+              scope, deviceId, keyORcert, hostNameCache)) {
+        IOTC_FREE(hostNameCache);  // register again on the next connect
+        hostNameCache = NULL;
+        return 1;
+      }
+    }
+
+    StringBuffer cstr(STRING_BUFFER_256);
+    int rc = snprintf(*cstr, STRING_BUFFER_256,
+                      F("HostName=%s;DeviceId=%s;SharedAccessKey=%s"),
+                      hostNameCache, deviceId, keyORcert);
+    assert(rc > 0 && rc < STRING_BUFFER_256);
+
+    // TODO: move into iotc_dps and do not re-parse from connection string
+    internal->connectionString.initialize(*cstr, rc);
+  } else if (type == IOTC_CONNECT_X509_CERT) {
+    IOTC_LOG(F("ERROR: IOTC_CONNECT_X509_CERT NOT IMPLEMENTED"));
+    connectionStatusCallback(IOTC_CONNECTION_DEVICE_DISABLED,
+                             (IOTContextInternal*)ctx);
+    return 1;
+  }
 
-  connectionStatusCallback(IOTC_CONNECTION_OK, (IOTContextInternal*)ctx);
+  int reason = openHubConnection(internal, HUB_CONNECT_TRIES);
+  if (reason != 0) {
+    connectionStatusCallback((IOTConnectionState)reason, internal);
+    return 1;
+  }
+
+  hubConnected(internal);
   return 0;
 }
 
@@ -279,14 +251,14 @@ int iotc_disconnect(IOTContext ctx) {
   CHECK_NOT_NULL(ctx)
 
   IOTContextInternal* internal = (IOTContextInternal*)ctx;
+  if (internal->mqttClient == NULL && internal->reconnect.isPending()) {
+    internal->reconnect.cancel();  // DISCONNECTED was reported already
+    return 0;
+  }
+  internal->reconnect.cancel();
   MUST_CALL_AFTER_CONNECT(internal);
 
-  if (internal->mqttClient) {
-    MQTT_AGENT_Disconnect(internal->mqttClient,
-                          IOTC_SERVER_RESPONSE_TIMEOUT * 1000);
-    MQTT_AGENT_Delete(internal->mqttClient);
-    internal->mqttClient = NULL;
-  }
+  closeHubConnection(internal);
 
   connectionStatusCallback(IOTC_CONNECTION_DISCONNECTED,
                            (IOTContextInternal*)ctx);
@@ -297,11 +269,55 @@ int iotc_disconnect(IOTContext ctx) {
 int iotc_do_work(IOTContext ctx) {
   CHECK_NOT_NULL(ctx)
 
-  // IOTContextInternal *internal = (IOTContextInternal*)ctx;
-  // MUST_CALL_AFTER_CONNECT(internal);
-  sendDoNodes();
+  IOTContextInternal* internal = (IOTContextInternal*)ctx;
+  if (internal->hubLost && internal->reconnect.isEnabled()) {
+    // the agent task reported DISCONNECTED already
+    closeHubConnection(internal);
+    scheduleReconnect(internal, IOTC_CONNECTION_DISCONNECTED);
+    return 1;
+  }
+
+  if (internal->mqttClient == NULL && internal->reconnect.isPending()) {
+    if (!internal->reconnect.isDue(tickMs())) return 0;
 
-  // NO OP
+    int reason = openHubConnection(internal, 1);
+    if (reason != 0) {
+      scheduleReconnect(internal, (IOTConnectionState)reason);
+      return 1;
+    }
+    hubConnected(internal);
+  }
+
+  sendResponses();
+  drainStore(internal, tickMs());
+  return 0;
+}
+
+/* extern */
+int iotc_get_wait_ms(IOTContext ctx, unsigned long* waitMs) {
+  CHECK_NOT_NULL(ctx)
+  CHECK_NOT_NULL(waitMs)
+
+  IOTContextInternal* internal = (IOTContextInternal*)ctx;
+  if (internal->hubLost || !internal->responses.isIdle()) {
+    *waitMs = 0;
+  } else if (internal->mqttClient == NULL && internal->reconnect.isPending()) {
+    *waitMs = iotc_min(internal->reconnect.getWaitMs(tickMs()),
+                       (unsigned long)IOTC_MAX_WAIT_MS);
+  } else {
+    *waitMs = getStoreWaitMs(internal, tickMs());
+  }
+  return 0;
+}
+
+/* extern */
+int iotc_set_wake_callback(IOTContext ctx, IOTWakeCallback wake,
+                           void* appContext) {
+  CHECK_NOT_NULL(ctx)
+
+  IOTContextInternal* internal = (IOTContextInternal*)ctx;
+  internal->wakeContext = appContext;
+  internal->wakeCallback = wake;
   return 0;
 }
 
@@ -311,4 +327,46 @@ int iotc_set_network_interface(void* networkInterface) {
   return 0;
 }
 
+// The offline store lives in the second flash bank by default. The firmware
+// only uses the first one (see the linker script) and the BG96 settings sit
+// in the last pages, so the code keeps running while a page is written.
+#ifndef IOTC_STORE_FLASH_ADDRESS
+#define IOTC_STORE_FLASH_ADDRESS 0x08080000UL
+#endif
+#ifndef IOTC_STORE_FLASH_SIZE
+#define IOTC_STORE_FLASH_SIZE (64 * 1024UL)
+#endif
+
+extern "C" int FLASH_update(uint32_t dst_addr, const void* data,
+                            uint32_t size);
+
+// the region is memory mapped; the medium is its address. path isn't used,
+// there is a single store
+void* iotc_store_open(const char* path, unsigned long size) {
+  if (size > IOTC_STORE_FLASH_SIZE) {
+    IOTC_LOG(F("ERROR: (iotc_store_open) %lu bytes don't fit the %lu byte "
+               "flash region."),
+             size, (unsigned long)IOTC_STORE_FLASH_SIZE);
+    return NULL;
+  }
+  return (void*)IOTC_STORE_FLASH_ADDRESS;
+}
+
+void iotc_store_close(void* medium) {}
+
+int iotc_store_read(void* medium, unsigned long offset, void* data,
+                    unsigned length) {
+  memcpy(data, (const char*)medium + offset, length);
+  return 0;
+}
+
+// FLASH_update erases and writes the pages the bytes are on: every stored
+// and every sent message costs a page erase. A write cut short loses the
+// other slots on that page too; they fail their checksums and are skipped
+int iotc_store_write(void* medium, unsigned long offset, const void* data,
+                     unsigned length) {
+  uint32_t address = (uint32_t)((uintptr_t)medium + offset);
+  return FLASH_update(address, data, length) < 0 ? 1 : 0;
+}
+
 #endif  // defined(PLATFORM_FREERTOS)
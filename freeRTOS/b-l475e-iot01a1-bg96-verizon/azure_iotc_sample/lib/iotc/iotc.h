@@ -62,6 +62,11 @@ typedef short IOTConnectType;
 #define IOTC_CONNECTION_DISCONNECTED 0x80
 typedef short IOTConnectionState;
 
+// the longest wait iotc_get_wait_ms reports (ms)
+#define IOTC_MAX_WAIT_MS 60000
+
+typedef void (*IOTWakeCallback)(void* appContext);
+
 #define IOTC_MESSAGE_ACCEPTED 0x01
 #define IOTC_MESSAGE_REJECTED 0x02
 #define IOTC_MESSAGE_ABANDONED 0x04
@@ -149,11 +154,45 @@ int iotc_send_property(IOTContext ctx, const char* payload, unsigned length);
 // returns 0 if there is no error. Otherwise, error code will be returned.
 int iotc_set_model_data(IOTContext ctx, const char* modelData);
 
+// Keeps up to `window` QoS1 publishes waiting for their acknowledgement on the
+// platforms that support it (ESP8266). Here every publish waits for its
+// acknowledgement before the send returns; only window == 0 is taken.
+// Call this after `init_context`
+// returns 0 if there is no error. Otherwise, error code will be returned.
+int iotc_set_inflight_window(IOTContext ctx, unsigned window);
+
 // Sets the auth token expiration globally
 // Call this before `connect` to take effect
 // returns 0 if there is no error. Otherwise, error code will be returned.
 int iotc_set_token_expiration(IOTContext ctx, unsigned timeout);
 
+// Opens the hub connection again from `do_work` once it was lost. Tries are
+// spread with jittered exponential backoff: every delay is picked at random
+// between baseMs and three times the previous one, up to capMs. The backoff
+// starts over once a connection stayed up for stableMs. After maxAttempts
+// (0: no limit) tries without a stable connection `ConnectionStatus` reports
+// IOTC_CONNECTION_RETRY_EXPIRED and the SDK stops trying.
+// `connect` spreads its own tries the same way.
+// baseMs == 0 (default) turns it off; reconnecting is up to the application.
+// Call this after `init_context`
+// returns 0 if there is no error. Otherwise, error code will be returned.
+int iotc_set_reconnect(IOTContext ctx, unsigned baseMs, unsigned capMs,
+                       unsigned stableMs, unsigned maxAttempts);
+
+// Keeps telemetry that can't be sent (i.e. while the connection is down) in
+// the internal flash and sends it once the connection is back: one message
+// every drainIntervalMs. The store holds slotCount messages of up to
+// slotSize - 12 bytes each, in a region of IOTC_STORE_FLASH_SIZE bytes at
+// IOTC_STORE_FLASH_ADDRESS (second flash bank by default); once it is full
+// the oldest message is dropped. Messages left over from an earlier run are
+// sent too. `MessageSent` fires when a stored message is sent.
+// Telemetry with system properties isn't stored.
+// path names the store; path == NULL closes it.
+// Call this after `init_context`
+// returns 0 if there is no error. Otherwise, error code will be returned.
+int iotc_set_offline_store(IOTContext ctx, const char* path, unsigned slotCount,
+                           unsigned slotSize, unsigned drainIntervalMs);
+
 /*
 eventName:
   ConnectionStatus
@@ -175,6 +214,25 @@ int iotc_on(IOTContext ctx, const char* eventName, IOTCallback callback,
 // returns 0 if there is no error. Otherwise, error code will be returned.
 int iotc_do_work(IOTContext ctx);
 
+// How long (ms) `do_work` has nothing to do: 0 while method responses or
+// desired property echoes wait to be sent, the time until the next reconnect
+// try while the connection is down, the time until the next stored message
+// is sent (see iotc_set_offline_store), IOTC_MAX_WAIT_MS otherwise. The
+// MQTT agent task keeps the connection alive on its own. Instead of calling
+// `do_work` in a loop, block until waitMs passed or the wake callback fired.
+// Ask again after every `do_work`.
+// Call this after `init_context`
+// returns 0 if there is no error. Otherwise, error code will be returned.
+int iotc_get_wait_ms(IOTContext ctx, unsigned long* waitMs);
+
+// wake(appContext) is called when `do_work` has responses to send. It runs in
+// the MQTT agent task: only signal the task that runs `do_work` from it, i.e.
+// with xTaskNotifyGive. Pass NULL to turn it off.
+// Call this after `init_context`
+// returns 0 if there is no error. Otherwise, error code will be returned.
+int iotc_set_wake_callback(IOTContext ctx, IOTWakeCallback wake,
+                           void* appContext);
+
 // Provide platform dependent NetworkInterface
 int iotc_set_network_interface(void* networkInterface);
 
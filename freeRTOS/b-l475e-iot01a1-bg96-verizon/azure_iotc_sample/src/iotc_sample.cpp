@@ -18,6 +18,7 @@
 
 #define STRING_BUFFER_256 256
 static int isConnected = 0;
+static int gaveUp = 0;
 static int triggerCountdown = -1;
 
 // iotc mqtt client connect status updates
@@ -26,6 +27,8 @@ void onConnectionStatus(IOTContext ctx, IOTCallbackInfo* callbackInfo) {
               callbackInfo->statusCode == IOTC_CONNECTION_OK ? "YES" : "NO",
               callbackInfo->statusCode);
   isConnected = callbackInfo->statusCode == IOTC_CONNECTION_OK ? 1 : 0;
+  // the SDK stopped reconnecting (see iotc_set_reconnect)
+  if (callbackInfo->statusCode == IOTC_CONNECTION_RETRY_EXPIRED) gaveUp = 1;
 }
 
 // updates to device settings (desired properties)
@@ -136,6 +139,14 @@ static void iotc_main(void* pvParameters) {
   iotc_on(context, "SettingsUpdated", onSettingsUpdated, NULL);
   iotc_on(context, "Error", onEvent, NULL);
 
+  // once the connection drops, iotc_do_work opens it again: the first try
+  // after 1 to 3 secs, backing off up to 5 mins, for as long as it takes
+  iotc_set_reconnect(context, 1000, 300000, 60000, 0);
+  // telemetry sent while the hub connection is down waits in the flash (64
+  // messages, the oldest is dropped) and goes out once a second when it's back
+  iotc_set_offline_store(context, "telemetry", 64, STRING_BUFFER_256 + 64,
+                         1000);
+
   LOG_VERBOSE("Connecting to Azure IoT");
   // connect to azure iot
   errorCode = iotc_connect(context, SCOPE_ID, DEVICE_KEY, DEVICE_ID,
@@ -148,19 +159,18 @@ static void iotc_main(void* pvParameters) {
   StringBuffer msg(STRING_BUFFER_256);
 
   int telemetryCounter = 2;
-  int reconnectCounter = 0;
   int messageCounter = 0;
 
   // application lifecycle loop
-  while (true) {
-    while (isBG96Online() != 1) {
+  while (!gaveUp) {
+    if (isBG96Online() != 1) {
+      // iotc_do_work reconnects to the hub once the modem is back
       logCellInfo("modem is reconnecting..", 0);
       vTaskDelay(5000);  // 5 secs
-      if (reconnectCounter++ > 12)
-        break;  // reset the thread if modem wasn't able to connect up to a
-                // minute
+      continue;
     }
 
+    // not connected: iotc_send_telemetry keeps it in the offline store
     if (telemetryCounter >= 2) {
       telemetryCounter = 0;
 
@@ -196,9 +206,9 @@ static void iotc_main(void* pvParameters) {
           0) {
         LOG_VERBOSE("Error @ iotc_send_telemetry (%s). Code %d", *msg,
                     errorCode);
-        break;
+      } else {
+        LOG_VERBOSE("Telemetry sent [%d]\r\n%s", messageCounter, *msg);
       }
-      LOG_VERBOSE("Telemetry sent [%d]\r\n%s", messageCounter, *msg);
     }
 
     iotc_do_work(context); // do background work
@@ -214,7 +224,6 @@ static void iotc_main(void* pvParameters) {
             0) {
           LOG_VERBOSE("Error @ iotc_send_property (%s). Code %d", *msg,
                       errorCode);
-          break;
         }
       }
       if (triggerCountdown > 0) BL_LED_Off(BL_LED_GREEN);
@@ -222,13 +231,13 @@ static void iotc_main(void* pvParameters) {
 
       telemetryCounter++;
     } else {
-      break;
+      vTaskDelay(1000);  // waiting for the next reconnect try
     }
   }
 
+  LOG_VERBOSE("Gave up on the hub connection");
   iotc_free_context(context);
   context = NULL;
-  iotc_create_task();
   vTaskDelete(NULL);
 }
 /*-----------------------------------------------------------*/